@@ -56,6 +56,8 @@ typedef struct
 	int current;		/* dbnextrow() reads this row */
 	int capacity;		/* how many elements the queue can hold  */
 	struct dblib_buffer_row *rows;		/* pointer to the row storage */
+	unsigned char *slab;	/* row data storage, one slot for each element */
+	size_t slot_size;	/* size of a slot in slab */
 } DBPROC_ROWBUF;
 
 typedef struct
@@ -217,6 +217,8 @@ struct _hdesc
 	SQLHANDLE parent;
 	struct _dheader header;
 	struct _drecord *records;
+	/** changed on every update of records or binding type, used to invalidate fetch plans */
+	unsigned int version;
 };
 
 typedef struct _hdesc TDS_DESC;
@@ -270,6 +272,10 @@ struct _hcattr
 	SQLUINTEGER mars_enabled;
 	SQLUINTEGER cursor_type;
 	SQLUINTEGER bulk_enabled;
+	SQLUINTEGER bulk_insert;
+	SQLUINTEGER prepare_cache_size;
+	SQLUINTEGER prepare_threshold;
+	SQLUINTEGER stream_lobs;
 #ifdef TDS_NO_DM
 	SQLUINTEGER trace;
 	DSTR tracefile;
@@ -279,6 +285,21 @@ struct _hcattr
 #define TDS_MAX_APP_DESC	100
 
 struct _hstmt;
+typedef struct odbc_prep_entry ODBC_PREP_ENTRY;
+
+/**
+ * Cache of statements prepared on a connection.
+ * Statements are indexed by query text, database and parameter types.
+ */
+typedef struct odbc_prep_cache
+{
+	TDS_HASH hash;
+	/** least recently used entries, first is the oldest */
+	ODBC_PREP_ENTRY *lru_first, *lru_last;
+	unsigned int num_entries;
+	TDS_UINT8 hits, misses, evictions;
+} ODBC_PREP_CACHE;
+
 struct _hdbc
 {
 	SQLSMALLINT htype;	/* do not reorder this field */
@@ -311,6 +332,8 @@ struct _hdbc
 	TDS_INT default_query_timeout;
 
 	TDSBCPINFO *bcpinfo;
+
+	ODBC_PREP_CACHE prep_cache;
 };
 
 struct _hsattr
@@ -366,6 +389,8 @@ struct _hsattr
 	DSTR qn_options;
 	SQLUINTEGER qn_timeout;
 	SQLUINTEGER param_focus;
+	/** file descriptor SQLGetData writes large columns to, -1 if not used */
+	SQLINTEGER getdata_fd;
 };
 
 typedef enum
@@ -386,6 +411,32 @@ typedef enum
 	ODBC_SPECIAL_SPECIALCOLUMNS = 4
 } TDS_ODBC_SPECIAL_ROWS;
 
+/** How to copy a column to the application buffer */
+struct _fetch_plan_col
+{
+	/** C type with SQL_C_DEFAULT resolved, 0 if not bound */
+	SQLSMALLINT c_type;
+	/** if not 0 column data can be copied as is using this size */
+	unsigned short copy_size;
+	/** distance between rows for column-wise binding */
+	SQLLEN stride;
+};
+
+/**
+ * Information to copy rows computed once for all fetches.
+ * Valid till ARD, IRD and current result does not change.
+ */
+struct _fetch_plan
+{
+	const TDS_DESC *ard;
+	unsigned int ard_version, ird_version;
+	const TDSRESULTINFO *resinfo;
+	int num_cols;
+	/** distance between indicators and lengths of rows for column-wise binding */
+	SQLLEN len_stride;
+	struct _fetch_plan_col cols[1];
+};
+
 struct _hstmt
 {
 	SQLSMALLINT htype;	/* do not reorder this field */
@@ -394,6 +445,9 @@ struct _hstmt
 	struct _hdbc *dbc;
 	/** query to execute */
 	DSTR query;
+	/** query as passed to wide functions, NULL if not available */
+	SQLWCHAR *query_wide;
+	size_t query_wide_len;
 	/** socket (only if active) */
 	TDSSOCKET *tds;
 
@@ -412,6 +466,8 @@ struct _hstmt
 	 */
 	unsigned need_reprepare:1;
 	unsigned param_data_called:1;
+	/** parameter waiting data is sent directly to the server by SQLPutData */
+	unsigned param_streamed:1;
 	unsigned params_queried:1;
 	unsigned params_set:1;
 	/* end prepared query stuff */
@@ -434,6 +490,8 @@ struct _hstmt
 	TDS_ODBC_ROW_STATUS row_status;
 	/* do NOT free dynamic, free from socket or attach to connection */
 	TDSDYNAMIC *dyn;
+	/** entry of connection cache used by dyn, NULL if not cached */
+	ODBC_PREP_ENTRY *prep_entry;
 	TDS_DESC *ard, *ird, *apd, *ipd;
 	TDS_DESC *orig_ard, *orig_apd;
 	SQLULEN sql_rowset_size;
@@ -442,6 +500,10 @@ struct _hstmt
 	TDS_ODBC_SPECIAL_ROWS special_row;
 	/* do NOT free cursor, free from socket or attach to connection */
 	TDSCURSOR *cursor;
+	/** cached plan to copy rows, see odbc_SQLFetch */
+	struct _fetch_plan *fetch_plan;
+	/** streamed column read by SQLGetData in current row, NULL if none */
+	TDSCOLUMN *stream_col;
 };
 
 typedef struct _henv TDS_ENV;
@@ -572,6 +634,7 @@ int odbc_build_connect_string(TDS_ERRS *errs, TDS_PARSED_PARAM *params, char **o
 SQLLEN odbc_tds2sql_col(TDS_STMT * stmt, TDSCOLUMN *curcol, int desttype,
 			TDS_CHAR * dest, SQLULEN destlen, const struct _drecord *drec_ixd);
 SQLLEN odbc_tds2sql_int4(TDS_STMT * stmt, TDS_INT *src, int desttype, TDS_CHAR * dest, SQLULEN destlen);
+TDSICONV *odbc_char_conv(TDS_STMT * stmt, TDSCOLUMN * curcol, int desttype);
 
 
 
@@ -643,6 +706,7 @@ typedef union {
 # define ODBC_CHAR SQLCHAR
 #endif
 SQLRETURN odbc_set_stmt_query(struct _hstmt *stmt, const ODBC_CHAR *sql, ptrdiff_t sql_len _WIDE);
+void odbc_use_wide_query(struct _hstmt *stmt);
 void odbc_set_return_status(struct _hstmt *stmt, unsigned int n_row);
 void odbc_set_return_params(struct _hstmt *stmt, unsigned int n_row);
 
@@ -703,6 +767,7 @@ SQLRETURN prepare_call(struct _hstmt *stmt);
 SQLRETURN native_sql(struct _hdbc *dbc, DSTR *s);
 int parse_prepared_query(struct _hstmt *stmt, bool compute_row);
 int start_parse_prepared_query(struct _hstmt *stmt, bool compute_row);
+int next_row_prepared_query(struct _hstmt *stmt);
 int continue_parse_prepared_query(struct _hstmt *stmt, SQLPOINTER DataPtr, SQLLEN StrLen_or_Ind);
 const char *parse_const_param(const char * s, TDS_SERVER_TYPE *type);
 const char *odbc_skip_rpc_name(const char *s);
@@ -732,6 +797,23 @@ int odbc_bcp_batch(TDS_DBC *dbc);
 int odbc_bcp_done(TDS_DBC *dbc);
 void odbc_bcp_bind(TDS_DBC *dbc, const void * varaddr, int prefixlen, int varlen, const void * terminator, int termlen,
 		   int vartype, int table_column);
+bool odbc_bulk_insert_params(TDS_STMT *stmt);
+
+/*
+ * prepare_cache.c
+ */
+typedef enum
+{
+	ODBC_PREP_MISS,		/**< statement must be prepared */
+	ODBC_PREP_HIT,		/**< prepared statement found, stmt->dyn is set */
+	ODBC_PREP_DIRECT,	/**< statement not executed enough times, execute it directly */
+} ODBC_PREP_RESULT;
+
+void odbc_prep_cache_init(ODBC_PREP_CACHE *cache);
+void odbc_prep_cache_clear(TDS_DBC *dbc);
+void odbc_prep_cache_trim(TDS_DBC *dbc);
+ODBC_PREP_RESULT odbc_prep_cache_get(TDS_STMT *stmt);
+bool odbc_prep_cache_put(TDS_STMT *stmt);
 
 /*
  * sqlwchar.c
@@ -133,6 +133,10 @@ typedef TDS_UINT8 TDS_BIGDATETIME;
 #define TDS_ENV_BEGINTRANS	8
 #define TDS_ENV_COMMITTRANS	9
 #define TDS_ENV_ROLLBACKTRANS	10
+#define TDS_ENV_ENLISTDTC	11
+#define TDS_ENV_DEFECTTRANS	12
+#define TDS_ENV_TRANSENDED	17
+#define TDS_ENV_RESETACK	18
 #define TDS_ENV_ROUTING 	20
 
 /* Microsoft internal stored procedure id's */
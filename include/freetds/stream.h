@@ -108,6 +108,19 @@ typedef struct tds_dynamic_stream {
 
 TDSRET tds_dynamic_stream_init(TDSDYNAMICSTREAM * stream, void **ptr, size_t allocated);
 
+typedef struct tds_fdout_stream {
+	TDSOUTSTREAM stream;
+	/** file descriptor to write to */
+	int fd;
+	/** bytes written to fd */
+	TDS_INT8 written;
+	char buf[8192];
+} TDSFDOUTSTREAM;
+
+void tds_fdout_stream_init(TDSFDOUTSTREAM * stream, int fd);
+
+TDSRET tds_stream_column_copy(TDSSOCKET * tds, TDSCOLUMN * col, TDSICONV * char_conv, TDSOUTSTREAM * ostream);
+
 #include <freetds/popvis.h>
 
 #endif
@@ -61,6 +61,7 @@ typedef struct tds_bcpinfo TDSBCPINFO;
 #include <freetds/bool.h>
 #include <freetds/macros.h>
 #include <freetds/utils/string.h>
+#include <freetds/utils/hash.h>
 #include <freetds/utils/path.h>
 #include <freetds/replacements.h>
 
@@ -422,6 +423,8 @@ is_tds_type_valid(int type)
 #define TDS_STR_CONNTIMEOUT "connect timeout"
 #define TDS_STR_HOSTNAME "hostname"
 #define TDS_STR_HOST     "host"
+/* host prefix to connect to a Unix domain socket, path follows */
+#define TDS_UNIX_HOST_PREFIX "unix:"
 #define TDS_STR_PORT     "port"
 #define TDS_STR_TEXTSZ   "text size"
 /* for big endian hosts, obsolete, ignored */
@@ -721,6 +724,14 @@ struct tds_column
 
 	unsigned char use_iconv_out:1;
 
+	/**
+	 * leave data on the wire when reading rows, see tds_stream_column_read;
+	 * for parameters data is sent by tds_stream_param_write
+	 */
+	unsigned char column_stream:1;
+	/** data of current row is still on the wire */
+	unsigned char column_stream_pending:1;
+
 	/* additional fields flags for compute results */
 	TDS_SMALLINT column_operand;
 	TDS_TINYINT column_operator;
@@ -776,6 +787,8 @@ typedef struct tds_result_info
 	bool rows_exist;
 	/* TODO remove ?? used only in dblib */
 	bool more_results;
+	/** index of columns by name, built by tds_find_column when needed */
+	struct tds_column_index *name_index;
 } TDSRESULTINFO;
 
 /** values for tds->state */
@@ -930,6 +943,7 @@ typedef enum tds_cursor_fetch
 typedef struct tds_cursor
 {
 	struct tds_cursor *next;	/**< next in linked list, keep first */
+	struct tds_cursor *prev;	/**< previous in linked list */
 	TDS_INT ref_count;		/**< reference counter so client can retain safely a pointer */
 	char *cursor_name;		/**< name of the cursor */
 	TDS_INT cursor_id;		/**< cursor id returned by the server after cursor declare */
@@ -971,6 +985,7 @@ typedef struct tds_env
 typedef struct tds_dynamic
 {
 	struct tds_dynamic *next;	/**< next in linked list, keep first */
+	struct tds_dynamic *prev;	/**< previous in linked list */
 	TDS_INT ref_count;		/**< reference counter so client can retain safely a pointer */
 	/** numeric id for mssql7+*/
 	TDS_INT num_id;
@@ -980,6 +995,7 @@ typedef struct tds_dynamic
 	 * is generated automatically by libTDS
 	 */
 	char id[30];
+	TDS_HASH_ENTRY id_entry;	/**< entry in connection index by id, linked while in connection list */
 	/**
 	 * this dynamic query cannot be prepared so libTDS have to construct a simple query.
 	 * This can happen for instance is tds protocol doesn't support dynamics or trying
@@ -1101,13 +1117,20 @@ struct tds_connection
 	 * linked list of cursors allocated for this connection
 	 * contains only cursors allocated on the server
 	 */
-	TDSCURSOR *cursors;
+	TDSCURSOR *cursors, *cursors_last;
 	/**
 	 * list of dynamic allocated for this connection
 	 * contains only dynamic allocated on the server
 	 */
 	TDSDYNAMIC *dyns;
 
+	/** index of dyns by id, use tds_lookup_dynamic to search */
+	TDS_HASH dyns_by_id;
+	/** queries the server refused to prepare, oldest first */
+	TDS_HASH emulated_queries;
+	struct tds_emulated_query *emulated_first, *emulated_last;
+	unsigned int num_emulated;
+
 	int char_conv_count;
 	TDSICONV **char_convs;
 
@@ -1254,6 +1277,23 @@ struct tds_socket
 	bool bulk_query;		/**< true is query sent was a bulk query so we need to switch state to QUERYING */
 	bool has_status; 		/**< true is ret_status is valid */
 	bool in_row;			/**< true if we are getting rows */
+	/**
+	 * Results whose current row has columns still on the wire, see
+	 * tds_stream_column_read. A reference is kept till the row is consumed.
+	 */
+	TDSRESULTINFO *stream_info;
+	TDSCOLUMN *stream_col;		/**< streamed column being read */
+	TDS_INT8 stream_size;		/**< length of stream_col, -1 if NULL, -2 if unknown */
+	TDS_INT8 stream_left;		/**< bytes left of stream_col (or of current chunk for PLP), -1 at end of PLP */
+	bool stream_plp;		/**< stream_col is sent in chunks */
+	/**
+	 * Parameters of the request being written while a parameter is
+	 * streamed, see tds_stream_param_write. A reference is kept till
+	 * the request is completed by tds_stream_param_end.
+	 */
+	TDSPARAMINFO *stream_params;
+	int stream_param_next;		/**< index of first parameter still to write */
+	int stream_param_flags;		/**< flags to write remaining parameters */
 	volatile 
 	unsigned char in_cancel; 	/**< indicate we are waiting a cancel reply; discard tokens till acknowledge; 
 	1 mean we have to send cancel packet, 2 already sent. */
@@ -1265,6 +1305,11 @@ struct tds_socket
 
 	TDSDYNAMIC *cur_dyn;		/**< dynamic structure in use */
 
+	/** queries already converted for RPC calls, first is the oldest */
+	TDS_HASH parsed_queries;
+	struct tds_parsed_query *parsed_first, *parsed_last;
+	unsigned int num_parsed;
+
 	TDSLOGIN *login;	/**< config for login stuff. After login this field is NULL */
 
 	void (*env_chg_func) (TDSSOCKET * tds, int type, char *oldval, char *newval);
@@ -1341,6 +1386,8 @@ void tds_free_all_results(TDSSOCKET * tds);
 void tds_free_results(TDSRESULTINFO * res_info);
 void tds_free_param_results(TDSPARAMINFO * param_info);
 void tds_free_param_result(TDSPARAMINFO * param_info);
+int tds_find_column(TDSRESULTINFO * res_info, const char *name, size_t len);
+void tds_reset_column_index(TDSRESULTINFO * res_info);
 void tds_free_msg(TDSMESSAGE * message);
 void tds_cursor_deallocated(TDSCONNECTION *conn, TDSCURSOR *cursor);
 void tds_release_cursor(TDSCURSOR **pcursor);
@@ -1358,6 +1405,8 @@ tds_release_cur_dyn(TDSSOCKET * tds)
 	tds_release_dynamic(&tds->cur_dyn);
 }
 void tds_dynamic_deallocated(TDSCONNECTION *conn, TDSDYNAMIC *dyn);
+void tds_dynamic_set_emulated(TDSCONNECTION *conn, TDSDYNAMIC *dyn);
+bool tds_dynamic_must_emulate(TDSCONNECTION *conn, const char *query);
 void tds_set_cur_dyn(TDSSOCKET *tds, TDSDYNAMIC *dyn);
 TDSSOCKET *tds_realloc_socket(TDSSOCKET * tds, unsigned int bufsize);
 char *tds_alloc_client_sqlstate(int msgno);
@@ -1426,6 +1475,12 @@ TDSRET tds_submit_begin_tran(TDSSOCKET *tds);
 TDSRET tds_submit_rollback(TDSSOCKET *tds, bool cont);
 TDSRET tds_submit_commit(TDSSOCKET *tds, bool cont);
 TDSRET tds_disconnect(TDSSOCKET * tds);
+void tds_free_parsed_queries(TDSSOCKET * tds);
+void tds_set_query_ucs2(TDSSOCKET *tds, const char *query, size_t query_len, const char *converted, size_t converted_len);
+bool tds_param_streamable(TDSSOCKET *tds, const TDSCOLUMN *col);
+TDSRET tds_stream_param_write(TDSSOCKET *tds, const void *data, size_t len);
+TDSRET tds_stream_param_end(TDSSOCKET *tds);
+TDSRET tds_stream_param_abort(TDSSOCKET *tds);
 size_t tds_quote_id(TDSSOCKET * tds, char *buffer, const char *id, ptrdiff_t idlen);
 size_t tds_quote_id_rpc(TDSSOCKET * tds, char *buffer, const char *id, ptrdiff_t idlen);
 size_t tds_quote_string(TDSSOCKET * tds, char *buffer, const char *str, ptrdiff_t len);
@@ -1469,6 +1524,11 @@ TDSRET tds_process_tokens(TDSSOCKET * tds, /*@out@*/ TDS_INT * result_type, /*@o
 /* data.c */
 void tds_set_param_type(TDSCONNECTION * conn, TDSCOLUMN * curcol, TDS_SERVER_TYPE type);
 void tds_set_column_type(TDSCONNECTION * conn, TDSCOLUMN * curcol, TDS_SERVER_TYPE type);
+bool tds_column_streamable(TDSSOCKET *tds, const TDSCOLUMN *col);
+TDSRET tds_stream_column_open(TDSSOCKET *tds, TDSCOLUMN *col, TDS_INT8 *size);
+int tds_stream_column_read(TDSSOCKET *tds, TDSCOLUMN *col, void *buf, size_t len);
+TDSRET tds_stream_skip_row(TDSSOCKET *tds);
+void tds_stream_reset(TDSSOCKET *tds);
 #ifdef WORDS_BIGENDIAN
 void tds_swap_datatype(int coltype, void *b);
 #endif
@@ -1560,6 +1620,8 @@ extern int tds_append_mode;
 
 /* net.c */
 TDSERRNO tds_open_socket(TDSSOCKET * tds, struct addrinfo *ipaddr, unsigned int port, int timeout, int *p_oserr);
+TDSERRNO tds_open_unix_socket(TDSSOCKET * tds, const char *path, int *p_oserr);
+const char *tds_unix_socket_path(const char *host);
 void tds_close_socket(TDSSOCKET * tds);
 int tds7_get_instance_ports(FILE *output, struct addrinfo *addr);
 int tds7_get_instance_port(struct addrinfo *addr, const char *instance);
@@ -0,0 +1,108 @@
+/* Hash - intrusive hash table
+ * Copyright (C) 2026 Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _tdsguard_4LeZPermn68RrJ7ktoGg5c_
+#define _tdsguard_4LeZPermn68RrJ7ktoGg5c_
+
+#include <tds_sysdep_public.h>
+#include <freetds/bool.h>
+#include <freetds/macros.h>
+
+#include <freetds/pushvis.h>
+
+/**
+ * Entry in a hash table, to be embedded in the indexed structure.
+ * The table does not own the items, the key is compared by the caller.
+ */
+typedef struct tds_hash_entry {
+	struct tds_hash_entry *next;
+	/** pointer to the pointer to this entry, NULL if not in a table */
+	struct tds_hash_entry **pprev;
+	uint32_t value;
+} TDS_HASH_ENTRY;
+
+#define TDS_HASH_SMALL_BUCKETS 8
+
+/**
+ * Hash table with chained entries, grows automatically.
+ * Inserting never fails, if the table cannot grow chains become longer.
+ * The structure must not be moved while it contains entries.
+ */
+typedef struct tds_hash {
+	/** allocated buckets, NULL to use small_buckets */
+	TDS_HASH_ENTRY **buckets;
+	uint32_t mask;
+	size_t count;
+	TDS_HASH_ENTRY *small_buckets[TDS_HASH_SMALL_BUCKETS];
+} TDS_HASH;
+
+/** Get the structure containing an entry */
+#define TDS_HASH_ITEM(entry, type, field) \
+	((type *) (((char *) (entry)) - TDS_OFFSET(type, field)))
+
+void tds_hash_init(TDS_HASH *hash);
+void tds_hash_free(TDS_HASH *hash);
+void tds_hash_insert(TDS_HASH *hash, TDS_HASH_ENTRY *entry, uint32_t value);
+void tds_hash_remove(TDS_HASH *hash, TDS_HASH_ENTRY *entry);
+
+uint32_t tds_hash_bytes(const void *data, size_t len);
+uint32_t tds_hash_bytes_ci(const void *data, size_t len);
+uint32_t tds_hash_uint(uint32_t n);
+
+/** test if entry is inserted in a table */
+static inline bool
+tds_hash_linked(const TDS_HASH_ENTRY *entry)
+{
+	return entry->pprev != NULL;
+}
+
+/** skip entries not having the specified hash value */
+static inline TDS_HASH_ENTRY *
+tds_hash_match(TDS_HASH_ENTRY *entry, uint32_t value)
+{
+	while (entry && entry->value != value)
+		entry = entry->next;
+	return entry;
+}
+
+/**
+ * Returns first entry with the specified hash value.
+ * Caller should compare keys and call tds_hash_next to get other candidates.
+ */
+static inline TDS_HASH_ENTRY *
+tds_hash_first(const TDS_HASH *hash, uint32_t value)
+{
+	TDS_HASH_ENTRY *const *buckets = hash->buckets ? hash->buckets : hash->small_buckets;
+
+	return tds_hash_match(buckets[value & hash->mask], value);
+}
+
+/** Returns next entry with the same hash value of the passed one */
+static inline TDS_HASH_ENTRY *
+tds_hash_next(const TDS_HASH_ENTRY *entry)
+{
+	return tds_hash_match(entry->next, entry->value);
+}
+
+#define TDS_HASH_FOREACH(hash, value, entry) \
+	for (entry = tds_hash_first(hash, value); entry != NULL; entry = tds_hash_next(entry))
+
+#include <freetds/popvis.h>
+
+#endif /* _tdsguard_4LeZPermn68RrJ7ktoGg5c_ */
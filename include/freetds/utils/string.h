@@ -29,38 +29,43 @@
  * @{ 
  */
 
+/** Size of the buffer embedded in a string, short strings are stored here without allocations */
+#define TDS_DSTR_INLINE_SIZE 32
+
 /**
  * Structure to hold a string.
  * Use tds_dstr_* functions/macros, do not access members directly.
  * There should be always a buffer.
+ * Strings shorter than TDS_DSTR_INLINE_SIZE are stored in dstr_inline,
+ * longer ones are allocated in dstr_heap.
  */
 typedef struct tds_dstr {
+	char *dstr_heap;	/**< allocated buffer, NULL if string is in dstr_inline */
 	size_t dstr_size;
-	char dstr_s[1];
-} *DSTR;
-
-/** Internal representation for an empty string */
-extern const struct tds_dstr tds_str_empty;
+	char dstr_inline[TDS_DSTR_INLINE_SIZE];
+} DSTR;
 
 /** Initializer, used to initialize string like in the following example
  * @code
  * DSTR s = DSTR_INITIALIZER;
  * @endcode
  */
-#define DSTR_INITIALIZER ((struct tds_dstr*) &tds_str_empty)
+#define DSTR_INITIALIZER { NULL, 0, "" }
 
 /** init a string with empty */
 static inline void
 tds_dstr_init(DSTR * s)
 {
-	*(s) = DSTR_INITIALIZER;
+	s->dstr_heap = NULL;
+	s->dstr_size = 0;
+	s->dstr_inline[0] = 0;
 }
 
 /** test if string is empty */
 static inline bool
 tds_dstr_isempty(const DSTR * s)
 {
-	return (*s)->dstr_size == 0;
+	return s->dstr_size == 0;
 }
 
 /**
@@ -71,21 +76,21 @@ tds_dstr_isempty(const DSTR * s)
 static inline char *
 tds_dstr_buf(DSTR * s)
 {
-	return (*s)->dstr_s;
+	return s->dstr_heap ? s->dstr_heap : s->dstr_inline;
 }
 
 /** Returns a C version (NUL terminated string) of dstr */
 static inline const char *
 tds_dstr_cstr(const DSTR * s)
 {
-	return (*s)->dstr_s;
+	return s->dstr_heap ? s->dstr_heap : s->dstr_inline;
 }
 
 /** Returns the length of the string in bytes */
 static inline size_t
 tds_dstr_len(const DSTR * s)
 {
-	return (*s)->dstr_size;
+	return s->dstr_size;
 }
 
 /** Make a string empty */
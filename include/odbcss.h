@@ -59,6 +59,40 @@ extern "C" {
 #define SQL_INFO_FREETDS_TDS_VERSION	1300
 #define SQL_INFO_FREETDS_SOCKET	1301
 
+/* send parameter arrays of simple INSERT statements using bulk copy */
+#define SQL_COPT_TDSODBC_BULK_INSERT	1509
+#define SQL_BULK_INSERT_OFF	0
+#define SQL_BULK_INSERT_ON	1
+
+/* maximum number of prepared statements kept by the connection, 0 to disable */
+#define SQL_COPT_TDSODBC_PREPARE_CACHE_SIZE	1510
+/* executions of the same query before it is prepared, needs the cache */
+#define SQL_COPT_TDSODBC_PREPARE_THRESHOLD	1511
+/* read only, fill a struct tdsodbc_prepare_cache_stats */
+#define SQL_COPT_TDSODBC_PREPARE_CACHE_STATS	1512
+
+struct tdsodbc_prepare_cache_stats
+{
+	SQLUBIGINT hits;
+	SQLUBIGINT misses;
+	SQLUBIGINT evictions;
+	SQLUINTEGER entries;
+};
+
+/*
+ * read large columns after last bound one directly from the wire in SQLGetData,
+ * send last data-at-execution parameter to the server in SQLPutData
+ */
+#define SQL_COPT_TDSODBC_STREAM_LOBS	1513
+#define SQL_STREAM_LOBS_OFF	0
+#define SQL_STREAM_LOBS_ON	1
+
+/*
+ * statement attribute, file descriptor SQLGetData writes columns read from
+ * the wire to, -1 (default) to disable. See SQL_COPT_TDSODBC_STREAM_LOBS
+ */
+#define SQL_SOPT_TDSODBC_GETDATA_FD	1514
+
 #ifndef SQL_MARS_ENABLED_NO
 #define SQL_MARS_ENABLED_NO	0
 #endif
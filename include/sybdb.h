@@ -864,6 +864,7 @@ RETCODE dbprrow(DBPROCESS * dbproc);
 const char *dbprtype(int token);
 DBBOOL DRBUF(DBPROCESS * dbprocess);
 STATUS dbreadtext(DBPROCESS * dbproc, void *buf, DBINT bufsize);
+DBBIGINT dbreadtextfd(DBPROCESS * dbproc, int fd);
 void dbrecftos(const char filename[]);
 RETCODE dbresults(DBPROCESS * dbproc);
 RETCODE dbresults_r(DBPROCESS * dbproc, int recursive);
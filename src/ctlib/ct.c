@@ -39,6 +39,8 @@
 #include <freetds/utils.h>
 #include <freetds/enum_cap.h>
 #include <freetds/data.h>
+#include <freetds/iconv.h>
+#include <freetds/stream.h>
 #include <freetds/replacements.h>
 
 
@@ -48,6 +50,7 @@ static const char * ct_describe_cmd_state(CS_INT state);
  * @return 0 on success
  */
 static int _ct_fetch_cursor(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * rows_read);
+static void _ct_set_stream_columns(CS_COMMAND * cmd, TDSRESULTINFO * resinfo);
 static int _ct_fetchable_results(CS_COMMAND * cmd);
 static TDSRET _ct_process_return_status(TDSSOCKET * tds);
 
@@ -1783,11 +1786,18 @@ ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * p
 		return CS_CMD_FAIL;
 
 
+	/* discard data left on the wire by previous row */
+	if (TDS_FAILED(tds_stream_skip_row(tds)))
+		return CS_FAIL;
+
 	marker = tds_peek(tds);
 	if ((cmd->curr_result_type == CS_ROW_RESULT    && marker != TDS_ROW_TOKEN && marker != TDS_NBC_ROW_TOKEN)
 	||  (cmd->curr_result_type == CS_STATUS_RESULT && marker != TDS_RETURNSTATUS_TOKEN) )
 		return CS_END_DATA;
 
+	if (tds->current_results)
+		_ct_set_stream_columns(cmd, tds->current_results);
+
 	/* Array Binding Code changes start here */
 
 	for (temp_count = 0; temp_count < cmd->bind_count; temp_count++) {
@@ -1821,6 +1831,9 @@ ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * p
 				break;
 		}
 
+		if (temp_count + 1 >= cmd->bind_count)
+			break;
+
 		/* have we reached the end of the rows ? */
 
 		marker = tds_peek(tds);
@@ -1835,6 +1848,25 @@ ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * p
 	return CS_SUCCEED;
 }
 
+/**
+ * Leave large columns after the last bound one on the wire,
+ * ct_get_data reads them directly into the client buffer.
+ */
+static void
+_ct_set_stream_columns(CS_COMMAND * cmd, TDSRESULTINFO * resinfo)
+{
+	bool enable = cmd->bind_count == 1 && cmd->curr_result_type == CS_ROW_RESULT;
+	int i;
+
+	for (i = resinfo->num_cols; --i >= 0; ) {
+		TDSCOLUMN *curcol = resinfo->columns[i];
+
+		if (curcol->column_varaddr || !tds_column_streamable(cmd->con->tds_socket, curcol))
+			enable = false;
+		curcol->column_stream = enable;
+	}
+}
+
 static CS_RETCODE
 _ct_fetch_cursor(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * rows_read)
 {
@@ -2988,6 +3020,82 @@ ct_compute_info(CS_COMMAND * cmd, CS_INT type, CS_INT colnum, CS_VOID * buffer,
 	return CS_SUCCEED;
 }
 
+/**
+ * Prepare the command to return a new column with ct_get_data() or ct_get_data_fd().
+ * Fills the I/O descriptor of the column.
+ */
+static CS_RETCODE
+_ct_get_data_start(CS_COMMAND * cmd, TDSCOLUMN * curcol, CS_INT item)
+{
+	TDSBLOB *blob = NULL;
+	size_t table_namelen, column_namelen, namelen;
+	TDS_INT8 size;
+
+	/* data left on the wire, read length */
+	if (curcol->column_stream_pending) {
+		if (TDS_FAILED(tds_stream_column_open(cmd->con->tds_socket, curcol, &size)))
+			return CS_FAIL;
+	} else if (curcol->column_stream && curcol->column_cur_size >= 0) {
+		/* data already discarded */
+		return CS_FAIL;
+	}
+
+	/* allocate needed descriptor if needed */
+	free(cmd->iodesc);
+	cmd->iodesc = tds_new0(CS_IODESC, 1);
+	if (!cmd->iodesc)
+		return CS_FAIL;
+
+	/* reset these values */
+	cmd->get_data_item = item;
+	cmd->get_data_bytes_returned = 0;
+
+	if (is_blob_col(curcol))
+		blob = (TDSBLOB *) curcol->column_data;
+
+	/* now populate the io_desc structure for this data item */
+
+	cmd->iodesc->iotype = CS_IODATA;
+	cmd->iodesc->datatype = _ct_get_client_type(curcol, true);
+	cmd->iodesc->locale = cmd->con->locale;
+	cmd->iodesc->usertype = curcol->column_usertype;
+	cmd->iodesc->total_txtlen = curcol->column_cur_size;
+	cmd->iodesc->offset = 0;
+	cmd->iodesc->log_on_update = CS_FALSE;
+
+	/* TODO quote needed ?? */
+	/* avoid possible buffer overflow */
+	table_namelen = tds_dstr_len(&curcol->table_name);
+	table_namelen = TDS_MIN(table_namelen, sizeof(cmd->iodesc->name) - 2);
+	column_namelen = tds_dstr_len(&curcol->column_name);
+	column_namelen = TDS_MIN(column_namelen, sizeof(cmd->iodesc->name) - 2 - table_namelen);
+
+	namelen = 0;
+	if (table_namelen) {
+		memcpy(cmd->iodesc->name, tds_dstr_cstr(&curcol->table_name), table_namelen);
+		namelen += table_namelen;
+	}
+
+	cmd->iodesc->name[namelen] = '.';
+	++namelen;
+
+	if (column_namelen) {
+		memcpy(cmd->iodesc->name + namelen, tds_dstr_cstr(&curcol->column_name), column_namelen);
+		namelen += column_namelen;
+	}
+
+	cmd->iodesc->name[namelen] = '\0';
+	cmd->iodesc->namelen = (CS_INT) namelen;
+
+	if (blob && blob->valid_ptr) {
+		memcpy(cmd->iodesc->timestamp, blob->timestamp, CS_TS_SIZE);
+		cmd->iodesc->timestamplen = CS_TS_SIZE;
+		memcpy(cmd->iodesc->textptr, blob->textptr, CS_TP_SIZE);
+		cmd->iodesc->textptrlen = CS_TP_SIZE;
+	}
+	return CS_SUCCEED;
+}
+
 CS_RETCODE
 ct_get_data(CS_COMMAND * cmd, CS_INT item, CS_VOID * buffer, CS_INT buflen, CS_INT * outlen)
 {
@@ -3015,79 +3123,16 @@ ct_get_data(CS_COMMAND * cmd, CS_INT item, CS_VOID * buffer, CS_INT buflen, CS_I
 		return CS_CANCELED;
 	}
 
-	/* This is a new column we are being asked to return */
-
-	if (item != cmd->get_data_item) {
-		TDSBLOB *blob = NULL;
-		size_t table_namelen, column_namelen, namelen;
-
-		/* allocate needed descriptor if needed */
-		free(cmd->iodesc);
-		cmd->iodesc = tds_new0(CS_IODESC, 1);
-		if (!cmd->iodesc)
-			return CS_FAIL;
-
-		/* reset these values */
-		cmd->get_data_item = item;
-		cmd->get_data_bytes_returned = 0;
-
-		/* get at the source data and length */
-		curcol = resinfo->columns[item - 1];
-
-		src = curcol->column_data;
-		if (is_blob_col(curcol)) {
-			blob = (TDSBLOB *) src;
-			src = (unsigned char *) blob->textvalue;
-		}
-
-		/* now populate the io_desc structure for this data item */
-
-		cmd->iodesc->iotype = CS_IODATA;
-		cmd->iodesc->datatype = _ct_get_client_type(curcol, true);
-		cmd->iodesc->locale = cmd->con->locale;
-		cmd->iodesc->usertype = curcol->column_usertype;
-		cmd->iodesc->total_txtlen = curcol->column_cur_size;
-		cmd->iodesc->offset = 0;
-		cmd->iodesc->log_on_update = CS_FALSE;
-
-		/* TODO quote needed ?? */
-		/* avoid possible buffer overflow */
-		table_namelen = tds_dstr_len(&curcol->table_name);
-		table_namelen = TDS_MIN(table_namelen, sizeof(cmd->iodesc->name) - 2);
-		column_namelen = tds_dstr_len(&curcol->column_name);
-		column_namelen = TDS_MIN(column_namelen, sizeof(cmd->iodesc->name) - 2 - table_namelen);
-
-		namelen = 0;
-		if (table_namelen) {
-			memcpy(cmd->iodesc->name, tds_dstr_cstr(&curcol->table_name), table_namelen);
-			namelen += table_namelen;
-		}
-
-		cmd->iodesc->name[namelen] = '.';
-		++namelen;
-
-		if (column_namelen) {
-			memcpy(cmd->iodesc->name + namelen, tds_dstr_cstr(&curcol->column_name), column_namelen);
-			namelen += column_namelen;
-		}
-
-		cmd->iodesc->name[namelen] = '\0';
-		cmd->iodesc->namelen = (CS_INT) namelen;
+	curcol = resinfo->columns[item - 1];
 
-		if (blob && blob->valid_ptr) {
-			memcpy(cmd->iodesc->timestamp, blob->timestamp, CS_TS_SIZE);
-			cmd->iodesc->timestamplen = CS_TS_SIZE;
-			memcpy(cmd->iodesc->textptr, blob->textptr, CS_TP_SIZE);
-			cmd->iodesc->textptrlen = CS_TP_SIZE;
-		}
-	} else {
-		/* get at the source data */
-		curcol = resinfo->columns[item - 1];
-		src = curcol->column_data;
-		if (is_blob_col(curcol))
-			src = (unsigned char *) ((TDSBLOB *) src)->textvalue;
+	/* This is a new column we are being asked to return */
+	if (item != cmd->get_data_item && _ct_get_data_start(cmd, curcol, item) != CS_SUCCEED)
+		return CS_FAIL;
 
-	}
+	/* get at the source data */
+	src = curcol->column_data;
+	if (is_blob_col(curcol))
+		src = (unsigned char *) ((TDSBLOB *) src)->textvalue;
 
 	/*
 	 * and adjust the data and length based on
@@ -3108,6 +3153,22 @@ ct_get_data(CS_COMMAND * cmd, CS_INT item, CS_VOID * buffer, CS_INT buflen, CS_I
 		}
 	}
 
+	/* read directly from the wire */
+	if (curcol->column_stream && curcol->column_cur_size >= 0) {
+		int len = tds_stream_column_read(cmd->con->tds_socket, curcol, buffer, buflen);
+
+		if (len < 0)
+			return CS_FAIL;
+		cmd->get_data_bytes_returned += len;
+		if (outlen)
+			*outlen = len;
+		if (curcol->column_stream_pending)
+			return CS_SUCCEED;
+		if (item < resinfo->num_cols)
+			return CS_END_ITEM;
+		return CS_END_DATA;
+	}
+
 	src += cmd->get_data_bytes_returned;
 	srclen -= cmd->get_data_bytes_returned;
 
@@ -3130,6 +3191,79 @@ ct_get_data(CS_COMMAND * cmd, CS_INT item, CS_VOID * buffer, CS_INT buflen, CS_I
 	return CS_SUCCEED;
 }
 
+/**
+ * Write the whole value of a column (or what is left of it after previous
+ * ct_get_data() calls) to a file descriptor.
+ * Data left on the wire are copied from network packets to the file
+ * descriptor without loading the value into memory.
+ * \param cmd   command
+ * \param item  column number, starting from 1
+ * \param fd    file descriptor to write to
+ * \param outlen returned bytes written, CS_NULLDATA for NULL values if
+ *               cs_note_empty_data is set
+ * \return CS_END_ITEM, CS_END_DATA, CS_CANCELED or CS_FAIL
+ */
+CS_RETCODE
+ct_get_data_fd(CS_COMMAND * cmd, CS_INT item, int fd, CS_BIGINT * outlen)
+{
+	TDSRESULTINFO *resinfo;
+	TDSCOLUMN *curcol;
+	TDSFDOUTSTREAM out;
+	TDSRET rc = TDS_SUCCESS;
+
+	tdsdump_log(TDS_DBG_FUNC, "ct_get_data_fd(%p, %d, %d, %p)\n", cmd, item, fd, outlen);
+
+	/* basic validations... */
+	if (!cmd || !cmd->con || !cmd->con->tds_socket || !(resinfo = cmd->con->tds_socket->current_results))
+		return CS_FAIL;
+	if (item < 1 || item > resinfo->num_cols)
+		return CS_FAIL;
+	if (fd < 0)
+		return CS_FAIL;
+
+	if (cmd->cancel_state == _CS_CANCEL_PENDING) {
+		_ct_cancel_cleanup(cmd);
+		return CS_CANCELED;
+	}
+
+	curcol = resinfo->columns[item - 1];
+	if (item != cmd->get_data_item && _ct_get_data_start(cmd, curcol, item) != CS_SUCCEED)
+		return CS_FAIL;
+
+	tds_fdout_stream_init(&out, fd);
+	if (curcol->column_cur_size < 0) {
+		/* this is NULL */
+		if (outlen)
+			*outlen = cmd->con->ctx->config.cs_note_empty_data ? CS_NULLDATA : 0;
+		goto done;
+	}
+
+	if (curcol->column_stream) {
+		if (curcol->column_stream_pending)
+			rc = tds_stream_column_copy(cmd->con->tds_socket, curcol, NULL, &out.stream);
+	} else if (curcol->column_cur_size > cmd->get_data_bytes_returned) {
+		TDSSTATICINSTREAM r;
+		unsigned char *src = curcol->column_data;
+
+		if (is_blob_col(curcol))
+			src = (unsigned char *) ((TDSBLOB *) src)->textvalue;
+		tds_staticin_stream_init(&r, src + cmd->get_data_bytes_returned,
+					 curcol->column_cur_size - cmd->get_data_bytes_returned);
+		rc = tds_copy_stream(&r.stream, &out.stream);
+	}
+	/* counter is an int, streamed values can be longer than 2GB */
+	cmd->get_data_bytes_returned = (int) TDS_MIN(cmd->get_data_bytes_returned + out.written, (TDS_INT8) 0x7fffffff);
+	if (TDS_FAILED(rc))
+		return CS_FAIL;
+	if (outlen)
+		*outlen = out.written;
+
+done:
+	if (item < resinfo->num_cols)
+		return CS_END_ITEM;
+	return CS_END_DATA;
+}
+
 CS_RETCODE
 ct_send_data(CS_COMMAND * cmd, CS_VOID * buffer, CS_INT buflen)
 {
@@ -0,0 +1,105 @@
+/* Test ct_get_data_fd writing text values to a file descriptor */
+
+#include "common.h"
+
+/* fetch next row and write its value to a temporary file, checking it */
+static void
+check_value(CS_COMMAND *cmd, char c, CS_BIGINT expected)
+{
+	CS_INT count;
+	CS_BIGINT len = -1, size = 0;
+	FILE *f;
+	int ch;
+
+	check_call(ct_fetch, (cmd, CS_UNUSED, CS_UNUSED, CS_UNUSED, &count));
+
+	f = tmpfile();
+	if (!f) {
+		fprintf(stderr, "Error creating temporary file\n");
+		exit(1);
+	}
+
+	if (ct_get_data_fd(cmd, 1, fileno(f), &len) != CS_END_DATA) {
+		fprintf(stderr, "ct_get_data_fd() failed\n");
+		exit(1);
+	}
+	if (len != expected) {
+		fprintf(stderr, "Wrong length %ld, expected %ld\n", (long) len, (long) expected);
+		exit(1);
+	}
+
+	rewind(f);
+	while ((ch = getc(f)) != EOF) {
+		if (ch != c) {
+			fprintf(stderr, "Wrong data at position %ld\n", (long) size);
+			exit(1);
+		}
+		++size;
+	}
+	fclose(f);
+	if (size != expected) {
+		fprintf(stderr, "Wrong file size %ld, expected %ld\n", (long) size, (long) expected);
+		exit(1);
+	}
+}
+
+TEST_MAIN()
+{
+	CS_CONTEXT *ctx;
+	CS_CONNECTION *conn;
+	CS_COMMAND *cmd;
+	CS_INT result_type, count;
+	CS_RETCODE ret;
+	int verbose = 0, tds_version, len_a = 200, len_b = 150;
+	char sql[512];
+
+	printf("%s: Retrieve text values using ct_get_data_fd()\n", __FILE__);
+	check_call(try_ctlogin, (&ctx, &conn, &cmd, verbose));
+
+	check_call(run_command, (cmd, "CREATE TABLE #get_data_fd (i int not null, t text null)"));
+
+	/* use values bigger than a packet if the server allows it */
+	check_call(ct_con_props, (conn, CS_GET, CS_TDS_VERSION, &tds_version, CS_UNUSED, NULL));
+#ifdef CS_TDS_72
+	if (tds_version >= CS_TDS_72) {
+		len_a = 100000;
+		len_b = 70000;
+		sprintf(sql, "INSERT #get_data_fd VALUES (1, REPLICATE(CONVERT(VARCHAR(MAX), 'a'), %d)) "
+			"INSERT #get_data_fd VALUES (2, REPLICATE(CONVERT(VARCHAR(MAX), 'b'), %d))", len_a, len_b);
+	} else
+#endif
+	{
+		sprintf(sql, "INSERT #get_data_fd VALUES (1, REPLICATE('a', %d)) "
+			"INSERT #get_data_fd VALUES (2, REPLICATE('b', %d))", len_a, len_b);
+	}
+	check_call(run_command, (cmd, sql));
+
+	check_call(ct_command, (cmd, CS_LANG_CMD, "SELECT t FROM #get_data_fd ORDER BY i", CS_NULLTERM, CS_UNUSED));
+	check_call(ct_send, (cmd));
+	while ((ret = ct_results(cmd, &result_type)) == CS_SUCCEED) {
+		switch ((int) result_type) {
+		case CS_CMD_SUCCEED:
+		case CS_CMD_DONE:
+			break;
+		case CS_ROW_RESULT:
+			check_value(cmd, 'a', len_a);
+			check_value(cmd, 'b', len_b);
+			if (ct_fetch(cmd, CS_UNUSED, CS_UNUSED, CS_UNUSED, &count) != CS_END_DATA) {
+				fprintf(stderr, "Expected end of data\n");
+				return 1;
+			}
+			break;
+		default:
+			fprintf(stderr, "ct_results() unexpected result_type %d.\n", (int) result_type);
+			return 1;
+		}
+	}
+	if (ret != CS_END_RESULTS) {
+		fprintf(stderr, "ct_results() unexpected return %d.\n", (int) ret);
+		return 1;
+	}
+
+	check_call(try_ctlogout, (ctx, conn, cmd, verbose));
+
+	return 0;
+}
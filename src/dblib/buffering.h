@@ -7,6 +7,8 @@ typedef struct dblib_buffer_row {
 	DBINT row;
 	/** save old sizes */
 	TDS_INT *sizes;
+	/** row_data and sizes are stored in the buffer slab */
+	bool slab;
 } DBLIB_BUFFER_ROW;
 
 static void buffer_struct_print(const DBPROC_ROWBUF *buf);
@@ -19,6 +21,7 @@ static void buffer_check_row_empty(DBLIB_BUFFER_ROW *row)
 	assert(row->resinfo == NULL);
 	assert(row->row_data == NULL);
 	assert(row->sizes == NULL);
+	assert(!row->slab);
 	assert(row->row == 0);
 }
 
@@ -149,9 +152,35 @@ buffer_index_valid(const DBPROC_ROWBUF *buf, int idx)
 }
 #endif
 
+/**
+ * Free blobs owned by a row saved in the slab
+ */
+static void
+buffer_free_blobs(DBLIB_BUFFER_ROW *row)
+{
+	int i;
+
+	for (i = 0; i < row->resinfo->num_cols; ++i) {
+		const TDSCOLUMN *col = row->resinfo->columns[i];
+
+		if (is_blob_col(col)) {
+			TDSBLOB *blob = (TDSBLOB *) &row->row_data[col->column_data - row->resinfo->current_row];
+
+			free(blob->textvalue);
+		}
+	}
+}
+
 static void
 buffer_free_row(DBLIB_BUFFER_ROW *row)
 {
+	if (row->slab) {
+		if (row->row_data)
+			buffer_free_blobs(row);
+		row->row_data = NULL;
+		row->sizes = NULL;
+		row->slab = false;
+	}
 	if (row->sizes)
 		TDS_ZERO_FREE(row->sizes);
 	if (row->row_data) {
@@ -183,6 +212,8 @@ buffer_free(DBPROC_ROWBUF *buf)
 			buffer_free_row(&buf->rows[i]);
 		TDS_ZERO_FREE(buf->rows);
 	}
+	TDS_ZERO_FREE(buf->slab);
+	buf->slot_size = 0;
 	BUFFER_CHECK(buf);
 }
 
@@ -479,6 +510,24 @@ buffer_alloc(DBPROCESS *dbproc)
 	buf->received = 0;
 }
 
+#define BUFFER_ROUND(n) (((n) + TDS_ALIGN_SIZE - 1) / TDS_ALIGN_SIZE * TDS_ALIGN_SIZE)
+
+/**
+ * Allocate the slab, sized for rows of the passed results.
+ * On failure rows are allocated one by one.
+ */
+static void
+buffer_alloc_slab(DBPROC_ROWBUF *buf, const TDSRESULTINFO *resinfo)
+{
+	size_t slot_size = BUFFER_ROUND((size_t) resinfo->row_size)
+			 + BUFFER_ROUND(sizeof(TDS_INT) * resinfo->num_cols);
+
+	if ((size_t) buf->capacity > ((size_t) -1) / slot_size)
+		return;
+	if ((buf->slab = tds_new(unsigned char, buf->capacity * slot_size)) != NULL)
+		buf->slot_size = slot_size;
+}
+
 /**
  * Called by dbnextrow
  * Returns a row buffer index, or -1 to indicate the buffer is full.
@@ -498,19 +547,27 @@ buffer_add_row(DBPROCESS *dbproc, TDSRESULTINFO *resinfo)
 	row = buffer_row_address(buf, buf->head);
 
 	/* bump the row number, write it, and move the data to head */
-	if (row->resinfo) {
-		tds_free_row(row->resinfo, row->row_data);
-		tds_free_results(row->resinfo);
-	}
+	if (row->resinfo)
+		buffer_free_row(row);
 	row->row = ++buf->received;
 	++resinfo->ref_count;
 	row->resinfo = resinfo;
 	row->row_data = NULL;
-	if (row->sizes)
-		free(row->sizes);
-	row->sizes = tds_new0(TDS_INT, resinfo->num_cols);
-	for (i = 0; i < resinfo->num_cols; ++i)
-		row->sizes[i] = resinfo->columns[i]->column_cur_size;
+
+	if (!buf->slab)
+		buffer_alloc_slab(buf, resinfo);
+
+	/* use the slot if the row fits, compute rows can be larger */
+	if (buf->slab && BUFFER_ROUND((size_t) resinfo->row_size) + sizeof(TDS_INT) * resinfo->num_cols <= buf->slot_size) {
+		row->slab = true;
+		row->sizes = (TDS_INT *) (buf->slab + buf->head * buf->slot_size + BUFFER_ROUND((size_t) resinfo->row_size));
+	} else {
+		row->sizes = tds_new0(TDS_INT, resinfo->num_cols);
+	}
+	if (row->sizes) {
+		for (i = 0; i < resinfo->num_cols; ++i)
+			row->sizes[i] = resinfo->columns[i]->column_cur_size;
+	}
 
 	/* initial condition is head == 0 and tail == capacity */
 	if (buf->tail == buf->capacity) {
@@ -544,7 +601,20 @@ buffer_save_row(DBPROCESS *dbproc)
 	if (idx >= 0 && idx < buf->capacity) {
 		row = &buf->rows[idx];
 
-		if (row->resinfo && !row->row_data) {
+		if (row->resinfo && !row->row_data && row->slab) {
+			TDSRESULTINFO *resinfo = row->resinfo;
+			int i;
+
+			/* copy to slot, blobs are now owned by the saved row */
+			row->row_data = buf->slab + idx * buf->slot_size;
+			memcpy(row->row_data, resinfo->current_row, resinfo->row_size);
+			for (i = 0; i < resinfo->num_cols; ++i) {
+				TDSCOLUMN *col = resinfo->columns[i];
+
+				if (is_blob_col(col))
+					((TDSBLOB *) col->column_data)->textvalue = NULL;
+			}
+		} else if (row->resinfo && !row->row_data) {
 			row->row_data = row->resinfo->current_row;
 			tds_alloc_row(row->resinfo);
 		}
@@ -54,6 +54,8 @@
 #include <freetds/convert.h>
 #include <freetds/utils/string.h>
 #include <freetds/data.h>
+#include <freetds/iconv.h>
+#include <freetds/stream.h>
 #include <freetds/replacements.h>
 #include <sybfront.h>
 #include <sybdb.h>
@@ -6694,6 +6696,38 @@ dbwritetext(DBPROCESS * dbproc, char *objname, DBBINARY * textptr, DBTINYINT tex
 	return FAIL;
 }
 
+/**
+ * Read next row for dbreadtext() and dbreadtextfd().
+ * \return SUCCEED, NO_MORE_ROWS or -1 on error
+ */
+static STATUS
+dbreadtext_row(DBPROCESS * dbproc, TDSCOLUMN * curcol)
+{
+	const int mask = TDS_STOPAT_ROWFMT|TDS_STOPAT_DONE|TDS_RETURN_ROW|TDS_RETURN_COMPUTE;
+	TDSSOCKET *tds = dbproc->tds_socket;
+	TDS_INT result_type;
+	TDSRET rc;
+
+	buffer_save_row(dbproc);
+	/* leave text on the wire if not buffering rows, read it directly into buf */
+	curcol->column_stream = tds->res_info->num_cols == 1 && dbproc->row_buf.capacity <= 1
+				&& tds_column_streamable(tds, curcol);
+	rc = tds_process_tokens(tds, &result_type, NULL, mask);
+	curcol->column_stream = 0;
+	switch (rc) {
+	case TDS_SUCCESS:
+		if (result_type == TDS_ROW_RESULT || result_type == TDS_COMPUTE_RESULT)
+			break;
+	case TDS_NO_MORE_RESULTS:
+		/* like dbnextrow, allows dbresults to read next result */
+		dbproc->dbresults_state = _DB_RES_NEXT_RESULT;
+		return NO_MORE_ROWS;
+	default:
+		return -1;
+	}
+	return SUCCEED;
+}
+
 /**
  * \ingroup dblib_core
  * \brief Fetch part of a text or image value from the server.
@@ -6714,7 +6748,6 @@ dbreadtext(DBPROCESS * dbproc, void *buf, DBINT bufsize)
 	TDSSOCKET *tds;
 	TDSCOLUMN *curcol;
 	int cpbytes, bytes_avail;
-	TDS_INT result_type;
 	TDSRESULTINFO *resinfo;
 
 	tdsdump_log(TDS_DBG_FUNC, "dbreadtext(%p, %p, %d)\n", dbproc, buf, bufsize);
@@ -6734,7 +6767,8 @@ dbreadtext(DBPROCESS * dbproc, void *buf, DBINT bufsize)
 	 * set pos to 0 and return 0 to denote the end of the 
 	 * text 
 	 */
-	if (curcol->column_textpos && curcol->column_textpos >= curcol->column_cur_size) {
+	if (!curcol->column_stream_pending && curcol->column_textpos
+	    && curcol->column_textpos >= curcol->column_cur_size) {
 		curcol->column_textpos = 0;
 		return 0;
 	}
@@ -6744,18 +6778,18 @@ dbreadtext(DBPROCESS * dbproc, void *buf, DBINT bufsize)
 	 * then read another row
 	 */
 
-	if (curcol->column_textpos == 0) {
-		const int mask = TDS_STOPAT_ROWFMT|TDS_STOPAT_DONE|TDS_RETURN_ROW|TDS_RETURN_COMPUTE;
-		buffer_save_row(dbproc);
-		switch (tds_process_tokens(dbproc->tds_socket, &result_type, NULL, mask)) {
-		case TDS_SUCCESS:
-			if (result_type == TDS_ROW_RESULT || result_type == TDS_COMPUTE_RESULT)
-				break;
-		case TDS_NO_MORE_RESULTS:
-			return NO_MORE_ROWS;
-		default:
-			return -1;
-		}
+	if (!curcol->column_stream_pending && curcol->column_textpos == 0) {
+		STATUS ret = dbreadtext_row(dbproc, curcol);
+
+		if (ret != SUCCEED)
+			return ret;
+	}
+
+	if (curcol->column_stream_pending) {
+		cpbytes = tds_stream_column_read(tds, curcol, buf, bufsize);
+		if (cpbytes > 0)
+			curcol->column_textpos += cpbytes;
+		return cpbytes;
 	}
 
 	/* find the number of bytes to return */
@@ -6766,6 +6800,67 @@ dbreadtext(DBPROCESS * dbproc, void *buf, DBINT bufsize)
 	return cpbytes;
 }
 
+/**
+ * \ingroup dblib_core
+ * \brief Write a text or image value from the server to a file descriptor.
+ *
+ * Like dbreadtext() but the whole value of the row (or what is left of it
+ * after previous dbreadtext() calls) is written to \a fd.  If rows are not
+ * buffered data are copied from network packets to the file descriptor
+ * without loading the value into memory.
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \param fd file descriptor to write to, can be a file, a pipe or a socket.
+ * \return
+	- \c >=0 count of bytes written to \a fd, next call reads next row.
+	- \c -1 \em error, no result set ready for \a dbproc or error writing to \a fd.
+	- \c NO_MORE_ROWS all rows read, no further data.
+ * \sa dbreadtext(), dbnextrow().
+ */
+DBBIGINT
+dbreadtextfd(DBPROCESS * dbproc, int fd)
+{
+	TDSSOCKET *tds;
+	TDSCOLUMN *curcol;
+	TDSFDOUTSTREAM out;
+	TDSRET rc = TDS_SUCCESS;
+
+	tdsdump_log(TDS_DBG_FUNC, "dbreadtextfd(%p, %d)\n", dbproc, fd);
+	CHECK_PARAMETER(dbproc, SYBENULL, -1);
+
+	tds = dbproc->tds_socket;
+
+	if (!tds || !tds->res_info || !tds->res_info->columns[0])
+		return -1;
+
+	curcol = tds->res_info->columns[0];
+
+	/* start a new row if previous value was completely read */
+	if (!curcol->column_stream_pending
+	    && (curcol->column_textpos == 0 || curcol->column_textpos >= curcol->column_cur_size)) {
+		STATUS ret;
+
+		curcol->column_textpos = 0;
+		ret = dbreadtext_row(dbproc, curcol);
+		if (ret != SUCCEED)
+			return ret;
+	}
+
+	tds_fdout_stream_init(&out, fd);
+	if (curcol->column_stream_pending) {
+		rc = tds_stream_column_copy(tds, curcol, NULL, &out.stream);
+	} else if (curcol->column_cur_size > curcol->column_textpos) {
+		TDSSTATICINSTREAM r;
+
+		tds_staticin_stream_init(&r, ((TDSBLOB *) curcol->column_data)->textvalue + curcol->column_textpos,
+					 curcol->column_cur_size - curcol->column_textpos);
+		rc = tds_copy_stream(&r.stream, &out.stream);
+	}
+	curcol->column_textpos = 0;
+	if (TDS_FAILED(rc))
+		return -1;
+	return out.written;
+}
+
 /**
  * \ingroup dblib_core
  * \brief Send chunk of a text/image value to the server.
@@ -8245,11 +8340,11 @@ dbperror(DBPROCESS *dbproc, DBINT msgno, long errnum, ...)
 	}
 
 	if (dbproc && dbproc->tds_socket && dbproc->tds_socket->login) {
-		DSTR server_name_dstr = dbproc->tds_socket->login->server_name;
-		if (!tds_dstr_isempty(&server_name_dstr)) {
+		const DSTR *server_name_dstr = &dbproc->tds_socket->login->server_name;
+		if (!tds_dstr_isempty(server_name_dstr)) {
 			char * buffer = NULL;
 			if (asprintf(&buffer, "%s (%s)", msg->msgtext,
-			             tds_dstr_cstr(&server_name_dstr)) >= 0) {
+			             tds_dstr_cstr(server_name_dstr)) >= 0) {
 				free((char*) constructed_message.msgtext);
 				constructed_message.msgtext = buffer;
 				constructed_message.severity = msg->severity;
@@ -47,6 +47,7 @@
 #include <freetds/thread.h>
 #include <freetds/convert.h>
 #include <freetds/utils/string.h>
+#include <freetds/utils/hash.h>
 #include <freetds/replacements.h>
 #include <sybfront.h>
 #include <sybdb.h>
@@ -551,33 +552,142 @@ key_equal(const KEY_T *a, const KEY_T *b)
 	return true;
 }
 
+/* must be consistent with col_equal */
+static uint32_t
+col_hash(const struct col_t *pcol)
+{
+	const char *end;
+
+	switch (pcol->type) {
+	case SYBCHAR:
+	case SYBVARCHAR:
+		/* strncmp stops at terminator */
+		end = (const char *) memchr(pcol->s, 0, pcol->len);
+		return tds_hash_bytes(pcol->s, end ? (size_t) (end - pcol->s) : pcol->len);
+	case SYBINT1:
+	case SYBUINT1:
+	case SYBSINT1:
+		return tds_hash_uint(pcol->data.ti);
+	case SYBINT2:
+	case SYBUINT2:
+		return tds_hash_uint((uint16_t) pcol->data.si);
+	case SYBINT4:
+	case SYBUINT4:
+		return tds_hash_uint((uint32_t) pcol->data.i);
+	case SYBFLT8:
+		/* 0.0 and -0.0 compare equal */
+		if (pcol->data.f == 0)
+			return 0;
+		return tds_hash_bytes(&pcol->data.f, sizeof(pcol->data.f));
+	case SYBREAL:
+		if (pcol->data.r == 0)
+			return 0;
+		return tds_hash_bytes(&pcol->data.r, sizeof(pcol->data.r));
+	default:
+		break;
+	}
+	return 0;
+}
+
+static uint32_t
+key_hash(const KEY_T *k)
+{
+	uint32_t value = 0;
+	int i;
+
+	for (i = 0; i < k->nkeys; i++)
+		value = tds_hash_uint(value ^ col_hash(k->keys + i));
+	return value;
+}
 
 static void
 key_free(KEY_T *p)
 {
-	col_free(p->keys);
+	int i;
+
+	for (i = 0; i < p->nkeys; i++)
+		col_free(p->keys + i);
 	free(p->keys);
 	memset(p, 0, sizeof(*p));
 }
 
-static KEY_T *
-key_cpy(KEY_T *pdest, const KEY_T *psrc)
+/*
+ * All keys and aggregates of a pivot are allocated in blocks and
+ * released together when the pivot is freed.
+ */
+typedef struct arena_block_t
+{
+	struct arena_block_t *next;
+	size_t used, size;
+} ARENA_BLOCK_T;
+
+typedef struct arena_t
+{
+	ARENA_BLOCK_T *blocks;
+} ARENA_T;
+
+#define ARENA_BLOCK_SIZE 65536u
+#define ARENA_ROUND(n) (((n) + TDS_ALIGN_SIZE - 1) / TDS_ALIGN_SIZE * TDS_ALIGN_SIZE)
+
+/** Allocate zeroed memory from arena, returns NULL on failure */
+static void *
+arena_alloc(ARENA_T *arena, size_t size)
+{
+	ARENA_BLOCK_T *block = arena->blocks;
+	const size_t header = ARENA_ROUND(sizeof(ARENA_BLOCK_T));
+	void *p;
+
+	size = ARENA_ROUND(size);
+	if (!block || block->size - block->used < size) {
+		size_t block_size = TDS_MAX(header + size, ARENA_BLOCK_SIZE);
+
+		if ((block = (ARENA_BLOCK_T *) calloc(1, block_size)) == NULL)
+			return NULL;
+		block->size = block_size;
+		block->used = header;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+	p = (char *) block + block->used;
+	block->used += size;
+	return p;
+}
+
+static void
+arena_free(ARENA_T *arena)
+{
+	ARENA_BLOCK_T *block, *next;
+
+	for (block = arena->blocks; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	arena->blocks = NULL;
+}
+
+static bool
+key_arena_cpy(ARENA_T *arena, KEY_T *pdest, const KEY_T *psrc)
 {
 	int i;
-	
+
 	assert( pdest && psrc );
-	
-	if ((pdest->keys = tds_new0(struct col_t, psrc->nkeys)) == NULL)
-		return NULL;
 
+	if ((pdest->keys = (struct col_t *) arena_alloc(arena, sizeof(struct col_t) * psrc->nkeys)) == NULL)
+		return false;
 	pdest->nkeys = psrc->nkeys;
-	
-	for( i=0; i < psrc->nkeys; i++) {
-		if (NULL == col_cpy(pdest->keys+i, psrc->keys+i))
-			return NULL;
-	}
 
-	return pdest;
+	for (i = 0; i < psrc->nkeys; i++) {
+		const struct col_t *src = psrc->keys + i;
+		struct col_t *dest = pdest->keys + i;
+
+		*dest = *src;
+		if (src->s) {
+			if ((dest->s = (char *) arena_alloc(arena, src->len + 1)) == NULL)
+				return false;
+			memcpy(dest->s, src->s, src->len);
+		}
+	}
+	return true;
 }
 
 
@@ -611,103 +721,67 @@ make_col_name(DBPROCESS *dbproc, const KEY_T *k)
 }
 	
 
+/** Aggregated value for a row/column intersection */
 typedef struct agg_t
 {
-	KEY_T row_key, col_key;
+	TDS_HASH_ENTRY entry;
+	/** next aggregate in the same row */
+	struct agg_t *next;
+	unsigned row, col;
 	struct col_t value;
 } AGG_T;
 
-#if 0
-static bool
-agg_key_equal(const void *a, const void *b)
+/** Input row, bound to the results being pivoted */
+typedef struct input_t
 {
-	int i;
-	const AGG_T *p1 = a, *p2 = b;
-	
-	assert(p1 && p2);
-	assert(p1->row_key.keys  && p2->row_key.keys);
-	assert(p1->row_key.nkeys == p2->row_key.nkeys);
-	
-	for( i=0; i < p1->row_key.nkeys; i++ ) {
-		if (! col_equal(p1->row_key.keys+i, p2->row_key.keys+i))
-			return false;
-	}
+	KEY_T row_key, col_key;
+	struct col_t value;
+} INPUT_T;
 
-	return true;
+/** Unique row (down) or column (across) key */
+typedef struct pivot_key_t
+{
+	TDS_HASH_ENTRY entry;
+	/** next key in order of appearance */
+	struct pivot_key_t *next;
+	unsigned idx;
+	KEY_T key;
+	/** aggregates of this row, unused for columns */
+	AGG_T *aggs;
+} PIVOT_KEY_T;
+
+static uint32_t
+agg_hash(unsigned row, unsigned col)
+{
+	return tds_hash_uint(row ^ tds_hash_uint(col));
 }
-#endif
 
-static bool
-agg_next(const AGG_T *p1, const AGG_T *p2)
+static PIVOT_KEY_T *
+pivot_key_find(const TDS_HASH *hash, const KEY_T *key, uint32_t value)
 {
-	int i;
-
-	assert(p1 && p2);
-	
-	if (p1->row_key.keys == NULL || p2->row_key.keys == NULL)
-		return false;
-	
-	assert(p1->row_key.keys  && p2->row_key.keys);
-	assert(p1->row_key.nkeys == p2->row_key.nkeys);
-	
-	assert(p1->col_key.keys  && p2->col_key.keys);
-	assert(p1->col_key.nkeys == p2->col_key.nkeys);
-	
-	for( i=0; i < p1->row_key.nkeys; i++ ) {
-		assert(p1->row_key.keys[i].type);
-		assert(p2->row_key.keys[i].type);
-		if (p1->row_key.keys[i].type != p2->row_key.keys[i].type)
-			return false;
-	}
-
-	for( i=0; i < p1->row_key.nkeys; i++ ) {
-		if (! col_equal(p1->row_key.keys+i, p2->row_key.keys+i))
-			return false;
-	}
+	TDS_HASH_ENTRY *entry;
 
-	for( i=0; i < p1->col_key.nkeys; i++ ) {
-		if (p1->col_key.keys[i].type != p2->col_key.keys[i].type)
-			return false;
-	}
+	TDS_HASH_FOREACH(hash, value, entry) {
+		PIVOT_KEY_T *pkey = TDS_HASH_ITEM(entry, PIVOT_KEY_T, entry);
 
-	for( i=0; i < p1->col_key.nkeys; i++ ) {
-		if (! col_equal(p1->col_key.keys+i, p2->col_key.keys+i))
-			return false;
+		if (key_equal(&pkey->key, key))
+			return pkey;
 	}
-
-	return true;
+	return NULL;
 }
 
-static void
-agg_free(AGG_T *p)
+static AGG_T *
+agg_find(const TDS_HASH *hash, unsigned row, unsigned col)
 {
-	key_free(&p->row_key);
-	key_free(&p->col_key);
-	col_free(&p->value);
-}
+	TDS_HASH_ENTRY *entry;
 
-static bool
-agg_equal(const AGG_T *p1, const AGG_T *p2)
-{
-	int i;
-	
-	assert(p1 && p2);
-	assert(p1->row_key.keys && p1->col_key.keys);
-	assert(p2->row_key.keys && p2->col_key.keys);
+	TDS_HASH_FOREACH(hash, agg_hash(row, col), entry) {
+		AGG_T *agg = TDS_HASH_ITEM(entry, AGG_T, entry);
 
-	assert(p1->row_key.nkeys == p2->row_key.nkeys);
-	assert(p1->col_key.nkeys == p2->col_key.nkeys);
-	
-	/* todo: use key_equal */
-	for( i=0; i < p1->row_key.nkeys; i++ ) {
-		if (! col_equal(p1->row_key.keys+i, p2->row_key.keys+i))
-			return false;
+		if (agg->row == row && agg->col == col)
+			return agg;
 	}
-	for( i=0; i < p1->col_key.nkeys; i++ ) {
-		if (! col_equal(p1->col_key.keys+i, p2->col_key.keys+i))
-			return false;
-	}
-	return true;
+	return NULL;
 }
 
 #undef TEST_MALLOC
@@ -780,7 +854,7 @@ set_result_column(TDSSOCKET * tds, TDSCOLUMN * curcol, const char name[], const
 	return TDS_SUCCESS;
 }
 
-struct metadata_t { KEY_T *pacross; char *name; struct col_t col; };
+struct metadata_t { int across; char *name; struct col_t col; };
 
 
 static bool
@@ -813,7 +887,7 @@ reinit_results(TDSSOCKET * tds, TDS_USMALLINT num_cols, const struct metadata_t
 	
 	for (i = 0; i < num_cols; i++) {
 		set_result_column(tds, info->columns[i], meta[i].name, &meta[i].col);
-		info->columns[i]->bcp_terminator = (char*) meta[i].pacross;	/* overload available pointer */
+		info->columns[i]->bcp_term_len = meta[i].across + 1;	/* overload available field */
 	}
 		
 	if (num_cols > 0) {
@@ -844,10 +918,12 @@ typedef struct pivot_t
 	STATUS status;
 	DB_RESULT_STATE dbresults_state;
 	
-	AGG_T *output;
-	KEY_T *across;
-	size_t nout;
+	ARENA_T arena;
+	/** output rows, in order of appearance */
+	PIVOT_KEY_T *rows, *next_row;
 	TDS_USMALLINT nacross;
+	/** values of the row being returned, indexed by across column */
+	struct col_t **out_row;
 } PIVOT_T;
 
 static bool
@@ -858,6 +934,14 @@ pivot_key_equal(const PIVOT_T *a, const PIVOT_T *b)
 	return a->dbproc == b->dbproc;
 }
 
+static void
+pivot_free(PIVOT_T *pp)
+{
+	arena_free(&pp->arena);
+	free(pp->out_row);
+	memset(pp, 0, sizeof(*pp));
+}
+
 static PIVOT_T *pivots = NULL;
 static size_t npivots = 0;
 
@@ -876,25 +960,24 @@ STATUS
 dbnextrow_pivoted(DBPROCESS *dbproc, PIVOT_T *pp)
 {
 	int i;
-	AGG_T candidate, *pout;
+	PIVOT_KEY_T *row;
+	AGG_T *agg;
 
 	assert(pp);
 	assert(dbproc && dbproc->tds_socket);
 	assert(dbproc->tds_socket->res_info);
 	assert(dbproc->tds_socket->res_info->columns || 0 == dbproc->tds_socket->res_info->num_cols);
 	
-	for (pout = pp->output; pout < pp->output + pp->nout; pout++) {
-		if (pout->row_key.keys != NULL)
-			break;
-	}
-
-	if (pout == pp->output + pp->nout) {
+	if ((row = pp->next_row) == NULL) {
 		dbproc->dbresults_state = _DB_RES_NEXT_RESULT;
+		/* done, following results are not pivoted */
+		pivot_free(pp);
 		return NO_MORE_ROWS;
 	}
+	pp->next_row = row->next;
 
-	memset(&candidate, 0, sizeof(candidate));
-	key_cpy(&candidate.row_key, &pout->row_key);
+	for (agg = row->aggs; agg; agg = agg->next)
+		pp->out_row[agg->col] = &agg->value;
 	
 	/* "buffer_transfer_bound_data" */
 	for (i = 0; i < dbproc->tds_socket->res_info->num_cols; i++) {
@@ -915,18 +998,10 @@ dbnextrow_pivoted(DBPROCESS *dbproc, PIVOT_T *pp)
 		}
 
 		/* find column in output */
-		if (pcol->bcp_terminator == NULL) { /* not a cross-tab column */
-			pval = &candidate.row_key.keys[i];
+		if (pcol->bcp_term_len == 0) { /* not a cross-tab column */
+			pval = &row->key.keys[i];
 		} else {
-			AGG_T *pcan;
-			key_cpy(&candidate.col_key, (KEY_T *) pcol->bcp_terminator);
-			pcan = (AGG_T *) tds_find(&candidate, pout, pp->output + pp->nout - pout,
-						  sizeof(*pp->output), (compare_func) agg_next);
-			if (pcan != NULL) {
-				/* flag this output as used */
-				pout->row_key.keys = NULL;
-				pval = &pcan->value;
-			}
+			pval = pp->out_row[pcol->bcp_term_len - 1];
 		}
 		
 		if (!pval || col_null(pval)) {  /* nothing in output for this x,y location */
@@ -950,9 +1025,83 @@ dbnextrow_pivoted(DBPROCESS *dbproc, PIVOT_T *pp)
 					);
 	}
 
+	for (agg = row->aggs; agg; agg = agg->next)
+		pp->out_row[agg->col] = NULL;
+
 	return REG_ROW;
 }
 
+static bool
+bind_key(DBPROCESS *dbproc, KEY_T *key, int nkeys, const int *cols)
+{
+	int i;
+
+	if ((key->keys = tds_new0(struct col_t, nkeys)) == NULL)
+		return false;
+	key->nkeys = nkeys;
+	for (i=0; i < nkeys; i++) {
+		int type = dbcoltype(dbproc, cols[i]);
+		int len = dbcollen(dbproc, cols[i]);
+		assert(type && len);
+		
+		if (!col_init(key->keys+i, type, len))
+			return false;
+		if (FAIL == dbbind(dbproc, cols[i], bind_type(type), (DBINT) key->keys[i].len,
+				   (BYTE *) col_buffer(key->keys+i)))
+			return false;
+		if (FAIL == dbnullbind(dbproc, cols[i], &key->keys[i].null_indicator))
+			return false;
+	}
+	return true;
+}
+
+/** Remove bindings to columns, so input buffers can be freed */
+static void
+unbind_cols(DBPROCESS *dbproc, int ncols, const int *cols)
+{
+	TDSRESULTINFO *info = dbproc->tds_socket->res_info;
+	int i;
+
+	for (i = 0; info && i < ncols; i++) {
+		TDSCOLUMN *curcol;
+
+		if (cols[i] < 1 || cols[i] > info->num_cols)
+			continue;
+		curcol = info->columns[cols[i] - 1];
+		curcol->column_varaddr = NULL;
+		curcol->column_nullbind = NULL;
+	}
+}
+
+/**
+ * Find or add a key
+ * \param pp     pivot owning the keys
+ * \param hash   index of keys
+ * \param ptail  pointer to last key next pointer, updated when a key is added
+ * \param pnum   number of keys, updated when a key is added
+ * \param key    key to search
+ * \return key found or added, NULL on memory error
+ */
+static PIVOT_KEY_T *
+pivot_key_add(PIVOT_T *pp, TDS_HASH *hash, PIVOT_KEY_T ***ptail, unsigned *pnum, const KEY_T *key)
+{
+	const uint32_t value = key_hash(key);
+	PIVOT_KEY_T *pkey = pivot_key_find(hash, key, value);
+
+	if (pkey)
+		return pkey;
+
+	if ((pkey = (PIVOT_KEY_T *) arena_alloc(&pp->arena, sizeof(*pkey))) == NULL)
+		return NULL;
+	if (!key_arena_cpy(&pp->arena, &pkey->key, key))
+		return NULL;
+	pkey->idx = (*pnum)++;
+	**ptail = pkey;
+	*ptail = &pkey->next;
+	tds_hash_insert(hash, &pkey->entry, value);
+	return pkey;
+}
+
 /** 
  * Pivot the rows, creating a new resultset
  *
@@ -961,6 +1110,9 @@ dbnextrow_pivoted(DBPROCESS *dbproc, PIVOT_T *pp)
  * dbpivot() modifies the metadata such that DB-Library can be used tranparently: 
  * retrieve the rows as usual with dbnumcols(), dbnextrow(), etc. 
  *
+ * Rows, columns and aggregates are indexed by hash so the cost is linear in the
+ * number of input rows.
+ *
  * @dbproc, our old friend
  * @nkeys the number of left-edge columns to group by
  * @keys  an array of left-edge columns to group by
@@ -977,10 +1129,15 @@ dbpivot(DBPROCESS *dbproc, int nkeys, int *keys, int ncols, int *cols, DBPIVOT_F
 {
 	enum { logalot = 1 };
 	PIVOT_T P, *pp;
-	AGG_T input, *pout = NULL;
-	struct metadata_t *metadata, *pmeta;
+	INPUT_T input;
+	AGG_T *pout = NULL, *first = NULL;
+	struct metadata_t *metadata = NULL, *pmeta;
 	int i;
 	TDS_USMALLINT nmeta = 0;
+	TDS_HASH row_index, col_index, agg_index;
+	PIVOT_KEY_T *across = NULL, **rows_tail, **across_tail, *pacross;
+	unsigned nrows = 0, nacross = 0;
+	RETCODE ret = FAIL;
 
 	tdsdump_log(TDS_DBG_FUNC, "dbpivot(%p, %d,%p, %d,%p, %p, %d)\n", dbproc, nkeys, keys, ncols, cols, func, val);
 	if (logalot) {
@@ -1007,50 +1164,30 @@ dbpivot(DBPROCESS *dbproc, int nkeys, int *keys, int ncols, int *cols, DBPIVOT_F
 	P.dbproc = dbproc;
 	pp = (PIVOT_T *) tds_find(&P, pivots, npivots, sizeof(*pivots),
 				  (compare_func) pivot_key_equal);
+	if (pp == NULL) {
+		/* reuse a released slot */
+		P.dbproc = NULL;
+		pp = (PIVOT_T *) tds_find(&P, pivots, npivots, sizeof(*pivots),
+					  (compare_func) pivot_key_equal);
+	}
 	if (pp == NULL) {
 		pp = (PIVOT_T *) TDS_RESIZE(pivots, 1 + npivots);
 		if (!pp)
 			return FAIL;
 		pp += npivots++;
+		memset(pp, 0, sizeof(*pp));
 	} else {
-		agg_free(pp->output);
-		key_free(pp->across);		
+		pivot_free(pp);
 	}
-	memset(pp, 0, sizeof(*pp));
 
-	if ((input.row_key.keys = tds_new0(struct col_t, nkeys)) == NULL)
-		return FAIL;
-	input.row_key.nkeys = nkeys;
-	for (i=0; i < nkeys; i++) {
-		int type = dbcoltype(dbproc, keys[i]);
-		int len = dbcollen(dbproc, keys[i]);
-		assert(type && len);
-		
-		if (!col_init(input.row_key.keys+i, type, len))
-			return FAIL;
-		if (FAIL == dbbind(dbproc, keys[i], bind_type(type), (DBINT) input.row_key.keys[i].len,
-				   (BYTE *) col_buffer(input.row_key.keys+i)))
-			return FAIL;
-		if (FAIL == dbnullbind(dbproc, keys[i], &input.row_key.keys[i].null_indicator))
-			return FAIL;
-	}
-	
-	if ((input.col_key.keys = tds_new0(struct col_t, ncols)) == NULL)
-		return FAIL;
-	input.col_key.nkeys = ncols;
-	for (i=0; i < ncols; i++) {
-		int type = dbcoltype(dbproc, cols[i]);
-		int len = dbcollen(dbproc, cols[i]);
-		assert(type && len);
-		
-		if (!col_init(input.col_key.keys+i, type, len))
-			return FAIL;
-		if (FAIL == dbbind(dbproc, cols[i], bind_type(type), (DBINT) input.col_key.keys[i].len,
-				   (BYTE *) col_buffer(input.col_key.keys+i)))
-			return FAIL;
-		if (FAIL == dbnullbind(dbproc, cols[i], &input.col_key.keys[i].null_indicator))
-			return FAIL;
-	}
+	tds_hash_init(&row_index);
+	tds_hash_init(&col_index);
+	tds_hash_init(&agg_index);
+
+	if (!bind_key(dbproc, &input.row_key, nkeys, keys))
+		goto Cleanup;
+	if (!bind_key(dbproc, &input.col_key, ncols, cols))
+		goto Cleanup;
 	
 	/* value */ {
 		int type = dbcoltype(dbproc, val);
@@ -1058,50 +1195,60 @@ dbpivot(DBPROCESS *dbproc, int nkeys, int *keys, int ncols, int *cols, DBPIVOT_F
 		assert(type && len);
 		
 		if (!col_init(&input.value, type, len))
-			return FAIL;
+			goto Cleanup;
 		if (FAIL == dbbind(dbproc, val, bind_type(type), input.value.len,
 				   (BYTE *) col_buffer(&input.value)))
-			return FAIL;
+			goto Cleanup;
 		if (FAIL == dbnullbind(dbproc, val, &input.value.null_indicator))
-			return FAIL;
+			goto Cleanup;
 	}
+
+	rows_tail = &pp->rows;
+	across_tail = &across;
 	
 	while ((pp->status = dbnextrow(dbproc)) == REG_ROW) {
+		PIVOT_KEY_T *row, *col;
+
 		/* add to unique list of crosstab columns */
-		if (tds_find(&input.col_key, pp->across, pp->nacross, sizeof(*pp->across),
-			     (compare_func) key_equal) == NULL) {
-			if (!TDS_RESIZE(pp->across, 1 + pp->nacross))
-				return FAIL;
-			key_cpy(pp->across + pp->nacross, &input.col_key);
+		if ((col = pivot_key_add(pp, &col_index, &across_tail, &nacross, &input.col_key)) == NULL)
+			goto Cleanup;
+		if ((row = pivot_key_add(pp, &row_index, &rows_tail, &nrows, &input.row_key)) == NULL)
+			goto Cleanup;
+		if (nkeys + nacross > 0xffffu) {
+			tdsdump_log(TDS_DBG_ERROR, "dbpivot(): too many columns\n");
+			goto Cleanup;
 		}
-		assert(pp->across);
-		
-		if ((pout = tds_find(&input, pp->output, pp->nout, sizeof(*pp->output), (compare_func) agg_equal)) == NULL ) {
-			if (!TDS_RESIZE(pp->output, 1 + pp->nout))
-				return FAIL;
-			pout = pp->output + pp->nout++;
-
-			
-			if ((pout->row_key.keys = tds_new0(struct col_t, input.row_key.nkeys)) == NULL)
-				return FAIL;
-			key_cpy(&pout->row_key, &input.row_key);
-
-			if ((pout->col_key.keys = tds_new0(struct col_t, input.col_key.nkeys)) == NULL)
-				return FAIL;
-			key_cpy(&pout->col_key, &input.col_key);
-
-			if (!col_init(&pout->value, input.value.type, input.value.len))
-				return FAIL;
+
+		if ((pout = agg_find(&agg_index, row->idx, col->idx)) == NULL) {
+			if ((pout = (AGG_T *) arena_alloc(&pp->arena, sizeof(*pout))) == NULL)
+				goto Cleanup;
+			pout->row = row->idx;
+			pout->col = col->idx;
+			pout->value.type = infer_col_type(input.value.type);
+			pout->value.len = input.value.len;
+			if (input.value.s && (pout->value.s = (char *) arena_alloc(&pp->arena, input.value.len + 1)) == NULL)
+				goto Cleanup;
+			pout->next = row->aggs;
+			row->aggs = pout;
+			tds_hash_insert(&agg_index, &pout->entry, agg_hash(pout->row, pout->col));
+			if (!first)
+				first = pout;
 		}
 		
 		func(&pout->value, &input.value);
+	}
 
+	pp->nacross = nacross;
+	if ((pp->out_row = tds_new0(struct col_t *, nacross + 1)) == NULL) {
+		dbperror(dbproc, SYBEMEM, errno);
+		goto Cleanup;
 	}
 
 	/* Mark this proc as pivoted, so that dbnextrow() sees it when the application calls it */
 	pp->dbproc = dbproc;
+	pp->next_row = pp->rows;
 	pp->dbresults_state = dbproc->dbresults_state;
-	dbproc->dbresults_state = pp->output < pout? _DB_RES_RESULTSET_ROWS : _DB_RES_RESULTSET_EMPTY;
+	dbproc->dbresults_state = pp->rows ? _DB_RES_RESULTSET_ROWS : _DB_RES_RESULTSET_EMPTY;
 	
 	/*
 	 * Initialize new metadata
@@ -1110,37 +1257,63 @@ dbpivot(DBPROCESS *dbproc, int nkeys, int *keys, int ncols, int *cols, DBPIVOT_F
 	metadata = tds_new0(struct metadata_t, nmeta);
 	if (!metadata) {
 		dbperror(dbproc, SYBEMEM, errno);
-		return FAIL;
+		goto Cleanup;
 	}
-	assert(pp->across || pp->nacross == 0);
-	
 	/* key columns are passed through as-is, verbatim */
 	for (i=0; i < input.row_key.nkeys; i++) {
 		assert(i < nkeys);
 		metadata[i].name = strdup(dbcolname(dbproc, keys[i]));
-		metadata[i].pacross = NULL;
+		metadata[i].across = -1;
 		col_cpy(&metadata[i].col, input.row_key.keys+i);
 	}
 
 	/* pivoted columms are found in the "across" data */
-	for (i=0, pmeta = metadata + input.row_key.nkeys; i < pp->nacross; i++) {
+	for (pacross = across; pacross; pacross = pacross->next) {
 		struct col_t col;
+		i = pacross->idx;
+		pmeta = metadata + input.row_key.nkeys + i;
 		if (!col_init(&col, SYBFLT8, sizeof(double)))
-			return FAIL;
-		assert(pmeta + i < metadata + nmeta);
-		pmeta[i].name = make_col_name(dbproc, pp->across+i);
-		if (!pmeta[i].name)
-			return FAIL;
-		assert(pp->across);
-		pmeta[i].pacross = pp->across + i;
-		col_cpy(&pmeta[i].col, pp->nout? &pp->output[0].value : &col);
+			goto Cleanup;
+		assert(pmeta < metadata + nmeta);
+		pmeta->name = make_col_name(dbproc, &pacross->key);
+		if (!pmeta->name)
+			goto Cleanup;
+		pmeta->across = i;
+		col_cpy(&pmeta->col, first ? &first->value : &col);
 	}
 
-	if (!reinit_results(dbproc->tds_socket, nmeta, metadata)) {
-		return FAIL;
-	}
+	if (!reinit_results(dbproc->tds_socket, nmeta, metadata))
+		goto Cleanup;
+
+	/* dbnextrow() will not be called for an empty result */
+	if (!pp->rows)
+		pivot_free(pp);
 	
-	return SUCCEED;
+	ret = SUCCEED;
+
+Cleanup:
+	/* input buffers can be still bound to the original results */
+	if (ret != SUCCEED) {
+		unbind_cols(dbproc, nkeys, keys);
+		unbind_cols(dbproc, ncols, cols);
+		unbind_cols(dbproc, 1, &val);
+	}
+	key_free(&input.row_key);
+	key_free(&input.col_key);
+	col_free(&input.value);
+	if (metadata) {
+		for (i = 0; i < nmeta; i++) {
+			free(metadata[i].name);
+			col_free(&metadata[i].col);
+		}
+		free(metadata);
+	}
+	tds_hash_free(&row_index);
+	tds_hash_free(&col_index);
+	tds_hash_free(&agg_index);
+	if (ret != SUCCEED)
+		pivot_free(pp);
+	return ret;
 }
 
 /* 
@@ -0,0 +1,155 @@
+/*
+ * Purpose: Test dbpivot with many rows and columns
+ * Functions: dbpivot dbnextrow dbnumcols
+ *
+ * Set PIVOT=bench to pivot a larger input and print how long it takes.
+ */
+
+#include "common.h"
+
+#include <freetds/time.h>
+
+static int num_rows = 100, num_cols = 200, num_repeats = 5;
+static bool bench = false;
+
+static int failed = 0;
+
+#ifndef DBNTWIN32
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+static void
+exec_cmd(DBPROCESS *dbproc)
+{
+	dbsqlexec(dbproc);
+	while (dbresults(dbproc) == SUCCEED) {
+		/* nop */
+	}
+}
+
+static void
+test_pivot(DBPROCESS *dbproc)
+{
+	int keys[1] = { 1 }, cols[1] = { 2 };
+	char key[32];
+	DBINT *values;
+	int i, rows = 0;
+	double start, pivoted = 0;
+
+	values = (DBINT *) calloc(num_cols, sizeof(DBINT));
+	assert(values);
+
+	dbcmd(dbproc, "create table #num(n int not null)");
+	exec_cmd(dbproc);
+	dbfcmd(dbproc, "declare @n int select @n = 0 while @n < %d begin insert into #num values(@n) select @n = @n + 1 end",
+	       TDS_MAX(TDS_MAX(num_rows, num_cols), num_repeats));
+	exec_cmd(dbproc);
+
+	dbfcmd(dbproc, "select 'row' + convert(varchar(10), a.n) as k, b.n as c, 1 as v "
+	       "from #num a, #num b, #num r where a.n < %d and b.n < %d and r.n < %d", num_rows, num_cols, num_repeats);
+	dbsqlexec(dbproc);
+	if (dbresults(dbproc) != SUCCEED) {
+		fprintf(stderr, "Was expecting a result set.\n");
+		exit(1);
+	}
+
+	start = now();
+	if (dbpivot(dbproc, 1, keys, 1, cols, dbpivot_sum, 3) != SUCCEED) {
+		fprintf(stderr, "dbpivot failed\n");
+		exit(1);
+	}
+	if (bench)
+		pivoted = now();
+
+	if (dbnumcols(dbproc) != 1 + num_cols) {
+		fprintf(stderr, "Expected %d columns, got %d\n", 1 + num_cols, dbnumcols(dbproc));
+		exit(1);
+	}
+
+	dbbind(dbproc, 1, NTBSTRINGBIND, sizeof(key), (BYTE *) key);
+	for (i = 0; i < num_cols; i++)
+		dbbind(dbproc, i + 2, INTBIND, 0, (BYTE *) &values[i]);
+
+	while (dbnextrow(dbproc) == REG_ROW) {
+		for (i = 0; i < num_cols; i++) {
+			if (values[i] != num_repeats) {
+				fprintf(stderr, "Wrong value for row %s column %d: %d\n", key, i, (int) values[i]);
+				failed = 1;
+			}
+		}
+		++rows;
+	}
+	if (rows != num_rows) {
+		fprintf(stderr, "Expected %d rows, got %d\n", num_rows, rows);
+		failed = 1;
+	}
+	if (bench)
+		printf("pivoted %d rows into %d rows and %d columns: dbpivot %.3f seconds, dbnextrow %.3f seconds\n",
+		       num_rows * num_cols * num_repeats, num_rows, num_cols, pivoted - start, now() - pivoted);
+	free(values);
+
+	while (dbresults(dbproc) == SUCCEED) {
+		/* nop */
+	}
+	dbcmd(dbproc, "drop table #num");
+	exec_cmd(dbproc);
+}
+#endif
+
+TEST_MAIN()
+{
+	LOGINREC *login;
+	DBPROCESS *dbproc;
+	const char *s;
+
+	set_malloc_options();
+
+	if ((s = getenv("PIVOT")) != NULL && 0 == strcmp(s, "bench")) {
+		bench = true;
+		num_rows = 2000;
+		num_cols = 500;
+		num_repeats = 4;
+	}
+
+	read_login_info(argc, argv);
+
+	printf("Starting %s\n", argv[0]);
+
+	dbinit();
+
+	dberrhandle(syb_err_handler);
+	dbmsghandle(syb_msg_handler);
+
+	printf("About to logon\n");
+
+	login = dblogin();
+	DBSETLPWD(login, PASSWORD);
+	DBSETLUSER(login, USER);
+	DBSETLAPP(login, "pivot");
+
+	printf("About to open\n");
+
+	dbproc = dbopen(login, SERVER);
+	if (!dbproc) {
+		fprintf(stderr, "Unable to connect to %s\n", SERVER);
+		return 1;
+	}
+	if (strlen(DATABASE))
+		dbuse(dbproc, DATABASE);
+	dbloginfree(login);
+
+#ifndef DBNTWIN32
+	test_pivot(dbproc);
+#endif
+
+	dbexit();
+
+	printf("%s %s\n", __FILE__, (failed ? "failed!" : "OK"));
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Purpose: Test writing text values to a file descriptor
+ * Functions: dbreadtextfd
+ */
+
+#include "common.h"
+
+static int failed = 0;
+
+#ifndef DBNTWIN32
+static void
+exec_cmd(DBPROCESS *dbproc)
+{
+	dbsqlexec(dbproc);
+	while (dbresults(dbproc) == SUCCEED) {
+		/* nop */
+	}
+}
+
+/* read next value into a temporary file and check its content */
+static void
+check_value(DBPROCESS *dbproc, char c, DBBIGINT expected)
+{
+	DBBIGINT len, size = 0;
+	FILE *f;
+	int ch;
+
+	f = tmpfile();
+	if (!f) {
+		fprintf(stderr, "Error creating temporary file\n");
+		exit(1);
+	}
+
+	len = dbreadtextfd(dbproc, fileno(f));
+	if (len != expected) {
+		fprintf(stderr, "Wrong length %ld, expected %ld\n", (long) len, (long) expected);
+		failed = 1;
+	}
+
+	rewind(f);
+	while ((ch = getc(f)) != EOF) {
+		if (ch != c) {
+			fprintf(stderr, "Wrong data at position %ld\n", (long) size);
+			failed = 1;
+			break;
+		}
+		++size;
+	}
+	fclose(f);
+	if (size != (expected > 0 ? expected : 0)) {
+		fprintf(stderr, "Wrong file size %ld, expected %ld\n", (long) size, (long) expected);
+		failed = 1;
+	}
+}
+
+static void
+test_readtextfd(DBPROCESS *dbproc)
+{
+	int len_a = 200, len_b = 150;
+
+	dbcmd(dbproc, "create table #readtextfd(i int not null, t text null)");
+	exec_cmd(dbproc);
+
+	/* use values bigger than a packet if the server allows it */
+#ifdef DBTDS_7_2
+	if (dbtds(dbproc) >= DBTDS_7_2) {
+		len_a = 100000;
+		len_b = 70000;
+		dbfcmd(dbproc, "insert into #readtextfd values(1, replicate(convert(varchar(max), 'a'), %d)) "
+		       "insert into #readtextfd values(2, null) "
+		       "insert into #readtextfd values(3, replicate(convert(varchar(max), 'b'), %d))", len_a, len_b);
+	} else
+#endif
+	{
+		dbfcmd(dbproc, "insert into #readtextfd values(1, replicate('a', %d)) "
+		       "insert into #readtextfd values(2, null) "
+		       "insert into #readtextfd values(3, replicate('b', %d))", len_a, len_b);
+	}
+	exec_cmd(dbproc);
+
+	dbcmd(dbproc, "select t from #readtextfd order by i");
+	dbsqlexec(dbproc);
+	if (dbresults(dbproc) != SUCCEED) {
+		fprintf(stderr, "Was expecting a result set.\n");
+		exit(1);
+	}
+
+	check_value(dbproc, 'a', len_a);
+	/* NULL value writes nothing */
+	check_value(dbproc, 0, 0);
+	check_value(dbproc, 'b', len_b);
+	check_value(dbproc, 0, NO_MORE_ROWS);
+
+	while (dbresults(dbproc) == SUCCEED) {
+		/* nop */
+	}
+}
+#endif
+
+TEST_MAIN()
+{
+	LOGINREC *login;
+	DBPROCESS *dbproc;
+
+	set_malloc_options();
+
+	read_login_info(argc, argv);
+
+	printf("Starting %s\n", argv[0]);
+
+	dbinit();
+
+	dberrhandle(syb_err_handler);
+	dbmsghandle(syb_msg_handler);
+
+	printf("About to logon\n");
+
+	login = dblogin();
+	DBSETLPWD(login, PASSWORD);
+	DBSETLUSER(login, USER);
+	DBSETLAPP(login, "readtextfd");
+
+	printf("About to open\n");
+
+	dbproc = dbopen(login, SERVER);
+	if (!dbproc) {
+		fprintf(stderr, "Unable to connect to %s\n", SERVER);
+		return 1;
+	}
+	if (strlen(DATABASE))
+		dbuse(dbproc, DATABASE);
+	dbloginfree(login);
+
+#ifndef DBNTWIN32
+	test_readtextfd(dbproc);
+#endif
+
+	dbexit();
+
+	printf("%s %s\n", __FILE__, (failed ? "failed!" : "OK"));
+	return failed ? 1 : 0;
+}
@@ -23,6 +23,8 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 
 #if HAVE_STRING_H
 #include <string.h>
@@ -41,6 +43,7 @@
 #endif
 
 #include <freetds/tds.h>
+#include <freetds/utils.h>
 #include <freetds/iconv.h>
 #include <freetds/convert.h>
 #include <freetds/odbc.h>
@@ -704,3 +707,508 @@ odbc_bcp_free_storage(TDS_DBC *dbc)
 	dbc->bcpinfo = NULL;
 }
 
+
+/*
+ * Bulk copy of parameter arrays.
+ * Simple INSERT statements with only placeholders as values and more rows
+ * of parameters are sent using a single bulk copy operation instead of
+ * executing the statement for every row.
+ */
+
+#define TDS_ISSPACE(c) isspace((unsigned char) (c))
+
+/** information about a simple INSERT statement */
+typedef struct odbc_bulk_insert
+{
+	/** table name, as written in the statement */
+	const char *table;
+	size_t table_len;
+	/** unquoted names of the columns, NULL if not specified */
+	char **columns;
+	/** number of columns or placeholders */
+	int num_columns;
+	/** for each table column index of the parameter, -1 if not sent */
+	int *params;
+} ODBC_BULK_INSERT;
+
+static const char *
+odbc_bulk_skip_spaces(const char *s)
+{
+	for (;;) {
+		while (TDS_ISSPACE(*s))
+			++s;
+		if ((s[0] == '-' && s[1] == '-') || (s[0] == '/' && s[1] == '*'))
+			s = tds_skip_comment(s);
+		else
+			return s;
+	}
+}
+
+static bool
+odbc_bulk_is_ident(char c)
+{
+	return isalnum((unsigned char) c) || c == '_' || c == '@' || c == '#' || c == '$';
+}
+
+/**
+ * Skip a keyword and following spaces.
+ * \return pointer after the keyword or NULL if keyword does not match
+ */
+static const char *
+odbc_bulk_skip_keyword(const char *s, const char *keyword)
+{
+	size_t len = strlen(keyword);
+
+	if (strncasecmp(s, keyword, len) != 0 || odbc_bulk_is_ident(s[len]))
+		return NULL;
+	return odbc_bulk_skip_spaces(s + len);
+}
+
+/**
+ * Skip an identifier, either quoted or not.
+ * \return pointer after the identifier or NULL if not found
+ */
+static const char *
+odbc_bulk_skip_ident(const char *s)
+{
+	const char *start = s;
+
+	if (*s == '[' || *s == '"') {
+		s = tds_skip_quoted(s);
+		return s[-1] == (*start == '[' ? ']' : '"') && s - start > 2 ? s : NULL;
+	}
+	while (odbc_bulk_is_ident(*s))
+		++s;
+	return s == start ? NULL : s;
+}
+
+/** Return an allocated copy of an identifier without quoting */
+static char *
+odbc_bulk_unquote(const char *s, const char *end)
+{
+	char *name, *p;
+	char quote;
+
+	if (*s != '[' && *s != '"')
+		return tds_strndup(s, end - s);
+
+	quote = *s == '[' ? ']' : '"';
+	p = name = tds_new(char, end - s);
+	if (!name)
+		return NULL;
+	for (++s, --end; s < end; ++s) {
+		*p++ = *s;
+		if (*s == quote)
+			++s;
+	}
+	*p = 0;
+	return name;
+}
+
+static void
+odbc_bulk_free(ODBC_BULK_INSERT *ins)
+{
+	int i;
+
+	if (ins->columns) {
+		for (i = 0; i < ins->num_columns; ++i)
+			free(ins->columns[i]);
+		free(ins->columns);
+	}
+	free(ins->params);
+}
+
+/**
+ * Parse a statement in the form
+ * INSERT [INTO] table [(column, ...)] VALUES (?, ...)
+ * \return true if statement has this form
+ */
+static bool
+odbc_bulk_parse(const char *s, ODBC_BULK_INSERT *ins)
+{
+	const char *p;
+	int num_columns = 0;
+
+	s = odbc_bulk_skip_keyword(odbc_bulk_skip_spaces(s), "insert");
+	if (!s)
+		return false;
+	if ((p = odbc_bulk_skip_keyword(s, "into")) != NULL)
+		s = p;
+
+	/* table name, possibly qualified */
+	ins->table = s;
+	for (;;) {
+		if ((s = odbc_bulk_skip_ident(s)) == NULL)
+			return false;
+		if (*s != '.')
+			break;
+		++s;
+	}
+	ins->table_len = s - ins->table;
+	s = odbc_bulk_skip_spaces(s);
+
+	/* column list */
+	if (*s == '(') {
+		do {
+			s = odbc_bulk_skip_spaces(s + 1);
+			if ((p = odbc_bulk_skip_ident(s)) == NULL)
+				return false;
+			if (!TDS_RESIZE(ins->columns, num_columns + 1))
+				return false;
+			ins->columns[num_columns] = odbc_bulk_unquote(s, p);
+			if (!ins->columns[num_columns])
+				return false;
+			ins->num_columns = ++num_columns;
+			s = odbc_bulk_skip_spaces(p);
+		} while (*s == ',');
+		if (*s != ')')
+			return false;
+		s = odbc_bulk_skip_spaces(s + 1);
+	}
+
+	/* values, only placeholders */
+	s = odbc_bulk_skip_keyword(s, "values");
+	if (!s || *s != '(')
+		return false;
+	num_columns = 0;
+	do {
+		s = odbc_bulk_skip_spaces(s + 1);
+		if (*s != '?')
+			return false;
+		++num_columns;
+		s = odbc_bulk_skip_spaces(s + 1);
+	} while (*s == ',');
+	if (*s != ')')
+		return false;
+	s = odbc_bulk_skip_spaces(s + 1);
+	if (*s == ';')
+		s = odbc_bulk_skip_spaces(s + 1);
+	if (*s)
+		return false;
+
+	if (ins->columns && ins->num_columns != num_columns)
+		return false;
+	ins->num_columns = num_columns;
+	return true;
+}
+
+/** test if a column is sent during bulk copy */
+static bool
+odbc_bulk_column_sent(const TDSCOLUMN *col)
+{
+	return !col->column_identity && !col->column_timestamp && !col->column_computed;
+}
+
+/**
+ * Associate every table column with a parameter and check conversions are supported.
+ * Statements not inserting all columns are not handled as bulk copy would
+ * insert NULLs instead of default values.
+ */
+static bool
+odbc_bulk_map_columns(TDS_STMT *stmt, ODBC_BULK_INSERT *ins, TDSBCPINFO *bcpinfo)
+{
+	TDSCONNECTION *conn = stmt->tds->conn;
+	TDSRESULTINFO *bindinfo = bcpinfo->bindinfo;
+	int i, n, num_sent = 0;
+
+	ins->params = tds_new(int, bindinfo->num_cols);
+	if (!ins->params)
+		return false;
+	for (i = 0; i < bindinfo->num_cols; ++i)
+		ins->params[i] = -1;
+
+	/* find column of every parameter, each column can be listed once */
+	if (ins->columns) {
+		for (n = 0; n < ins->num_columns; ++n) {
+			int pos = tds_find_column(bindinfo, ins->columns[n], strlen(ins->columns[n]));
+
+			if (pos < 0 || ins->params[pos] >= 0)
+				return false;
+			ins->params[pos] = n;
+		}
+	}
+
+	for (i = 0; i < bindinfo->num_cols; ++i) {
+		TDSCOLUMN *bindcol = bindinfo->columns[i];
+		const TDSCOLUMN *param;
+		const struct _drecord *drec_apd;
+		TDS_SERVER_TYPE srctype, desttype;
+		int c_type, src_charset;
+
+		n = ins->columns ? ins->params[i] : num_sent;
+		ins->params[i] = -1;
+		if (!odbc_bulk_column_sent(bindcol))
+			continue;
+
+		if (n < 0 || n >= ins->num_columns)
+			return false;
+		ins->params[i] = n;
+		++num_sent;
+
+		/* check types, data is converted by odbc_bulk_convert */
+		param = stmt->params->columns[n];
+		if (is_blob_col(bindcol))
+			return false;
+		srctype = tds_get_conversion_type(param->column_type, param->column_size);
+		desttype = tds_get_conversion_type(bindcol->column_type, bindcol->column_size);
+		if (is_char_type(srctype) != is_char_type(desttype)
+		    || is_binary_type(srctype) != is_binary_type(desttype))
+			return false;
+		if (!is_char_type(desttype) || !bindcol->char_conv)
+			continue;
+
+		/* compute conversion from parameter data to column */
+		drec_apd = &stmt->apd->records[n];
+		c_type = drec_apd->sql_desc_concise_type;
+		if (c_type == SQL_C_DEFAULT)
+			c_type = odbc_sql_to_c_type_default(stmt->ipd->records[n].sql_desc_concise_type);
+		if (c_type == SQL_C_BINARY) {
+			bindcol->char_conv = NULL;
+			continue;
+		}
+		if (param->char_conv)
+			src_charset = param->char_conv->from.charset.canonic;
+		else
+			src_charset = conn->char_convs[client2server_chardata]->from.charset.canonic;
+		bindcol->char_conv = tds_iconv_get_info(conn, src_charset, bindcol->char_conv->to.charset.canonic);
+		if (!bindcol->char_conv)
+			return false;
+	}
+
+	/* all parameters should be used */
+	return num_sent == ins->num_columns;
+}
+
+/**
+ * Convert parameter data to the format expected by bulk copy.
+ * Errors are reported to the statement.
+ */
+static bool
+odbc_bulk_convert(TDS_STMT *stmt, const TDSCOLUMN *param, TDSCOLUMN *bindcol)
+{
+	BCPCOLDATA *coldata = bindcol->bcp_column_data;
+	TDS_SERVER_TYPE srctype, desttype;
+	const TDS_CHAR *src;
+	size_t srclen, destlen;
+
+	if (param->column_cur_size < 0) {
+		if (!bindcol->column_nullable && !is_nullable_type(bindcol->on_server.column_type)) {
+			odbc_errs_add(&stmt->errs, "23000", NULL);
+			return false;
+		}
+		coldata->is_null = true;
+		coldata->datalen = 0;
+		return true;
+	}
+
+	src = (const TDS_CHAR *) param->column_data;
+	if (is_blob_col(param))
+		src = ((const TDSBLOB *) src)->textvalue;
+	srclen = param->column_cur_size;
+	srctype = tds_get_conversion_type(param->column_type, param->column_size);
+	desttype = tds_get_conversion_type(bindcol->column_type, bindcol->column_size);
+	destlen = bindcol->column_size;
+
+	if (is_char_type(desttype) && bindcol->char_conv) {
+		char *dest = (char *) coldata->data;
+
+		if (tds_iconv(stmt->tds, bindcol->char_conv, to_server, &src, &srclen, &dest, &destlen) == (size_t) -1
+		    || srclen) {
+			odbc_errs_add(&stmt->errs, errno == EILSEQ ? "22018" : "22001", NULL);
+			return false;
+		}
+		srclen = dest - (char *) coldata->data;
+	} else if (is_char_type(desttype) || is_binary_type(desttype)) {
+		if (srclen > destlen) {
+			odbc_errs_add(&stmt->errs, "22001", NULL);
+			return false;
+		}
+		memcpy(coldata->data, src, srclen);
+	} else if (srctype == desttype && !is_numeric_type(desttype)) {
+		memcpy(coldata->data, src, srclen);
+	} else {
+		CONV_RESULT cr;
+		TDS_INT res;
+
+		if (is_numeric_type(desttype)) {
+			cr.n.precision = bindcol->column_prec;
+			cr.n.scale = bindcol->column_scale;
+		}
+		res = tds_convert(stmt->dbc->env->tds_ctx, srctype, src, srclen, desttype, &cr);
+		if (res < 0) {
+			odbc_convert_err_set(&stmt->errs, res);
+			return false;
+		}
+		memcpy(coldata->data, &cr, res);
+		srclen = res;
+	}
+	coldata->datalen = (TDS_INT) srclen;
+	coldata->is_null = false;
+	return true;
+}
+
+static TDSRET
+odbc_bulk_get_col_data(TDSBCPINFO *bcpinfo TDS_UNUSED, TDSCOLUMN *bindcol TDS_UNUSED, int offset TDS_UNUSED)
+{
+	/* data was already converted by odbc_bulk_convert */
+	return TDS_SUCCESS;
+}
+
+/**
+ * Convert a row of parameters.
+ * \return true if the row can be sent
+ */
+static bool
+odbc_bulk_row(TDS_STMT *stmt, const ODBC_BULK_INSERT *ins, TDSBCPINFO *bcpinfo)
+{
+	TDSRESULTINFO *bindinfo = bcpinfo->bindinfo;
+	int i;
+
+	if (stmt->curr_param_row > 0 && next_row_prepared_query(stmt) != SQL_SUCCESS)
+		return false;
+
+	for (i = 0; i < bindinfo->num_cols; ++i) {
+		if (ins->params[i] < 0)
+			continue;
+		if (!odbc_bulk_convert(stmt, stmt->params->columns[ins->params[i]], bindinfo->columns[i]))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Abort a bulk copy after a failure sending rows.
+ * Data not sent yet is dropped and the server is asked to discard
+ * the rows already received.
+ */
+static void
+odbc_bulk_abort(TDSSOCKET *tds)
+{
+	if (tds->state != TDS_SENDING || tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return;
+	tds_init_write_buf(tds);
+	tds_set_state(tds, TDS_PENDING);
+	if (TDS_SUCCEED(tds_send_cancel(tds)))
+		tds_process_cancel(tds);
+}
+
+/**
+ * Execute a parameter array using bulk copy.
+ * Only simple INSERT statements using all input parameters are handled;
+ * if the statement cannot be handled nothing is sent to the server.
+ * Row status and number of rows processed are updated like for normal
+ * executions. Bulk copy is atomic so if the server rejects it no row
+ * is inserted; the caller then executes the rows one by one to get
+ * the status of each row.
+ * \return true if statement was executed, false if caller should execute it normally
+ */
+bool
+odbc_bulk_insert_params(TDS_STMT *stmt)
+{
+	TDSSOCKET *tds = stmt->tds;
+	ODBC_BULK_INSERT ins;
+	TDSBCPINFO *bcpinfo = NULL;
+	SQLUSMALLINT *status_ptr = stmt->ipd->header.sql_desc_array_status_ptr;
+	bool handled = false, found_error = false;
+	int i, rows_copied = 0;
+	TDSRET rc;
+
+	tdsdump_log(TDS_DBG_FUNC, "odbc_bulk_insert_params(%p)\n", stmt);
+
+	if (!IS_TDS7_PLUS(tds->conn) || !stmt->params || stmt->prepared_query_is_rpc || stmt->prepared_query_is_func
+	    || stmt->attr.cursor_type != SQL_CURSOR_FORWARD_ONLY || stmt->attr.concurrency != SQL_CONCUR_READ_ONLY)
+		return false;
+	for (i = 0; i < stmt->params->num_cols; ++i)
+		if (stmt->ipd->records[i].sql_desc_parameter_type != SQL_PARAM_INPUT)
+			return false;
+
+	memset(&ins, 0, sizeof(ins));
+	if (!odbc_bulk_parse(tds_dstr_cstr(&stmt->query), &ins) || ins.num_columns != stmt->params->num_cols)
+		goto Cleanup;
+
+	/* get table information */
+	bcpinfo = tds_alloc_bcpinfo();
+	if (!bcpinfo || !tds_dstr_copyn(&bcpinfo->tablename, ins.table, ins.table_len)
+	    || !tds_dstr_copy(&bcpinfo->hint, "CHECK_CONSTRAINTS, FIRE_TRIGGERS, KEEP_NULLS"))
+		goto Cleanup;
+	bcpinfo->direction = TDS_BCP_IN;
+	bcpinfo->parent = stmt;
+	if (TDS_FAILED(tds_bcp_init(tds, bcpinfo))) {
+		/* execute normally to report errors */
+		if (tds->state == TDS_IDLE) {
+			odbc_errs_reset(&stmt->errs);
+		} else {
+			handled = true;
+			if (!stmt->errs.num_errors)
+				odbc_errs_add(&stmt->errs, "HY000", "Bulk copy failed");
+			stmt->errs.lastrc = SQL_ERROR;
+		}
+		goto Cleanup;
+	}
+	if (!odbc_bulk_map_columns(stmt, &ins, bcpinfo))
+		goto Cleanup;
+
+	tdsdump_log(TDS_DBG_INFO1, "Sending %u rows using bulk copy\n", (unsigned int) stmt->num_param_rows);
+	handled = true;
+	rc = tds_bcp_start_copy_in(tds, bcpinfo);
+	for (stmt->curr_param_row = 0; TDS_SUCCEED(rc) && stmt->curr_param_row < stmt->num_param_rows; ++stmt->curr_param_row) {
+		SQLUSMALLINT param_status = SQL_PARAM_SUCCESS;
+
+		if (!odbc_bulk_row(stmt, &ins, bcpinfo)) {
+			found_error = true;
+			param_status = SQL_PARAM_ERROR;
+		} else {
+			rc = tds_bcp_send_record(tds, bcpinfo, odbc_bulk_get_col_data, NULL, 0);
+		}
+		if (status_ptr)
+			status_ptr[stmt->curr_param_row] = param_status;
+	}
+	if (TDS_SUCCEED(rc))
+		rc = tds_bcp_done(tds, &rows_copied);
+	else
+		odbc_bulk_abort(tds);
+	if (TDS_FAILED(rc) && tds->state == TDS_IDLE) {
+		/* nothing inserted, execute rows one by one to report each row status */
+		tdsdump_log(TDS_DBG_INFO1, "Bulk copy failed, executing rows one by one\n");
+		odbc_errs_reset(&stmt->errs);
+		handled = false;
+		goto Cleanup;
+	}
+	if (TDS_FAILED(rc)) {
+		/* the whole bulk operation failed, rows not sent were not processed */
+		if (status_ptr) {
+			for (i = 0; i < stmt->curr_param_row; ++i)
+				status_ptr[i] = SQL_PARAM_ERROR;
+			for (; i < (int) stmt->num_param_rows; ++i)
+				status_ptr[i] = SQL_PARAM_UNUSED;
+		}
+		found_error = true;
+		rows_copied = 0;
+		if (!stmt->errs.num_errors)
+			odbc_errs_add(&stmt->errs, "HY000", "Bulk copy failed");
+	}
+
+	if (stmt->ipd->header.sql_desc_rows_processed_ptr)
+		*stmt->ipd->header.sql_desc_rows_processed_ptr = stmt->curr_param_row;
+	stmt->row_count = rows_copied;
+	stmt->row_status = NOT_IN_ROW;
+
+	/* like normal execution, report row errors only with a status array */
+	if (found_error && status_ptr && TDS_SUCCEED(rc))
+		stmt->errs.lastrc = SQL_SUCCESS_WITH_INFO;
+	else if (found_error)
+		stmt->errs.lastrc = SQL_ERROR;
+
+Cleanup:
+	tds_free_bcpinfo(bcpinfo);
+	odbc_bulk_free(&ins);
+	/* parameters were converted for other rows, compute first row again */
+	if (!handled && stmt->curr_param_row > 0) {
+		stmt->curr_param_row = 0;
+		if (start_parse_prepared_query(stmt, true) != SQL_SUCCESS) {
+			stmt->errs.lastrc = SQL_ERROR;
+			return true;
+		}
+	}
+	return handled;
+}
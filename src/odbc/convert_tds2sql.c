@@ -58,16 +58,11 @@ eat_iconv_left(TDSCOLUMN * curcol, char **pbuf, size_t *plen)
 }
 
 /**
- * Handle conversions from TDS (N)CHAR to ODBC (W)CHAR
+ * Get the converter from TDS (N)CHAR column to ODBC (W)CHAR
  */
-static SQLLEN
-odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT srclen,
-		  int desttype, TDS_CHAR * dest, SQLULEN destlen)
+TDSICONV *
+odbc_char_conv(TDS_STMT * stmt, TDSCOLUMN * curcol, int desttype)
 {
-	const char *ib;
-	char *ob;
-	size_t il, ol, char_size;
-
 	/* FIXME MARS not correct cause is the global tds but stmt->tds can be NULL on SQLGetData */
 	TDSSOCKET *tds = stmt->dbc->tds_socket;
 
@@ -89,6 +84,23 @@ odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT
 			conv = tds_iconv_get_info(tds->conn, TDS_CHARSET_ISO_8859_1, TDS_CHARSET_ISO_8859_1);
 #endif
 	}
+	return conv;
+}
+
+/**
+ * Handle conversions from TDS (N)CHAR to ODBC (W)CHAR
+ */
+static SQLLEN
+odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT srclen,
+		  int desttype, TDS_CHAR * dest, SQLULEN destlen)
+{
+	const char *ib;
+	char *ob;
+	size_t il, ol, char_size;
+
+	/* FIXME MARS not correct cause is the global tds but stmt->tds can be NULL on SQLGetData */
+	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	TDSICONV *conv = odbc_char_conv(stmt, curcol, desttype);
 
 	ib = src;
 	il = srclen;
@@ -103,6 +115,8 @@ odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT
 			memset(&conv->suppress, 0, sizeof(conv->suppress));
 			conv->suppress.eilseq = 1;
 			conv->suppress.e2big = 1;
+			/* partial character will be completed reading more data */
+			conv->suppress.einval = curcol->column_stream_pending;
 			/* TODO check return value */
 			tds_iconv(tds, conv, to_client, &ib, &il, &ob, &ol);
 		}
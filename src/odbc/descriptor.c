@@ -94,9 +94,11 @@ desc_alloc_records(TDS_DESC * desc, SQLSMALLINT count)
 		for (i = count; i < desc->header.sql_desc_count; ++i)
 			desc_free_record(&desc->records[i]);
 		desc->header.sql_desc_count = count;
+		++desc->version;
 		return SQL_SUCCESS;
 	}
 
+	++desc->version;
 	if (!TDS_RESIZE(desc->records, count))
 		return SQL_ERROR;
 	memset(desc->records + desc->header.sql_desc_count, 0, sizeof(struct _drecord) * (count - desc->header.sql_desc_count));
@@ -146,6 +148,7 @@ desc_free_records(TDS_DESC * desc)
 	}
 
 	desc->header.sql_desc_count = 0;
+	++desc->version;
 	return SQL_SUCCESS;
 }
 
@@ -192,6 +195,7 @@ desc_copy(TDS_DESC * dest, TDS_DESC * src)
 	/* success, copy back to our descriptor */
 	desc_free_records(dest);
 	odbc_errs_reset(&dest->errs);
+	tmp.version = dest->version + 1;
 	*dest = tmp;
 	return SQL_SUCCESS;
 
@@ -37,6 +37,7 @@
 #include <freetds/utils.h>
 #include <freetds/odbc.h>
 #include <freetds/iconv.h>
+#include <freetds/stream.h>
 #include <freetds/utils/string.h>
 #include <freetds/convert.h>
 #include <freetds/encodings.h>
@@ -62,6 +63,8 @@ static SQLRETURN odbc_SQLFreeEnv(SQLHENV henv);
 static SQLRETURN odbc_SQLFreeStmt(SQLHSTMT hstmt, SQLUSMALLINT fOption, int force);
 static SQLRETURN odbc_SQLFreeDesc(SQLHDESC hdesc);
 static SQLRETURN odbc_SQLExecute(TDS_STMT * stmt);
+static SQLRETURN odbc_execute_results(TDS_STMT * stmt);
+static void odbc_param_stream_abort(TDS_STMT * stmt);
 static SQLRETURN odbc_SQLSetStmtAttr(SQLHSTMT hstmt, SQLINTEGER Attribute, SQLPOINTER ValuePtr, SQLINTEGER StringLength WIDE);
 static SQLRETURN odbc_SQLGetStmtAttr(SQLHSTMT hstmt, SQLINTEGER Attribute, SQLPOINTER Value, SQLINTEGER BufferLength,
 				     SQLINTEGER * StringLength WIDE);
@@ -167,6 +170,7 @@ odbc_col_setname(TDS_STMT * stmt, int colpos, const char *name)
 			if (!tds_dstr_copy(&resinfo->columns[colpos - 1]->column_name, name))
 				odbc_errs_add(&stmt->errs, "HY001", NULL);
 			tds_dstr_empty(&resinfo->columns[colpos - 1]->table_column_name);
+			tds_reset_column_index(resinfo);
 		}
 	}
 #endif
@@ -389,7 +393,7 @@ odbc_connect(TDS_DBC * dbc, TDSLOGIN * login)
 
 	if (dbc->attr.mars_enabled != SQL_MARS_ENABLED_NO)
 		login->mars = 1;
-	if (dbc->attr.bulk_enabled != SQL_BCP_OFF)
+	if (dbc->attr.bulk_enabled != SQL_BCP_OFF || dbc->attr.bulk_insert != SQL_BULK_INSERT_OFF)
 		tds_set_bulk(login, true);
 
 #ifdef ENABLE_ODBC_WIDE
@@ -514,6 +518,7 @@ odbc_prepare(TDS_STMT *stmt)
 	TDSSOCKET *tds = stmt->tds;
 	bool in_row = false;
 
+	odbc_use_wide_query(stmt);
 	if (TDS_FAILED(tds_submit_prepare(tds, tds_dstr_cstr(&stmt->query), NULL, &stmt->dyn, stmt->params))) {
 		ODBC_SAFE_ERROR(stmt);
 		return SQL_ERROR;
@@ -1766,6 +1771,11 @@ odbc_SQLAllocConnect(SQLHENV henv, SQLHDBC FAR * phdbc)
 	dbc->attr.txn_isolation = SQL_TXN_READ_COMMITTED;
 	dbc->attr.mars_enabled = SQL_MARS_ENABLED_NO;
 	dbc->attr.bulk_enabled = SQL_BCP_OFF;
+	dbc->attr.bulk_insert = SQL_BULK_INSERT_OFF;
+	dbc->attr.prepare_cache_size = 0;
+	dbc->attr.prepare_threshold = 0;
+	dbc->attr.stream_lobs = SQL_STREAM_LOBS_OFF;
+	odbc_prep_cache_init(&dbc->prep_cache);
 
 	tds_mutex_init(&dbc->mtx);
 	*phdbc = (SQLHDBC) dbc;
@@ -1948,6 +1958,7 @@ odbc_SQLAllocStmt(SQLHDBC hdbc, SQLHSTMT FAR * phstmt)
 	tds_dstr_init(&stmt->attr.qn_msgtext);
 	tds_dstr_init(&stmt->attr.qn_options);
 	stmt->attr.qn_timeout = 432000;
+	stmt->attr.getdata_fd = -1;
 
 	stmt->sql_rowset_size = 1;
 
@@ -2022,6 +2033,7 @@ SQLBindCol(SQLHSTMT hstmt, SQLUSMALLINT icol, SQLSMALLINT fCType, SQLPOINTER rgb
 	}
 
 	drec = &ard->records[icol - 1];
+	++ard->version;
 
 	if (odbc_set_concise_c_type(fCType, drec, 0) != SQL_SUCCESS) {
 		desc_alloc_records(ard, orig_ard_size);
@@ -2071,6 +2083,7 @@ SQLCancel(SQLHSTMT hstmt)
 		/* FIXME test current statement */
 		/* FIXME here we are unlocked */
 
+		odbc_param_stream_abort(stmt);
 		if (TDS_FAILED(tds_send_cancel(tds))) {
 			ODBC_SAFE_ERROR(stmt);
 			ODBC_EXIT_(stmt);
@@ -2517,6 +2530,8 @@ SQLDisconnect(SQLHDBC hdbc)
 #ifdef ENABLE_ODBC_WIDE
 	dbc->mb_conv = NULL;
 #endif
+	odbc_prep_cache_clear(dbc);
+
 	tds_close_socket(dbc->tds_socket);
 	tds_free_socket(dbc->tds_socket);
 	dbc->tds_socket = NULL;
@@ -2627,6 +2642,7 @@ SQLSetDescRec(SQLHDESC hdesc, SQLSMALLINT nRecordNumber, SQLSMALLINT nType, SQLS
 	}
 
 	drec = &desc->records[nRecordNumber - 1];
+	++desc->version;
 
 	/* check for valid types and return "HY021" if not */
 	if (desc->type == DESC_IPD) {
@@ -2974,6 +2990,7 @@ ODBC_FUNC(SQLSetDescField, (P(SQLHDESC,hdesc), P(SQLSMALLINT,icol), P(SQLSMALLIN
 	}
 
 	fdesc = desc_get_focused(desc);
+	++fdesc->version;
 
 	/* dont check column index for these */
 	switch (fDescType) {
@@ -3261,6 +3278,7 @@ odbc_populate_ird(TDS_STMT * stmt)
 	int i;
 
 	desc_free_records(ird);
+	TDS_ZERO_FREE(stmt->fetch_plan);
 	if (!stmt->tds || !(res_info = stmt->tds->current_results))
 		return SQL_SUCCESS;
 	if (res_info == stmt->tds->param_info)
@@ -3471,17 +3489,48 @@ odbc_init_headers(TDS_STMT * stmt, TDSHEADERS * head)
 	return head;
 }
 
+/**
+ * Send the query of a statement without preparing it.
+ */
+static TDSRET
+odbc_submit_direct(TDS_STMT * stmt)
+{
+	TDSSOCKET *tds = stmt->tds;
+	TDSHEADERS head;
+	TDSRET ret;
+
+	if (stmt->num_param_rows <= 1) {
+		if (!stmt->params)
+			return tds_submit_query_params(tds, tds_dstr_cstr(&stmt->query), NULL,
+						       odbc_init_headers(stmt, &head));
+		return tds_submit_execdirect(tds, tds_dstr_cstr(&stmt->query), stmt->params,
+					     odbc_init_headers(stmt, &head));
+	} else {
+		/* pack multiple submit using language */
+		TDSMULTIPLE multiple;
+
+		ret = tds_multiple_init(tds, &multiple, TDS_MULTIPLE_QUERY, odbc_init_headers(stmt, &head));
+		for (stmt->curr_param_row = 0; TDS_SUCCEED(ret); ) {
+			/* submit a query */
+			ret = tds_multiple_query(tds, &multiple, tds_dstr_cstr(&stmt->query), stmt->params);
+			if (++stmt->curr_param_row >= stmt->num_param_rows)
+				break;
+			/* than process others parameters */
+			/* TODO handle all results*/
+			if (next_row_prepared_query(stmt) != SQL_SUCCESS)
+				break;
+		}
+		if (TDS_SUCCEED(ret))
+			ret = tds_multiple_done(tds, &multiple);
+	}
+	return ret;
+}
+
 static SQLRETURN
 odbc_SQLExecute(TDS_STMT * stmt)
 {
 	TDSRET ret;
 	TDSSOCKET *tds;
-	TDS_INT result_type;
-	TDS_INT done = 0;
-	bool in_row = false;
-	SQLUSMALLINT param_status;
-	int found_info = 0, found_error = 0;
-	TDS_INT8 total_rows = TDS_NO_COUNT;
 	TDSHEADERS head;
 
 	tdsdump_log(TDS_DBG_FUNC, "odbc_SQLExecute(%p)\n",
@@ -3491,7 +3540,7 @@ odbc_SQLExecute(TDS_STMT * stmt)
 
 
 	/* check parameters are all OK */
-	if (stmt->params && stmt->param_num <= (int) stmt->param_count) {
+	if (stmt->params && stmt->param_num <= (int) stmt->param_count && !stmt->param_streamed) {
 		/* TODO what error ?? */
 		ODBC_SAFE_ERROR(stmt);
 		return SQL_ERROR;
@@ -3503,6 +3552,8 @@ odbc_SQLExecute(TDS_STMT * stmt)
 	tds = stmt->tds;
 	tdsdump_log(TDS_DBG_FUNC, "odbc_SQLExecute() starting with state %d\n", tds->state);
 
+	odbc_use_wide_query(stmt);
+
 	if (tds->state != TDS_IDLE) {
 		if (tds->state == TDS_DEAD) {
 			odbc_errs_add(&stmt->errs, "08S01", NULL);
@@ -3517,6 +3568,13 @@ odbc_SQLExecute(TDS_STMT * stmt)
 
 	stmt->row_count = TDS_NO_COUNT;
 
+	if (stmt->num_param_rows > 1 && stmt->dbc->attr.bulk_insert != SQL_BULK_INSERT_OFF
+	    && odbc_bulk_insert_params(stmt)) {
+		odbc_populate_ird(stmt);
+		odbc_unlock_statement(stmt);
+		ODBC_RETURN_(stmt);
+	}
+
 	if (stmt->prepared_query_is_rpc) {
 		/* TODO support stmt->apd->header.sql_desc_array_size for RPC */
 		/* get rpc name */
@@ -3538,32 +3596,7 @@ odbc_SQLExecute(TDS_STMT * stmt)
 		/* not prepared query */
 		/* TODO cursor change way of calling */
 		/* SQLExecDirect */
-		if (stmt->num_param_rows <= 1) {
-			if (!stmt->params) {
-				ret = tds_submit_query_params(tds, tds_dstr_cstr(&stmt->query), NULL,
-							      odbc_init_headers(stmt, &head));
-			} else {
-				ret = tds_submit_execdirect(tds, tds_dstr_cstr(&stmt->query), stmt->params,
-							    odbc_init_headers(stmt, &head));
-			}
-		} else {
-			/* pack multiple submit using language */
-			TDSMULTIPLE multiple;
-
-			ret = tds_multiple_init(tds, &multiple, TDS_MULTIPLE_QUERY, odbc_init_headers(stmt, &head));
-			for (stmt->curr_param_row = 0; TDS_SUCCEED(ret); ) {
-				/* submit a query */
-				ret = tds_multiple_query(tds, &multiple, tds_dstr_cstr(&stmt->query), stmt->params);
-				if (++stmt->curr_param_row >= stmt->num_param_rows)
-					break;
-				/* than process others parameters */
-				/* TODO handle all results*/
-				if (start_parse_prepared_query(stmt, true) != SQL_SUCCESS)
-					break;
-			}
-			if (TDS_SUCCEED(ret))
-				ret = tds_multiple_done(tds, &multiple);
-		}
+		ret = odbc_submit_direct(stmt);
 	} else if (stmt->num_param_rows <= 1 && IS_TDS71_PLUS(tds->conn)
 		   && (!stmt->dyn || stmt->need_reprepare || !stmt->dyn->num_id)) {
 		if (stmt->dyn) {
@@ -3572,11 +3605,27 @@ odbc_SQLExecute(TDS_STMT * stmt)
 				ODBC_RETURN(stmt, SQL_ERROR);
 		}
 		stmt->need_reprepare = 0;
-		ret = tds71_submit_prepexec(tds, tds_dstr_cstr(&stmt->query), NULL, &stmt->dyn, stmt->params);
+		switch (odbc_prep_cache_get(stmt)) {
+		case ODBC_PREP_HIT:
+			tds_free_input_params(stmt->dyn);
+			stmt->dyn->params = stmt->params;
+			/* prevent double free */
+			stmt->params = NULL;
+			ret = tds_submit_execute(tds, stmt->dyn);
+			break;
+		case ODBC_PREP_DIRECT:
+			ret = tds_submit_execdirect(tds, tds_dstr_cstr(&stmt->query), stmt->params,
+						    odbc_init_headers(stmt, &head));
+			break;
+		default:
+			ret = tds71_submit_prepexec(tds, tds_dstr_cstr(&stmt->query), NULL, &stmt->dyn, stmt->params);
+			break;
+		}
 	} else {
 		/* TODO cursor change way of calling */
 		/* SQLPrepare */
 		TDSDYNAMIC *dyn;
+		ODBC_PREP_RESULT prep = ODBC_PREP_HIT;
 
 		/* prepare dynamic query (only for first SQLExecute call) */
 		if (!stmt->dyn || (stmt->need_reprepare && !stmt->dyn->emulated && IS_TDS7_PLUS(tds->conn))) {
@@ -3587,23 +3636,31 @@ odbc_SQLExecute(TDS_STMT * stmt)
 					ODBC_RETURN(stmt, SQL_ERROR);
 			}
 			stmt->need_reprepare = 0;
-
+		}
+		if (!stmt->dyn)
+			prep = odbc_prep_cache_get(stmt);
+		if (prep == ODBC_PREP_MISS) {
 			tdsdump_log(TDS_DBG_INFO1, "Creating prepared statement\n");
 			/* TODO use tds_submit_prepexec (mssql2k, tds71) */
 			if (TDS_FAILED(tds_submit_prepare(tds, tds_dstr_cstr(&stmt->query), NULL, &stmt->dyn, stmt->params))) {
 				/* TODO ?? tds_free_param_results(params); */
+				odbc_prep_cache_put(stmt);
 				ODBC_SAFE_ERROR(stmt);
 				return SQL_ERROR;
 			}
 			if (TDS_FAILED(tds_process_simple_query(tds))) {
 				tds_release_dynamic(&stmt->dyn);
+				odbc_prep_cache_put(stmt);
 				/* TODO ?? tds_free_param_results(params); */
 				ODBC_SAFE_ERROR(stmt);
 				return SQL_ERROR;
 			}
 		}
 		stmt->row_count = TDS_NO_COUNT;
-		if (stmt->num_param_rows <= 1) {
+		if (prep == ODBC_PREP_DIRECT) {
+			/* not requested enough times yet to be worth preparing */
+			ret = odbc_submit_direct(stmt);
+		} else if (stmt->num_param_rows <= 1) {
 			dyn = stmt->dyn;
 			tds_free_input_params(dyn);
 			dyn->params = stmt->params;
@@ -3625,9 +3682,12 @@ odbc_SQLExecute(TDS_STMT * stmt)
 				ret = tds_multiple_execute(tds, &multiple, dyn);
 				if (++stmt->curr_param_row >= stmt->num_param_rows)
 					break;
+				/* data is already in the packet, reuse parameters for next row */
+				stmt->params = dyn->params;
+				dyn->params = NULL;
 				/* than process others parameters */
 				/* TODO handle all results*/
-				if (start_parse_prepared_query(stmt, true) != SQL_SUCCESS)
+				if (next_row_prepared_query(stmt) != SQL_SUCCESS)
 					break;
 			}
 			if (TDS_SUCCEED(ret))
@@ -3638,6 +3698,27 @@ odbc_SQLExecute(TDS_STMT * stmt)
 		ODBC_SAFE_ERROR(stmt);
 		return SQL_ERROR;
 	}
+
+	/* data of a parameter will be sent by SQLPutData, results are read by SQLParamData */
+	if (tds->stream_params)
+		return SQL_NEED_DATA;
+
+	return odbc_execute_results(stmt);
+}
+
+/**
+ * Read results of a request sent to the server till first result set.
+ */
+static SQLRETURN
+odbc_execute_results(TDS_STMT * stmt)
+{
+	TDS_INT result_type;
+	TDS_INT done = 0;
+	bool in_row = false;
+	SQLUSMALLINT param_status;
+	int found_info = 0, found_error = 0;
+	TDS_INT8 total_rows = TDS_NO_COUNT;
+
 	/* catch all errors */
 	if (!odbc_lock_statement(stmt))
 		ODBC_RETURN_(stmt);
@@ -3952,19 +4033,100 @@ odbc_fix_data_type_col(TDS_STMT *stmt, int idx)
 	}
 }
 
+/**
+ * Return size of data that can be copied without conversion, 0 if
+ * a conversion is needed.
+ */
+static unsigned int
+odbc_direct_copy_size(const TDSCOLUMN *colinfo, int c_type)
+{
+	int srctype;
+
+	if (is_blob_col(colinfo))
+		return 0;
+
+	/* data must be stored in the same format received from the server */
+	srctype = tds_get_conversion_type(colinfo->on_server.column_type, colinfo->on_server.column_size);
+	if (srctype != tds_get_conversion_type(colinfo->column_type, colinfo->column_size))
+		return 0;
+	if (srctype != odbc_c_to_server_type(c_type))
+		return 0;
+
+	switch (srctype) {
+	case SYBINT1:
+	case SYBINT2:
+	case SYBINT4:
+	case SYBINT8:
+	case SYBUINT2:
+	case SYBUINT4:
+	case SYBUINT8:
+	case SYBREAL:
+	case SYBFLT8:
+		return tds_get_size_by_type(srctype);
+	default:
+		break;
+	}
+	return 0;
+}
+
+/**
+ * Get the plan to copy rows of current results, computing it if needed.
+ * Return NULL on memory error.
+ */
+static const struct _fetch_plan *
+odbc_get_fetch_plan(TDS_STMT * stmt, const TDSRESULTINFO *resinfo)
+{
+	const TDS_DESC *const ard = stmt->ard;
+	struct _fetch_plan *plan = stmt->fetch_plan;
+	int i;
+
+	if (plan && plan->ard == ard && plan->ard_version == ard->version
+	    && plan->ird_version == stmt->ird->version && plan->resinfo == resinfo)
+		return plan;
+
+	free(plan);
+	stmt->fetch_plan = plan = (struct _fetch_plan *)
+		calloc(1, sizeof(struct _fetch_plan) + sizeof(struct _fetch_plan_col) * TDS_MAX(resinfo->num_cols - 1, 0));
+	if (!plan)
+		return NULL;
+
+	plan->ard = ard;
+	plan->ard_version = ard->version;
+	plan->ird_version = stmt->ird->version;
+	plan->resinfo = resinfo;
+	plan->num_cols = resinfo->num_cols;
+	if (ard->header.sql_desc_bind_type == SQL_BIND_BY_COLUMN)
+		plan->len_stride = sizeof(SQLLEN);
+
+	for (i = 0; i < resinfo->num_cols && i < ard->header.sql_desc_count; i++) {
+		const struct _drecord *drec_ard = &ard->records[i];
+		struct _fetch_plan_col *col = &plan->cols[i];
+		int c_type = drec_ard->sql_desc_concise_type;
+
+		if (c_type == SQL_C_DEFAULT)
+			c_type = odbc_sql_to_c_type_default(stmt->ird->records[i].sql_desc_concise_type);
+		col->c_type = c_type;
+		col->copy_size = odbc_direct_copy_size(resinfo->columns[i], c_type);
+		if (ard->header.sql_desc_bind_type == SQL_BIND_BY_COLUMN)
+			col->stride = odbc_get_octet_len(c_type, drec_ard);
+	}
+	return plan;
+}
+
 static SQLUSMALLINT
-copy_row(TDS_STMT * const stmt, const SQLLEN row_offset, const SQLULEN curr_row)
+copy_row(TDS_STMT * const stmt, const struct _fetch_plan *plan, const SQLLEN row_offset, const SQLULEN curr_row)
 {
 	const TDS_DESC *const ard = stmt->ard;
 	TDSRESULTINFO *const resinfo = stmt->tds->current_results;
 	int i;
 	bool truncated = false;
 
-#define AT_ROW(ptr, type) (row_offset ? (type*)(((char*)(ptr)) + row_offset) : &ptr[curr_row])
+#define AT_ROW(ptr, type) ((type*)(((char*)(ptr)) + row_offset + plan->len_stride * curr_row))
 
 	for (i = 0; i < resinfo->num_cols; i++) {
 		TDSCOLUMN *colinfo;
 		struct _drecord *drec_ard;
+		const struct _fetch_plan_col *plan_col;
 		SQLLEN len;
 
 		colinfo = resinfo->columns[i];
@@ -3992,24 +4154,22 @@ copy_row(TDS_STMT * const stmt, const SQLLEN row_offset, const SQLULEN curr_row)
 			int c_type;
 			TDS_CHAR *data_ptr = (TDS_CHAR *) drec_ard->sql_desc_data_ptr;
 
-			colinfo->column_text_sqlgetdatapos = 0;
-			colinfo->column_iconv_left = 0;
-			c_type = drec_ard->sql_desc_concise_type;
-			if (c_type == SQL_C_DEFAULT)
-				c_type = odbc_sql_to_c_type_default(stmt->ird->records[i].sql_desc_concise_type);
-			if (row_offset || curr_row == 0) {
-				data_ptr += row_offset;
+			plan_col = &plan->cols[i];
+			c_type = plan_col->c_type;
+			data_ptr += row_offset + plan_col->stride * curr_row;
+			if (plan_col->copy_size) {
+				memcpy(data_ptr, colinfo->column_data, plan_col->copy_size);
+				len = plan_col->copy_size;
 			} else {
-				data_ptr += odbc_get_octet_len(c_type, drec_ard) * curr_row;
-			}
-			len = odbc_tds2sql_col(stmt, colinfo, c_type, data_ptr, drec_ard->sql_desc_octet_length, drec_ard);
-			if (len == SQL_NULL_DATA)
-				return SQL_ROW_ERROR;
-
-			if ((c_type == SQL_C_CHAR && len >= drec_ard->sql_desc_octet_length)
-			    || (c_type == SQL_C_BINARY && len > drec_ard->sql_desc_octet_length)) {
-				truncated = true;
-				stmt->errs.lastrc = SQL_SUCCESS_WITH_INFO;
+				len = odbc_tds2sql_col(stmt, colinfo, c_type, data_ptr, drec_ard->sql_desc_octet_length, drec_ard);
+				if (len == SQL_NULL_DATA)
+					return SQL_ROW_ERROR;
+
+				if ((c_type == SQL_C_CHAR && len >= drec_ard->sql_desc_octet_length)
+				    || (c_type == SQL_C_BINARY && len > drec_ard->sql_desc_octet_length)) {
+					truncated = true;
+					stmt->errs.lastrc = SQL_SUCCESS_WITH_INFO;
+				}
 			}
 		}
 		if (drec_ard->sql_desc_octet_length_ptr)
@@ -4020,6 +4180,30 @@ copy_row(TDS_STMT * const stmt, const SQLLEN row_offset, const SQLULEN curr_row)
 #undef AT_ROW
 }
 
+/**
+ * Mark large columns after the last bound one to be left on the wire
+ * when reading next row. SQLGetData will read them in pieces.
+ */
+static void
+odbc_set_stream_columns(TDS_STMT * stmt, TDSRESULTINFO *resinfo, bool enable)
+{
+	const TDS_DESC *const ard = stmt->ard;
+	int i;
+
+	stmt->stream_col = NULL;
+	for (i = resinfo->num_cols; --i >= 0; ) {
+		TDSCOLUMN *colinfo = resinfo->columns[i];
+		const struct _drecord *drec_ard = (i < ard->header.sql_desc_count) ? &ard->records[i] : NULL;
+
+		if (drec_ard && (drec_ard->sql_desc_data_ptr || drec_ard->sql_desc_indicator_ptr
+				 || drec_ard->sql_desc_octet_length_ptr))
+			enable = false;
+		if (!tds_column_streamable(stmt->tds, colinfo))
+			enable = false;
+		colinfo->column_stream = enable;
+	}
+}
+
 /*
  * - handle correctly SQLGetData (for forward cursors accept only row_size == 1
  *   for other types application must use SQLSetPos)
@@ -4038,6 +4222,7 @@ odbc_SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 	SQLUSMALLINT *status_ptr, row_status = SQL_ROW_SUCCESS;
 	TDS_INT result_type;
 	bool truncated = false;
+	const struct _fetch_plan *plan = NULL;
 
 	SQLLEN row_offset = 0;
 
@@ -4156,6 +4341,10 @@ odbc_SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 			break;
 
 		default:
+			if (tds->current_results && !stmt->cursor)
+				odbc_set_stream_columns(stmt, tds->current_results,
+							stmt->dbc->attr.stream_lobs != SQL_STREAM_LOBS_OFF && num_rows == 1
+							&& stmt->special_row == ODBC_SPECIAL_NONE);
 			/* FIXME stmt->row_count set correctly ?? TDS_DONE_COUNT not checked */
 			switch (odbc_process_tokens(stmt, TDS_STOPAT_ROWFMT|TDS_RETURN_ROW|TDS_STOPAT_COMPUTE)) {
 			case TDS_ROW_RESULT:
@@ -4211,9 +4400,17 @@ odbc_SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 			break;
 		}
 
+		if (!plan || plan->resinfo != resinfo) {
+			plan = odbc_get_fetch_plan(stmt, resinfo);
+			if (!plan) {
+				odbc_errs_add(&stmt->errs, "HY001", NULL);
+				break;
+			}
+		}
+
 		/* we got a row, return a row readed even if error (for ODBC specifications) */
 		++(*fetched_ptr);
-		row_status = copy_row(stmt, row_offset, curr_row);
+		row_status = copy_row(stmt, plan, row_offset, curr_row);
 		if (row_status == SQL_ROW_SUCCESS_WITH_INFO)
 			truncated = true;
 
@@ -4331,6 +4528,7 @@ odbc_SQLFreeConnect(SQLHDBC hdbc)
 	tdsdump_log(TDS_DBG_FUNC, "odbc_SQLFreeConnect(%p)\n",
 			hdbc);
 
+	odbc_prep_cache_clear(dbc);
 	tds_close_socket(dbc->tds_socket);
 
 	/* TODO if connected return error */
@@ -4432,6 +4630,7 @@ odbc_SQLFreeStmt(SQLHSTMT hstmt, SQLUSMALLINT fOption, int force)
 		/*
 		 * FIXME -- otherwise make sure the current statement is complete
 		 */
+		odbc_param_stream_abort(stmt);
 		/* do not close other running query ! */
 		if (tds && tds->state != TDS_IDLE && tds->state != TDS_DEAD) {
 			if (TDS_SUCCEED(tds_send_cancel(tds)))
@@ -4464,7 +4663,9 @@ odbc_SQLFreeStmt(SQLHSTMT hstmt, SQLUSMALLINT fOption, int force)
 		tds_mutex_unlock(&stmt->dbc->mtx);
 
 		tds_dstr_free(&stmt->query);
+		free(stmt->query_wide);
 		tds_free_param_results(stmt->params);
+		free(stmt->fetch_plan);
 		odbc_errs_reset(&stmt->errs);
 		odbc_unlock_statement(stmt);
 		tds_dstr_free(&stmt->cursor_name);
@@ -4712,6 +4913,10 @@ odbc_SQLGetStmtAttr(SQLHSTMT hstmt, SQLINTEGER Attribute, SQLPOINTER Value,
 		size = sizeof(stmt->attr.qn_timeout);
 		src = &stmt->attr.qn_timeout;
 		break;
+	case SQL_SOPT_TDSODBC_GETDATA_FD:
+		size = sizeof(stmt->attr.getdata_fd);
+		src = &stmt->attr.getdata_fd;
+		break;
 	case SQL_SOPT_SS_QUERYNOTIFICATION_MSGTEXT:
 		{
 			SQLRETURN rc = odbc_set_dstr_oct(stmt->dbc, Value, BufferLength, StringLength, &stmt->attr.qn_msgtext);
@@ -5121,6 +5326,29 @@ ODBC_FUNC(SQLGetConnectAttr, (P(SQLHDBC,hdbc), P(SQLINTEGER,Attribute), P(SQLPOI
 	case SQL_COPT_SS_BCP:
 		*((SQLUINTEGER *) Value) = dbc->attr.bulk_enabled;
 		break;
+	case SQL_COPT_TDSODBC_BULK_INSERT:
+		*((SQLUINTEGER *) Value) = dbc->attr.bulk_insert;
+		break;
+	case SQL_COPT_TDSODBC_PREPARE_CACHE_SIZE:
+		*((SQLUINTEGER *) Value) = dbc->attr.prepare_cache_size;
+		break;
+	case SQL_COPT_TDSODBC_PREPARE_THRESHOLD:
+		*((SQLUINTEGER *) Value) = dbc->attr.prepare_threshold;
+		break;
+	case SQL_COPT_TDSODBC_STREAM_LOBS:
+		*((SQLUINTEGER *) Value) = dbc->attr.stream_lobs;
+		break;
+	case SQL_COPT_TDSODBC_PREPARE_CACHE_STATS: {
+		struct tdsodbc_prepare_cache_stats *stats = (struct tdsodbc_prepare_cache_stats *) Value;
+
+		/* counters are updated with dbc->mtx held, same lock we hold here */
+		tds_mutex_check_owned(&dbc->mtx);
+		stats->hits = dbc->prep_cache.hits;
+		stats->misses = dbc->prep_cache.misses;
+		stats->evictions = dbc->prep_cache.evictions;
+		stats->entries = dbc->prep_cache.num_entries;
+		}
+		break;
 	default:
 		odbc_errs_add(&dbc->errs, "HY092", NULL);
 		break;
@@ -5151,6 +5379,114 @@ SQLGetConnectOptionW(SQLHDBC hdbc, SQLUSMALLINT fOption, SQLPOINTER pvParam)
 }
 #endif
 
+/* bytes kept before reading more data, enough to hold a partial character */
+#define ODBC_STREAM_MIN 16
+
+/**
+ * Read next part of a column left on the wire.
+ * Bytes not consumed yet are kept at the beginning of the buffer.
+ * \param all read all data left, used for conversions not supporting pieces
+ */
+static bool
+odbc_stream_fill(TDS_STMT * stmt, TDSCOLUMN *colinfo, bool all)
+{
+	TDSSOCKET *tds = stmt->tds;
+	TDSBLOB *blob = (TDSBLOB *) colinfo->column_data;
+	size_t size = 0, chunk;
+	TDS_INT8 total;
+	int len;
+
+	if (tds->stream_col != colinfo) {
+		if (TDS_FAILED(tds_stream_column_open(tds, colinfo, &total)))
+			return false;
+		stmt->stream_col = colinfo;
+		colinfo->column_iconv_left = 0;
+		if (colinfo->column_cur_size < 0)
+			return true;
+	} else {
+		size = colinfo->column_cur_size - colinfo->column_text_sqlgetdatapos;
+		if (size >= ODBC_STREAM_MIN && !all)
+			return true;
+		memmove(blob->textvalue, blob->textvalue + colinfo->column_text_sqlgetdatapos, size);
+	}
+	colinfo->column_text_sqlgetdatapos = 0;
+	colinfo->column_cur_size = (TDS_INT) size;
+
+	chunk = TDS_MAX(tds->conn->env.block_size, 4096);
+	do {
+		if (!TDS_RESIZE(blob->textvalue, size + chunk)) {
+			odbc_errs_add(&stmt->errs, "HY001", NULL);
+			return false;
+		}
+		len = tds_stream_column_read(tds, colinfo, blob->textvalue + size, chunk);
+		if (len < 0) {
+			odbc_errs_add(&stmt->errs, "08S01", NULL);
+			return false;
+		}
+		size += len;
+	} while (all && colinfo->column_stream_pending);
+	colinfo->column_cur_size = (TDS_INT) size;
+	return true;
+}
+
+/**
+ * Write a column left on the wire to the file descriptor set with
+ * SQL_SOPT_TDSODBC_GETDATA_FD.
+ * Binary data are copied from network packets to the file descriptor,
+ * characters are converted like SQLGetData would do.
+ * Conversion of binary data to hexadecimal is not supported.
+ */
+static SQLRETURN
+odbc_getdata_fd(TDS_STMT * stmt, TDSCOLUMN *colinfo, SQLSMALLINT fCType, SQLLEN * pcbValue)
+{
+	TDSSOCKET *tds = stmt->tds;
+	TDSICONV *conv = NULL;
+	TDSFDOUTSTREAM out;
+	TDS_INT8 total;
+	TDSRET rc;
+
+	switch (fCType) {
+	case SQL_C_BINARY:
+		break;
+	case SQL_C_CHAR:
+	case SQL_C_WCHAR:
+		if (is_char_type(colinfo->column_type)) {
+			conv = odbc_char_conv(stmt, colinfo, fCType);
+			break;
+		}
+		/* fall through */
+	default:
+		odbc_errs_add(&stmt->errs, "07006", NULL);
+		return SQL_ERROR;
+	}
+
+	if (TDS_FAILED(tds_stream_column_open(tds, colinfo, &total))) {
+		odbc_errs_add(&stmt->errs, "08S01", NULL);
+		return SQL_ERROR;
+	}
+	stmt->stream_col = colinfo;
+	colinfo->column_iconv_left = 0;
+	if (colinfo->column_cur_size < 0) {
+		*pcbValue = SQL_NULL_DATA;
+		return SQL_SUCCESS;
+	}
+
+	tds_fdout_stream_init(&out, stmt->attr.getdata_fd);
+	rc = tds_stream_column_copy(tds, colinfo, conv, &out.stream);
+
+	/* next call will return SQL_NO_DATA */
+	colinfo->column_cur_size = 0;
+	colinfo->column_text_sqlgetdatapos = 1;
+
+	if (TDS_FAILED(rc)) {
+		odbc_errs_add(&stmt->errs, IS_TDSDEAD(tds) ? "08S01" : "HY000",
+			      "Error writing column data");
+		return SQL_ERROR;
+	}
+	*pcbValue = (SQLLEN) out.written;
+	return SQL_SUCCESS;
+}
+
 SQLRETURN ODBC_PUBLIC ODBC_API
 SQLGetData(SQLHSTMT hstmt, SQLUSMALLINT icol, SQLSMALLINT fCType, SQLPOINTER rgbValue, SQLLEN cbValueMax, SQLLEN FAR * pcbValue)
 {
@@ -5194,6 +5530,32 @@ SQLGetData(SQLHSTMT hstmt, SQLUSMALLINT icol, SQLSMALLINT fCType, SQLPOINTER rgb
 	}
 	colinfo = resinfo->columns[icol - 1];
 
+	/* column left on the wire, write it to the file descriptor */
+	if (colinfo->column_stream_pending && stmt->attr.getdata_fd >= 0 && stmt->stream_col != colinfo) {
+		if (fCType == SQL_C_DEFAULT)
+			fCType = odbc_sql_to_c_type_default(stmt->ird->records[icol - 1].sql_desc_concise_type);
+		if (fCType == SQL_ARD_TYPE) {
+			if (icol > stmt->ard->header.sql_desc_count) {
+				odbc_errs_add(&stmt->errs, "07009", NULL);
+				ODBC_EXIT_(stmt);
+			}
+			fCType = stmt->ard->records[icol - 1].sql_desc_concise_type;
+		}
+		ODBC_EXIT(stmt, odbc_getdata_fd(stmt, colinfo, fCType, pcbValue));
+	}
+
+	/* column left on the wire, read data in pieces if possible */
+	if (colinfo->column_stream_pending) {
+		bool all = fCType != SQL_C_CHAR && fCType != SQL_C_WCHAR && fCType != SQL_C_BINARY && fCType != SQL_C_DEFAULT;
+
+		if (!odbc_stream_fill(stmt, colinfo, all))
+			ODBC_EXIT(stmt, SQL_ERROR);
+	} else if (colinfo->column_stream && colinfo->column_cur_size >= 0 && stmt->stream_col != colinfo) {
+		/* data discarded reading a following column */
+		odbc_errs_add(&stmt->errs, "07009", NULL);
+		ODBC_EXIT_(stmt);
+	}
+
 	if (colinfo->column_cur_size < 0) {
 		/* TODO check what should happen if pcbValue was NULL */
 		*pcbValue = SQL_NULL_DATA;
@@ -5223,6 +5585,8 @@ SQLGetData(SQLHSTMT hstmt, SQLUSMALLINT icol, SQLSMALLINT fCType, SQLPOINTER rgb
 		*pcbValue = odbc_tds2sql_col(stmt, colinfo, fCType, (TDS_CHAR *) rgbValue, cbValueMax, NULL);
 		if (*pcbValue == SQL_NULL_DATA)
 			ODBC_EXIT(stmt, SQL_ERROR);
+		if (colinfo->column_stream_pending)
+			*pcbValue = SQL_NO_TOTAL;
 
 		if (is_variable_type(colinfo->column_type)
 		    && (fCType == SQL_C_CHAR || fCType == SQL_C_WCHAR || fCType == SQL_C_BINARY)) {
@@ -5230,7 +5594,8 @@ SQLGetData(SQLHSTMT hstmt, SQLUSMALLINT icol, SQLSMALLINT fCType, SQLPOINTER rgb
 			if (colinfo->column_text_sqlgetdatapos == 0 && cbValueMax > 0)
 				++colinfo->column_text_sqlgetdatapos;
 
-			if (colinfo->column_text_sqlgetdatapos < colinfo->column_cur_size || colinfo->column_iconv_left != 0) {
+			if (colinfo->column_text_sqlgetdatapos < colinfo->column_cur_size || colinfo->column_iconv_left != 0
+			    || colinfo->column_stream_pending) {
 				/* not all read ?? */
 				odbc_errs_add(&stmt->errs, "01004", "String data, right truncated");
 				ODBC_EXIT_(stmt);
@@ -6405,6 +6770,146 @@ SQLGetTypeInfoW(SQLHSTMT hstmt, SQLSMALLINT fSqlType)
 }
 #endif
 
+/**
+ * Check if data of the parameter waiting data can be sent to the server
+ * while the application provides it with SQLPutData.
+ * All other parameters must be known to start the request so only
+ * the last data-at-execution parameter is streamed.
+ * The statement must be executed by odbc_SQLExecute with a RPC
+ * (sp_executesql, sp_prepexec or sp_execute), the only requests
+ * able to send a parameter in chunks.
+ */
+static bool
+odbc_param_can_stream(TDS_STMT * stmt, const TDSCOLUMN * curcol)
+{
+	const struct _drecord *drec_apd = &stmt->apd->records[stmt->param_num - 1];
+	int sql_src_type, i;
+
+	if (stmt->dbc->attr.stream_lobs == SQL_STREAM_LOBS_OFF || stmt->prepared_query_is_rpc
+	    || stmt->apd->header.sql_desc_array_size > 1
+	    || stmt->attr.cursor_type != SQL_CURSOR_FORWARD_ONLY || stmt->attr.concurrency != SQL_CONCUR_READ_ONLY
+	    || curcol->column_output || curcol->column_cur_size != 0
+	    || !tds_param_streamable(stmt->dbc->tds_socket, curcol))
+		return false;
+
+	/* characters are converted from hexadecimal */
+	sql_src_type = drec_apd->sql_desc_concise_type;
+	if (sql_src_type == SQL_C_DEFAULT)
+		sql_src_type = odbc_sql_to_c_type_default(stmt->ipd->records[stmt->param_num - 1].sql_desc_concise_type);
+	if (curcol->on_server.column_type == XSYBVARBINARY && sql_src_type != SQL_C_BINARY)
+		return false;
+
+	for (i = stmt->param_num; i < (int) stmt->param_count; ++i) {
+		SQLLEN len;
+
+		if (i >= stmt->apd->header.sql_desc_count || i >= stmt->ipd->header.sql_desc_count)
+			return false;
+		if (stmt->ipd->records[i].sql_desc_parameter_type == SQL_PARAM_OUTPUT)
+			continue;
+		len = odbc_get_param_len(&stmt->apd->records[i], &stmt->ipd->records[i], stmt->apd, 0);
+		if (len < 0 && len != SQL_NULL_DATA && len != SQL_NTS && len != SQL_DEFAULT_PARAM)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Compute remaining parameters and send the request to the server.
+ * Request is left open to send data of the current parameter.
+ * Everything that could prevent the request from being started is
+ * checked before touching the parameters, so the caller can still
+ * buffer the data.
+ * \return SQL_NEED_DATA on success, SQL_SUCCESS if data must be buffered
+ *         instead, SQL_ERROR on error
+ */
+static SQLRETURN
+odbc_param_stream_start(TDS_STMT * stmt, TDSCOLUMN * curcol)
+{
+	int param_num = stmt->param_num;
+	SQLRETURN res;
+
+	/* the connection could be busy, another statement can free it later */
+	if (!odbc_lock_statement(stmt)) {
+		odbc_errs_reset(&stmt->errs);
+		return SQL_SUCCESS;
+	}
+	if (stmt->tds->state != TDS_IDLE || !tds_param_streamable(stmt->tds, curcol)) {
+		odbc_unlock_statement(stmt);
+		return SQL_SUCCESS;
+	}
+
+	++stmt->param_num;
+	res = parse_prepared_query(stmt, true);
+	stmt->param_num = param_num;
+	if (res != SQL_SUCCESS) {
+		odbc_unlock_statement(stmt);
+		return SQL_ERROR;
+	}
+
+	tdsdump_log(TDS_DBG_INFO1, "streaming parameter %d\n", param_num);
+	curcol->column_stream = 1;
+	stmt->param_streamed = 1;
+	res = odbc_SQLExecute(stmt);
+	if (res == SQL_NEED_DATA)
+		return res;
+
+	stmt->param_streamed = 0;
+	curcol->column_stream = 0;
+	/* request was not sent with the data of the parameter */
+	if (SQL_SUCCEEDED(res)) {
+		tdsdump_log(TDS_DBG_ERROR, "parameter %d not streamed\n", param_num);
+		odbc_errs_add(&stmt->errs, "HY000", "Parameter data not sent");
+	}
+	return SQL_ERROR;
+}
+
+static SQLRETURN
+odbc_param_stream_write(TDS_STMT * stmt, SQLPOINTER DataPtr, SQLLEN StrLen_or_Ind)
+{
+	const struct _drecord *drec_apd = &stmt->apd->records[stmt->param_num - 1];
+	SQLLEN len = StrLen_or_Ind;
+
+	if (!DataPtr && StrLen_or_Ind != SQL_NULL_DATA) {
+		odbc_errs_add(&stmt->errs, "HY009", NULL);
+		return SQL_ERROR;
+	}
+
+	switch (StrLen_or_Ind) {
+	case SQL_NTS:
+		if (drec_apd->sql_desc_concise_type == SQL_C_WCHAR)
+			len = sqlwcslen((SQLWCHAR *) DataPtr) * sizeof(SQLWCHAR);
+		else
+			len = strlen((char *) DataPtr);
+		break;
+	case SQL_NULL_DATA:
+		/* Attempt to concatenate a null value */
+		odbc_errs_add(&stmt->errs, "HY020", NULL);
+		return SQL_ERROR;
+	}
+	if (len < 0) {
+		odbc_errs_add(&stmt->errs, "HY090", NULL);
+		return SQL_ERROR;
+	}
+
+	if (TDS_FAILED(tds_stream_param_write(stmt->tds, DataPtr, len))) {
+		ODBC_SAFE_ERROR(stmt);
+		return SQL_ERROR;
+	}
+	return SQL_SUCCESS;
+}
+
+/**
+ * Discard request whose parameter is being streamed.
+ */
+static void
+odbc_param_stream_abort(TDS_STMT * stmt)
+{
+	if (!stmt->param_streamed)
+		return;
+	stmt->param_streamed = 0;
+	tds_stream_param_abort(stmt->tds);
+}
+
 static SQLRETURN
 odbc_SQLParamData(SQLHSTMT hstmt, SQLPOINTER FAR * prgbValue)
 {
@@ -6413,6 +6918,17 @@ odbc_SQLParamData(SQLHSTMT hstmt, SQLPOINTER FAR * prgbValue)
 	tdsdump_log(TDS_DBG_FUNC, "SQLParamData(%p, %p) [param_num %d, param_data_called = %d]\n",
 					hstmt, prgbValue, stmt->param_num, stmt->param_data_called);
 
+	/* last parameter sent, complete the request and read results */
+	if (stmt->param_streamed) {
+		stmt->param_streamed = 0;
+		stmt->param_num = stmt->param_count + 1;
+		if (TDS_FAILED(tds_stream_param_end(stmt->tds))) {
+			ODBC_SAFE_ERROR(stmt);
+			ODBC_EXIT(stmt, SQL_ERROR);
+		}
+		ODBC_EXIT(stmt, odbc_execute_results(stmt));
+	}
+
 	if (stmt->params && (unsigned int) stmt->param_num <= stmt->param_count) {
 		SQLRETURN res;
 
@@ -6469,7 +6985,21 @@ SQLPutData(SQLHSTMT hstmt, SQLPOINTER rgbValue, SQLLEN cbValue)
 
 	if (stmt->param_data_called) {
 		SQLRETURN ret;
-		const TDSCOLUMN *curcol = stmt->params->columns[stmt->param_num - (stmt->prepared_query_is_func ? 2 : 1)];
+		TDSCOLUMN *curcol;
+
+		if (stmt->param_streamed)
+			ODBC_EXIT(stmt, odbc_param_stream_write(stmt, rgbValue, cbValue));
+
+		curcol = stmt->params->columns[stmt->param_num - (stmt->prepared_query_is_func ? 2 : 1)];
+		if (cbValue != SQL_NULL_DATA && odbc_param_can_stream(stmt, curcol)) {
+			ret = odbc_param_stream_start(stmt, curcol);
+			if (ret == SQL_NEED_DATA)
+				ODBC_EXIT(stmt, odbc_param_stream_write(stmt, rgbValue, cbValue));
+			if (ret != SQL_SUCCESS)
+				ODBC_EXIT(stmt, ret);
+			/* request not started, buffer data */
+		}
+
 		/* TODO do some more tests before setting this flag */
 		stmt->param_data_called = 1;
 		ret = continue_parse_prepared_query(stmt, rgbValue, cbValue);
@@ -6582,6 +7112,20 @@ ODBC_FUNC(SQLSetConnectAttr, (P(SQLHDBC,hdbc), P(SQLINTEGER,Attribute), P(SQLPOI
 	case SQL_COPT_SS_BCP:
 		dbc->attr.bulk_enabled = (SQLUINTEGER) u_value;
 		break;
+	case SQL_COPT_TDSODBC_BULK_INSERT:
+		dbc->attr.bulk_insert = (SQLUINTEGER) u_value;
+		break;
+	case SQL_COPT_TDSODBC_PREPARE_CACHE_SIZE:
+		dbc->attr.prepare_cache_size = (SQLUINTEGER) u_value;
+		/* dbc->mtx is held since ODBC_ENTER_HDBC, as trim requires */
+		odbc_prep_cache_trim(dbc);
+		break;
+	case SQL_COPT_TDSODBC_PREPARE_THRESHOLD:
+		dbc->attr.prepare_threshold = (SQLUINTEGER) u_value;
+		break;
+	case SQL_COPT_TDSODBC_STREAM_LOBS:
+		dbc->attr.stream_lobs = (SQLUINTEGER) u_value;
+		break;
 	case SQL_COPT_TDSODBC_IMPL_BCP_INITA:
 		if (!ValuePtr)
 			odbc_errs_add(&dbc->errs, "HY009", NULL);
@@ -6925,6 +7469,7 @@ odbc_SQLSetStmtAttr(SQLHSTMT hstmt, SQLINTEGER Attribute, SQLPOINTER ValuePtr, S
 #endif
 	case SQL_ATTR_ROW_BIND_TYPE:
 		stmt->ard->header.sql_desc_bind_type = (SQLUINTEGER) ui;
+		++stmt->ard->version;
 		break;
 	case SQL_ATTR_ROW_NUMBER:
 		odbc_errs_add(&stmt->errs, "HY092", NULL);
@@ -7001,6 +7546,13 @@ odbc_SQLSetStmtAttr(SQLHSTMT hstmt, SQLINTEGER Attribute, SQLPOINTER ValuePtr, S
 		stmt->orig_apd->focus = (int) ui;
 		stmt->ipd->focus = (int) ui;
 		break;
+	case SQL_SOPT_TDSODBC_GETDATA_FD:
+		if ((TDS_INTPTR) ValuePtr < -1 || (SQLINTEGER) (TDS_INTPTR) ValuePtr != (TDS_INTPTR) ValuePtr) {
+			odbc_errs_add(&stmt->errs, "HY024", NULL);
+			break;
+		}
+		stmt->attr.getdata_fd = (SQLINTEGER) (TDS_INTPTR) ValuePtr;
+		break;
 	default:
 		odbc_errs_add(&stmt->errs, "HY092", NULL);
 		break;
@@ -7685,8 +8237,9 @@ odbc_free_dynamic(TDS_STMT * stmt)
 {
 	TDSSOCKET *tds;
 
-	if (!stmt->dyn)
-		return TDS_SUCCESS;
+	/* give statement back to connection cache */
+	if (odbc_prep_cache_put(stmt) || !stmt->dyn)
+		return SQL_SUCCESS;
 
 	tds = stmt->dbc->tds_socket;
 	if (!tds_needs_unprepare(tds->conn, stmt->dyn)) {
@@ -8021,7 +8574,7 @@ read_params(TDS_STMT *stmt)
 		TDS_INT result_type;
 		int done_flags;
 		TDSRESULTINFO *res_info;
-		ptrdiff_t i, j, num_cols;
+		ptrdiff_t i;
 		struct _drecord *drec;
 		int idx, scale, precision, len, tds_type;
 
@@ -8035,28 +8588,17 @@ read_params(TDS_STMT *stmt)
 				break;
 
 			case TDS_ROWFMT_RESULT:
-				/* parse results, scan all columns to find needed ones */
-				/* extract all column indexes */
+				/* find needed columns by name */
 				res_info = tds->current_results;
-				num_cols = res_info->num_cols;
-
-				for (i = 0; i < NUM_COLUMNS; i++)
-					column_idx[i] = ~0u;
-				for (i = 0; i < num_cols; i++) {
-					char *name;
-					TDSCOLUMN *col;
-
-					col = res_info->columns[i];
-					name = tds_dstr_buf(&col->column_name);
-					tds_ascii_strupr(name);
-					for (j = 0; j < NUM_COLUMNS; j++)
-						if (strcmp(name, column_names[j]) == 0)
-							column_idx[j] = i;
-				}
+
 				in_row = true;
-				for (i = 0; i < NUM_COLUMNS; i++)
-					if (column_idx[i] == ~0u)
+				for (i = 0; i < NUM_COLUMNS; i++) {
+					int pos = tds_find_column(res_info, column_names[i], strlen(column_names[i]));
+
+					column_idx[i] = (unsigned) pos;
+					if (pos < 0)
 						in_row = false;
+				}
 				break;
 			case TDS_ROW_RESULT:
 				if (!in_row)
@@ -34,6 +34,7 @@
 
 #include <freetds/odbc.h>
 #include <freetds/iconv.h>
+#include <freetds/encodings.h>
 #include <freetds/utils/string.h>
 #include <freetds/convert.h>
 #include <freetds/enum_cap.h>
@@ -57,6 +58,23 @@ static DSTR *odbc_mb2utf(TDS_DBC *dbc, DSTR *res, const char *s, size_t len);
 static DSTR *odbc_wide2utf(DSTR *res, const SQLWCHAR *s, size_t len);
 #endif
 
+#ifdef ENABLE_ODBC_WIDE
+/**
+ * Check if wide strings are encoded as server expects queries.
+ * Client encoding must also keep ASCII characters as single bytes so
+ * odbc_use_wide_query can compare queries.
+ */
+static bool
+odbc_wide_is_server_encoding(TDSCONNECTION *conn)
+{
+	const TDSICONV *conv = conn->char_convs[client2ucs2];
+
+	if (!IS_TDS7_PLUS(conn) || odbc_get_wide_canonic(conn) != conv->to.charset.canonic)
+		return false;
+	return conv->from.charset.max_bytes_per_char == 1 || conv->from.charset.canonic == TDS_CHARSET_UTF_8;
+}
+#endif
+
 SQLRETURN
 odbc_set_stmt_query(TDS_STMT * stmt, const ODBC_CHAR *sql, ptrdiff_t sql_len _WIDE)
 {
@@ -83,12 +101,65 @@ odbc_set_stmt_query(TDS_STMT * stmt, const ODBC_CHAR *sql, ptrdiff_t sql_len _WI
 	stmt->need_reprepare = 0;
 	stmt->params_queried = 0;
 
+	TDS_ZERO_FREE(stmt->query_wide);
 	if (!odbc_dstr_copy(stmt->dbc, &stmt->query, sql_len, sql))
 		return SQL_ERROR;
 
+#ifdef ENABLE_ODBC_WIDE
+	/* keep original query to avoid converting it back */
+	if (wide && stmt->dbc->tds_socket && odbc_wide_is_server_encoding(stmt->dbc->tds_socket->conn)) {
+		stmt->query_wide = tds_new(SQLWCHAR, sql_len);
+		if (stmt->query_wide) {
+			memcpy(stmt->query_wide, sql->wide, sql_len * sizeof(SQLWCHAR));
+			stmt->query_wide_len = sql_len;
+		}
+	}
+#endif
+
 	return SQL_SUCCESS;
 }
 
+/**
+ * Pass the query in wide encoding to libTDS, if available, so it's not
+ * converted again before sending it.
+ * The query could have been changed after being set (for instance converting
+ * ODBC escapes) so check that it still matches, comparing ASCII characters
+ * and sequences of non ASCII ones.
+ */
+void
+odbc_use_wide_query(TDS_STMT *stmt)
+{
+	const SQLWCHAR *w = stmt->query_wide, *w_end;
+	const unsigned char *p, *p_end;
+
+	if (!w || !stmt->tds)
+		return;
+
+	p = (const unsigned char *) tds_dstr_cstr(&stmt->query);
+	p_end = p + tds_dstr_len(&stmt->query);
+	w_end = w + stmt->query_wide_len;
+	while (w != w_end && p != p_end) {
+		if (*w < 0x80) {
+			if (*w != *p)
+				break;
+			++w;
+			++p;
+			continue;
+		}
+		if (*p < 0x80)
+			break;
+		while (w != w_end && *w >= 0x80)
+			++w;
+		while (p != p_end && *p >= 0x80)
+			++p;
+	}
+
+	if (w == w_end && p == p_end)
+		tds_set_query_ucs2(stmt->tds, tds_dstr_cstr(&stmt->query), tds_dstr_len(&stmt->query),
+				   (const char *) stmt->query_wide, stmt->query_wide_len * sizeof(SQLWCHAR));
+	TDS_ZERO_FREE(stmt->query_wide);
+}
+
 size_t
 odbc_get_string_size(ptrdiff_t size, const ODBC_CHAR * str _WIDE)
 {
@@ -0,0 +1,326 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * \file
+ * Cache of prepared statements shared by all statements of a connection.
+ *
+ * Applications often allocate a statement, prepare a query, execute it
+ * and free the statement again.  Keeping the prepared handles on the
+ * connection allows to skip the prepare round trip for queries already seen.
+ * Entries are indexed by query text, current database and parameter types.
+ * An entry used by a statement is never evicted; evicted handles are
+ * unprepared using the deferred mechanism of libTDS.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#include <freetds/tds.h>
+#include <freetds/odbc.h>
+#include <freetds/utils/hash.h>
+
+struct odbc_prep_entry
+{
+	TDS_HASH_ENTRY hash_entry;
+	ODBC_PREP_ENTRY *lru_prev, *lru_next;
+	/** prepared statement, NULL if not prepared yet */
+	TDSDYNAMIC *dyn;
+	/** number of executions requested for this query */
+	unsigned int executions;
+	/** entry used by a statement, cannot be evicted */
+	bool in_use;
+	size_t key_len;
+	unsigned char key[1];
+};
+
+void
+odbc_prep_cache_init(ODBC_PREP_CACHE *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+	tds_hash_init(&cache->hash);
+}
+
+static void
+odbc_prep_lru_unlink(ODBC_PREP_CACHE *cache, ODBC_PREP_ENTRY *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache->lru_first = entry->lru_next;
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache->lru_last = entry->lru_prev;
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void
+odbc_prep_lru_append(ODBC_PREP_CACHE *cache, ODBC_PREP_ENTRY *entry)
+{
+	entry->lru_next = NULL;
+	entry->lru_prev = cache->lru_last;
+	if (cache->lru_last)
+		cache->lru_last->lru_next = entry;
+	else
+		cache->lru_first = entry;
+	cache->lru_last = entry;
+}
+
+static void
+odbc_prep_entry_free(TDS_DBC *dbc, ODBC_PREP_ENTRY *entry, bool unprepare)
+{
+	ODBC_PREP_CACHE *cache = &dbc->prep_cache;
+
+	tds_hash_remove(&cache->hash, &entry->hash_entry);
+	odbc_prep_lru_unlink(cache, entry);
+	--cache->num_entries;
+
+	if (entry->dyn) {
+		if (unprepare && dbc->tds_socket)
+			tds_deferred_unprepare(dbc->tds_socket->conn, entry->dyn);
+		tds_release_dynamic(&entry->dyn);
+	}
+	free(entry);
+}
+
+/**
+ * Remove least recently used entries not in use till cache fits its limit.
+ * Connection lock must be held.
+ */
+void
+odbc_prep_cache_trim(TDS_DBC *dbc)
+{
+	ODBC_PREP_CACHE *cache = &dbc->prep_cache;
+	ODBC_PREP_ENTRY *entry, *next;
+
+	tds_mutex_check_owned(&dbc->mtx);
+
+	for (entry = cache->lru_first; entry && cache->num_entries > dbc->attr.prepare_cache_size; entry = next) {
+		next = entry->lru_next;
+		if (entry->in_use)
+			continue;
+		if (entry->dyn)
+			++cache->evictions;
+		odbc_prep_entry_free(dbc, entry, true);
+	}
+}
+
+/**
+ * Free all entries, called before closing the connection.
+ * Statements must be already freed.
+ */
+void
+odbc_prep_cache_clear(TDS_DBC *dbc)
+{
+	ODBC_PREP_CACHE *cache = &dbc->prep_cache;
+
+	while (cache->lru_first)
+		odbc_prep_entry_free(dbc, cache->lru_first, false);
+	tds_hash_free(&cache->hash);
+	tds_hash_init(&cache->hash);
+}
+
+static bool
+odbc_prep_key_add(unsigned char **key, size_t *len, size_t *alloc, const void *data, size_t data_len)
+{
+	if (*len + data_len > *alloc) {
+		size_t new_alloc = (*len + data_len) * 2;
+
+		if (!TDS_RESIZE(*key, new_alloc))
+			return false;
+		*alloc = new_alloc;
+	}
+	memcpy(*key + *len, data, data_len);
+	*len += data_len;
+	return true;
+}
+
+/**
+ * Build key of the statement.
+ * Key is composed by database, query and type of all parameters, so a
+ * statement reprepared with different types does not match the old entry.
+ */
+static unsigned char *
+odbc_prep_key(TDS_STMT *stmt, size_t *len)
+{
+	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	const char *database = tds->conn->env.database ? tds->conn->env.database : "";
+	TDSPARAMINFO *params = stmt->params;
+	unsigned char *key = NULL;
+	size_t alloc = 0;
+	int i;
+
+	*len = 0;
+	if (!odbc_prep_key_add(&key, len, &alloc, database, strlen(database) + 1)
+	    || !odbc_prep_key_add(&key, len, &alloc, tds_dstr_cstr(&stmt->query), tds_dstr_len(&stmt->query) + 1))
+		goto error;
+
+	for (i = 0; params && i < params->num_cols; ++i) {
+		const TDSCOLUMN *col = params->columns[i];
+		unsigned char info[8];
+		TDS_INT size = col->on_server.column_size;
+
+		info[0] = (unsigned char) col->on_server.column_type;
+		info[1] = col->column_prec;
+		info[2] = col->column_scale;
+		info[3] = col->column_output;
+		memcpy(info + 4, &size, 4);
+		if (!odbc_prep_key_add(&key, len, &alloc, info, sizeof(info)))
+			goto error;
+	}
+	return key;
+
+error:
+	free(key);
+	return NULL;
+}
+
+/**
+ * Search a prepared statement for the query of the statement.
+ * On hit stmt->dyn is set to the cached prepared statement.
+ * On miss the entry is reserved to the statement so the statement
+ * prepared can be stored calling odbc_prep_cache_put.
+ */
+ODBC_PREP_RESULT
+odbc_prep_cache_get(TDS_STMT *stmt)
+{
+	TDS_DBC *dbc = stmt->dbc;
+	ODBC_PREP_CACHE *cache = &dbc->prep_cache;
+	ODBC_PREP_ENTRY *entry = NULL;
+	TDS_HASH_ENTRY *hash_entry;
+	ODBC_PREP_RESULT res = ODBC_PREP_MISS;
+	unsigned char *key;
+	size_t key_len;
+	uint32_t hash;
+
+	if (!dbc->attr.prepare_cache_size || stmt->dyn || stmt->prep_entry)
+		return ODBC_PREP_MISS;
+
+	key = odbc_prep_key(stmt, &key_len);
+	if (!key)
+		return ODBC_PREP_MISS;
+	hash = tds_hash_bytes(key, key_len);
+
+	tds_mutex_lock(&dbc->mtx);
+	TDS_HASH_FOREACH(&cache->hash, hash, hash_entry) {
+		ODBC_PREP_ENTRY *e = TDS_HASH_ITEM(hash_entry, ODBC_PREP_ENTRY, hash_entry);
+
+		if (e->key_len == key_len && memcmp(e->key, key, key_len) == 0) {
+			entry = e;
+			break;
+		}
+	}
+
+	if (!entry) {
+		entry = (ODBC_PREP_ENTRY *) malloc(TDS_OFFSET(ODBC_PREP_ENTRY, key) + key_len);
+		if (!entry) {
+			tds_mutex_unlock(&dbc->mtx);
+			free(key);
+			return ODBC_PREP_MISS;
+		}
+		memset(entry, 0, TDS_OFFSET(ODBC_PREP_ENTRY, key));
+		entry->key_len = key_len;
+		memcpy(entry->key, key, key_len);
+		tds_hash_insert(&cache->hash, &entry->hash_entry, hash);
+		++cache->num_entries;
+	} else {
+		odbc_prep_lru_unlink(cache, entry);
+	}
+	odbc_prep_lru_append(cache, entry);
+	free(key);
+
+	++entry->executions;
+
+	/* another statement is using it, prepare a private one */
+	if (entry->in_use) {
+		++cache->misses;
+		tds_mutex_unlock(&dbc->mtx);
+		return ODBC_PREP_MISS;
+	}
+
+	/* server could have lost the statement */
+	if (entry->dyn && (entry->dyn->defer_close || !tds_needs_unprepare(dbc->tds_socket->conn, entry->dyn)))
+		tds_release_dynamic(&entry->dyn);
+
+	if (entry->dyn) {
+		++cache->hits;
+		++entry->dyn->ref_count;
+		stmt->dyn = entry->dyn;
+		res = ODBC_PREP_HIT;
+	} else if (entry->executions < dbc->attr.prepare_threshold) {
+		++cache->misses;
+		res = ODBC_PREP_DIRECT;
+	} else {
+		++cache->misses;
+	}
+	if (res != ODBC_PREP_DIRECT) {
+		entry->in_use = true;
+		stmt->prep_entry = entry;
+	}
+
+	tdsdump_log(TDS_DBG_INFO1, "prepare cache %s, hits %" PRIu64 " misses %" PRIu64 "\n",
+		    res == ODBC_PREP_HIT ? "hit" : "miss", (uint64_t) cache->hits, (uint64_t) cache->misses);
+
+	odbc_prep_cache_trim(dbc);
+	tds_mutex_unlock(&dbc->mtx);
+	return res;
+}
+
+/**
+ * Give back the statement prepared to the cache.
+ * \return true if stmt->dyn was taken by the cache (stmt->dyn is set to NULL)
+ */
+bool
+odbc_prep_cache_put(TDS_STMT *stmt)
+{
+	TDS_DBC *dbc = stmt->dbc;
+	ODBC_PREP_ENTRY *entry = stmt->prep_entry;
+	bool taken = false;
+
+	if (!entry)
+		return false;
+
+	tds_mutex_lock(&dbc->mtx);
+	stmt->prep_entry = NULL;
+	entry->in_use = false;
+
+	if (stmt->dyn && entry->dyn == stmt->dyn) {
+		tds_release_dynamic(&stmt->dyn);
+		taken = true;
+	} else if (stmt->dyn && !entry->dyn && !stmt->dyn->defer_close
+		   && tds_needs_unprepare(dbc->tds_socket->conn, stmt->dyn)) {
+		entry->dyn = stmt->dyn;
+		stmt->dyn = NULL;
+		taken = true;
+	}
+
+	odbc_prep_cache_trim(dbc);
+	tds_mutex_unlock(&dbc->mtx);
+	return taken;
+}
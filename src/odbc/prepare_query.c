@@ -248,6 +248,39 @@ start_parse_prepared_query(struct _hstmt *stmt, bool compute_row)
 	return parse_prepared_query(stmt, compute_row);
 }
 
+/**
+ * Compute parameters for the next row of a parameter array.
+ * Parameters of the previous row are converted in place, column by
+ * column, reusing the parameter information and data buffers instead
+ * of building them again.
+ */
+int
+next_row_prepared_query(struct _hstmt *stmt)
+{
+	TDSPARAMINFO *params = stmt->params;
+	int i;
+
+	/* constants in RPC calls and return values need a full parse */
+	if (stmt->prepared_pos > 0 || stmt->prepared_query_is_func || !params
+	    || params->num_cols != (int) stmt->param_count
+	    || params->num_cols > stmt->apd->header.sql_desc_count
+	    || params->num_cols > stmt->ipd->header.sql_desc_count)
+		return start_parse_prepared_query(stmt, true);
+
+	for (i = 0; i < params->num_cols; ++i) {
+		stmt->param_num = i + 1;
+		switch (odbc_sql2tds(stmt, &stmt->ipd->records[i], &stmt->apd->records[i],
+				     params->columns[i], true, stmt->apd, stmt->curr_param_row)) {
+		case SQL_ERROR:
+			return SQL_ERROR;
+		case SQL_NEED_DATA:
+			return SQL_NEED_DATA;
+		}
+	}
+	stmt->param_num = params->num_cols + 1;
+	return SQL_SUCCESS;
+}
+
 static ptrdiff_t
 odbc_wchar2hex(TDS_CHAR *dest, size_t destlen, const SQLWCHAR * src, size_t srclen)
 {
@@ -172,6 +172,21 @@ _odbc_blob_free(TDSCOLUMN *col)
 	TDS_ZERO_FREE(col->column_data);
 }
 
+/**
+ * Allocate data for a parameter.
+ * The buffer used for the previous row of a parameter array is
+ * reused if it has the right size.
+ * \param prev_size size of the buffer already allocated, -1 if none
+ */
+static void *
+odbc_alloc_param_data(TDSCOLUMN *curcol, TDS_INT prev_size)
+{
+	if (prev_size >= 0 && prev_size == curcol->funcs->row_len(curcol)
+	    && !is_blob_col(curcol) && curcol->column_type != SYBMSTABLE)
+		return curcol->column_data;
+	return tds_alloc_param_data(curcol);
+}
+
 static SQLRETURN
 odbc_convert_table(TDS_STMT *stmt, SQLTVP *src, TDS_TVP *dest, SQLLEN num_rows)
 {
@@ -290,10 +305,16 @@ odbc_sql2tds(TDS_STMT * stmt, const struct _drecord *drec_ixd, const struct _dre
 	ODBC_CONVERT_BUF convert_buf;
 	SQLLEN sql_len;
 	bool need_data = false;
+	TDS_INT prev_size = -1;
 
 	/* TODO handle bindings of char like "{d '2002-11-12'}" */
 	tdsdump_log(TDS_DBG_INFO2, "type=%d\n", drec_ixd->sql_desc_concise_type);
 
+	/* data allocated converting previous row, can be reused */
+	if (curcol->column_data && curcol->column_data_free && curcol->column_data_free != _odbc_blob_free
+	    && !is_blob_col(curcol) && curcol->column_type != SYBMSTABLE)
+		prev_size = curcol->funcs->row_len(curcol);
+
 	/* what type to convert ? */
 	dest_type = odbc_sql_to_server_type(conn, drec_ixd->sql_desc_concise_type, drec_ixd->sql_desc_unsigned);
 	if (dest_type == TDS_INVALID_TYPE) {
@@ -497,7 +518,7 @@ odbc_sql2tds(TDS_STMT * stmt, const struct _drecord *drec_ixd, const struct _dre
 	}
 
 	/* allocate given space */
-	if (!tds_alloc_param_data(curcol)) {
+	if (!odbc_alloc_param_data(curcol, prev_size)) {
 		odbc_errs_add(&stmt->errs, "HY001", NULL);
 		return SQL_ERROR;
 	}
@@ -0,0 +1,193 @@
+#include "common.h"
+#include <assert.h>
+#include <odbcss.h>
+
+/* Test parameter arrays of INSERT statements sent using bulk copy */
+
+#define ARRAY_SIZE 100
+
+static int failure = 0;
+
+static void
+set_attr(void)
+{
+	CHKSetConnectAttr(SQL_COPT_TDSODBC_BULK_INSERT, (SQLPOINTER) SQL_BULK_INSERT_ON, 0, "S");
+}
+
+static void
+query_test(const char *query, bool prepare, SQLRETURN expected, unsigned expected_rows, unsigned bad_row)
+{
+	SQLINTEGER ids[ARRAY_SIZE];
+	SQLCHAR names[ARRAY_SIZE][30];
+	SQLLEN id_lens[ARRAY_SIZE], name_lens[ARRAY_SIZE];
+	SQLUSMALLINT statuses[ARRAY_SIZE];
+	SQLULEN processed;
+	SQLRETURN ret;
+	char sql[128];
+	unsigned i;
+
+	odbc_reset_statement();
+
+	odbc_command("create table #bulk (id int not null, name varchar(20) null)");
+
+	SQLSetStmtAttr(odbc_stmt, SQL_ATTR_PARAM_BIND_TYPE, SQL_PARAM_BIND_BY_COLUMN, 0);
+	SQLSetStmtAttr(odbc_stmt, SQL_ATTR_PARAMSET_SIZE, (void *) ARRAY_SIZE, 0);
+	SQLSetStmtAttr(odbc_stmt, SQL_ATTR_PARAM_STATUS_PTR, statuses, 0);
+	SQLSetStmtAttr(odbc_stmt, SQL_ATTR_PARAMS_PROCESSED_PTR, &processed, 0);
+	CHKBindParameter(1, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, ids, 0, id_lens, "S");
+	CHKBindParameter(2, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 20, 0, names, sizeof(names[0]), name_lens, "S");
+
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		statuses[i] = SQL_PARAM_DIAG_UNAVAILABLE;
+		ids[i] = i + 1;
+		id_lens[i] = 0;
+		sprintf((char *) names[i], "name %u", i);
+		name_lens[i] = (i % 10) == 3 ? SQL_NULL_DATA : SQL_NTS;
+	}
+	/* this row does not fit into the column */
+	if (bad_row < ARRAY_SIZE)
+		strcpy((char *) names[bad_row], "a string too long for column");
+
+	if (prepare) {
+		CHKPrepare(T(query), SQL_NTS, "S");
+		ret = SQLExecute(odbc_stmt);
+	} else {
+		ret = SQLExecDirect(odbc_stmt, T(query), SQL_NTS);
+	}
+	if (ret != expected) {
+		fprintf(stderr, "Invalid result for %s: got %d expected %d\n", query, (int) ret, (int) expected);
+		odbc_read_error();
+		failure = 1;
+	}
+	if (processed != ARRAY_SIZE) {
+		fprintf(stderr, "Invalid processed number: %d\n", (int) processed);
+		failure = 1;
+	}
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		SQLUSMALLINT expected_status = i == bad_row ? SQL_PARAM_ERROR : SQL_PARAM_SUCCESS;
+
+		if (statuses[i] != expected_status) {
+			fprintf(stderr, "Invalid status %d for row %u\n", statuses[i], i);
+			failure = 1;
+		}
+	}
+
+	odbc_reset_statement();
+
+	sprintf(sql, "IF (SELECT COUNT(*) FROM #bulk) <> %u SELECT 1", expected_rows);
+	odbc_check_no_row(sql);
+	odbc_check_no_row("IF EXISTS(SELECT * FROM #bulk WHERE (id % 10) = 4 AND name IS NOT NULL) SELECT 1");
+	odbc_check_no_row("IF NOT EXISTS(SELECT * FROM #bulk WHERE id = 5 AND name = 'name 4') SELECT 1");
+
+	odbc_command("drop table #bulk");
+}
+
+/*
+ * Insert rows in a table with an INSERT trigger logging each firing.
+ * Bulk copy fires the trigger once, executing rows one by one fires
+ * it for each row inserted.
+ */
+static void
+trigger_test(bool bulk, unsigned bad_row)
+{
+	SQLINTEGER ids[ARRAY_SIZE];
+	SQLLEN id_lens[ARRAY_SIZE];
+	SQLUSMALLINT statuses[ARRAY_SIZE];
+	SQLULEN processed;
+	SQLRETURN ret, expected = bad_row < ARRAY_SIZE ? SQL_SUCCESS_WITH_INFO : SQL_SUCCESS;
+	unsigned i, rows = bad_row < ARRAY_SIZE ? ARRAY_SIZE - 1 : ARRAY_SIZE;
+	unsigned firings = bulk && bad_row >= ARRAY_SIZE ? 1 : rows;
+	char sql[128];
+
+	CHKSetConnectAttr(SQL_COPT_TDSODBC_BULK_INSERT, TDS_INT2PTR(bulk ? SQL_BULK_INSERT_ON : SQL_BULK_INSERT_OFF), 0, "S");
+	odbc_reset_statement();
+	odbc_command("DELETE FROM bulk_insert_trg");
+	odbc_command("DELETE FROM bulk_insert_log");
+
+	SQLSetStmtAttr(odbc_stmt, SQL_ATTR_PARAM_BIND_TYPE, SQL_PARAM_BIND_BY_COLUMN, 0);
+	SQLSetStmtAttr(odbc_stmt, SQL_ATTR_PARAMSET_SIZE, (void *) ARRAY_SIZE, 0);
+	SQLSetStmtAttr(odbc_stmt, SQL_ATTR_PARAM_STATUS_PTR, statuses, 0);
+	SQLSetStmtAttr(odbc_stmt, SQL_ATTR_PARAMS_PROCESSED_PTR, &processed, 0);
+	CHKBindParameter(1, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, ids, 0, id_lens, "S");
+
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		statuses[i] = SQL_PARAM_DIAG_UNAVAILABLE;
+		/* zero violates the check constraint */
+		ids[i] = i == bad_row ? 0 : i + 1;
+		id_lens[i] = 0;
+	}
+
+	ret = SQLExecDirect(odbc_stmt, T("INSERT INTO bulk_insert_trg VALUES (?)"), SQL_NTS);
+	if (ret != expected) {
+		fprintf(stderr, "Invalid result for bulk %d: got %d expected %d\n", (int) bulk, (int) ret, (int) expected);
+		odbc_read_error();
+		failure = 1;
+	}
+	if (processed != ARRAY_SIZE) {
+		fprintf(stderr, "Invalid processed number: %d\n", (int) processed);
+		failure = 1;
+	}
+	for (i = 0; i < ARRAY_SIZE; i++) {
+		SQLUSMALLINT expected_status = i == bad_row ? SQL_PARAM_ERROR : SQL_PARAM_SUCCESS;
+
+		if (statuses[i] != expected_status) {
+			fprintf(stderr, "Invalid status %d for row %u\n", statuses[i], i);
+			failure = 1;
+		}
+	}
+
+	odbc_reset_statement();
+
+	sprintf(sql, "IF (SELECT COUNT(*) FROM bulk_insert_trg) <> %u SELECT 1", rows);
+	odbc_check_no_row(sql);
+	sprintf(sql, "IF (SELECT COUNT(*) FROM bulk_insert_log) <> %u SELECT 1", firings);
+	odbc_check_no_row(sql);
+}
+
+TEST_MAIN()
+{
+	odbc_use_version3 = true;
+	odbc_set_conn_attr = set_attr;
+	odbc_conn_additional_params = "ClientCharset=ISO-8859-1;";
+	odbc_connect();
+
+	if (!odbc_db_is_microsoft()) {
+		odbc_disconnect();
+		printf("Test for MSSQL only\n");
+		odbc_test_skipped();
+		return 0;
+	}
+
+	query_test("INSERT INTO #bulk VALUES (?, ?)", false, SQL_SUCCESS, ARRAY_SIZE, ARRAY_SIZE);
+	query_test("insert #bulk(id, [name]) values(?,?);", true, SQL_SUCCESS, ARRAY_SIZE, ARRAY_SIZE);
+
+	/* a row failing conversion is not inserted */
+	query_test("INSERT INTO #bulk VALUES (?, ?)", false, SQL_SUCCESS_WITH_INFO, ARRAY_SIZE - 1, 7);
+
+	/* not handled by bulk copy */
+	query_test("INSERT INTO #bulk(id, name) SELECT ?, ?", false, SQL_SUCCESS, ARRAY_SIZE, ARRAY_SIZE);
+
+	/* triggers cannot be created on temporary tables */
+	odbc_command("IF OBJECT_ID('bulk_insert_trg') IS NOT NULL DROP TABLE bulk_insert_trg");
+	odbc_command("IF OBJECT_ID('bulk_insert_log') IS NOT NULL DROP TABLE bulk_insert_log");
+	odbc_command("CREATE TABLE bulk_insert_trg (id int not null CHECK (id <> 0))");
+	odbc_command("CREATE TABLE bulk_insert_log (n int not null)");
+	odbc_command("CREATE TRIGGER bulk_insert_trg_ins ON bulk_insert_trg FOR INSERT AS "
+		     "SET NOCOUNT ON INSERT INTO bulk_insert_log VALUES (1)");
+
+	/* check rows were sent using bulk copy */
+	trigger_test(true, ARRAY_SIZE);
+	trigger_test(false, ARRAY_SIZE);
+
+	/* server rejects bulk copy, rows are executed one by one */
+	trigger_test(true, 42);
+	trigger_test(false, 42);
+
+	odbc_command("DROP TABLE bulk_insert_trg");
+	odbc_command("DROP TABLE bulk_insert_log");
+
+	odbc_disconnect();
+
+	printf("Done.\n");
+	return failure;
+}
@@ -0,0 +1,174 @@
+#include "common.h"
+#include <assert.h>
+
+/* Test bound columns are copied correctly when plan of the copy changes */
+
+#define ROWS 4
+
+static const SQLINTEGER ints[ROWS] = { 1, 2, 0, 4 };
+static const double floats[ROWS] = { 1.5, 0, 3.5, 4.5 };
+static const bool int_nulls[ROWS] = { false, false, true, false };
+static const bool float_nulls[ROWS] = { false, true, false, false };
+
+static void
+check_int(int row, SQLINTEGER value, SQLLEN ind)
+{
+	if (int_nulls[row] ? ind != SQL_NULL_DATA : (ind != sizeof(SQLINTEGER) || value != ints[row])) {
+		fprintf(stderr, "Row %d: wrong int %d ind %ld\n", row, (int) value, (long) ind);
+		exit(1);
+	}
+}
+
+static void
+check_float(int row, double value, SQLLEN ind)
+{
+	if (float_nulls[row] ? ind != SQL_NULL_DATA : (ind != sizeof(double) || value != floats[row])) {
+		fprintf(stderr, "Row %d: wrong float %g ind %ld\n", row, value, (long) ind);
+		exit(1);
+	}
+}
+
+/* fetch row by row, values copied directly */
+static void
+test_direct(void)
+{
+	SQLINTEGER i;
+	double f;
+	SQLLEN i_ind, f_ind;
+	int row;
+
+	CHKBindCol(1, SQL_C_LONG, &i, 0, &i_ind, "S");
+	CHKBindCol(2, SQL_C_DOUBLE, &f, 0, &f_ind, "S");
+	odbc_command("SELECT i, f FROM #plan ORDER BY k");
+	for (row = 0; row < ROWS; ++row) {
+		CHKFetch("S");
+		check_int(row, i, i_ind);
+		check_float(row, f, f_ind);
+	}
+	CHKFetch("No");
+	CHKMoreResults("No");
+	CHKFreeStmt(SQL_UNBIND, "S");
+}
+
+/* binding a column again while fetching */
+static void
+test_rebind(void)
+{
+	SQLINTEGER i;
+	char buf[32];
+	SQLLEN ind;
+
+	CHKBindCol(1, SQL_C_LONG, &i, 0, &ind, "S");
+	odbc_command("SELECT i FROM #plan ORDER BY k");
+	CHKFetch("S");
+	check_int(0, i, ind);
+
+	CHKBindCol(1, SQL_C_CHAR, buf, sizeof(buf), &ind, "S");
+	CHKFetch("S");
+	if (ind != 1 || strcmp(buf, "2") != 0) {
+		fprintf(stderr, "Wrong data after binding again: %s\n", buf);
+		exit(1);
+	}
+	CHKCloseCursor("SI");
+	CHKFreeStmt(SQL_UNBIND, "S");
+}
+
+/* same binding used for different result sets */
+static void
+test_new_result(void)
+{
+	double f;
+	SQLLEN ind;
+
+	CHKBindCol(1, SQL_C_DOUBLE, &f, 0, &ind, "S");
+	odbc_command("SELECT f FROM #plan WHERE k = 1 SELECT i FROM #plan WHERE k = 4");
+	CHKFetch("S");
+	check_float(0, f, ind);
+	CHKFetch("No");
+
+	/* an int column now, data must be converted */
+	CHKMoreResults("S");
+	CHKFetch("S");
+	if (ind != sizeof(double) || f != 4.0) {
+		fprintf(stderr, "Wrong data in second result: %g\n", f);
+		exit(1);
+	}
+	CHKFetch("No");
+	CHKMoreResults("No");
+	CHKFreeStmt(SQL_UNBIND, "S");
+}
+
+/* column-wise arrays with a bind offset */
+static void
+test_column_wise(void)
+{
+#define EXTRA 2
+	SQLINTEGER i[ROWS + EXTRA * 2];
+	double f[ROWS + EXTRA];
+	SQLLEN i_ind[ROWS + EXTRA], f_ind[ROWS + EXTRA];
+	SQLLEN offset = EXTRA * sizeof(SQLINTEGER);
+	SQLULEN fetched;
+	int row, n;
+
+	/* offset is in bytes, so it moves each array by a different number of elements */
+	assert(offset % sizeof(double) == 0 && offset % sizeof(SQLLEN) == 0);
+
+	for (n = 0; n < ROWS + EXTRA; ++n) {
+		f[n] = -1;
+		i_ind[n] = f_ind[n] = -2;
+	}
+	for (n = 0; n < ROWS + EXTRA * 2; ++n)
+		i[n] = -1;
+
+	CHKSetStmtAttr(SQL_ATTR_ROW_ARRAY_SIZE, TDS_INT2PTR(ROWS), 0, "S");
+	CHKSetStmtAttr(SQL_ATTR_ROW_BIND_TYPE, SQL_BIND_BY_COLUMN, 0, "S");
+	CHKSetStmtAttr(SQL_ATTR_ROW_BIND_OFFSET_PTR, &offset, 0, "S");
+	CHKSetStmtAttr(SQL_ATTR_ROWS_FETCHED_PTR, &fetched, 0, "S");
+	CHKBindCol(1, SQL_C_LONG, i, 0, i_ind, "S");
+	CHKBindCol(2, SQL_C_DOUBLE, f, 0, f_ind, "S");
+
+	odbc_command("SELECT i, f FROM #plan ORDER BY k");
+	CHKFetch("S");
+	if (fetched != ROWS) {
+		fprintf(stderr, "Wrong number of rows fetched %ld\n", (long) fetched);
+		exit(1);
+	}
+
+	/* data and lengths of same row must move together */
+	n = (int) (offset / sizeof(SQLLEN));
+	for (row = 0; row < ROWS; ++row) {
+		check_int(row, i[offset / sizeof(SQLINTEGER) + row], i_ind[n + row]);
+		check_float(row, f[offset / sizeof(double) + row], f_ind[n + row]);
+	}
+	/* nothing before the offset is written */
+	for (row = 0; row < n; ++row)
+		assert(i_ind[row] == -2 && f_ind[row] == -2);
+	for (row = 0; row < (int) (offset / sizeof(SQLINTEGER)); ++row)
+		assert(i[row] == -1);
+
+	CHKFetch("No");
+	CHKMoreResults("No");
+	CHKFreeStmt(SQL_UNBIND, "S");
+	CHKSetStmtAttr(SQL_ATTR_ROW_BIND_OFFSET_PTR, NULL, 0, "S");
+	CHKSetStmtAttr(SQL_ATTR_ROW_ARRAY_SIZE, TDS_INT2PTR(1), 0, "S");
+}
+
+TEST_MAIN()
+{
+	odbc_use_version3 = true;
+	odbc_connect();
+
+	odbc_command("CREATE TABLE #plan(k INT NOT NULL, i INT NULL, f FLOAT NULL)");
+	odbc_command("INSERT INTO #plan VALUES(1, 1, 1.5)");
+	odbc_command("INSERT INTO #plan VALUES(2, 2, NULL)");
+	odbc_command("INSERT INTO #plan VALUES(3, NULL, 3.5)");
+	odbc_command("INSERT INTO #plan VALUES(4, 4, 4.5)");
+
+	test_direct();
+	test_rebind();
+	test_new_result();
+	test_column_wise();
+
+	odbc_disconnect();
+	return 0;
+}
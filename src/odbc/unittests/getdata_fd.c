@@ -0,0 +1,103 @@
+#include "common.h"
+#include <odbcss.h>
+
+/* Test large columns written by SQLGetData to a file descriptor */
+
+static void
+set_attr(void)
+{
+	CHKSetConnectAttr(SQL_COPT_TDSODBC_STREAM_LOBS, (SQLPOINTER) SQL_STREAM_LOBS_ON, 0, "S");
+}
+
+static void
+check_column(SQLUSMALLINT col, SQLSMALLINT c_type, char c, SQLLEN expected)
+{
+	SQLLEN len, size = 0;
+	SQLINTEGER fd;
+	char buf[16];
+	FILE *f;
+	int ch;
+
+	f = tmpfile();
+	if (!f) {
+		fprintf(stderr, "Error creating temporary file\n");
+		exit(1);
+	}
+	CHKSetStmtAttr(SQL_SOPT_TDSODBC_GETDATA_FD, TDS_INT2PTR(fileno(f)), 0, "S");
+	CHKGetStmtAttr(SQL_SOPT_TDSODBC_GETDATA_FD, &fd, sizeof(fd), NULL, "S");
+	if (fd != fileno(f)) {
+		fprintf(stderr, "Wrong file descriptor %d\n", (int) fd);
+		exit(1);
+	}
+
+	CHKGetData(col, c_type, buf, sizeof(buf), &len, "S");
+	if (len != expected) {
+		fprintf(stderr, "Wrong length %ld of column %u, expected %ld\n", (long) len, col, (long) expected);
+		exit(1);
+	}
+
+	/* value already returned */
+	CHKGetData(col, c_type, buf, sizeof(buf), &len, expected == SQL_NULL_DATA ? "S" : "No");
+
+	rewind(f);
+	while ((ch = getc(f)) != EOF) {
+		if (ch != c) {
+			fprintf(stderr, "Wrong data at position %ld of column %u\n", (long) size, col);
+			exit(1);
+		}
+		++size;
+	}
+	fclose(f);
+	if (size != (expected == SQL_NULL_DATA ? 0 : expected)) {
+		fprintf(stderr, "Wrong file size %ld of column %u\n", (long) size, col);
+		exit(1);
+	}
+}
+
+TEST_MAIN()
+{
+	SQLINTEGER id;
+	SQLLEN id_len, len;
+	char buf[16];
+
+	odbc_use_version3 = true;
+	odbc_set_conn_attr = set_attr;
+	odbc_connect();
+
+	if (!odbc_db_is_microsoft() || odbc_tds_version() < 0x702) {
+		odbc_disconnect();
+		printf("Test for MSSQL 2005 or later only\n");
+		odbc_test_skipped();
+		return 0;
+	}
+
+	odbc_command("SELECT 1 AS id, REPLICATE(CONVERT(VARCHAR(MAX), 'a'), 100000) AS a, "
+		     "CONVERT(VARBINARY(MAX), NULL) AS n, CONVERT(VARBINARY(MAX), REPLICATE(CONVERT(VARCHAR(MAX), 'b'), 70000)) AS b");
+	CHKBindCol(1, SQL_C_SLONG, &id, 0, &id_len, "S");
+
+	CHKFetch("S");
+	check_column(2, SQL_C_CHAR, 'a', 100000);
+	check_column(3, SQL_C_BINARY, 0, SQL_NULL_DATA);
+	check_column(4, SQL_C_BINARY, 'b', 70000);
+	CHKFetch("No");
+	CHKMoreResults("No");
+
+	/* only character and binary types can be written */
+	odbc_command("SELECT 1 AS id, REPLICATE(CONVERT(VARCHAR(MAX), 'a'), 10) AS a");
+	CHKFetch("S");
+	CHKSetStmtAttr(SQL_SOPT_TDSODBC_GETDATA_FD, TDS_INT2PTR(fileno(stdout)), 0, "S");
+	CHKGetData(2, SQL_C_SLONG, &id, sizeof(id), &len, "E");
+	odbc_reset_statement();
+
+	/* binary data are not converted to hexadecimal */
+	odbc_command("SELECT 1 AS id, CONVERT(VARBINARY(MAX), REPLICATE(CONVERT(VARCHAR(MAX), 'b'), 10)) AS b");
+	CHKFetch("S");
+	CHKSetStmtAttr(SQL_SOPT_TDSODBC_GETDATA_FD, TDS_INT2PTR(fileno(stdout)), 0, "S");
+	CHKGetData(2, SQL_C_CHAR, buf, sizeof(buf), &len, "E");
+	odbc_reset_statement();
+
+	odbc_disconnect();
+
+	printf("Done.\n");
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include "common.h"
+#include <odbcss.h>
+
+/* Test prepared statements are reused between statements of a connection */
+
+static void
+set_attr(void)
+{
+	CHKSetConnectAttr(SQL_COPT_TDSODBC_PREPARE_CACHE_SIZE, (SQLPOINTER) 2, 0, "S");
+}
+
+static void
+execute(const char *query, SQLINTEGER value)
+{
+	SQLINTEGER out = 0;
+	SQLLEN out_len;
+
+	odbc_reset_statement();
+
+	CHKPrepare(T(query), SQL_NTS, "S");
+	CHKBindParameter(1, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, &value, 0, NULL, "S");
+	CHKExecute("S");
+	CHKBindCol(1, SQL_C_SLONG, &out, 0, &out_len, "S");
+	CHKFetch("S");
+	if (out != value) {
+		fprintf(stderr, "Wrong value %d, expected %d\n", (int) out, (int) value);
+		exit(1);
+	}
+	CHKFetch("No");
+	CHKMoreResults("No");
+}
+
+static void
+check_stats(unsigned hits, unsigned misses, unsigned evictions, unsigned entries)
+{
+	struct tdsodbc_prepare_cache_stats stats;
+
+	CHKGetConnectAttr(SQL_COPT_TDSODBC_PREPARE_CACHE_STATS, &stats, sizeof(stats), NULL, "S");
+	if (stats.hits != hits || stats.misses != misses || stats.evictions != evictions || stats.entries != entries) {
+		fprintf(stderr, "Wrong stats: hits %u misses %u evictions %u entries %u\n",
+			(unsigned) stats.hits, (unsigned) stats.misses, (unsigned) stats.evictions,
+			(unsigned) stats.entries);
+		exit(1);
+	}
+}
+
+TEST_MAIN()
+{
+	int i;
+
+	odbc_use_version3 = true;
+	odbc_set_conn_attr = set_attr;
+	odbc_connect();
+
+	if (!odbc_db_is_microsoft()) {
+		odbc_disconnect();
+		printf("Test for MSSQL only\n");
+		odbc_test_skipped();
+		return 0;
+	}
+
+	/* first execution prepares, others reuse the handle */
+	for (i = 0; i < 4; ++i)
+		execute("SELECT ? AS n", i);
+	odbc_reset_statement();
+	check_stats(3, 1, 0, 1);
+
+	/* prepare only after the third execution */
+	CHKSetConnectAttr(SQL_COPT_TDSODBC_PREPARE_THRESHOLD, (SQLPOINTER) 3, 0, "S");
+	for (i = 0; i < 4; ++i)
+		execute("SELECT ? AS m", i);
+	odbc_reset_statement();
+	check_stats(4, 4, 0, 2);
+
+	/* shrinking the cache evicts the oldest entry */
+	CHKSetConnectAttr(SQL_COPT_TDSODBC_PREPARE_CACHE_SIZE, (SQLPOINTER) 1, 0, "S");
+	check_stats(4, 4, 1, 1);
+
+	/* evicted statement is unprepared and prepared again */
+	execute("SELECT ? AS n", 5);
+	odbc_reset_statement();
+	execute("SELECT ? AS m", 6);
+
+	odbc_disconnect();
+
+	printf("Done.\n");
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include "common.h"
+#include <odbcss.h>
+
+/* Test large parameters sent to the server while SQLPutData is called */
+
+#define CHUNK 4000
+#define NUM_CHUNKS 50
+
+static void
+set_attr(void)
+{
+	CHKSetConnectAttr(SQL_COPT_TDSODBC_STREAM_LOBS, (SQLPOINTER) SQL_STREAM_LOBS_ON, 0, "S");
+}
+
+static void
+put_data(unsigned num_chunks)
+{
+	unsigned char buf[CHUNK];
+	unsigned i, n;
+	SQLPOINTER ptr;
+
+	CHKParamData(&ptr, "Ne");
+	for (n = 0; n < num_chunks; ++n) {
+		for (i = 0; i < CHUNK; ++i)
+			buf[i] = (unsigned char) (i + n);
+		CHKPutData(buf, CHUNK, "S");
+	}
+}
+
+static void
+insert(SQLINTEGER id, const char *text, unsigned num_chunks)
+{
+	SQLLEN id_len = 0, text_ind = SQL_LEN_DATA_AT_EXEC(0), blob_ind = SQL_LEN_DATA_AT_EXEC(0);
+	SQLPOINTER ptr;
+
+	odbc_reset_statement();
+
+	CHKBindParameter(1, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, &id, 0, &id_len, "S");
+	CHKBindParameter(2, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_LONGVARCHAR, 0, 0, (SQLPOINTER) 2, 0, &text_ind, "S");
+	CHKBindParameter(3, SQL_PARAM_INPUT, SQL_C_BINARY, SQL_LONGVARBINARY, 0, 0, (SQLPOINTER) 3, 0, &blob_ind, "S");
+
+	CHKPrepare(T("INSERT INTO #putdata VALUES(?, ?, ?)"), SQL_NTS, "S");
+	CHKExecute("Ne");
+
+	/* first parameter is buffered, last one is streamed */
+	CHKParamData(&ptr, "Ne");
+	if (ptr != (SQLPOINTER) 2) {
+		fprintf(stderr, "Wrong pointer %p from SQLParamData\n", ptr);
+		exit(1);
+	}
+	CHKPutData((char *) text, SQL_NTS, "S");
+
+	put_data(num_chunks);
+	CHKParamData(&ptr, "S");
+}
+
+TEST_MAIN()
+{
+	char sql[256];
+	SQLLEN blob_ind = SQL_LEN_DATA_AT_EXEC(0);
+
+	odbc_use_version3 = true;
+	odbc_set_conn_attr = set_attr;
+	odbc_connect();
+
+	if (!odbc_db_is_microsoft() || odbc_tds_version() < 0x702) {
+		odbc_disconnect();
+		printf("Test for MSSQL 2005 or later only\n");
+		odbc_test_skipped();
+		return 0;
+	}
+
+	odbc_command("CREATE TABLE #putdata (id INT, t VARCHAR(MAX) NULL, b VARBINARY(MAX) NULL)");
+
+	insert(1, "some text", NUM_CHUNKS);
+	insert(2, "", 0);
+
+	odbc_reset_statement();
+	sprintf(sql, "IF NOT EXISTS(SELECT * FROM #putdata WHERE id = 1 AND t = 'some text' AND DATALENGTH(b) = %u "
+		"AND SUBSTRING(b, %u, 3) = 0x%02x%02x%02x) SELECT 1",
+		CHUNK * NUM_CHUNKS, CHUNK * 3 + 1, 3, 4, 5);
+	odbc_check_no_row(sql);
+	odbc_check_no_row("IF NOT EXISTS(SELECT * FROM #putdata WHERE id = 2 AND DATALENGTH(b) = 0) SELECT 1");
+
+	/* closing the statement discards the request */
+	odbc_reset_statement();
+	CHKBindParameter(1, SQL_PARAM_INPUT, SQL_C_BINARY, SQL_LONGVARBINARY, 0, 0, (SQLPOINTER) 1, 0, &blob_ind, "S");
+	CHKExecDirect(T("INSERT INTO #putdata(id, b) VALUES(3, ?)"), SQL_NTS, "Ne");
+	put_data(2);
+	CHKFreeStmt(SQL_CLOSE, "S");
+
+	odbc_reset_statement();
+	odbc_check_no_row("IF (SELECT COUNT(*) FROM #putdata) <> 2 SELECT 1");
+
+	odbc_disconnect();
+
+	printf("Done.\n");
+	return 0;
+}
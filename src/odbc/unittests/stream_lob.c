@@ -0,0 +1,88 @@
+#include "common.h"
+#include <odbcss.h>
+
+/* Test large columns read in pieces directly from the wire */
+
+static void
+set_attr(void)
+{
+	CHKSetConnectAttr(SQL_COPT_TDSODBC_STREAM_LOBS, (SQLPOINTER) SQL_STREAM_LOBS_ON, 0, "S");
+}
+
+static void
+check_column(SQLUSMALLINT col, SQLSMALLINT c_type, char c, size_t expected)
+{
+	char buf[1001];
+	size_t total = 0, i, n;
+	const size_t char_size = c_type == SQL_C_WCHAR ? sizeof(SQLWCHAR) : 1;
+	SQLLEN len;
+
+	while (CHKGetData(col, c_type, buf, sizeof(buf) - sizeof(buf) % char_size, &len, "SINo") != SQL_NO_DATA) {
+		if (len == SQL_NULL_DATA) {
+			n = 0;
+			break;
+		}
+		n = (len == SQL_NO_TOTAL || len >= (SQLLEN) sizeof(buf)) ? sizeof(buf) / char_size - 1 : len / char_size;
+		for (i = 0; i < n; ++i) {
+			if (buf[i * char_size] != c) {
+				fprintf(stderr, "Wrong data at position %u of column %u\n", (unsigned) (total + i), col);
+				exit(1);
+			}
+		}
+		total += n;
+	}
+	if (total != expected) {
+		fprintf(stderr, "Wrong length %u of column %u, expected %u\n", (unsigned) total, col, (unsigned) expected);
+		exit(1);
+	}
+}
+
+TEST_MAIN()
+{
+	SQLINTEGER id;
+	SQLLEN id_len, len;
+	char buf[16];
+
+	odbc_use_version3 = true;
+	odbc_set_conn_attr = set_attr;
+	odbc_connect();
+
+	if (!odbc_db_is_microsoft() || odbc_tds_version() < 0x702) {
+		odbc_disconnect();
+		printf("Test for MSSQL 2005 or later only\n");
+		odbc_test_skipped();
+		return 0;
+	}
+
+	odbc_command("SELECT 1 AS id, REPLICATE(CONVERT(VARCHAR(MAX), 'a'), 100000) AS a, "
+		     "CONVERT(VARCHAR(MAX), NULL) AS n, REPLICATE(CONVERT(NVARCHAR(MAX), N'b'), 50000) AS b "
+		     "UNION ALL SELECT 2, REPLICATE(CONVERT(VARCHAR(MAX), 'c'), 30000), 'x', N''");
+	CHKBindCol(1, SQL_C_SLONG, &id, 0, &id_len, "S");
+
+	/* read all columns in pieces */
+	CHKFetch("S");
+	check_column(2, SQL_C_CHAR, 'a', 100000);
+	check_column(3, SQL_C_CHAR, 0, 0);
+	check_column(4, SQL_C_WCHAR, 'b', 50000);
+
+	/* previous column was discarded */
+	CHKGetData(2, SQL_C_CHAR, buf, sizeof(buf), &len, "E");
+
+	/* skip remaining data of the row */
+	CHKFetch("S");
+	if (id != 2) {
+		fprintf(stderr, "Wrong id %d\n", (int) id);
+		exit(1);
+	}
+	CHKGetData(2, SQL_C_CHAR, buf, sizeof(buf), &len, "I");
+	CHKFetch("No");
+	CHKMoreResults("No");
+
+	/* connection is still usable */
+	odbc_check_no_row("IF 1 = 0 SELECT 1");
+
+	odbc_disconnect();
+
+	printf("Done.\n");
+	return 0;
+}
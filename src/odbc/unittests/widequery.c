@@ -0,0 +1,79 @@
+#include "common.h"
+#include <assert.h>
+#include <freetds/odbc.h>
+#include <freetds/iconv.h>
+#include <freetds/encodings.h>
+
+/* Check queries passed to wide functions are handed to libTDS already converted */
+
+#if defined(ENABLE_ODBC_WIDE) && defined(UNICODE)
+static TDS_DBC *dbc;
+static TDS_STMT *stmt;
+
+/* same conditions used by driver to keep wide queries */
+static bool
+wide_expected(void)
+{
+	TDSCONNECTION *conn = dbc->tds_socket->conn;
+	const TDSICONV *conv = conn->char_convs[client2ucs2];
+
+	if (!IS_TDS7_PLUS(conn) || odbc_get_wide_canonic(conn) != conv->to.charset.canonic)
+		return false;
+	return conv->from.charset.max_bytes_per_char == 1 || conv->from.charset.canonic == TDS_CHARSET_UTF_8;
+}
+
+static void
+check_query(const char *query, bool seeded)
+{
+	unsigned int num_parsed = dbc->tds_socket->num_parsed;
+
+	CHKExecDirect(T(query), SQL_NTS, "S");
+	CHKFreeStmt(SQL_CLOSE, "S");
+
+	/* wide copy is released once used */
+	assert(stmt->query_wide == NULL);
+	if (dbc->tds_socket->num_parsed != num_parsed + (seeded ? 1 : 0)) {
+		fprintf(stderr, "Query %s: wrong number of parsed queries %u, was %u\n",
+			query, dbc->tds_socket->num_parsed, num_parsed);
+		exit(1);
+	}
+}
+#endif
+
+TEST_MAIN()
+{
+#if defined(ENABLE_ODBC_WIDE) && defined(UNICODE)
+	SQLULEN ulen;
+	bool expected;
+
+	odbc_connect();
+
+	if (!odbc_driver_is_freetds()) {
+		odbc_disconnect();
+		return 0;
+	}
+
+	CHKGetInfo(SQL_DRIVER_HDBC, &ulen, sizeof(ulen), NULL, "S");
+	dbc = (TDS_DBC *) (TDS_UINTPTR) ulen;
+	assert(dbc && dbc->tds_socket);
+	ulen = (SQLULEN) (TDS_UINTPTR) odbc_stmt;
+	CHKGetInfo(SQL_DRIVER_HSTMT, &ulen, sizeof(ulen), NULL, "S");
+	stmt = (TDS_STMT *) (TDS_UINTPTR) ulen;
+	assert(stmt);
+
+	expected = wide_expected();
+	printf("wide query %sexpected\n", expected ? "" : "not ");
+
+	/* query sent as is, wide text is used */
+	check_query("SELECT 'widequery test 1' AS w", expected);
+	/* same text again, already known */
+	check_query("SELECT 'widequery test 1' AS w", false);
+	/* escapes change the query, wide text cannot be used */
+	check_query("SELECT {fn LCASE('widequery test 2')} AS w", false);
+	/* non ASCII characters are compared as sequences */
+	check_query("SELECT 'widequery \xe8 test 3' AS w", expected);
+
+	odbc_disconnect();
+#endif
+	return 0;
+}
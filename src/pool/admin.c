@@ -0,0 +1,579 @@
+/* TDSPool - Connection pooling for TDS based databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Administration pseudo database.
+ * Users logging into POOL_ADMIN_DATABASE are not given a member,
+ * the pool answers their SQL batches itself. Supported commands are
+ * SHOW STATS, SHOW MEMBERS and SHOW USERS, each returning a result set.
+ * Replies are built in memory and sent like cached responses.
+ */
+
+#include <config.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include "pool.h"
+#include <freetds/server.h>
+#include <freetds/bytes.h>
+
+#define ADMIN_STR_SIZE 64
+
+typedef struct
+{
+	const char *name;
+	/** BIGINT if true, VARCHAR otherwise */
+	bool is_int;
+} ADMIN_COLUMN;
+
+/* values of a row being sent */
+typedef struct
+{
+	TDSRESULTINFO *resinfo;
+	/** rows sent */
+	int rows;
+	TDS_INT8 ints[8];
+	char strs[8][ADMIN_STR_SIZE];
+} ADMIN_ROW;
+
+static const char *const wait_bucket_names[POOL_WAIT_BUCKETS] = {
+	"wait < 1ms",
+	"wait < 10ms",
+	"wait < 100ms",
+	"wait < 1s",
+	"wait < 10s",
+	"wait >= 10s",
+};
+
+/**
+ * Record the time a user waited for a member.
+ * Pool lock must be held.
+ */
+void
+pool_admin_wait_time(TDS_POOL * pool, unsigned int wait_ms)
+{
+	unsigned int i, limit = 1;
+
+	for (i = 0; i < POOL_WAIT_BUCKETS - 1; ++i, limit *= 10)
+		if (wait_ms < limit)
+			break;
+	pool->wait_hist[i]++;
+}
+
+/**
+ * Accept a user logged into the admin database, sending the login
+ * acknowledge directly.
+ */
+bool
+pool_admin_login(TDS_POOL * pool, TDS_POOL_USER * puser)
+{
+	static const TDS_UCHAR latin1_collation[5] = { 0x09, 0x04, 0xd0, 0x00, 0x34 };
+	TDSSOCKET *tds = puser->sock.tds;
+	char msg[128];
+
+	tdsdump_log(TDS_DBG_INFO1, "admin user logged in\n");
+
+	tds_mutex_lock(&pool->mtx);
+	pool->user_logins++;
+	tds_mutex_unlock(&pool->mtx);
+
+	tds->conn->product_version = TDS_MS_VER(10, 0, 0);
+	memcpy(tds->conn->collation, latin1_collation, sizeof(latin1_collation));
+	if (!tds_realloc_socket(tds, 4096))
+		return false;
+	tds->conn->env.block_size = 4096;
+
+	tds->out_flag = TDS_REPLY;
+	tds_env_change(tds, TDS_ENV_DATABASE, "master", POOL_ADMIN_DATABASE);
+	sprintf(msg, "Changed database context to '%s'.", POOL_ADMIN_DATABASE);
+	tds_send_msg(tds, 5701, 2, 0, msg, pool->name, NULL, 1);
+
+	if (IS_TDS71_PLUS(tds->conn)) {
+		tds_put_byte(tds, TDS_ENVCHANGE_TOKEN);
+		tds_put_smallint(tds, 8);
+		tds_put_byte(tds, TDS_ENV_SQLCOLLATION);
+		tds_put_byte(tds, 5);
+		tds_put_n(tds, tds->conn->collation, 5);
+		tds_put_byte(tds, 0);
+	}
+
+	tds_send_login_ack(tds, "tdspool");
+	tds_env_change(tds, TDS_ENV_PACKSIZE, "4096", "4096");
+	tds_send_done_token(tds, TDS_DONE_FINAL, 0);
+	if (TDS_FAILED(tds_flush_packet(tds)))
+		return false;
+
+	tds_free_login(puser->login);
+	puser->login = NULL;
+	puser->admin = true;
+	puser->user_state = TDS_SRV_QUERY;
+	return true;
+}
+
+static bool
+admin_row_init(ADMIN_ROW * row, TDSSOCKET * tds, const ADMIN_COLUMN * columns, int num_cols)
+{
+	TDSRESULTINFO *resinfo;
+	int i;
+
+	assert(num_cols <= 8);
+
+	row->rows = 0;
+	row->resinfo = resinfo = tds_alloc_results(num_cols);
+	if (!resinfo)
+		return false;
+
+	for (i = 0; i < num_cols; ++i) {
+		TDSCOLUMN *col = resinfo->columns[i];
+
+		if (columns[i].is_int) {
+			tds_set_column_type(tds->conn, col, SYBINT8);
+			col->column_data = (unsigned char *) &row->ints[i];
+		} else {
+			tds_set_column_type(tds->conn, col, XSYBVARCHAR);
+			col->column_size = ADMIN_STR_SIZE;
+			col->on_server.column_size = ADMIN_STR_SIZE;
+			col->column_data = (unsigned char *) row->strs[i];
+		}
+		if (!tds_dstr_copy(&col->column_name, columns[i].name))
+			return false;
+	}
+	return TDS_SUCCEED(tds_send_table_header(tds, resinfo));
+}
+
+static void
+admin_set_int(ADMIN_ROW * row, int col, TDS_INT8 value)
+{
+	row->ints[col] = value;
+}
+
+static void
+admin_set_str(ADMIN_ROW * row, int col, const char *value)
+{
+	size_t len = strlen(value);
+
+	if (len >= ADMIN_STR_SIZE)
+		len = ADMIN_STR_SIZE - 1;
+	memcpy(row->strs[col], value, len);
+	row->resinfo->columns[col]->column_cur_size = (TDS_INT) len;
+}
+
+static void
+admin_send_row(TDSSOCKET * tds, ADMIN_ROW * row)
+{
+	tds_send_row(tds, row->resinfo);
+	row->rows++;
+}
+
+static void
+admin_stat(TDSSOCKET * tds, ADMIN_ROW * row, const char *name, TDS_INT8 value)
+{
+	admin_set_str(row, 0, name);
+	admin_set_int(row, 1, value);
+	admin_send_row(tds, row);
+}
+
+static int
+admin_show_stats(TDS_POOL * pool, TDSSOCKET * tds)
+{
+	static const ADMIN_COLUMN columns[] = {
+		{ "name", false },
+		{ "value", true },
+	};
+	ADMIN_ROW row;
+	TDS_POOL_MEMBER *pmbr;
+	TDS_UINT8 to_members = 0, to_users = 0;
+	unsigned long wait_hist[POOL_WAIT_BUCKETS], member_resets;
+	unsigned long user_logins, member_logins, members_prewarmed, members_retired;
+	unsigned long cache_hits, cache_misses;
+	unsigned int cache_entries;
+	size_t cache_bytes;
+	int num_users, num_waiters, num_members, active = 0, idle = 0, target;
+	double login_secs;
+	unsigned int i;
+
+	/* per worker counters, read without lock */
+	for (i = 0; i < pool->set->num_workers; ++i) {
+		to_members += pool->set->workers[i].bytes_to_members;
+		to_users += pool->set->workers[i].bytes_to_users;
+	}
+
+	tds_mutex_lock(&pool->mtx);
+	DLIST_FOREACH(dlist_member, &pool->active_members, pmbr)
+		++active;
+	DLIST_FOREACH(dlist_member, &pool->idle_members, pmbr)
+		++idle;
+	num_users = pool->num_users;
+	num_waiters = pool->num_waiters;
+	num_members = pool->num_active_members;
+	memcpy(wait_hist, pool->wait_hist, sizeof(wait_hist));
+	member_resets = pool->member_resets;
+	user_logins = pool->user_logins;
+	member_logins = pool->member_logins;
+	members_prewarmed = pool->members_prewarmed;
+	members_retired = pool->members_retired;
+	target = pool->target_members;
+	login_secs = pool->ewma_login_secs;
+	cache_entries = pool->cache_entries;
+	cache_bytes = pool->cache_bytes;
+	cache_hits = pool->cache_hits;
+	cache_misses = pool->cache_misses;
+	tds_mutex_unlock(&pool->mtx);
+
+	if (!admin_row_init(&row, tds, columns, TDS_VECTOR_SIZE(columns))) {
+		tds_free_results(row.resinfo);
+		return -1;
+	}
+
+	admin_stat(tds, &row, "users", num_users);
+	admin_stat(tds, &row, "waiters", num_waiters);
+	admin_stat(tds, &row, "members", num_members);
+	admin_stat(tds, &row, "active members", active);
+	admin_stat(tds, &row, "idle members", idle);
+	admin_stat(tds, &row, "user logins", user_logins);
+	admin_stat(tds, &row, "member logins", member_logins);
+	admin_stat(tds, &row, "member login ms", (TDS_INT8) (login_secs * 1000.0 + 0.5));
+	admin_stat(tds, &row, "member resets", member_resets);
+	admin_stat(tds, &row, "bytes to members", (TDS_INT8) to_members);
+	admin_stat(tds, &row, "bytes to users", (TDS_INT8) to_users);
+	for (i = 0; i < POOL_WAIT_BUCKETS; ++i)
+		admin_stat(tds, &row, wait_bucket_names[i], wait_hist[i]);
+	if (pool->adaptive_size) {
+		admin_stat(tds, &row, "target members", target);
+		admin_stat(tds, &row, "members prewarmed", members_prewarmed);
+		admin_stat(tds, &row, "members retired", members_retired);
+	}
+	if (pool->num_cache_queries) {
+		admin_stat(tds, &row, "cache entries", cache_entries);
+		admin_stat(tds, &row, "cache bytes", (TDS_INT8) cache_bytes);
+		admin_stat(tds, &row, "cache hits", cache_hits);
+		admin_stat(tds, &row, "cache misses", cache_misses);
+	}
+
+	tds_free_results(row.resinfo);
+	return row.rows;
+}
+
+/* values of a member or user, copied under the pool lock */
+typedef struct
+{
+	const char *state;
+	char login[ADMIN_STR_SIZE];
+	TDS_INT8 ints[4];
+} ADMIN_ITEM;
+
+/* send copied items, pool lock must not be held as sending can block */
+static int
+admin_send_items(TDSSOCKET * tds, const ADMIN_COLUMN * columns, int num_cols, const ADMIN_ITEM * items, int num_items)
+{
+	ADMIN_ROW row;
+	int i, col;
+
+	if (!admin_row_init(&row, tds, columns, num_cols)) {
+		tds_free_results(row.resinfo);
+		return -1;
+	}
+	for (i = 0; i < num_items; ++i) {
+		admin_set_str(&row, 0, items[i].state);
+		admin_set_str(&row, 1, items[i].login);
+		for (col = 2; col < num_cols; ++col)
+			admin_set_int(&row, col, items[i].ints[col - 2]);
+		admin_send_row(tds, &row);
+	}
+	tds_free_results(row.resinfo);
+	return row.rows;
+}
+
+static int
+admin_show_members(TDS_POOL * pool, TDSSOCKET * tds)
+{
+	static const ADMIN_COLUMN columns[] = {
+		{ "state", false },
+		{ "login", false },
+		{ "age", true },
+		{ "idle", true },
+		{ "pinned", true },
+		{ "in_tran", true },
+	};
+	ADMIN_ITEM *items, *item;
+	TDS_POOL_MEMBER *pmbr;
+	dlist_members *list;
+	time_t now = time(NULL);
+	int num_items = 0, rows;
+
+	/* members flags are owned by other workers, values can be stale */
+	tds_mutex_lock(&pool->mtx);
+	DLIST_FOREACH(dlist_member, &pool->active_members, pmbr)
+		++num_items;
+	DLIST_FOREACH(dlist_member, &pool->idle_members, pmbr)
+		++num_items;
+	items = tds_new(ADMIN_ITEM, num_items + 1);
+	if (!items) {
+		tds_mutex_unlock(&pool->mtx);
+		return -1;
+	}
+	item = items;
+	for (list = &pool->active_members;; list = &pool->idle_members) {
+		DLIST_FOREACH(dlist_member, list, pmbr) {
+			item->state = "idle";
+			if (pmbr->doing_async)
+				item->state = "connecting";
+			else if (pmbr->resetting)
+				item->state = "resetting";
+			else if (pmbr->busy)
+				item->state = "busy";
+			else if (list == &pool->active_members)
+				item->state = "active";
+			strlcpy(item->login, list == &pool->active_members && pmbr->last_class ? pmbr->last_class->name : "",
+				sizeof(item->login));
+			item->ints[0] = now - pmbr->open_tm;
+			item->ints[1] = pmbr->last_used_tm ? now - pmbr->last_used_tm : 0;
+			item->ints[2] = pmbr->pinned;
+			item->ints[3] = pmbr->in_tran;
+			++item;
+		}
+		if (list == &pool->idle_members)
+			break;
+	}
+	tds_mutex_unlock(&pool->mtx);
+
+	rows = admin_send_items(tds, columns, TDS_VECTOR_SIZE(columns), items, num_items);
+	free(items);
+	return rows;
+}
+
+static int
+admin_show_users(TDS_POOL * pool, TDSSOCKET * tds)
+{
+	static const ADMIN_COLUMN columns[] = {
+		{ "state", false },
+		{ "login", false },
+		{ "wait", true },
+	};
+	ADMIN_ITEM *items, *item;
+	TDS_POOL_USER *puser;
+	dlist_users *list;
+	time_t now = time(NULL);
+	int num_items = 0, rows;
+
+	tds_mutex_lock(&pool->mtx);
+	DLIST_FOREACH(dlist_user, &pool->users, puser)
+		++num_items;
+	DLIST_FOREACH(dlist_user, &pool->waiters, puser)
+		++num_items;
+	items = tds_new(ADMIN_ITEM, num_items + 1);
+	if (!items) {
+		tds_mutex_unlock(&pool->mtx);
+		return -1;
+	}
+	item = items;
+	for (list = &pool->users;; list = &pool->waiters) {
+		DLIST_FOREACH(dlist_user, list, puser) {
+			item->state = "idle";
+			if (puser->admin)
+				item->state = "admin";
+			else if (!puser->pclass)
+				item->state = "login";
+			else if (list == &pool->waiters)
+				item->state = "waiting";
+			else if (puser->assigned_member)
+				item->state = "active";
+			strlcpy(item->login, puser->pclass ? puser->pclass->name : "", sizeof(item->login));
+			item->ints[0] = puser->wait_tm ? now - puser->wait_tm : 0;
+			++item;
+		}
+		if (list == &pool->waiters)
+			break;
+	}
+	tds_mutex_unlock(&pool->mtx);
+
+	rows = admin_send_items(tds, columns, TDS_VECTOR_SIZE(columns), items, num_items);
+	free(items);
+	return rows;
+}
+
+/*
+ * Take the reply written since the freeze and send it like a cached
+ * response, so a user slow to read does not block the worker.
+ * @return false if user was disconnected
+ */
+static bool
+admin_send_reply(TDS_POOL * pool, TDS_POOL_USER * puser, TDSFREEZE * freeze)
+{
+	TDSPACKET *pkt;
+	unsigned char *data = NULL, *p;
+	size_t len = 0;
+
+	if (TDS_SUCCEED(tds_flush_packet(puser->sock.tds))) {
+		for (pkt = freeze->pkt; pkt->next; pkt = pkt->next)
+			len += pkt->data_len;
+		data = tds_new(unsigned char, len);
+	}
+	if (data) {
+		p = data;
+		for (pkt = freeze->pkt; pkt->next; pkt = pkt->next) {
+			memcpy(p, pkt->buf + tds_packet_get_data_start(pkt), pkt->data_len);
+			p += pkt->data_len;
+		}
+	}
+	tds_freeze_abort(freeze);
+
+	if (!data) {
+		pool_free_user(pool, puser);
+		return false;
+	}
+	return pool_cache_send(pool, puser, data, len);
+}
+
+/* execute the command received, normalized in upper case */
+static bool
+admin_execute(TDS_POOL * pool, TDS_POOL_USER * puser)
+{
+	TDSSOCKET *tds = puser->sock.tds;
+	const char *cmd = puser->admin_cmd;
+	int rows = -1;
+	TDSFREEZE freeze;
+
+	tdsdump_log(TDS_DBG_INFO1, "admin command: %s\n", cmd);
+
+	tds->out_flag = TDS_REPLY;
+	tds_freeze(tds, &freeze, 0);
+	if (strcmp(cmd, "SHOW STATS") == 0)
+		rows = admin_show_stats(pool, tds);
+	else if (strcmp(cmd, "SHOW MEMBERS") == 0)
+		rows = admin_show_members(pool, tds);
+	else if (strcmp(cmd, "SHOW USERS") == 0)
+		rows = admin_show_users(pool, tds);
+	else
+		tds_send_err(tds, 40000, 1, 16, "Unknown command, use SHOW STATS, SHOW MEMBERS or SHOW USERS",
+			     pool->name, NULL, 1);
+
+	if (rows >= 0)
+		tds_send_done_token(tds, TDS_DONE_COUNT, rows);
+	else
+		tds_send_done_token(tds, TDS_DONE_ERROR, 0);
+	return admin_send_reply(pool, puser, &freeze);
+}
+
+/* append text of a query packet to the command, normalizing spaces */
+static void
+admin_append(TDS_POOL_USER * puser, const unsigned char *p, const unsigned char *end)
+{
+	const unsigned int max_len = sizeof(puser->admin_cmd) - 1;
+	unsigned int len = puser->admin_cmd_len;
+	char *cmd = puser->admin_cmd;
+
+	/* text is UCS-2, non ASCII characters are not valid in commands */
+	for (; p + 2 <= end; p += 2) {
+		unsigned char c = p[1] ? '?' : p[0];
+
+		if (isspace(c) || c == ';') {
+			if (len == 0 || cmd[len - 1] == ' ')
+				continue;
+			c = ' ';
+		}
+		if (len >= max_len) {
+			/* too long, will not match any command */
+			len = max_len;
+			cmd[0] = '?';
+			break;
+		}
+		cmd[len++] = toupper(c);
+	}
+	puser->admin_cmd_len = len;
+}
+
+/**
+ * Read requests from an admin user and answer them.
+ * @return false if user was disconnected
+ */
+bool
+pool_admin_read(TDS_POOL * pool, TDS_POOL_USER * puser)
+{
+	TDSSOCKET *tds = puser->sock.tds;
+	const unsigned char *p, *end;
+	bool eom;
+	TDSFREEZE freeze;
+
+	for (;;) {
+		/* wait for the previous reply to be sent */
+		if (puser->cache_reply)
+			return true;
+		if (pool_packet_read(tds))
+			return true;
+		if (tds->in_len == 0) {
+			tdsdump_log(TDS_DBG_INFO1, "admin user disconnected\n");
+			pool_free_user(pool, puser);
+			return false;
+		}
+		tds->in_pos = tds->in_len;
+
+		p = tds->in_buf + 8;
+		end = tds->in_buf + tds->in_len;
+		eom = (tds->in_buf[1] & TDS_STATUS_EOM) != 0;
+		switch (tds->in_buf[0]) {
+		case TDS_QUERY:
+			/* skip ALL_HEADERS at start of request */
+			if (!puser->admin_more && IS_TDS72_PLUS(tds->conn) && end - p >= 4)
+				p += TDS_MIN(TDS_GET_A4LE(p), (TDS_UINT) (end - p));
+			admin_append(puser, p, end);
+			puser->admin_more = !eom;
+			if (!eom)
+				continue;
+			break;
+		case TDS_CANCEL:
+			/* requests are answered at once, nothing to cancel */
+			puser->admin_more = false;
+			puser->admin_cmd_len = 0;
+			tds->out_flag = TDS_REPLY;
+			tds_freeze(tds, &freeze, 0);
+			tds_send_done_token(tds, TDS_DONE_CANCELLED, 0);
+			if (!admin_send_reply(pool, puser, &freeze))
+				return false;
+			continue;
+		default:
+			/* not supported, answer with an error at end of request */
+			puser->admin_more = !eom;
+			puser->admin_cmd_len = 0;
+			if (!eom)
+				continue;
+			break;
+		}
+
+		/* strip last separator */
+		if (puser->admin_cmd_len && puser->admin_cmd[puser->admin_cmd_len - 1] == ' ')
+			puser->admin_cmd_len--;
+		puser->admin_cmd[puser->admin_cmd_len] = 0;
+		puser->admin_cmd_len = 0;
+		if (!admin_execute(pool, puser)) {
+			pool_free_user(pool, puser);
+			return false;
+		}
+	}
+}
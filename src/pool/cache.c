@@ -0,0 +1,472 @@
+/* TDSPool - Connection pooling for TDS based databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Result cache.
+ * Responses to queries listed in the configuration are recorded while
+ * forwarded to the user and sent again, without using a member, to
+ * users sending the same query till they expire.
+ * Only SQL batches sent when the user has no member (transaction mode,
+ * no transaction open) are considered so the session is always the
+ * one of a clean member. Responses with errors, changing the session
+ * or opening transactions are not stored.
+ * Memory is bounded, least recently used entries are evicted first.
+ */
+
+#include <config.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include "pool.h"
+#include <freetds/bytes.h>
+
+/* memory used by the cache, in bytes */
+#define CACHE_MAX_BYTES(pool) ((size_t) (pool)->cache_size * 1024u)
+/* larger responses are not stored */
+#define CACHE_MAX_ENTRY(pool) (CACHE_MAX_BYTES(pool) / 4u)
+
+static uint32_t
+cache_hash(TDS_USMALLINT tds_version, const unsigned char *sql, size_t len)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u ^ tds_version;
+
+	while (len--) {
+		hash ^= *sql++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void
+cache_entry_free(TDS_POOL_CACHE_ENTRY *entry)
+{
+	free(entry->sql);
+	free(entry->data);
+	free(entry);
+}
+
+/* Pool lock must be held. */
+static void
+cache_entry_unref(TDS_POOL_CACHE_ENTRY *entry)
+{
+	if (--entry->refs == 0)
+		cache_entry_free(entry);
+}
+
+/**
+ * Find entry for a query.
+ * Pool lock must be held.
+ */
+static TDS_POOL_CACHE_ENTRY *
+cache_find(TDS_POOL *pool, uint32_t hash, TDS_USMALLINT tds_version, const unsigned char *sql, size_t sql_len)
+{
+	TDS_POOL_CACHE_ENTRY *entry;
+
+	for (entry = pool->cache_hash[hash % POOL_CACHE_BUCKETS]; entry; entry = entry->hash_next)
+		if (entry->hash == hash && entry->tds_version == tds_version && entry->sql_len == sql_len
+		    && memcmp(entry->sql, sql, sql_len) == 0)
+			return entry;
+	return NULL;
+}
+
+/**
+ * Remove entry from the cache, freeing it if no user is sending it.
+ * Pool lock must be held.
+ */
+static void
+cache_remove(TDS_POOL *pool, TDS_POOL_CACHE_ENTRY *entry)
+{
+	TDS_POOL_CACHE_ENTRY **prev;
+
+	for (prev = &pool->cache_hash[entry->hash % POOL_CACHE_BUCKETS]; *prev != entry; prev = &(*prev)->hash_next)
+		continue;
+	*prev = entry->hash_next;
+	dlist_cache_remove(&pool->cache_lru, entry);
+	pool->cache_entries--;
+	pool->cache_bytes -= entry->sql_len + entry->data_len;
+	cache_entry_unref(entry);
+}
+
+void
+pool_cache_init(TDS_POOL * pool)
+{
+	dlist_cache_init(&pool->cache_lru);
+}
+
+void
+pool_cache_destroy(TDS_POOL * pool)
+{
+	TDS_POOL_CACHE_ENTRY *entry;
+	unsigned int i;
+
+	while ((entry = dlist_cache_first(&pool->cache_lru)) != NULL)
+		cache_remove(pool, entry);
+
+	for (i = 0; i < pool->num_cache_queries; ++i)
+		free(pool->cache_queries[i]);
+	free(pool->cache_queries);
+	pool->cache_queries = NULL;
+	pool->num_cache_queries = 0;
+}
+
+static bool
+cache_is_space(const unsigned char *p)
+{
+	return p[1] == 0 && isspace(p[0]);
+}
+
+/*
+ * Compare UCS-2 text with a query of the configuration.
+ * Case is ignored and spaces in the text match a single space.
+ */
+static bool
+cache_query_match(const char *query, const unsigned char *sql, const unsigned char *end)
+{
+	while (sql < end) {
+		if (query[0] == '*' && query[1] == 0)
+			return true;
+		if (sql[1] != 0 || sql[0] >= 128)
+			return false;
+		if (cache_is_space(sql)) {
+			if (*query++ != ' ')
+				return false;
+			while (sql < end && cache_is_space(sql))
+				sql += 2;
+			continue;
+		}
+		if (toupper(sql[0]) != *query++)
+			return false;
+		sql += 2;
+	}
+	return query[0] == 0 || strcmp(query, "*") == 0;
+}
+
+/**
+ * Get the SQL text of a request if its response can be cached.
+ * @param tds  user socket, request is in in_buf
+ */
+static bool
+cache_query_sql(TDS_POOL *pool, TDSSOCKET *tds, const unsigned char **p_sql, size_t *p_len)
+{
+	const unsigned char *p = tds->in_buf + 8, *end = tds->in_buf + tds->in_len;
+	const unsigned char *start, *stop;
+	unsigned int i;
+
+	/* single packet SQL batch */
+	if (tds->in_buf[0] != TDS_QUERY || (tds->in_buf[1] & (TDS_STATUS_EOM|TDS_STATUS_RESETCONNECTION)) != TDS_STATUS_EOM)
+		return false;
+	if (!IS_TDS7_PLUS(tds->conn))
+		return false;
+
+	/* skip ALL_HEADERS */
+	if (IS_TDS72_PLUS(tds->conn)) {
+		if (end - p < 4 || (size_t) (end - p) < TDS_GET_UA4LE(p))
+			return false;
+		p += TDS_GET_UA4LE(p);
+	}
+	if ((end - p) % 2u != 0)
+		return false;
+	*p_sql = p;
+	*p_len = end - p;
+
+	/* ignore spaces around the query */
+	for (start = p; start < end && cache_is_space(start); start += 2)
+		continue;
+	for (stop = end; stop > start && cache_is_space(stop - 2); stop -= 2)
+		continue;
+
+	for (i = 0; i < pool->num_cache_queries; ++i)
+		if (cache_query_match(pool->cache_queries[i], start, stop))
+			return true;
+	return false;
+}
+
+/* drop response being recorded */
+static void
+cache_fill_free(TDS_POOL_USER * puser)
+{
+	if (puser->cache_fill)
+		cache_entry_free(puser->cache_fill);
+	puser->cache_fill = NULL;
+	puser->cache_fill_sent = false;
+}
+
+/**
+ * Look up the request read from the user in the cache.
+ * On a hit the request is consumed and pool_cache_reply must be called
+ * to send the response. On a miss the response of a cacheable request
+ * will be recorded while forwarded.
+ * @return true if the request is answered from the cache
+ */
+bool
+pool_cache_request(TDS_POOL * pool, TDS_POOL_USER * puser)
+{
+	TDSSOCKET *tds = puser->sock.tds;
+	const TDS_USMALLINT tds_version = tds->conn->tds_version;
+	TDS_POOL_CACHE_ENTRY *entry;
+	const unsigned char *sql;
+	size_t sql_len;
+	uint32_t hash;
+
+	/* response to previous request not completed */
+	cache_fill_free(puser);
+
+	if (!cache_query_sql(pool, tds, &sql, &sql_len))
+		return false;
+
+	hash = cache_hash(tds_version, sql, sql_len);
+	tds_mutex_lock(&pool->mtx);
+	entry = cache_find(pool, hash, tds_version, sql, sql_len);
+	if (entry && entry->expire_tm <= time(NULL)) {
+		cache_remove(pool, entry);
+		entry = NULL;
+	}
+	if (entry) {
+		/* now most recently used */
+		dlist_cache_remove(&pool->cache_lru, entry);
+		dlist_cache_append(&pool->cache_lru, entry);
+		entry->refs++;
+		pool->cache_hits++;
+	} else {
+		pool->cache_misses++;
+	}
+	tds_mutex_unlock(&pool->mtx);
+
+	if (!entry) {
+		entry = tds_new0(TDS_POOL_CACHE_ENTRY, 1);
+		if (!entry)
+			return false;
+		entry->sql = tds_new(unsigned char, sql_len);
+		if (!entry->sql) {
+			free(entry);
+			return false;
+		}
+		memcpy(entry->sql, sql, sql_len);
+		entry->sql_len = sql_len;
+		entry->hash = hash;
+		entry->tds_version = tds_version;
+		entry->refs = 1;
+		puser->cache_fill = entry;
+		return false;
+	}
+
+	tdsdump_log(TDS_DBG_INFO1, "query answered from cache\n");
+	tds->in_pos = tds->in_len;
+	puser->cache_reply = entry;
+	puser->cache_reply_pos = 0;
+	return true;
+}
+
+/**
+ * Send cached response to the user, without blocking.
+ * @return false if user was disconnected
+ */
+bool
+pool_cache_reply(TDS_POOL * pool, TDS_POOL_USER * puser)
+{
+	TDS_POOL_CACHE_ENTRY *entry = puser->cache_reply;
+	int ret;
+
+	ret = pool_write(tds_get_s(puser->sock.tds), entry->data + puser->cache_reply_pos,
+			 entry->data_len - puser->cache_reply_pos);
+	if (ret < 0) {
+		tdsdump_log(TDS_DBG_ERROR, "error writing cached response\n");
+		pool_free_user(pool, puser);
+		return false;
+	}
+	puser->cache_reply_pos += ret;
+	if (puser->sock.worker)
+		puser->sock.worker->bytes_to_users += ret;
+
+	if (puser->cache_reply_pos < entry->data_len) {
+		/* partial write, schedule a future write */
+		puser->sock.revents &= ~POLLOUT;
+		pool_socket_poll(&puser->sock, false, true);
+		return true;
+	}
+
+	tds_mutex_lock(&pool->mtx);
+	cache_entry_unref(entry);
+	tds_mutex_unlock(&pool->mtx);
+	puser->cache_reply = NULL;
+
+	/* next request could be already in the socket */
+	puser->sock.revents |= POLLIN;
+	pool_socket_poll(&puser->sock, true, false);
+	return true;
+}
+
+/**
+ * Send a response built by the pool itself, the same way as
+ * a cached one.
+ * @param data  response packets, freed by the function
+ * @return false if user was disconnected
+ */
+bool
+pool_cache_send(TDS_POOL * pool, TDS_POOL_USER * puser, unsigned char *data, size_t data_len)
+{
+	TDS_POOL_CACHE_ENTRY *entry;
+
+	assert(!puser->cache_reply);
+
+	entry = tds_new0(TDS_POOL_CACHE_ENTRY, 1);
+	if (!entry) {
+		free(data);
+		pool_free_user(pool, puser);
+		return false;
+	}
+	entry->refs = 1;
+	entry->data = data;
+	entry->data_len = entry->data_size = data_len;
+
+	puser->cache_reply = entry;
+	puser->cache_reply_pos = 0;
+	return pool_cache_reply(pool, puser);
+}
+
+/**
+ * A request packet is going to be forwarded to the member.
+ * Only the response to the recorded request can be cached.
+ * @param tds  user socket, packet is in in_buf
+ */
+void
+pool_cache_forward(TDS_POOL_USER * puser, TDSSOCKET * tds)
+{
+	if (!puser->cache_fill)
+		return;
+	if (puser->cache_fill_sent || (tds->in_buf[1] & TDS_STATUS_RESETCONNECTION) != 0) {
+		cache_fill_free(puser);
+		return;
+	}
+	puser->cache_fill_sent = true;
+}
+
+/**
+ * Record response data forwarded to the user.
+ */
+void
+pool_cache_data(TDS_POOL_USER * puser, const unsigned char *data, size_t len)
+{
+	TDS_POOL_CACHE_ENTRY *entry = puser->cache_fill;
+	size_t size;
+
+	if (!entry || !len)
+		return;
+
+	if (entry->sql_len + entry->data_len + len > CACHE_MAX_ENTRY(puser->sock.pool)) {
+		tdsdump_log(TDS_DBG_INFO1, "response too big to be cached\n");
+		cache_fill_free(puser);
+		return;
+	}
+	if (entry->data_len + len > entry->data_size) {
+		size = TDS_MAX(entry->data_len + len, 512u) * 2u;
+		if (!TDS_RESIZE(entry->data, size)) {
+			cache_fill_free(puser);
+			return;
+		}
+		entry->data_size = size;
+	}
+	memcpy(entry->data + entry->data_len, data, len);
+	entry->data_len += len;
+}
+
+/* check data is a sequence of packets, last one ending the response */
+static bool
+cache_data_complete(const unsigned char *data, size_t len)
+{
+	size_t pos = 0, packet_len;
+	unsigned char status = 0;
+
+	while (pos + 8 <= len) {
+		packet_len = TDS_GET_A2BE(&data[pos + 2]);
+		if (packet_len < 8)
+			return false;
+		status = data[pos + 1];
+		pos += packet_len;
+	}
+	return pos == len && (status & TDS_STATUS_EOM) != 0;
+}
+
+/**
+ * Response from a member was completely forwarded to its user,
+ * store it if it was recorded.
+ */
+void
+pool_cache_store(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
+{
+	TDS_POOL_USER *puser = pmbr->current_user;
+	TDS_POOL_CACHE_ENTRY *entry = puser->cache_fill, *old;
+
+	if (!entry)
+		return;
+
+	if (!puser->cache_fill_sent || pmbr->pinned || pmbr->in_tran || pmbr->scan.error
+	    || !cache_data_complete(entry->data, entry->data_len)) {
+		tdsdump_log(TDS_DBG_INFO1, "response not cacheable\n");
+		cache_fill_free(puser);
+		return;
+	}
+	puser->cache_fill = NULL;
+	puser->cache_fill_sent = false;
+
+	entry->expire_tm = time(NULL) + pool->cache_ttl;
+
+	tds_mutex_lock(&pool->mtx);
+	/* replace response stored meanwhile by another user */
+	old = cache_find(pool, entry->hash, entry->tds_version, entry->sql, entry->sql_len);
+	if (old)
+		cache_remove(pool, old);
+
+	entry->hash_next = pool->cache_hash[entry->hash % POOL_CACHE_BUCKETS];
+	pool->cache_hash[entry->hash % POOL_CACHE_BUCKETS] = entry;
+	dlist_cache_append(&pool->cache_lru, entry);
+	pool->cache_entries++;
+	pool->cache_bytes += entry->sql_len + entry->data_len;
+
+	/* evict least recently used entries */
+	while (pool->cache_bytes > CACHE_MAX_BYTES(pool))
+		cache_remove(pool, dlist_cache_first(&pool->cache_lru));
+	tds_mutex_unlock(&pool->mtx);
+}
+
+/**
+ * Free cache state of a user being freed.
+ */
+void
+pool_cache_user_free(TDS_POOL * pool, TDS_POOL_USER * puser)
+{
+	cache_fill_free(puser);
+	if (puser->cache_reply) {
+		tds_mutex_lock(&pool->mtx);
+		cache_entry_unref(puser->cache_reply);
+		tds_mutex_unlock(&pool->mtx);
+		puser->cache_reply = NULL;
+	}
+}
@@ -51,6 +51,19 @@
 #define POOL_STR_MAX_POOL_CONN	"max pool conn"
 #define POOL_STR_MIN_POOL_CONN	"min pool conn"
 #define POOL_STR_MAX_POOL_USERS	"max pool users"
+#define POOL_STR_WORKER_THREADS	"worker threads"
+#define POOL_STR_POOL_MODE	"pool mode"
+#define POOL_STR_MAX_WAITERS	"max waiters"
+#define POOL_STR_WAIT_TIMEOUT	"wait timeout"
+#define POOL_STR_MAX_USER_CONN	"max user conn"
+#define POOL_STR_USER_WEIGHTS	"user weights"
+#define POOL_STR_USER_CLASS	"user class"
+#define POOL_STR_ADAPTIVE_SIZE	"adaptive size"
+#define POOL_STR_WARM_SPARES	"warm spares"
+#define POOL_STR_UNIX_SOCKET	"unix socket"
+#define POOL_STR_CACHE_QUERY	"cache query"
+#define POOL_STR_CACHE_TTL	"cache ttl"
+#define POOL_STR_CACHE_SIZE	"cache size"
 
 typedef struct {
 	TDS_POOL *pool;
@@ -58,6 +71,8 @@ typedef struct {
 } conf_params;
 
 static bool pool_parse(const char *option, const char *value, void *param);
+static bool pool_parse_weights(TDS_POOL * pool, const char *value);
+static bool pool_parse_cache_query(TDS_POOL * pool, const char *value);
 static bool pool_read_conf_file(const tds_dir_char *path, const char *poolname, conf_params *params);
 
 bool
@@ -158,6 +173,61 @@ pool_parse(const char *option, const char *value, void *param)
 	} else if (!strcmp(option, POOL_STR_MIN_POOL_CONN)) {
 		val = pool_get_uint(value);
 		pool->min_open_conn = val;
+	} else if (!strcmp(option, POOL_STR_WORKER_THREADS)) {
+		val = pool_get_uint(value);
+		if (val < 1 || val > 1024)
+			val = -1;
+		pool->num_workers = val;
+	} else if (!strcmp(option, POOL_STR_POOL_MODE)) {
+		if (!strcasecmp(value, "session"))
+			pool->mode = TDS_POOL_SESSION;
+		else if (!strcasecmp(value, "transaction"))
+			pool->mode = TDS_POOL_TRANSACTION;
+		else
+			val = -1;
+	} else if (!strcmp(option, POOL_STR_MAX_WAITERS)) {
+		val = pool_get_uint(value);
+		pool->max_waiters = val;
+	} else if (!strcmp(option, POOL_STR_WAIT_TIMEOUT)) {
+		val = pool_get_uint(value);
+		pool->wait_timeout = val;
+	} else if (!strcmp(option, POOL_STR_MAX_USER_CONN)) {
+		val = pool_get_uint(value);
+		pool->max_user_conn = val;
+	} else if (!strcmp(option, POOL_STR_USER_WEIGHTS)) {
+		if (!pool_parse_weights(pool, value))
+			val = -1;
+	} else if (!strcmp(option, POOL_STR_USER_CLASS)) {
+		if (!strcasecmp(value, "application"))
+			pool->class_by = TDS_POOL_CLASS_APP;
+		else if (!strcasecmp(value, "database"))
+			pool->class_by = TDS_POOL_CLASS_DATABASE;
+		else if (!strcasecmp(value, "host"))
+			pool->class_by = TDS_POOL_CLASS_HOST;
+		else
+			val = -1;
+	} else if (!strcmp(option, POOL_STR_ADAPTIVE_SIZE)) {
+		val = tds_parse_boolean(value, -1);
+		pool->adaptive_size = val > 0;
+	} else if (!strcmp(option, POOL_STR_WARM_SPARES)) {
+		val = pool_get_uint(value);
+		pool->warm_spares = val;
+	} else if (!strcmp(option, POOL_STR_UNIX_SOCKET)) {
+		free(pool->unix_socket);
+		pool->unix_socket = NULL;
+		if (value[0])
+			pool->unix_socket = strdup(value);
+	} else if (!strcmp(option, POOL_STR_CACHE_QUERY)) {
+		if (!pool_parse_cache_query(pool, value))
+			val = -1;
+	} else if (!strcmp(option, POOL_STR_CACHE_TTL)) {
+		val = pool_get_uint(value);
+		pool->cache_ttl = val;
+	} else if (!strcmp(option, POOL_STR_CACHE_SIZE)) {
+		val = pool_get_uint(value);
+		if (val < 1 || val > 4 * 1024 * 1024)
+			val = -1;
+		pool->cache_size = val;
 	}
 	if (val < 0) {
 		free(*params->err);
@@ -167,3 +237,68 @@ pool_parse(const char *option, const char *value, void *param)
 	}
 	return true;
 }
+
+/**
+ * Parse a list of class weights like "app1:3, app2:1".
+ */
+static bool
+pool_parse_weights(TDS_POOL * pool, const char *value)
+{
+	char *list, *item, *sep, *save = NULL;
+	TDS_POOL_CLASS *pclass;
+	bool ok = true;
+	int weight;
+
+	list = strdup(value);
+	if (!list)
+		return false;
+
+	for (item = strtok_r(list, ",", &save); item && ok; item = strtok_r(NULL, ",", &save)) {
+		sep = strchr(item, ':');
+		if (!sep) {
+			ok = false;
+			break;
+		}
+		weight = pool_get_uint(sep + 1);
+		/* strip spaces around the name */
+		while (sep > item && isspace((unsigned char) sep[-1]))
+			--sep;
+		*sep = 0;
+		while (isspace((unsigned char) *item))
+			++item;
+		if (weight < 1 || weight > 1000 || !item[0]) {
+			ok = false;
+			break;
+		}
+		pclass = pool_class_get(pool, item);
+		if (!pclass) {
+			ok = false;
+			break;
+		}
+		pclass->weight = weight;
+	}
+	free(list);
+	return ok;
+}
+
+/**
+ * Add a query to the ones whose results can be cached.
+ * Option can be repeated, a final '*' matches any text.
+ */
+static bool
+pool_parse_cache_query(TDS_POOL * pool, const char *value)
+{
+	char *query, *p;
+
+	if (!value[0])
+		return false;
+	if (!TDS_RESIZE(pool->cache_queries, pool->num_cache_queries + 1))
+		return false;
+	query = strdup(value);
+	if (!query)
+		return false;
+	for (p = query; *p; ++p)
+		*p = toupper((unsigned char) *p);
+	pool->cache_queries[pool->num_cache_queries++] = query;
+	return true;
+}
@@ -55,6 +55,14 @@
 #include <arpa/inet.h>
 #endif /* HAVE_ARPA_INET_H */
 
+#if HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif /* HAVE_SYS_UN_H */
+
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif /* HAVE_SYS_STAT_H */
+
 #ifdef _WIN32
 #include <io.h>
 #endif
@@ -62,28 +70,41 @@
 #include "pool.h"
 
 /* to be set by sig term */
-static bool got_sigterm = false;
+static volatile bool got_sigterm = false;
 static const char *logfile_name = NULL;
+/* socket to wake up first worker from signal handlers */
+static TDS_SYS_SOCKET signal_fd = INVALID_SOCKET;
 
 static void sigterm_handler(int sig);
-static void pool_schedule_waiters(TDS_POOL * pool);
 static void pool_socket_init(TDS_POOL * pool);
-static void pool_main_loop(TDS_POOL * pool);
+static void pool_main_loop(TDS_POOL_SET * set);
 static bool pool_open_logfile(void);
 
+static void
+signal_wakeup(void)
+{
+	int saved_errno = errno;
+
+	if (!TDS_IS_SOCKET_INVALID(signal_fd))
+		WRITESOCKET(signal_fd, "x", 1);
+	errno = saved_errno;
+}
+
 static void
 sigterm_handler(int sig TDS_UNUSED)
 {
 	got_sigterm = true;
+	signal_wakeup();
 }
 
 #ifndef _WIN32
-static bool got_sighup = false;
+static volatile bool got_sighup = false;
 
 static void
 sighup_handler(int sig TDS_UNUSED)
 {
 	got_sighup = true;
+	signal_wakeup();
 }
 #endif
 
@@ -100,9 +121,9 @@ check_field(const char *pool_name, bool cond, const char *field_name)
  * pool_init creates a named pool and opens connections to the database
  */
 static TDS_POOL *
-pool_init(const char *name, const tds_dir_char *config_path)
+pool_init(TDS_POOL_SET * set, const char *name, const tds_dir_char *config_path)
 {
-	TDS_POOL *pool;
+	TDS_POOL *pool, **prev;
 	char *err = NULL;
 
 	/* initialize the pool */
@@ -113,9 +134,11 @@ pool_init(const char *name, const tds_dir_char *config_path)
 		exit(EXIT_FAILURE);
 	}
 	pool->password = strdup("");
+	pool->num_workers = 1;
+	pool->cache_ttl = 10;
+	pool->cache_size = 1024;
 
-	pool->event_fd = INVALID_SOCKET;
-	if (tds_mutex_init(&pool->events_mtx)) {
+	if (tds_mutex_init(&pool->mtx)) {
 		fprintf(stderr, "Error initializing pool mutex\n");
 		exit(EXIT_FAILURE);
 	}
@@ -144,11 +167,23 @@ pool_init(const char *name, const tds_dir_char *config_path)
 		exit(EXIT_FAILURE);
 	}
 
+	if (pool->num_cache_queries && pool->mode != TDS_POOL_TRANSACTION) {
+		fprintf(stderr, "Cache queries require transaction pool mode\n");
+		exit(EXIT_FAILURE);
+	}
+
 	pool->name = strdup(name);
 
-	pool_open_logfile();
+	/* add to the set, keeping order */
+	pool->set = set;
+	for (prev = &set->pools; *prev; prev = &(*prev)->next)
+		continue;
+	*prev = pool;
+	if (pool->num_workers > set->num_workers)
+		set->num_workers = pool->num_workers;
 
 	pool_mbr_init(pool);
+	pool_cache_init(pool);
 	pool_user_init(pool);
 
 	pool_socket_init(pool);
@@ -156,108 +191,65 @@ pool_init(const char *name, const tds_dir_char *config_path)
 	return pool;
 }
 
+static void
+pool_workers_init(TDS_POOL_SET * set)
+{
+	unsigned int i;
+
+	set->workers = tds_new0(TDS_POOL_WORKER, set->num_workers);
+	if (!set->workers) {
+		fprintf(stderr, "Could not allocate memory for workers\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < set->num_workers; ++i) {
+		if (!pool_worker_init(&set->workers[i], set, i)) {
+			perror("worker");
+			exit(EXIT_FAILURE);
+		}
+	}
+	signal_fd = set->workers[0].event_fd;
+}
+
+/* remove Unix socket file, only if it is still the one we bound */
+static void
+pool_unix_socket_remove(TDS_POOL *pool)
+{
+#if HAVE_SYS_UN_H
+	struct stat st;
+
+	if (lstat(pool->unix_socket, &st) == 0 && S_ISSOCK(st.st_mode)
+	    && st.st_dev == pool->unix_socket_dev && st.st_ino == pool->unix_socket_ino)
+		unlink(pool->unix_socket);
+#endif
+}
+
 static void
 pool_destroy(TDS_POOL *pool)
 {
+	int i;
+
 	pool_mbr_destroy(pool);
 	pool_user_destroy(pool);
+	pool_cache_destroy(pool);
 
-	CLOSESOCKET(pool->wakeup_fd);
-	CLOSESOCKET(pool->listen_fd);
-	CLOSESOCKET(pool->event_fd);
-	tds_mutex_free(&pool->events_mtx);
+	if (!TDS_IS_SOCKET_INVALID(pool->listen_fds[POOL_LISTEN_UNIX]))
+		pool_unix_socket_remove(pool);
+	for (i = 0; i < POOL_NUM_LISTEN; ++i)
+		if (!TDS_IS_SOCKET_INVALID(pool->listen_fds[i]))
+			CLOSESOCKET(pool->listen_fds[i]);
+	tds_mutex_free(&pool->mtx);
 
 	free(pool->user);
 	free(pool->password);
 	free(pool->server);
 	free(pool->database);
+	free(pool->unix_socket);
 	free(pool->name);
 	free(pool->server_user);
 	free(pool->server_password);
 	free(pool);
 }
 
-static void
-pool_schedule_waiters(TDS_POOL * pool)
-{
-	TDS_POOL_USER *puser;
-
-	/* first see if there are free members to do the request */
-	if (!dlist_member_first(&pool->idle_members))
-		return;
-
-	while ((puser = dlist_user_first(&pool->waiters)) != NULL) {
-		if (puser->user_state == TDS_SRV_WAIT) {
-			/* place back in query state */
-			puser->user_state = TDS_SRV_QUERY;
-			dlist_user_remove(&pool->waiters, puser);
-			dlist_user_append(&pool->users, puser);
-			/* now try again */
-			pool_user_query(pool, puser);
-			return;
-		}
-	}
-}
-
-typedef struct select_info
-{
-	struct pollfd *fds;
-	uint32_t num_fds, alloc_fds;
-} SELECT_INFO;
-
-static void
-pool_select_add_socket(SELECT_INFO *sel, TDS_POOL_SOCKET *sock)
-{
-	short events;
-	struct pollfd *fd;
-
-	/* skip dead connections */
-	if (IS_TDSDEAD(sock->tds))
-		return;
-	if (!sock->poll_recv && !sock->poll_send)
-		return;
-
-	events = 0;
-	if (sock->poll_recv)
-		events |= POLLIN;
-	if (sock->poll_send)
-		events |= POLLOUT;
-	if (sel->num_fds >= sel->alloc_fds) {
-		sel->alloc_fds *= 2;
-		if (!TDS_RESIZE(sel->fds, sel->alloc_fds)) {
-			fprintf(stderr, "Out of memory allocating fds\n");
-			exit(EXIT_FAILURE);
-		}
-	}
-	sock->poll_index = sel->num_fds;
-	fd = &sel->fds[sel->num_fds++];
-	fd->fd = tds_get_s(sock->tds);
-	fd->events = events;
-	fd->revents = 0;
-}
-
-static void
-pool_process_events(TDS_POOL *pool)
-{
-	TDS_POOL_EVENT *events, *next;
-
-	/* detach events from pool */
-	tds_mutex_lock(&pool->events_mtx);
-	events = pool->events;
-	pool->events = NULL;
-	tds_mutex_unlock(&pool->events_mtx);
-
-	/* process them */
-	while (events) {
-		next = events->next;
-		events->next = NULL;
-
-		events->execute(events);
-		free(events);
-		events = next;
-	}
-}
-
 static bool
 pool_open_logfile(void)
 {
@@ -285,12 +277,96 @@ pool_open_logfile(void)
 	return true;
 }
 
+/*
+ * Listen also on a Unix domain socket, local clients connect using
+ * "host = unix:/path" avoiding the TCP stack.
+ * Users are routed like the ones coming from the TCP port.
+ */
+static void
+pool_unix_socket_init(TDS_POOL * pool)
+{
+#if HAVE_SYS_UN_H
+	struct sockaddr_un sa;
+	struct stat st;
+	TDS_SYS_SOCKET s;
+	int err;
+
+	if (strlen(pool->unix_socket) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "Unix socket path %s too long\n", pool->unix_socket);
+		exit(1);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, pool->unix_socket);
+
+	if (TDS_IS_SOCKET_INVALID(s = socket(AF_UNIX, SOCK_STREAM, 0))) {
+		perror("socket");
+		exit(1);
+	}
+	tds_socket_set_nonblocking(s);
+
+	/* remove stale socket from a previous run, nobody must be listening */
+	if (lstat(pool->unix_socket, &st) == 0) {
+		TDS_SYS_SOCKET probe;
+
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "%s exists and is not a socket\n", pool->unix_socket);
+			exit(1);
+		}
+		if (TDS_IS_SOCKET_INVALID(probe = socket(AF_UNIX, SOCK_STREAM, 0))) {
+			perror("socket");
+			exit(1);
+		}
+		err = 0;
+		if (connect(probe, (struct sockaddr *) &sa, sizeof(sa)) < 0)
+			err = sock_errno;
+		CLOSESOCKET(probe);
+		if (err != ECONNREFUSED) {
+			fprintf(stderr, "Unix socket %s is in use\n", pool->unix_socket);
+			exit(1);
+		}
+		unlink(pool->unix_socket);
+	}
+
+	fprintf(stderr, "Listening on unix socket %s\n", pool->unix_socket);
+	if (bind(s, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+	if (lstat(pool->unix_socket, &st) < 0) {
+		perror("lstat");
+		exit(1);
+	}
+	pool->unix_socket_dev = st.st_dev;
+	pool->unix_socket_ino = st.st_ino;
+	listen(s, 5);
+	pool->listen_fds[POOL_LISTEN_UNIX] = s;
+	pool->set->num_listeners++;
+#else
+	fprintf(stderr, "Unix sockets not supported, ignoring %s\n", pool->unix_socket);
+#endif
+}
+
 static void
 pool_socket_init(TDS_POOL * pool)
 {
 	struct sockaddr_in sin;
-	TDS_SYS_SOCKET s, event_pair[2];
+	TDS_SYS_SOCKET s;
 	int socktrue = 1;
+	TDS_POOL *p;
+
+	pool->listen_fds[POOL_LISTEN_TCP] = INVALID_SOCKET;
+	pool->listen_fds[POOL_LISTEN_UNIX] = INVALID_SOCKET;
+	if (pool->unix_socket)
+		pool_unix_socket_init(pool);
+
+	/* port already used by another pool, users are routed at login */
+	for (p = pool->set->pools; p != pool; p = p->next) {
+		if (p->port == pool->port) {
+			fprintf(stderr, "Pool %s shares port %d with pool %s\n", pool->name, pool->port, p->name);
+			return;
+		}
+	}
 
 	/* FIXME -- read the interfaces file and bind accordingly */
 	sin.sin_addr.s_addr = INADDR_ANY;
@@ -311,69 +387,41 @@ pool_socket_init(TDS_POOL * pool)
 		exit(1);
 	}
 	listen(s, 5);
-	pool->listen_fd = s;
+	pool->listen_fds[POOL_LISTEN_TCP] = s;
+	pool->set->num_listeners++;
+}
 
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, event_pair) < 0) {
-		perror("socketpair");
-		exit(1);
-	}
-	tds_socket_set_nonblocking(event_pair[0]);
-	tds_socket_set_nonblocking(event_pair[1]);
-	pool->event_fd = event_pair[1];
-	pool->wakeup_fd = event_pair[0];
+/* combine timeouts in seconds, -1 is infinite */
+static int
+pool_min_left(int left, int other)
+{
+	if (other >= 0 && (left < 0 || other < left))
+		return other;
+	return left;
 }
 
 /*
- * pool_main_loop
- * Accept new connections from clients, and handle all input from clients and
- * pool members.
+ * pool_worker_loop
+ * Handle all input from clients and pool members of a worker.
+ * First worker also accepts new connections from clients.
  */
 static void
-pool_main_loop(TDS_POOL * pool)
+pool_worker_loop(TDS_POOL_WORKER * worker)
 {
-	TDS_POOL_MEMBER *pmbr;
-	TDS_POOL_USER *puser;
-	TDS_SYS_SOCKET s, wakeup;
-	SELECT_INFO sel = { NULL, 0, 8 };
-	int min_expire_left = -1;
-	int rc;
-
-	s = pool->listen_fd;
-	wakeup = pool->wakeup_fd;
-
-	/* add the listening socket to the read list */
-	if (!TDS_RESIZE(sel.fds, sel.alloc_fds)) {
-		fprintf(stderr, "Out of memory allocating fds\n");
-		exit(EXIT_FAILURE);
-	}
-	sel.fds[0].fd = s;
-	sel.fds[0].events = POLLIN;
-	sel.fds[1].fd = wakeup;
-	sel.fds[1].events = POLLIN;
+	TDS_POOL_SET *set = worker->set;
+	TDS_POOL *pool;
+	int min_expire_left = 0;
+	bool accept;
+	unsigned int i;
 
 	while (!got_sigterm) {
 
-		sel.num_fds = 2;
-		sel.fds[0].revents = 0;
-		sel.fds[1].revents = 0;
-
-		/* add the user sockets to the read list */
-		DLIST_FOREACH(dlist_user, &pool->users, puser)
-			pool_select_add_socket(&sel, &puser->sock);
-
-		/* add the pool member sockets to the read list */
-		DLIST_FOREACH(dlist_member, &pool->active_members, pmbr)
-			pool_select_add_socket(&sel, &pmbr->sock);
-
 		if (min_expire_left > 0)
 			min_expire_left *= 1000;
 
-		rc = poll(sel.fds, sel.num_fds, min_expire_left);
-		if (TDS_UNLIKELY(rc < 0)) {
+		if (TDS_UNLIKELY(pool_worker_wait(worker, min_expire_left, &accept) < 0)) {
 			char *errstr;
 
-			if (sock_errno == TDSSOCK_EINTR)
-				continue;
 			errstr = sock_strerror(sock_errno);
 			fprintf(stderr, "Error: poll returned %d, %s\n", sock_errno, errstr);
 			sock_strerror_free(errstr);
@@ -383,38 +431,76 @@ pool_main_loop(TDS_POOL * pool)
 			break;
 
 #ifndef _WIN32
-		if (TDS_UNLIKELY(got_sighup)) {
+		if (TDS_UNLIKELY(got_sighup) && worker->index == 0) {
 			got_sighup = false;
 			pool_open_logfile();
 		}
 #endif
 
 		/* process events */
-		if ((sel.fds[1].revents & POLLIN) != 0) {
-			char buf[32];
-			READSOCKET(wakeup, buf, sizeof(buf));
-
-			pool_process_events(pool);
-		}
+		pool_worker_process_events(worker);
 
 		/* process the sockets */
-		if ((sel.fds[0].revents & POLLIN) != 0) {
-			pool_user_create(pool, s);
+		for (pool = set->pools; accept && pool; pool = pool->next) {
+			for (i = 0; i < POOL_NUM_LISTEN; ++i) {
+				if (!pool->listen_ready[i])
+					continue;
+				pool->listen_ready[i] = false;
+				pool_user_create(pool, pool->listen_fds[i]);
+			}
 		}
-		pool_process_users(pool, sel.fds, sel.num_fds);
-		min_expire_left = pool_process_members(pool, sel.fds, sel.num_fds);
+		pool_worker_process_ready(worker);
+		min_expire_left = -1;
+		for (pool = set->pools; pool; pool = pool->next) {
+			if (worker->index == 0) {
+				min_expire_left = pool_min_left(min_expire_left, pool_expire_members(pool));
+				min_expire_left = pool_min_left(min_expire_left, pool_size_members(pool, worker));
+				min_expire_left = pool_min_left(min_expire_left, pool_reset_idle_members(pool, worker));
+			}
 
-		/* back from members */
-		if (dlist_user_first(&pool->waiters))
-			pool_schedule_waiters(pool);
+			/* back from members */
+			min_expire_left = pool_min_left(min_expire_left, pool_schedule_waiters(pool, worker));
+		}
 	}			/* while !got_sigterm */
+
+	/* stop other workers */
+	for (i = 0; i < set->num_workers; ++i)
+		pool_worker_wakeup(&set->workers[i]);
+}
+
+static TDS_THREAD_PROC_DECLARE(worker_proc, arg)
+{
+	pool_worker_loop((TDS_POOL_WORKER *) arg);
+	return TDS_THREAD_RESULT(0);
+}
+
+/*
+ * pool_main_loop
+ * Start workers, first worker runs in the main thread.
+ */
+static void
+pool_main_loop(TDS_POOL_SET * set)
+{
+	unsigned int i;
+
+	for (i = 1; i < set->num_workers; ++i) {
+		if (tds_thread_create(&set->workers[i].thread, worker_proc, &set->workers[i]) != 0) {
+			fprintf(stderr, "error creating thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pool_worker_loop(&set->workers[0]);
+
+	for (i = 1; i < set->num_workers; ++i)
+		tds_thread_join(set->workers[i].thread, NULL);
 	tdsdump_log(TDS_DBG_INFO2, "Shutdown Requested\n");
 }
 
 static void
 print_usage(const char *progname)
 {
-	fprintf(stderr, "Usage:\t%s [-l <log file>] [-c <conf file>] [-d] <pool name>\n", progname);
+	fprintf(stderr, "Usage:\t%s [-l <log file>] [-c <conf file>] [-d] <pool name>...\n", progname);
 }
 
 int
@@ -427,8 +513,10 @@ main(int argc, char **argv)
 #else
 #  define DAEMON_OPT ""
 #endif
+	TDS_POOL_SET set;
 	TDS_POOL *pool;
 	tds_dir_char *config_path = NULL;
+	unsigned int i;
 
 	signal(SIGTERM, sigterm_handler);
 	signal(SIGINT, sigterm_handler);
@@ -463,8 +551,18 @@ main(int argc, char **argv)
 		print_usage(argv[0]);
 		return EXIT_FAILURE;
 	}
-	pool = pool_init(argv[optind], config_path);
+
+	memset(&set, 0, sizeof(set));
+	pool_open_logfile();
+	set.ctx = tds_alloc_context(NULL);
+	if (!set.ctx) {
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+	for (; optind < argc; ++optind)
+		pool_init(&set, argv[optind], config_path);
 	TDS_ZERO_FREE(config_path);
+	pool_workers_init(&set);
 #ifdef HAVE_FORK
 	if (daemonize) {
 		if (daemon(0, 0) < 0) {
@@ -473,9 +571,25 @@ main(int argc, char **argv)
 		}
 	}
 #endif
-	pool_main_loop(pool);
-	printf("User logins %lu members logins %lu members at end %d\n", pool->user_logins, pool->member_logins, pool->num_active_members);
-	pool_destroy(pool);
+	pool_main_loop(&set);
+	for (pool = set.pools; pool; pool = pool->next) {
+		if (set.pools->next)
+			printf("Pool %s\n", pool->name);
+		printf("User logins %lu members logins %lu members at end %d\n", pool->user_logins, pool->member_logins, pool->num_active_members);
+		if (pool->adaptive_size)
+			printf("Members prewarmed %lu retired %lu target %d\n", pool->members_prewarmed, pool->members_retired,
+			       pool->target_members);
+	}
+	while ((pool = set.pools) != NULL) {
+		set.pools = pool->next;
+		pool_destroy(pool);
+	}
+
+	signal_fd = INVALID_SOCKET;
+	for (i = 0; i < set.num_workers; ++i)
+		pool_worker_destroy(&set.workers[i]);
+	free(set.workers);
+	tds_free_context(set.ctx);
 	printf("tdspool Shutdown\n");
 	return EXIT_SUCCESS;
 }
@@ -35,6 +35,10 @@
 #include <unistd.h>
 #endif /* HAVE_UNISTD_H */
 
+#if HAVE_ERRNO_H
+#include <errno.h>
+#endif /* HAVE_ERRNO_H */
+
 #if HAVE_SYS_PARAM_H
 #include <sys/param.h>
 #endif /* HAVE_SYS_PARAM_H */
@@ -53,6 +57,7 @@
 
 #include "pool.h"
 #include <freetds/utils/string.h>
+#include <freetds/bytes.h>
 
 #ifndef MAXHOSTNAMELEN
 #define MAXHOSTNAMELEN 256
@@ -69,6 +74,31 @@ pool_mbr_free_socket(TDSSOCKET *tds)
 	}
 }
 
+static TDS_POOL_MEMBER *
+pool_mbr_alloc(TDS_POOL * pool)
+{
+	TDS_POOL_MEMBER *pmbr = tds_new0(TDS_POOL_MEMBER, 1);
+
+	if (!pmbr)
+		return NULL;
+	pmbr->sock.pool = pool;
+	pmbr->sock.is_member = true;
+	pmbr->open_tm = time(NULL);
+	pmbr->splice_pipe[0] = pmbr->splice_pipe[1] = -1;
+	return pmbr;
+}
+
+static void
+pool_mbr_close_pipe(TDS_POOL_MEMBER *pmbr)
+{
+	if (pmbr->splice_pipe[0] >= 0) {
+		close(pmbr->splice_pipe[0]);
+		close(pmbr->splice_pipe[1]);
+		pmbr->splice_pipe[0] = pmbr->splice_pipe[1] = -1;
+	}
+	pmbr->splice_pending = 0;
+}
+
 /*
  * pool_mbr_login open a single pool login, to be call at init time or
  * to reconnect.
@@ -143,6 +173,11 @@ pool_mbr_login(const TDS_POOL * pool, int tds_version)
 	return tds;
 }
 
+/*
+ * pool_assign_member
+ * move member to active list and link to user.
+ * Pool lock must be held.
+ */
 void
 pool_assign_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr, TDS_POOL_USER *puser)
 {
@@ -155,20 +190,242 @@ pool_assign_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr, TDS_POOL_USER *puser)
 		dlist_member_append(&pool->active_members, pmbr);
 	}
 	pmbr->current_user = puser;
+	pmbr->last_class = puser->pclass;
 	puser->assigned_member = pmbr;
+	pool_user_granted(pool, puser);
 	pool_mbr_check(pool);
 }
 
+/*
+ * pool_unlink_member
+ * break the link between a member and its user.
+ */
+void
+pool_unlink_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
+{
+	TDS_POOL_USER *puser = pmbr->current_user;
+
+	if (!puser)
+		return;
+
+	tds_mutex_lock(&pool->mtx);
+	if (puser->pclass)
+		puser->pclass->num_members--;
+	tds_mutex_unlock(&pool->mtx);
+	puser->assigned_member = NULL;
+	pmbr->current_user = NULL;
+}
+
+/*
+ * pool_deassign_member
+ * put an active member back in the idle list, member should be
+ * already reset. A worker with users waiting is woken up.
+ */
 void
 pool_deassign_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr)
 {
-	if (pmbr->current_user) {
-		pmbr->current_user->assigned_member = NULL;
-		pmbr->current_user = NULL;
-		dlist_member_remove(&pool->active_members, pmbr);
-		dlist_member_append(&pool->idle_members, pmbr);
+	TDS_POOL_USER *waiter;
+
+	pool_unlink_member(pool, pmbr);
+	pool_socket_unregister(&pmbr->sock);
+	pool_socket_poll(&pmbr->sock, pmbr->sock.poll_recv, false);
+
+	tds_mutex_lock(&pool->mtx);
+	dlist_member_remove(&pool->active_members, pmbr);
+	dlist_member_append(&pool->idle_members, pmbr);
+	waiter = dlist_user_first(&pool->waiters);
+	if (waiter)
+		pool_worker_wakeup(waiter->sock.worker);
+	pool_mbr_check(pool);
+	tds_mutex_unlock(&pool->mtx);
+}
+
+/* packet read only partially from member */
+static bool
+pool_packet_partial(TDSSOCKET *tds)
+{
+	return tds->in_len > 0 && (tds->in_len < 4 || tds->in_len < TDS_GET_A2BE(&tds->in_buf[2]));
+}
+
+#define POOL_DONE_SIZE(conn) (IS_TDS72_PLUS(conn) ? 13 : 9)
+
+/* check if DONE token is the acknowledge of a cancel */
+static bool
+pool_done_cancel_ack(const unsigned char *p)
+{
+	return p[0] == TDS_DONE_TOKEN && (TDS_GET_A2LE(&p[1]) & TDS_DONE_CANCELLED) != 0;
+}
+
+/* check if packet ends with the acknowledge of a cancel */
+static bool
+pool_packet_cancel_ack(TDSSOCKET *tds)
+{
+	const unsigned int done_size = POOL_DONE_SIZE(tds->conn);
+
+	if ((tds->in_buf[1] & TDS_STATUS_EOM) == 0 || tds->in_len < 8 + done_size)
+		return false;
+	return pool_done_cancel_ack(tds->in_buf + tds->in_len - done_size);
+}
+
+/*
+ * Compute how many bytes of the packet being spliced can be read.
+ * If the packet could contain the acknowledge of a cancel the data
+ * before the final DONE token is read first, then the token is peeked.
+ * @return bytes to read, 0 to wait for more data, -1 on error
+ */
+static int
+pool_splice_check_ack(TDS_POOL_MEMBER *pmbr)
+{
+	const unsigned int done_size = POOL_DONE_SIZE(pmbr->sock.tds->conn);
+	unsigned char tail[13];
+	int len;
+
+	if (!pmbr->splice_ack)
+		return pmbr->splice_left;
+	if (pmbr->splice_left > done_size)
+		return pmbr->splice_left - done_size;
+	assert(pmbr->splice_left == done_size);
+
+	do {
+		len = recv(tds_get_s(pmbr->sock.tds), (void *) tail, done_size, MSG_PEEK);
+	} while (len < 0 && sock_errno == EINTR);
+	if (len < 0)
+		return TDSSOCK_WOULDBLOCK(sock_errno) ? 0 : -1;
+	if (len == 0)
+		return -1;
+	if (len < (int) done_size)
+		return 0;
+
+	if (pool_done_cancel_ack(tail))
+		pmbr->busy = pmbr->cancelling = false;
+	pmbr->splice_ack = false;
+	return pmbr->splice_left;
+}
+
+/*
+ * pool_release_member
+ * in transaction mode give member back to the pool as soon as the
+ * batch is completed, no transaction is open and the session did
+ * not change. User will get a member again with next request.
+ */
+void
+pool_release_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
+{
+	TDS_POOL_USER *puser = pmbr->current_user;
+	TDSSOCKET *tds = pmbr->sock.tds;
+
+	if (pool->mode != TDS_POOL_TRANSACTION || !puser || puser->login)
+		return;
+	if (pmbr->doing_async || pmbr->resetting || pmbr->busy)
+		return;
+	/* data still to forward */
+	if (pmbr->sock.poll_send || puser->sock.poll_send || tds->in_pos < tds->in_len || pool_packet_partial(tds))
+		return;
+
+	/* response completed */
+	pool_cache_store(pool, pmbr);
+	if (pmbr->pinned || pmbr->in_tran)
+		return;
+
+	tdsdump_log(TDS_DBG_INFO1, "batch completed, releasing member\n");
+	pool_deassign_member(pool, pmbr);
+}
+
+/*
+ * pool_send_reset
+ * send a batch with the reset connection status bit, so the server
+ * rolls back any open transaction and resets the session now.
+ * Response is discarded by pool_process_reset.
+ */
+static bool
+pool_send_reset(TDS_POOL_MEMBER * pmbr)
+{
+	TDSSOCKET *tds = pmbr->sock.tds;
+	TDSRET ret;
+
+	tdsdump_log(TDS_DBG_INFO1, "sending reset to member\n");
+	tds_init_write_buf(tds);
+	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return false;
+	tds_start_query(tds, TDS_QUERY);
+	tds_put_string(tds, "IF @@TRANCOUNT > 0 ROLLBACK", -1);
+	ret = tds_write_packet(tds, TDS_STATUS_EOM | TDS_STATUS_RESETCONNECTION);
+	tds_set_state(tds, TDS_PENDING);
+	if (TDS_FAILED(ret))
+		return false;
+
+	pmbr->reset_pending = false;
+	pmbr->reset_now = false;
+	pmbr->busy = true;
+	return true;
+}
+
+/*
+ * pool_process_reset
+ * read data from a member being reset without blocking, discarding it
+ * till the server acknowledges the cancel (and the reset, if sent),
+ * then make the member idle.
+ */
+static void
+pool_process_reset(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
+{
+	TDSSOCKET *tds = pmbr->sock.tds;
+	unsigned char buf[512];
+	int len, err;
+
+	/* discard rest of the packet being spliced */
+	while (pmbr->splice_left) {
+		len = pool_splice_check_ack(pmbr);
+		if (len == 0)
+			return;
+		if (len < 0)
+			goto failure;
+		len = READSOCKET(tds_get_s(tds), buf, TDS_MIN(sizeof(buf), (unsigned int) len));
+		if (len > 0) {
+			pmbr->splice_left -= len;
+			continue;
+		}
+		if (len < 0) {
+			err = sock_errno;
+			if (err == EINTR)
+				continue;
+			if (TDSSOCK_WOULDBLOCK(err))
+				return;
+		}
+		goto failure;
+	}
+
+	for (;;) {
+		/* discard packets till cancel is acknowledged or response ends */
+		while (pmbr->busy || pool_packet_partial(tds)) {
+			if (pool_packet_read(tds))
+				return;
+			if (tds->in_len == 0)
+				goto failure;
+			tds->in_pos = tds->in_len;
+			if ((tds->in_buf[1] & TDS_STATUS_EOM) && (!pmbr->cancelling || pool_packet_cancel_ack(tds)))
+				pmbr->busy = pmbr->cancelling = false;
+		}
+		tds->in_cancel = 0;
+		tds_set_state(tds, TDS_IDLE);
+
+		/* do not keep locks of an open transaction while idle */
+		if (!pmbr->reset_now)
+			break;
+		if (!pool_send_reset(pmbr))
+			goto failure;
 	}
-	pmbr->sock.poll_send = false;
+
+	tdsdump_log(TDS_DBG_INFO1, "member reset completed\n");
+	pmbr->resetting = false;
+	pmbr->last_used_tm = time(NULL);
+
+	/* now member can be used by other users */
+	pool_deassign_member(pool, pmbr);
+	return;
+
+failure:
+	pool_free_member(pool, pmbr);
 }
 
 /*
@@ -176,46 +433,60 @@ pool_deassign_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr)
  * state, let's bring in a correct one
  * We are not sure what the client did so we must try to clean as much as
  * possible.
+ * The request in progress is cancelled and the member is made idle when
+ * the server acknowledges it; session state is reset setting the reset
+ * connection flag on next request so it costs no additional round trip.
  * Use pool_free_member if the state is really broken.
  */
 void
 pool_reset_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
 {
-	// FIXME not wait for server !!! asyncronous
 	TDSSOCKET *tds = pmbr->sock.tds;
 	TDS_POOL_USER *puser;
 
 	puser = pmbr->current_user;
 	if (puser) {
-		pool_deassign_member(pool, pmbr);
+		pool_unlink_member(pool, pmbr);
 		pool_free_user(pool, puser);
 	}
 
-	/* cancel whatever pending */
-	tds_init_write_buf(tds);
-	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
-		goto failure;
-	tds->out_flag = TDS_CANCEL;
-	if (TDS_FAILED(tds_flush_packet(tds)))
-		goto failure;
-	tds_set_state(tds, TDS_PENDING);
-	tds->in_cancel = 2;
+	/* still connecting, will be made idle when connected */
+	if (pmbr->doing_async)
+		return;
 
-	if (TDS_FAILED(tds_process_cancel(tds)))
+	/* a request packet was partially written, cannot send a cancel */
+	if (pmbr->sock.poll_send)
 		goto failure;
 
-	if (IS_TDS71_PLUS(tds->conn)) {
-		/* this 0x9 final reset the state from mssql 2000 */
+	/* drop data not forwarded to the user */
+	pool_mbr_close_pipe(pmbr);
+	tds->in_pos = tds->in_len;
+	/* a transaction left open must be rolled back now, not by next user */
+	pmbr->reset_now = pmbr->in_tran;
+	pool_session_reset(pmbr);
+
+	pmbr->reset_pending = true;
+	tds_mutex_lock(&pool->mtx);
+	pool->member_resets++;
+	tds_mutex_unlock(&pool->mtx);
+
+	/* cancel whatever pending, unless user already did it */
+	if (pmbr->busy && !pmbr->cancelling) {
+		tds_init_write_buf(tds);
 		if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
 			goto failure;
-		tds_start_query(tds, TDS_QUERY);
-		tds_put_string(tds, "WHILE @@TRANCOUNT > 0 ROLLBACK SET TRANSACTION ISOLATION LEVEL READ COMMITTED", -1);
-		tds_write_packet(tds, 0x9);
-		tds_set_state(tds, TDS_PENDING);
-
-		if (TDS_FAILED(tds_process_simple_query(tds)))
+		tds->out_flag = TDS_CANCEL;
+		if (TDS_FAILED(tds_flush_packet(tds)))
 			goto failure;
+		tds_set_state(tds, TDS_PENDING);
+		tds->in_cancel = 2;
+		pmbr->cancelling = true;
 	}
+
+	/* wait for the server in the event loop */
+	pmbr->resetting = true;
+	pool_socket_poll(&pmbr->sock, true, false);
+	pool_process_reset(pool, pmbr);
 	return;
 
 failure:
@@ -228,6 +499,7 @@ pool_free_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
 	TDSSOCKET *tds;
 	TDS_POOL_USER *puser;
 
+	pool_socket_unregister(&pmbr->sock);
 	tds = pmbr->sock.tds;
 	if (tds) {
 		if (!IS_TDSDEAD(tds))
@@ -242,16 +514,24 @@ pool_free_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
 	 */
 	puser = pmbr->current_user;
 	if (puser) {
-		pool_deassign_member(pool, pmbr);
+		pool_unlink_member(pool, pmbr);
 		pool_free_user(pool, puser);
 	}
 
+	/* members already detached (expired ones) are not in a list */
+	tds_mutex_lock(&pool->mtx);
 	if (dlist_member_in_list(&pool->active_members, pmbr)) {
 		pool->num_active_members--;
 		dlist_member_remove(&pool->active_members, pmbr);
+		/* a new member can be opened for waiting users */
+		if (dlist_user_first(&pool->waiters))
+			pool_worker_wakeup(dlist_user_first(&pool->waiters)->sock.worker);
 	}
-	free(pmbr);
 	pool_mbr_check(pool);
+	tds_mutex_unlock(&pool->mtx);
+	pool_mbr_close_pipe(pmbr);
+	pool_session_reset(pmbr);
+	free(pmbr);
 }
 
 void
@@ -268,12 +548,12 @@ pool_mbr_init(TDS_POOL * pool)
 
 	/* open connections for each member */
 	while (pool->num_active_members < pool->min_open_conn) {
-		pmbr = tds_new0(TDS_POOL_MEMBER, 1);
+		pmbr = pool_mbr_alloc(pool);
 		if (!pmbr) {
 			fprintf(stderr, "Out of memory\n");
 			exit(1);
 		}
-		pmbr->sock.poll_recv = true;
+		pool_socket_poll(&pmbr->sock, true, false);
 
 		pmbr->sock.tds = pool_mbr_login(pool, 0);
 		if (!pmbr->sock.tds) {
@@ -304,12 +584,124 @@ pool_mbr_destroy(TDS_POOL * pool)
 	pool->num_active_members = 0;
 }
 
+#if POOL_SPLICE
+/**
+ * Prepare member to forward data using splice.
+ * @return false if normal copy must be used
+ */
+static bool
+pool_splice_init(TDS_POOL *pool, TDS_POOL_MEMBER *pmbr)
+{
+	if (pmbr->splice_pipe[0] >= 0)
+		return true;
+
+	/* responses must be parsed to release the member */
+	if (pool->mode == TDS_POOL_TRANSACTION && !pmbr->pinned)
+		return false;
+
+	/* data read in the normal way not forwarded yet */
+	if (pmbr->sock.tds->in_pos < pmbr->sock.tds->in_len)
+		return false;
+
+	if (pipe(pmbr->splice_pipe)) {
+		pmbr->splice_pipe[0] = pmbr->splice_pipe[1] = -1;
+		return false;
+	}
+	fcntl(pmbr->splice_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(pmbr->splice_pipe[1], F_SETFL, O_NONBLOCK);
+	return true;
+}
+
+/**
+ * Forward data from member to user moving it through a pipe with splice.
+ * Data is never copied to userspace, only packet headers are peeked
+ * to know where packets (and so responses) end.
+ */
+static bool
+pool_splice_data(TDS_POOL *pool, TDS_POOL_MEMBER *pmbr)
+{
+	TDS_SYS_SOCKET s = tds_get_s(pmbr->sock.tds);
+	TDS_POOL_USER *puser = pmbr->current_user;
+	unsigned char header[8];
+	ssize_t len;
+	int err;
+
+	for (;;) {
+		/* send data still in the pipe */
+		if (pmbr->splice_pending) {
+			if (!pool_write_data(&pmbr->sock, &puser->sock)) {
+				tdsdump_log(TDS_DBG_ERROR, "member received error while writing\n");
+				pool_free_user(pool, puser);
+				return false;
+			}
+			/* partial write, schedule a future write */
+			if (pmbr->splice_pending)
+				break;
+		}
+
+		/* peek next packet header */
+		if (!pmbr->splice_left) {
+			len = recv(s, (void *) header, sizeof(header), MSG_PEEK);
+			if (len < 0)
+				goto read_error;
+			if (len == 0)
+				goto disconnected;
+			/* wait for the full header */
+			if (len < (ssize_t) sizeof(header))
+				break;
+			pmbr->splice_left = TDS_GET_A2BE(&header[2]);
+			if (pmbr->splice_left < 8)
+				goto disconnected;
+			/* after a cancel response ends with its acknowledge */
+			if ((header[1] & TDS_STATUS_EOM) && !pmbr->cancelling)
+				pmbr->busy = false;
+			else if (header[1] & TDS_STATUS_EOM)
+				pmbr->splice_ack = pmbr->splice_left >= 8 + POOL_DONE_SIZE(pmbr->sock.tds->conn);
+		}
+
+		len = pool_splice_check_ack(pmbr);
+		if (len < 0)
+			goto disconnected;
+		if (len == 0)
+			break;
+		len = splice(s, NULL, pmbr->splice_pipe[1], NULL, len, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (len < 0)
+			goto read_error;
+		if (len == 0)
+			goto disconnected;
+		pmbr->splice_left -= (unsigned int) len;
+		pmbr->splice_pending += (unsigned int) len;
+		continue;
+
+	read_error:
+		err = sock_errno;
+		if (err == EINTR)
+			continue;
+		if (TDSSOCK_WOULDBLOCK(err))
+			break;
+	disconnected:
+		tdsdump_log(TDS_DBG_INFO1, "Uh oh! member disconnected\n");
+		/* mark as dead */
+		pool_free_member(pool, pmbr);
+		return false;
+	}
+	if (!puser->sock.poll_send)
+		tds_connection_flush(puser->sock.tds);
+	return true;
+}
+#endif
+
 static bool
 pool_process_data(TDS_POOL *pool, TDS_POOL_MEMBER *pmbr)
 {
 	TDSSOCKET *tds = pmbr->sock.tds;
 	TDS_POOL_USER *puser = NULL;
 
+#if POOL_SPLICE
+	if (pmbr->current_user && pool_splice_init(pool, pmbr))
+		return pool_splice_data(pool, pmbr);
+#endif
+
 	for (;;) {
 		if (pool_packet_read(tds))
 			break;
@@ -323,10 +715,16 @@ pool_process_data(TDS_POOL *pool, TDS_POOL_MEMBER *pmbr)
 		}
 
 		tdsdump_dump_buf(TDS_DBG_NETWORK, "Got packet from server:", tds->in_buf, tds->in_len);
+		/* after a cancel response ends with its acknowledge */
+		if ((tds->in_buf[1] & TDS_STATUS_EOM) && (!pmbr->cancelling || pool_packet_cancel_ack(tds)))
+			pmbr->busy = pmbr->cancelling = false;
 		puser = pmbr->current_user;
 		if (!puser)
 			break;
 
+		if (pool->mode == TDS_POOL_TRANSACTION && !pmbr->pinned)
+			pool_session_response(pmbr, tds->in_buf + 8, tds->in_len - 8);
+
 		tdsdump_log(TDS_DBG_INFO1, "writing it sock %d\n", (int) tds_get_s(puser->sock.tds));
 		if (!pool_write_data(&pmbr->sock, &puser->sock)) {
 			tdsdump_log(TDS_DBG_ERROR, "member received error while writing\n");
@@ -339,92 +737,176 @@ pool_process_data(TDS_POOL *pool, TDS_POOL_MEMBER *pmbr)
 	}
 	if (puser && !puser->sock.poll_send)
 		tds_connection_flush(puser->sock.tds);
+	pool_release_member(pool, pmbr);
 	return true;
 }
 
 /* 
- * pool_process_members
- * check the fd_set for members returning data to the client, lookup the 
- * client holding this member and forward the results.
+ * pool_process_member
+ * handle member returning data to the client, forward the results to
+ * the client holding this member.
+ */
+void
+pool_process_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr, short revents)
+{
+	bool processed = false;
+
+	assert(pmbr->sock.tds);
+	if (pmbr->doing_async)
+		return;
+
+	if (pmbr->resetting) {
+		pool_process_reset(pool, pmbr);
+		return;
+	}
+	assert(pmbr->current_user);
+
+	if (pmbr->sock.poll_recv && (revents & (POLLIN|POLLHUP)) != 0) {
+		if (!pool_process_data(pool, pmbr))
+			return;
+		processed = true;
+	}
+	if (pmbr->sock.poll_send && (revents & POLLOUT) != 0) {
+		if (!pool_write_data(&pmbr->current_user->sock, &pmbr->sock)) {
+			pool_free_member(pool, pmbr);
+			return;
+		}
+		processed = true;
+	}
+	if (processed)
+		pmbr->last_used_tm = time(NULL);
+}
+
+/*
+ * pool_expire_members
+ * close idle members too old.
  * @return Timeout you should call this function again or -1 for infinite
  */
 int
-pool_process_members(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds)
+pool_expire_members(TDS_POOL * pool)
 {
 	TDS_POOL_MEMBER *pmbr, *next;
 	time_t age;
 	time_t time_now;
-	int min_expire_left = -1;
-	short revents;
-
-	pool_mbr_check(pool);
-	for (next = dlist_member_first(&pool->active_members); (pmbr = next) != NULL; ) {
-		bool processed = false;
+	int min_expire_left, min_conn;
+
+	do {
+		min_expire_left = -1;
+		tds_mutex_lock(&pool->mtx);
+		/* members wanted by adaptive sizing are kept too */
+		min_conn = pool->min_open_conn;
+		if (pool->adaptive_size)
+			min_conn = TDS_MAX(min_conn, pool->target_members);
+		if (pool->num_active_members <= min_conn) {
+			tds_mutex_unlock(&pool->mtx);
+			return min_expire_left;
+		}
 
-		next = dlist_member_next(&pool->active_members, pmbr);
+		/* close old connections */
+		time_now = time(NULL);
+		for (next = dlist_member_first(&pool->idle_members); (pmbr = next) != NULL; ) {
 
-		assert(pmbr->current_user);
-		if (pmbr->doing_async || pmbr->sock.poll_index > num_fds)
-			continue;
+			next = dlist_member_next(&pool->idle_members, pmbr);
 
-		revents = fds[pmbr->sock.poll_index].revents;
-		assert(pmbr->sock.tds);
+			assert(pmbr->sock.tds);
+			assert(!pmbr->current_user);
 
-		time_now = time(NULL);
-		if (pmbr->sock.poll_recv && (revents & (POLLIN|POLLHUP)) != 0) {
-			if (!pool_process_data(pool, pmbr))
-				continue;
-			processed = true;
-		}
-		if (pmbr->sock.poll_send && (revents & POLLOUT) != 0) {
-			if (!pool_write_data(&pmbr->current_user->sock, &pmbr->sock)) {
-				pool_free_member(pool, pmbr);
-				continue;
+			age = time_now - pmbr->last_used_tm;
+			if (age >= pool->max_member_age) {
+				/* detach from the pool, close it without the lock */
+				pool->num_active_members--;
+				dlist_member_remove(&pool->idle_members, pmbr);
+				break;
+			} else {
+				int left = (int) (pool->max_member_age - age);
+				if (min_expire_left < 0 || left < min_expire_left)
+					min_expire_left = left;
 			}
-			processed = true;
 		}
-		if (processed)
-			pmbr->last_used_tm = time_now;
-	}
+		tds_mutex_unlock(&pool->mtx);
 
-	if (pool->num_active_members <= pool->min_open_conn)
-		return min_expire_left;
+		if (pmbr) {
+			tdsdump_log(TDS_DBG_INFO1, "member is %ld seconds old...closing\n", (long int) age);
+			pool_free_member(pool, pmbr);
+		}
+	} while (pmbr);
+	return min_expire_left;
+}
 
-	/* close old connections */
-	time_now = time(NULL);
-	for (next = dlist_member_first(&pool->idle_members); (pmbr = next) != NULL; ) {
+/* seconds an idle member waits for a new user before its session is reset */
+#define POOL_RESET_DELAY 2
 
-		next = dlist_member_next(&pool->idle_members, pmbr);
+/*
+ * pool_reset_idle_members
+ * reset the session of idle members not reused shortly after their
+ * user left, so locks and resources of the previous user are released.
+ * @return Timeout you should call this function again or -1 for infinite
+ */
+int
+pool_reset_idle_members(TDS_POOL * pool, TDS_POOL_WORKER * worker)
+{
+	TDS_POOL_MEMBER *pmbr;
+	time_t time_now;
+	int min_left;
 
-		assert(pmbr->sock.tds);
-		assert(!pmbr->current_user);
+	do {
+		min_left = -1;
+		time_now = time(NULL);
+		tds_mutex_lock(&pool->mtx);
+		DLIST_FOREACH(dlist_member, &pool->idle_members, pmbr) {
+			time_t age;
 
-		age = time_now - pmbr->last_used_tm;
-		if (age >= pool->max_member_age) {
-			tdsdump_log(TDS_DBG_INFO1, "member is %ld seconds old...closing\n", (long int) age);
-			pool_free_member(pool, pmbr);
-		} else {
-			int left = (int) (pool->max_member_age - age);
-			if (min_expire_left < 0 || left < min_expire_left)
-				min_expire_left = left;
+			if (!pmbr->reset_pending)
+				continue;
+			age = time_now - pmbr->last_used_tm;
+			if (age >= POOL_RESET_DELAY)
+				break;
+			if (min_left < 0 || POOL_RESET_DELAY - age < min_left)
+				min_left = (int) (POOL_RESET_DELAY - age);
 		}
-	}
-	return min_expire_left;
+		/* keep it out of idle list till reset is done */
+		if (pmbr) {
+			dlist_member_remove(&pool->idle_members, pmbr);
+			dlist_member_append(&pool->active_members, pmbr);
+		}
+		tds_mutex_unlock(&pool->mtx);
+
+		if (pmbr) {
+			if (!pool_socket_register(worker, &pmbr->sock) || !pool_send_reset(pmbr)) {
+				pool_free_member(pool, pmbr);
+				continue;
+			}
+			pmbr->resetting = true;
+			pool_socket_poll(&pmbr->sock, true, false);
+		}
+	} while (pmbr);
+	return min_left;
 }
 
 static bool
 compatible_versions(const TDSSOCKET *tds, const TDS_POOL_USER *user)
 {
-	if (tds->conn->tds_version != user->login->tds_version)
+	const int tds_version = user->login ? user->login->tds_version : user->sock.tds->conn->tds_version;
+
+	if (tds->conn->tds_version != tds_version)
 		return false;
 	return true;
 }
 
+/* seconds between sizing decisions */
+#define POOL_SIZING_INTERVAL 1
+/* time constant of the moving averages, in seconds */
+#define POOL_SIZING_TAU 10.0
+/* delay of prewarming after a failed login */
+#define POOL_PREWARM_RETRY_MS 10000u
+
 typedef struct {
 	TDS_POOL_EVENT common;
 	TDS_POOL *pool;
+	TDS_POOL_WORKER *worker;
 	TDS_POOL_MEMBER *pmbr;
 	int tds_version;
+	unsigned int start_ms;
 } CONNECT_EVENT;
 
 static void connect_execute_ok(TDS_POOL_EVENT *base_event);
@@ -448,16 +930,16 @@ static TDS_THREAD_PROC_DECLARE(connect_proc, arg)
 		}
 
 		/* if already attached to a user we can send login directly */
-		if (pmbr->current_user)
+		if (pmbr->current_user && pmbr->current_user->login)
 			if (!pool_user_send_login_ack(pool, pmbr->current_user))
 				break;
 
-		pool_event_add(pool, &ev->common, connect_execute_ok);
+		pool_event_add(ev->worker, &ev->common, connect_execute_ok);
 		return TDS_THREAD_RESULT(0);
 	}
 
 	/* failure */
-	pool_event_add(pool, &ev->common, connect_execute_ko);
+	pool_event_add(ev->worker, &ev->common, connect_execute_ko);
 	return TDS_THREAD_RESULT(0);
 }
 
@@ -465,28 +947,52 @@ static void
 connect_execute_ko(TDS_POOL_EVENT *base_event)
 {
 	CONNECT_EVENT *ev = (CONNECT_EVENT *) base_event;
+	TDS_POOL *pool = ev->pool;
 
-	pool_free_member(ev->pool, ev->pmbr);
+	/* do not insist opening members for future users */
+	tds_mutex_lock(&pool->mtx);
+	pool->prewarm_ms = (tds_gettime_ms() + POOL_PREWARM_RETRY_MS) | 1;
+	tds_mutex_unlock(&pool->mtx);
+	pool_free_member(pool, ev->pmbr);
 }
 
 static void
 connect_execute_ok(TDS_POOL_EVENT *base_event)
 {
 	CONNECT_EVENT *ev = (CONNECT_EVENT *) base_event;
+	TDS_POOL *pool = ev->pool;
 	TDS_POOL_MEMBER *pmbr = ev->pmbr;
 	TDS_POOL_USER *puser = pmbr->current_user;
-
-	ev->pool->member_logins++;
+	double login_secs;
+
+	login_secs = (unsigned int) (tds_gettime_ms() - ev->start_ms) / 1000.0;
+	tds_mutex_lock(&pool->mtx);
+	pool->member_logins++;
+	if (pool->ewma_login_secs > 0)
+		pool->ewma_login_secs += 0.25 * (login_secs - pool->ewma_login_secs);
+	else
+		pool->ewma_login_secs = login_secs;
+	tds_mutex_unlock(&pool->mtx);
 	pmbr->doing_async = false;
 
 	pmbr->last_used_tm = time(NULL);
 
-	if (puser) {
-		pmbr->sock.poll_recv = true;
-		puser->sock.poll_recv = true;
+	/* user left while connecting */
+	if (!puser) {
+		pool_deassign_member(pool, pmbr);
+		return;
+	}
 
-		puser->user_state = TDS_SRV_QUERY;
+	if (!pool_socket_register(puser->sock.worker, &pmbr->sock)) {
+		pool_free_member(pool, pmbr);
+		return;
 	}
+	pool_socket_poll(&pmbr->sock, true, pmbr->sock.poll_send);
+	/* user may have sent a request while connecting */
+	puser->sock.revents |= POLLIN;
+	pool_socket_poll(&puser->sock, true, puser->sock.poll_send);
+
+	puser->user_state = TDS_SRV_QUERY;
 }
 
 /*
@@ -499,10 +1005,18 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 	TDS_POOL_MEMBER *pmbr;
 	CONNECT_EVENT *ev;
 
-	puser->sock.poll_recv = false;
-	puser->sock.poll_send = false;
+	pool_socket_poll(&puser->sock, false, false);
 
+	tds_mutex_lock(&pool->mtx);
 	pool_mbr_check(pool);
+
+	/* class already uses all members it can */
+	if (pool->max_user_conn && puser->pclass && puser->pclass->num_members >= pool->max_user_conn) {
+		tds_mutex_unlock(&pool->mtx);
+		tdsdump_log(TDS_DBG_INFO1, "Class %s reached \"max user conn\"\n", puser->pclass->name);
+		return NULL;
+	}
+
 	DLIST_FOREACH(dlist_member, &pool->idle_members, pmbr) {
 		assert(pmbr->current_user == NULL);
 		assert(!pmbr->doing_async);
@@ -513,6 +1027,7 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 			continue;
 
 		pool_assign_member(pool, pmbr, puser);
+		tds_mutex_unlock(&pool->mtx);
 
 		/*
 		 * make sure member wasn't idle more that the timeout
@@ -520,21 +1035,29 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 		 * hung client
 		 */
 		pmbr->last_used_tm = time(NULL);
-		pmbr->sock.poll_recv = false;
-		pmbr->sock.poll_send = false;
+		pool_socket_poll(&pmbr->sock, false, false);
+		if (!pool_socket_register(puser->sock.worker, &pmbr->sock)) {
+			/* drop the member, user will wait for another one */
+			pool_unlink_member(pool, pmbr);
+			pool_free_member(pool, pmbr);
+			return NULL;
+		}
 
-		pool_user_finish_login(pool, puser);
+		if (puser->login)
+			pool_user_finish_login(pool, puser);
 		return pmbr;
 	}
 
 	/* if we can open a new connection open it */
 	if (pool->num_active_members >= pool->max_open_conn) {
+		tds_mutex_unlock(&pool->mtx);
 		fprintf(stderr, "No idle members left, increase \"max pool conn\"\n");
 		return NULL;
 	}
 
-	pmbr = tds_new0(TDS_POOL_MEMBER, 1);
+	pmbr = pool_mbr_alloc(pool);
 	if (!pmbr) {
+		tds_mutex_unlock(&pool->mtx);
 		fprintf(stderr, "Out of memory\n");
 		return NULL;
 	}
@@ -543,32 +1066,162 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 
 	ev = tds_new0(CONNECT_EVENT, 1);
 	if (!ev) {
+		tds_mutex_unlock(&pool->mtx);
 		free(pmbr);
 		fprintf(stderr, "Out of memory\n");
 		return NULL;
 	}
 	ev->pmbr = pmbr;
 	ev->pool = pool;
-	ev->tds_version = puser->login->tds_version;
+	ev->worker = puser->sock.worker;
+	ev->tds_version = puser->login ? puser->login->tds_version : puser->sock.tds->conn->tds_version;
+	ev->start_ms = tds_gettime_ms();
+
+	/* connection is counted before connecting to respect the limit */
+	pmbr->doing_async = true;
+	pool->num_active_members++;
+	dlist_member_append(&pool->idle_members, pmbr);
+	pool_assign_member(pool, pmbr, puser);
+	tds_mutex_unlock(&pool->mtx);
 
 	if (tds_thread_create_detached(connect_proc, ev) != 0) {
+		pool_unlink_member(pool, pmbr);
+		tds_mutex_lock(&pool->mtx);
+		pool->num_active_members--;
+		dlist_member_remove(&pool->active_members, pmbr);
+		tds_mutex_unlock(&pool->mtx);
 		free(pmbr);
 		free(ev);
 		fprintf(stderr, "error creating thread\n");
 		return NULL;
 	}
-	pmbr->doing_async = true;
 
-	pool_mbr_check(pool);
+	return pmbr;
+}
+
+
+/*
+ * pool_mbr_prewarm
+ * open a member before users need it.
+ * It stays in the active list while connecting, see connect_execute_ok.
+ */
+static bool
+pool_mbr_prewarm(TDS_POOL * pool, TDS_POOL_WORKER * worker)
+{
+	TDS_POOL_MEMBER *pmbr;
+	CONNECT_EVENT *ev;
+
+	pmbr = pool_mbr_alloc(pool);
+	ev = tds_new0(CONNECT_EVENT, 1);
+	if (!pmbr || !ev) {
+		free(pmbr);
+		free(ev);
+		return false;
+	}
+	ev->pmbr = pmbr;
+	ev->pool = pool;
+	ev->worker = worker;
+	ev->start_ms = tds_gettime_ms();
+
+	tds_mutex_lock(&pool->mtx);
+	if (pool->prewarm_ms && (int) (ev->start_ms - pool->prewarm_ms) >= 0)
+		pool->prewarm_ms = 0;
+	if (pool->prewarm_ms || pool->num_active_members >= pool->target_members
+	    || pool->num_active_members >= pool->max_open_conn) {
+		tds_mutex_unlock(&pool->mtx);
+		free(pmbr);
+		free(ev);
+		return false;
+	}
+	pmbr->doing_async = true;
 	pool->num_active_members++;
-	dlist_member_append(&pool->idle_members, pmbr);
-	pool_mbr_check(pool);
+	pool->members_prewarmed++;
+	dlist_member_append(&pool->active_members, pmbr);
+	tds_mutex_unlock(&pool->mtx);
 
-	pool_assign_member(pool, pmbr, puser);
-	puser->sock.poll_send = false;
-	puser->sock.poll_recv = false;
+	if (tds_thread_create_detached(connect_proc, ev) != 0) {
+		tds_mutex_lock(&pool->mtx);
+		pool->num_active_members--;
+		pool->members_prewarmed--;
+		dlist_member_remove(&pool->active_members, pmbr);
+		tds_mutex_unlock(&pool->mtx);
+		free(pmbr);
+		free(ev);
+		return false;
+	}
+	return true;
+}
 
-	return pmbr;
+/*
+ * pool_size_members
+ * adapt the number of members to the demand.
+ * Members in use, waiting users and users arriving while a member
+ * logs in are tracked with moving averages; members are opened
+ * ahead of demand to keep "warm spares" idle ones and retired one
+ * at a time when well above the target so the pool does not bounce.
+ * @return seconds till next call, -1 for infinite
+ */
+int
+pool_size_members(TDS_POOL * pool, TDS_POOL_WORKER * worker)
+{
+	TDS_POOL_MEMBER *pmbr;
+	unsigned int now = tds_gettime_ms(), in_use = 0;
+	double dt, alpha, rate, demand;
+	int target, high;
+
+	if (!pool->adaptive_size)
+		return -1;
+
+	dt = (unsigned int) (now - pool->sizing_ms) / 1000.0;
+	if (pool->sizing_ms && dt < POOL_SIZING_INTERVAL)
+		return POOL_SIZING_INTERVAL;
+
+	tds_mutex_lock(&pool->mtx);
+	if (!pool->sizing_ms)
+		dt = POOL_SIZING_INTERVAL;
+	pool->sizing_ms = now;
+
+	DLIST_FOREACH(dlist_member, &pool->active_members, pmbr)
+		if (pmbr->current_user)
+			++in_use;
+	rate = pool->grants / dt;
+	pool->grants = 0;
+
+	alpha = dt / (POOL_SIZING_TAU + dt);
+	pool->ewma_in_use += alpha * (in_use - pool->ewma_in_use);
+	pool->ewma_waiters += alpha * (pool->num_waiters - pool->ewma_waiters);
+	pool->ewma_rate += alpha * (rate - pool->ewma_rate);
+
+	demand = pool->ewma_in_use + pool->ewma_waiters + pool->ewma_rate * pool->ewma_login_secs;
+	target = (int) (demand + 0.999) + pool->warm_spares;
+	target = TDS_MIN(TDS_MAX(target, pool->min_open_conn), pool->max_open_conn);
+	if (target != pool->target_members)
+		tdsdump_log(TDS_DBG_INFO1, "members target %d (in use %.2f waiters %.2f rate %.2f/s login %.2fs)\n",
+			    target, pool->ewma_in_use, pool->ewma_waiters, pool->ewma_rate, pool->ewma_login_secs);
+	pool->target_members = target;
+
+	/* retire the member idle for more time */
+	high = target + TDS_MAX(1, target / 4);
+	pmbr = NULL;
+	if (pool->num_active_members > high && pool->num_active_members > pool->min_open_conn) {
+		pmbr = dlist_member_first(&pool->idle_members);
+		if (pmbr) {
+			pool->num_active_members--;
+			pool->members_retired++;
+			dlist_member_remove(&pool->idle_members, pmbr);
+		}
+	}
+	tds_mutex_unlock(&pool->mtx);
+
+	if (pmbr) {
+		tdsdump_log(TDS_DBG_INFO1, "retiring member, %d over target\n", pool->num_active_members - target);
+		pool_free_member(pool, pmbr);
+	}
+
+	while (pool_mbr_prewarm(pool, worker))
+		tdsdump_log(TDS_DBG_INFO1, "prewarming member\n");
+
+	return POOL_SIZING_INTERVAL;
 }
 
 #if ENABLE_EXTRA_CHECKS
@@ -577,9 +1230,9 @@ void pool_mbr_check(TDS_POOL *pool)
 	TDS_POOL_MEMBER *pmbr;
 	unsigned total = 0;
 
+	/* active members can be detached from user while resetting */
 	DLIST_FOREACH(dlist_member, &pool->active_members, pmbr) {
 		assert(pmbr->doing_async || pmbr->sock.tds);
-		assert(pmbr->current_user);
 		++total;
 	}
 	DLIST_FOREACH(dlist_member, &pool->idle_members, pmbr) {
@@ -37,15 +37,31 @@
 #include <sys/time.h>
 #endif
 
+#if HAVE_SPLICE
+#include <fcntl.h>
+#endif
+
 #include <freetds/tds.h>
 #include <freetds/utils/dlist.h>
 #include <freetds/replacements.h>
 
+/* forward data from members to users without copying it to userspace */
+#if HAVE_SPLICE && defined(SPLICE_F_MOVE)
+#define POOL_SPLICE 1
+#endif
+
 /* defines */
 #define PGSIZ 2048
 #define BLOCKSIZ 512
 #define MAX_POOL_USERS 1024
 
+/* database name giving access to pool statistics, see admin.c */
+#define POOL_ADMIN_DATABASE "pool_admin"
+/* buckets of wait time histogram, powers of 10 milliseconds */
+#define POOL_WAIT_BUCKETS 6
+/* hash buckets of the result cache, see cache.c */
+#define POOL_CACHE_BUCKETS 256
+
 /* enums and typedefs */
 typedef enum
 {
@@ -53,12 +69,37 @@ typedef enum
 	TDS_SRV_QUERY,
 } TDS_USER_STATE;
 
+typedef enum
+{
+	TDS_POOL_SESSION,	/* member assigned till user disconnects */
+	TDS_POOL_TRANSACTION,	/* member released after every batch outside transactions */
+} TDS_POOL_MODE;
+
+/* login field grouping users in classes */
+typedef enum
+{
+	TDS_POOL_CLASS_APP,	/* application name */
+	TDS_POOL_CLASS_DATABASE,	/* database */
+	TDS_POOL_CLASS_HOST,	/* client host name */
+} TDS_POOL_CLASS_BY;
+
+/* listening sockets of a pool */
+enum
+{
+	POOL_LISTEN_TCP,
+	POOL_LISTEN_UNIX,
+	POOL_NUM_LISTEN
+};
+
 /* forward declaration */
 typedef struct tds_pool_event TDS_POOL_EVENT;
 typedef struct tds_pool_socket TDS_POOL_SOCKET;
 typedef struct tds_pool_member TDS_POOL_MEMBER;
 typedef struct tds_pool_user TDS_POOL_USER;
+typedef struct tds_pool_cache_entry TDS_POOL_CACHE_ENTRY;
 typedef struct tds_pool TDS_POOL;
+typedef struct tds_pool_set TDS_POOL_SET;
+typedef struct tds_pool_worker TDS_POOL_WORKER;
 typedef void (*TDS_POOL_EXECUTE)(TDS_POOL_EVENT *event);
 
 struct tds_pool_event
@@ -70,11 +111,73 @@ struct tds_pool_event
 struct tds_pool_socket
 {
 	TDSSOCKET *tds;
+	/** pool owning the user or member */
+	TDS_POOL *pool;
+	/** worker polling the socket, NULL if not registered */
+	TDS_POOL_WORKER *worker;
+	DLIST_FIELDS(dlist_ready_item);
+	/** readiness (POLLIN/POLLOUT/POLLHUP) reported but not consumed yet */
+	short revents;
+	bool is_member;
 	uint32_t poll_index;
 	bool poll_recv;
 	bool poll_send;
 };
 
+#define DLIST_PREFIX dlist_ready
+#define DLIST_LIST_TYPE dlist_sockets
+#define DLIST_ITEM_TYPE TDS_POOL_SOCKET
+#include <freetds/utils/dlist.tmpl.h>
+
+/**
+ * A thread polling a shard of the users and the members assigned to them.
+ * Workers are shared by all pools of the process.
+ * Sockets are registered once (edge triggered where epoll is available),
+ * readiness is remembered in the socket till the flags allow to consume it.
+ */
+struct tds_pool_worker
+{
+	TDS_POOL_SET *set;
+	unsigned int index;
+	tds_thread thread;
+#if HAVE_SYS_EPOLL_H
+	int epoll_fd;
+#else
+	/** registered sockets, used to build poll array */
+	TDS_POOL_SOCKET **socks;
+	uint32_t num_socks, alloc_socks;
+	struct pollfd *fds;
+#endif
+	/** sockets with readiness to process */
+	dlist_sockets ready;
+	tds_mutex events_mtx;
+	TDS_SYS_SOCKET wakeup_fd;
+	TDS_SYS_SOCKET event_fd;
+	TDS_POOL_EVENT *events;
+	/** data forwarded by the worker */
+	TDS_UINT8 bytes_to_members, bytes_to_users;
+};
+
+/* virtual time of a grant to a class with weight 1 */
+#define POOL_STRIDE 1000000u
+
+/**
+ * Users with the same application name, database or client host,
+ * see "user class" option.
+ * Waiting users are served in order of class virtual time so
+ * classes get members in proportion of their weights.
+ */
+typedef struct tds_pool_class
+{
+	struct tds_pool_class *next;
+	char *name;
+	unsigned int weight;
+	/** members assigned to users of the class */
+	unsigned int num_members;
+	/** virtual time of next grant, advances by POOL_STRIDE / weight */
+	TDS_UINT8 pass;
+} TDS_POOL_CLASS;
+
 struct tds_pool_user
 {
 	TDS_POOL_SOCKET sock;
@@ -82,15 +185,94 @@ struct tds_pool_user
 	TDSLOGIN *login;
 	TDS_USER_STATE user_state;
 	TDS_POOL_MEMBER *assigned_member;
+	TDS_POOL_CLASS *pclass;
+	/** when user started waiting for a member, 0 if not waiting */
+	time_t wait_tm;
+	unsigned int wait_ms;
+	/** logged into admin database, requests are answered by the pool */
+	bool admin;
+	/** request continues in next packet */
+	bool admin_more;
+	/** command being received by admin user, in upper case */
+	char admin_cmd[64];
+	unsigned int admin_cmd_len;
+	/** response of a cacheable query being recorded, see cache.c */
+	TDS_POOL_CACHE_ENTRY *cache_fill;
+	/** request of cache_fill was forwarded to the member */
+	bool cache_fill_sent;
+	/** cached response being sent and bytes already sent */
+	TDS_POOL_CACHE_ENTRY *cache_reply;
+	size_t cache_reply_pos;
 };
 
+/* encoding of a column value in rows, see session.c */
+typedef struct tds_pool_column
+{
+	unsigned char kind;
+	unsigned char size;
+} TDS_POOL_COLUMN;
+
+/* state of member session tracking, see session.c */
+typedef struct tds_pool_scan
+{
+	/** response data not parsed yet */
+	unsigned char *buf;
+	size_t buf_len, buf_size;
+	/** response bytes to discard before parsing next data */
+	TDS_UINT8 skip;
+	/** columns of current result */
+	TDS_POOL_COLUMN *columns;
+	unsigned int num_columns;
+	/** NULL bitmap of current row */
+	unsigned char *nulls;
+	/** return value being parsed */
+	TDS_POOL_COLUMN param;
+	/** columns of row being parsed, NULL if not inside a row */
+	const TDS_POOL_COLUMN *row_columns;
+	unsigned int row_num_columns, row_col;
+	bool row_nbc;
+	/** reading chunks of a PLP value */
+	bool plp;
+	/** response contains errors */
+	bool error;
+	/** text of SQL batch request, in upper case ASCII */
+	char *sql;
+	size_t sql_len, sql_size;
+} TDS_POOL_SCAN;
+
 struct tds_pool_member
 {
 	TDS_POOL_SOCKET sock;
 	DLIST_FIELDS(dlist_member_item);
 	bool doing_async;
+	/** a request was sent, end of its response not received yet */
+	bool busy;
+	/** user sent a cancel, busy till the server acknowledges it */
+	bool cancelling;
+	/** reset in progress, see pool_reset_member */
+	bool resetting;
+	/** session must be reset by next request */
+	bool reset_pending;
+	/** session must be reset before the member is made idle */
+	bool reset_now;
+	time_t open_tm;
 	time_t last_used_tm;
 	TDS_POOL_USER *current_user;
+	/** class of last user the member was given to */
+	TDS_POOL_CLASS *last_class;
+	/** pipe used to splice data to the user, -1 if not allocated */
+	int splice_pipe[2];
+	/** bytes of current packet still to read from member socket */
+	unsigned int splice_left;
+	/** bytes in the pipe still to write to the user */
+	unsigned int splice_pending;
+	/** current packet ends the response to a cancel, check its tail */
+	bool splice_ack;
+	/** session has state, cannot be released to other users */
+	bool pinned;
+	/** a transaction is open */
+	bool in_tran;
+	TDS_POOL_SCAN scan;
 };
 
 #define DLIST_PREFIX dlist_member
@@ -103,8 +285,38 @@ struct tds_pool_member
 #define DLIST_ITEM_TYPE TDS_POOL_USER
 #include <freetds/utils/dlist.tmpl.h>
 
+/**
+ * Complete response to a query, as packets received from the member.
+ * Entries are shared by users sending them, data does not change
+ * once the entry is in the cache.
+ */
+struct tds_pool_cache_entry
+{
+	DLIST_FIELDS(dlist_cache_item);
+	/** next entry in the same hash bucket */
+	TDS_POOL_CACHE_ENTRY *hash_next;
+	uint32_t hash;
+	/** users sending the entry plus one if in the cache */
+	unsigned int refs;
+	time_t expire_tm;
+	/** TDS version and SQL text (UCS-2) of the query */
+	TDS_USMALLINT tds_version;
+	size_t sql_len;
+	unsigned char *sql;
+	size_t data_len, data_size;
+	unsigned char *data;
+};
+
+#define DLIST_PREFIX dlist_cache
+#define DLIST_LIST_TYPE dlist_cache_entries
+#define DLIST_ITEM_TYPE TDS_POOL_CACHE_ENTRY
+#include <freetds/utils/dlist.tmpl.h>
+
 struct tds_pool
 {
+	TDS_POOL_SET *set;
+	/** next pool of the set */
+	TDS_POOL *next;
 	char *name;
 	char *user;
 	char *password;
@@ -113,14 +325,37 @@ struct tds_pool
 	char *server_user;
 	char *server_password;
 	int port;
+	char *unix_socket;	/* path of optional Unix domain socket */
+	/** file of the Unix socket bound by us, removed at exit */
+	dev_t unix_socket_dev;
+	ino_t unix_socket_ino;
 	int max_member_age;	/* in seconds */
 	int min_open_conn;
 	int max_open_conn;
-	tds_mutex events_mtx;
-	TDS_SYS_SOCKET listen_fd;
-	TDS_SYS_SOCKET wakeup_fd;
-	TDS_SYS_SOCKET event_fd;
-	TDS_POOL_EVENT *events;
+	TDS_POOL_MODE mode;
+	int max_waiters;	/* 0 for no limit */
+	int wait_timeout;	/* in seconds, 0 for no limit */
+	int max_user_conn;	/* members for class, 0 for no limit */
+	TDS_POOL_CLASS_BY class_by;
+	bool adaptive_size;
+	int warm_spares;	/* idle members kept ready by adaptive sizing */
+	/** queries whose results can be cached, in upper case, a final '*' matches any text */
+	char **cache_queries;
+	unsigned int num_cache_queries;
+	int cache_ttl;	/* in seconds */
+	int cache_size;	/* in kilobytes */
+	unsigned int num_workers;	/* from configuration, see TDS_POOL_SET */
+
+	/**
+	 * sockets accepting users, INVALID_SOCKET if not configured or
+	 * if a previous pool listens on the same port, see pool_user_route
+	 */
+	TDS_SYS_SOCKET listen_fds[POOL_NUM_LISTEN];
+	/** listening socket has users to accept */
+	bool listen_ready[POOL_NUM_LISTEN];
+
+	/** protects lists and counters shared between workers */
+	tds_mutex mtx;
 
 	int num_active_members;
 	dlist_members active_members;
@@ -128,18 +363,84 @@ struct tds_pool
 
 	/** users in wait state */
 	dlist_users waiters;
+	int num_waiters;
+	/** classes seen, from configuration or logins */
+	TDS_POOL_CLASS *classes;
+	/** virtual time of last grant */
+	TDS_UINT8 pass;
 	int num_users;
 	dlist_users users;
-	TDSCONTEXT *ctx;
 
 	unsigned long user_logins;
 	unsigned long member_logins;
+
+	/* adaptive sizing, see pool_size_members */
+	unsigned int sizing_ms;
+	/** no prewarming till this time, set when a login fails */
+	unsigned int prewarm_ms;
+	/** members given to users since last sizing */
+	unsigned int grants;
+	double ewma_in_use, ewma_waiters, ewma_rate, ewma_login_secs;
+	int target_members;
+	unsigned long members_prewarmed;
+	unsigned long members_retired;
+
+	/* statistics, see admin.c */
+	unsigned long wait_hist[POOL_WAIT_BUCKETS];
+	unsigned long member_resets;
+
+	/* result cache, see cache.c */
+	TDS_POOL_CACHE_ENTRY *cache_hash[POOL_CACHE_BUCKETS];
+	/** entries, least recently used first */
+	dlist_cache_entries cache_lru;
+	unsigned int cache_entries;
+	size_t cache_bytes;
+	unsigned long cache_hits;
+	unsigned long cache_misses;
+};
+
+/**
+ * Pools served by the process.
+ * Workers, the context of user sockets and the event loop are shared.
+ */
+struct tds_pool_set
+{
+	/** pools, in command line order */
+	TDS_POOL *pools;
+	/** listening sockets of all pools */
+	unsigned int num_listeners;
+
+	unsigned int num_workers;
+	TDS_POOL_WORKER *workers;
+	/** worker receiving next accepted user */
+	unsigned int next_worker;
+
+	TDSCONTEXT *ctx;
 };
 
 /* prototypes */
 
+/* admin.c */
+bool pool_admin_login(TDS_POOL * pool, TDS_POOL_USER * puser);
+bool pool_admin_read(TDS_POOL * pool, TDS_POOL_USER * puser);
+void pool_admin_wait_time(TDS_POOL * pool, unsigned int wait_ms);
+
+/* cache.c */
+void pool_cache_init(TDS_POOL * pool);
+void pool_cache_destroy(TDS_POOL * pool);
+bool pool_cache_request(TDS_POOL * pool, TDS_POOL_USER * puser);
+bool pool_cache_reply(TDS_POOL * pool, TDS_POOL_USER * puser);
+bool pool_cache_send(TDS_POOL * pool, TDS_POOL_USER * puser, unsigned char *data, size_t data_len);
+void pool_cache_forward(TDS_POOL_USER * puser, TDSSOCKET * tds);
+void pool_cache_data(TDS_POOL_USER * puser, const unsigned char *data, size_t len);
+void pool_cache_store(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr);
+void pool_cache_user_free(TDS_POOL * pool, TDS_POOL_USER * puser);
+
 /* member.c */
-int pool_process_members(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds);
+void pool_process_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr, short revents);
+int pool_expire_members(TDS_POOL * pool);
+int pool_size_members(TDS_POOL * pool, TDS_POOL_WORKER * worker);
+int pool_reset_idle_members(TDS_POOL * pool, TDS_POOL_WORKER * worker);
 TDS_POOL_MEMBER *pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *user);
 void pool_mbr_init(TDS_POOL * pool);
 void pool_mbr_destroy(TDS_POOL * pool);
@@ -147,6 +448,8 @@ void pool_free_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr);
 void pool_assign_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr, TDS_POOL_USER *puser);
 void pool_deassign_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr);
 void pool_reset_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr);
+void pool_release_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr);
+void pool_unlink_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr);
 bool pool_packet_read(TDSSOCKET * tds);
 #if ENABLE_EXTRA_CHECKS
 void pool_mbr_check(TDS_POOL *pool);
@@ -158,21 +461,40 @@ static inline void pool_mbr_check(TDS_POOL *pool TDS_UNUSED)
 
 
 /* user.c */
-void pool_process_users(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds);
+void pool_process_user(TDS_POOL * pool, TDS_POOL_USER * puser, short revents);
 void pool_user_init(TDS_POOL * pool);
 void pool_user_destroy(TDS_POOL * pool);
 TDS_POOL_USER *pool_user_create(TDS_POOL * pool, TDS_SYS_SOCKET s);
+int pool_schedule_waiters(TDS_POOL * pool, TDS_POOL_WORKER * worker);
 void pool_free_user(TDS_POOL * pool, TDS_POOL_USER * puser);
-void pool_user_query(TDS_POOL * pool, TDS_POOL_USER * puser);
+bool pool_user_query(TDS_POOL * pool, TDS_POOL_USER * puser);
+TDS_POOL_CLASS *pool_class_get(TDS_POOL * pool, const char *name);
+void pool_user_granted(TDS_POOL * pool, TDS_POOL_USER * puser);
 bool pool_user_send_login_ack(TDS_POOL * pool, TDS_POOL_USER * puser);
 void pool_user_finish_login(TDS_POOL * pool, TDS_POOL_USER * puser);
 
+/* session.c */
+void pool_session_request(TDS_POOL_MEMBER * pmbr, TDSSOCKET * tds, bool first);
+void pool_session_response(TDS_POOL_MEMBER * pmbr, const unsigned char *data, size_t len);
+void pool_session_reset(TDS_POOL_MEMBER * pmbr);
+
 /* util.c */
 void dump_login(TDSLOGIN * login);
-void pool_event_add(TDS_POOL *pool, TDS_POOL_EVENT *ev, TDS_POOL_EXECUTE execute);
+void pool_event_add(TDS_POOL_WORKER *worker, TDS_POOL_EVENT *ev, TDS_POOL_EXECUTE execute);
 int pool_write(TDS_SYS_SOCKET sock, const void *buf, size_t len);
 bool pool_write_data(TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to);
 
+/* worker.c */
+bool pool_worker_init(TDS_POOL_WORKER * worker, TDS_POOL_SET * set, unsigned int index);
+void pool_worker_destroy(TDS_POOL_WORKER * worker);
+int pool_worker_wait(TDS_POOL_WORKER * worker, int timeout, bool *accept);
+void pool_worker_wakeup(TDS_POOL_WORKER * worker);
+void pool_worker_process_events(TDS_POOL_WORKER * worker);
+void pool_worker_process_ready(TDS_POOL_WORKER * worker);
+bool pool_socket_register(TDS_POOL_WORKER * worker, TDS_POOL_SOCKET * sock) TDS_WUR;
+void pool_socket_unregister(TDS_POOL_SOCKET * sock);
+void pool_socket_poll(TDS_POOL_SOCKET * sock, bool recv, bool send);
+
 /* config.c */
 bool pool_read_conf_files(const tds_dir_char *path, const char *poolname, TDS_POOL * pool, char **err);
 
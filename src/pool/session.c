@@ -0,0 +1,829 @@
+/* TDSPool - Connection pooling for TDS based databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Session state tracking used by transaction pooling.
+ * A member is given back to the pool at the end of every batch so we
+ * must know when its session has state other users must not see.
+ * Responses are scanned for ENVCHANGE tokens to know if a transaction
+ * is open; only token framing is parsed, values are skipped.
+ * Requests are searched for statements changing the session (SET
+ * options, temporary tables, cursors, prepared statements); members
+ * with such state are pinned to their user.
+ */
+
+#include <config.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include "pool.h"
+#include <freetds/bytes.h>
+
+/* column value encodings */
+enum {
+	POOL_COL_FIXED,
+	POOL_COL_LEN1,
+	POOL_COL_LEN2,
+	POOL_COL_LEN4,
+	POOL_COL_TEXT,
+	POOL_COL_PLP,
+};
+
+#define SCAN_MORE  (-1)
+#define SCAN_ERROR (-2)
+
+/* limits of buffered data, above them session is pinned */
+#define SCAN_MAX_BUF (4u * 1024u * 1024u)
+#define SCAN_MAX_SQL (1024u * 1024u)
+
+static void
+scan_reset_response(TDS_POOL_SCAN *scan)
+{
+	scan->buf_len = 0;
+	scan->skip = 0;
+	scan->row_columns = NULL;
+	scan->plp = false;
+	scan->error = false;
+}
+
+/* append data to the scan buffer */
+static bool
+scan_append(TDS_POOL_SCAN *scan, const unsigned char *data, size_t len)
+{
+	size_t n;
+
+	if (scan->buf_len + len > SCAN_MAX_BUF)
+		return false;
+	if (scan->buf_len + len > scan->buf_size) {
+		n = TDS_MAX(scan->buf_len + len, 512u) * 2u;
+		if (!TDS_RESIZE(scan->buf, n))
+			return false;
+		scan->buf_size = n;
+	}
+	memcpy(scan->buf + scan->buf_len, data, len);
+	scan->buf_len += len;
+	return true;
+}
+
+/**
+ * Free session tracking state, called when member is reset.
+ */
+void
+pool_session_reset(TDS_POOL_MEMBER *pmbr)
+{
+	TDS_POOL_SCAN *scan = &pmbr->scan;
+
+	free(scan->buf);
+	free(scan->columns);
+	free(scan->nulls);
+	free(scan->sql);
+	memset(scan, 0, sizeof(*scan));
+	pmbr->pinned = false;
+	pmbr->in_tran = false;
+}
+
+static void
+scan_envchange(TDS_POOL_MEMBER *pmbr, unsigned char type)
+{
+	switch (type) {
+	case TDS_ENV_BEGINTRANS:
+		pmbr->in_tran = true;
+		break;
+	case TDS_ENV_COMMITTRANS:
+	case TDS_ENV_ROLLBACKTRANS:
+	case TDS_ENV_TRANSENDED:
+		pmbr->in_tran = false;
+		break;
+	case TDS_ENV_RESETACK:
+		break;
+	default:
+		/* database, language, distributed transactions... */
+		tdsdump_log(TDS_DBG_INFO1, "session changed by envchange %d, pinning\n", type);
+		pmbr->pinned = true;
+		break;
+	}
+}
+
+/**
+ * Parse TYPE_INFO of a column or return value.
+ * @return bytes used, SCAN_MORE if more data is needed or SCAN_ERROR
+ */
+static int
+scan_type_info(TDS_POOL_MEMBER *pmbr, const unsigned char *p, size_t avail, TDS_POOL_COLUMN *col)
+{
+	const bool tds72 = IS_TDS72_PLUS(pmbr->sock.tds->conn);
+	TDS_SERVER_TYPE type;
+	size_t pos = 1;
+	unsigned int n;
+
+#define NEED(n) do { if (avail < pos + (n)) return SCAN_MORE; } while(0)
+
+	NEED(0);
+	type = (TDS_SERVER_TYPE) p[0];
+	col->size = 0;
+	switch (type) {
+	case SYBINT1:
+	case SYBBIT:
+	case SYBINT2:
+	case SYBINT4:
+	case SYBINT8:
+	case SYBDATETIME4:
+	case SYBREAL:
+	case SYBMONEY:
+	case SYBDATETIME:
+	case SYBFLT8:
+	case SYBMONEY4:
+	case SYBVOID:
+		col->kind = POOL_COL_FIXED;
+		col->size = tds_get_size_by_type(type);
+		break;
+	case SYBMSDATE:
+		col->kind = POOL_COL_LEN1;
+		break;
+	case SYBMSTIME:
+	case SYBMSDATETIME2:
+	case SYBMSDATETIMEOFFSET:
+	case SYBUNIQUE:
+	case SYBINTN:
+	case SYBBITN:
+	case SYBFLTN:
+	case SYBMONEYN:
+	case SYBDATETIMN:
+	case SYBCHAR:
+	case SYBVARCHAR:
+	case SYBBINARY:
+	case SYBVARBINARY:
+		/* size or scale */
+		pos += 1;
+		col->kind = POOL_COL_LEN1;
+		break;
+	case SYBDECIMAL:
+	case SYBNUMERIC:
+		/* size, precision and scale */
+		pos += 3;
+		col->kind = POOL_COL_LEN1;
+		break;
+	case XSYBVARBINARY:
+	case XSYBBINARY:
+	case XSYBVARCHAR:
+	case XSYBCHAR:
+	case XSYBNVARCHAR:
+	case XSYBNCHAR:
+		NEED(2);
+		col->kind = (tds72 && TDS_GET_UA2LE(p + pos) == 0xffff) ? POOL_COL_PLP : POOL_COL_LEN2;
+		pos += 2;
+		if (is_collate_type(type))
+			pos += 5;
+		break;
+	case SYBTEXT:
+	case SYBNTEXT:
+	case SYBIMAGE:
+		pos += 4;
+		if (is_collate_type(type))
+			pos += 5;
+		/* table name */
+		n = 1;
+		if (tds72) {
+			NEED(1);
+			n = p[pos++];
+		}
+		for (; n; --n) {
+			NEED(2);
+			pos += 2 + 2 * TDS_GET_UA2LE(p + pos);
+		}
+		col->kind = POOL_COL_TEXT;
+		break;
+	case SYBVARIANT:
+		pos += 4;
+		col->kind = POOL_COL_LEN4;
+		break;
+	case SYBMSXML:
+		NEED(1);
+		if (p[pos++]) {
+			/* database, owner and collection of the schema */
+			NEED(1);
+			pos += 1 + 2 * p[pos];
+			NEED(1);
+			pos += 1 + 2 * p[pos];
+			NEED(2);
+			pos += 2 + 2 * TDS_GET_UA2LE(p + pos);
+		}
+		col->kind = POOL_COL_PLP;
+		break;
+	case SYBMSUDT:
+		pos += 2;
+		/* database, schema and type names */
+		for (n = 0; n < 3; ++n) {
+			NEED(1);
+			pos += 1 + 2 * p[pos];
+		}
+		/* assembly name */
+		NEED(2);
+		pos += 2 + 2 * TDS_GET_UA2LE(p + pos);
+		col->kind = POOL_COL_PLP;
+		break;
+	default:
+		tdsdump_log(TDS_DBG_ERROR, "unknown type %d in response\n", type);
+		return SCAN_ERROR;
+	}
+	NEED(0);
+	return (int) pos;
+#undef NEED
+}
+
+static int
+scan_colmetadata(TDS_POOL_MEMBER *pmbr, const unsigned char *p, size_t avail)
+{
+	TDS_POOL_SCAN *scan = &pmbr->scan;
+	const size_t header = IS_TDS72_PLUS(pmbr->sock.tds->conn) ? 6 : 4;
+	TDS_POOL_COLUMN *columns;
+	unsigned char *nulls;
+	unsigned int num_cols, i;
+	size_t pos = 3;
+	int used;
+
+	if (avail < 3)
+		return SCAN_MORE;
+	num_cols = TDS_GET_UA2LE(p + 1);
+
+	/* no metadata, following rows use previous ones */
+	if (num_cols == 0xffff)
+		return 3;
+
+	columns = tds_new(TDS_POOL_COLUMN, num_cols + 1);
+	nulls = tds_new0(unsigned char, num_cols / 8u + 1);
+	if (!columns || !nulls) {
+		used = SCAN_ERROR;
+		goto error;
+	}
+
+	for (i = 0; i < num_cols; ++i) {
+		/* user type and flags */
+		pos += header;
+		used = scan_type_info(pmbr, p + pos, avail > pos ? avail - pos : 0, &columns[i]);
+		if (used < 0)
+			goto error;
+		pos += used;
+
+		/* column name */
+		if (avail < pos + 1) {
+			used = SCAN_MORE;
+			goto error;
+		}
+		pos += 1 + 2 * p[pos];
+	}
+	if (avail < pos) {
+		used = SCAN_MORE;
+		goto error;
+	}
+
+	free(scan->columns);
+	free(scan->nulls);
+	scan->columns = columns;
+	scan->nulls = nulls;
+	scan->num_columns = num_cols;
+	return (int) pos;
+
+error:
+	free(columns);
+	free(nulls);
+	return used;
+}
+
+/**
+ * Parse start of a column value, value itself is skipped.
+ * @return bytes used or SCAN_MORE, *done is set if value ends
+ */
+static int
+scan_value(TDS_POOL_SCAN *scan, const TDS_POOL_COLUMN *col, const unsigned char *p, size_t avail, bool *done)
+{
+	unsigned int n;
+
+	*done = true;
+
+	/* chunk of a PLP value */
+	if (scan->plp) {
+		if (avail < 4)
+			return SCAN_MORE;
+		n = TDS_GET_UA4LE(p);
+		if (n) {
+			scan->skip = n;
+			*done = false;
+		} else {
+			scan->plp = false;
+		}
+		return 4;
+	}
+
+	switch (col->kind) {
+	case POOL_COL_FIXED:
+		scan->skip = col->size;
+		return 0;
+	case POOL_COL_LEN1:
+		if (avail < 1)
+			return SCAN_MORE;
+		scan->skip = p[0];
+		return 1;
+	case POOL_COL_LEN2:
+		if (avail < 2)
+			return SCAN_MORE;
+		n = TDS_GET_UA2LE(p);
+		if (n != 0xffff)
+			scan->skip = n;
+		return 2;
+	case POOL_COL_LEN4:
+		if (avail < 4)
+			return SCAN_MORE;
+		scan->skip = TDS_GET_UA4LE(p);
+		return 4;
+	case POOL_COL_TEXT:
+		/* text pointer, timestamp and size */
+		if (avail < 1)
+			return SCAN_MORE;
+		if (!p[0])
+			return 1;
+		n = 1 + p[0] + 8;
+		if (avail < n + 4)
+			return SCAN_MORE;
+		scan->skip = TDS_GET_UA4LE(p + n);
+		return n + 4;
+	case POOL_COL_PLP:
+		if (avail < 8)
+			return SCAN_MORE;
+		/* not NULL */
+		if (TDS_GET_UA4LE(p) != 0xffffffffu || TDS_GET_UA4LE(p + 4) != 0xffffffffu) {
+			scan->plp = true;
+			*done = false;
+		}
+		return 8;
+	}
+	return 0;
+}
+
+static void
+scan_start_row(TDS_POOL_SCAN *scan, const TDS_POOL_COLUMN *columns, unsigned int num_columns, bool nbc)
+{
+	if (!num_columns)
+		return;
+	scan->row_columns = columns;
+	scan->row_num_columns = num_columns;
+	scan->row_col = 0;
+	scan->row_nbc = nbc;
+}
+
+/**
+ * Parse next token or next value inside a row.
+ * @return bytes used, SCAN_MORE if more data is needed or SCAN_ERROR
+ */
+static int
+scan_token(TDS_POOL_MEMBER *pmbr, const unsigned char *p, size_t avail)
+{
+	TDS_POOL_SCAN *scan = &pmbr->scan;
+	const bool tds72 = IS_TDS72_PLUS(pmbr->sock.tds->conn);
+	size_t len;
+	int used;
+
+	if (scan->row_columns) {
+		const unsigned int col = scan->row_col;
+		bool done = true;
+
+		used = 0;
+		if (scan->plp || !scan->row_nbc || (scan->nulls[col / 8u] & (1u << (col % 8u))) == 0) {
+			used = scan_value(scan, &scan->row_columns[col], p, avail, &done);
+			if (used < 0)
+				return used;
+		}
+		if (done && ++scan->row_col >= scan->row_num_columns)
+			scan->row_columns = NULL;
+		return used;
+	}
+
+	if (avail < 1)
+		return SCAN_MORE;
+
+	switch (p[0]) {
+	case TDS7_RESULT_TOKEN:
+		return scan_colmetadata(pmbr, p, avail);
+	case TDS_ROW_TOKEN:
+		scan_start_row(scan, scan->columns, scan->num_columns, false);
+		return 1;
+	case TDS_NBC_ROW_TOKEN:
+		len = (scan->num_columns + 7u) / 8u;
+		if (avail < 1 + len)
+			return SCAN_MORE;
+		if (len)
+			memcpy(scan->nulls, p + 1, len);
+		scan_start_row(scan, scan->columns, scan->num_columns, true);
+		return (int) (1 + len);
+	case TDS_PARAM_TOKEN:
+		/* ordinal, name, status, user type and flags */
+		if (avail < 4)
+			return SCAN_MORE;
+		len = 3 + 1 + 2 * p[3] + 1 + (tds72 ? 6 : 4);
+		if (avail < len)
+			return SCAN_MORE;
+		used = scan_type_info(pmbr, p + len, avail - len, &scan->param);
+		if (used < 0)
+			return used;
+		scan_start_row(scan, &scan->param, 1, false);
+		return (int) len + used;
+	case TDS_ENVCHANGE_TOKEN:
+		if (avail < 4)
+			return SCAN_MORE;
+		len = TDS_GET_UA2LE(p + 1);
+		if (len < 1)
+			return SCAN_ERROR;
+		scan_envchange(pmbr, p[3]);
+		scan->skip = len - 1;
+		return 4;
+	case TDS_SESSIONSTATE_TOKEN:
+		if (avail < 5)
+			return SCAN_MORE;
+		pmbr->pinned = true;
+		scan->skip = TDS_GET_UA4LE(p + 1);
+		return 5;
+	case TDS_ERROR_TOKEN:
+		scan->error = true;
+		/* fall through */
+	case TDS_ORDERBY_TOKEN:
+	case TDS_INFO_TOKEN:
+	case TDS_LOGINACK_TOKEN:
+	case TDS_COLINFO_TOKEN:
+	case TDS_TABNAME_TOKEN:
+	case TDS_AUTH_TOKEN:
+		if (avail < 3)
+			return SCAN_MORE;
+		scan->skip = TDS_GET_UA2LE(p + 1);
+		return 3;
+	case TDS_RETURNSTATUS_TOKEN:
+		scan->skip = 4;
+		return 1;
+	case TDS_DONE_TOKEN:
+	case TDS_DONEPROC_TOKEN:
+	case TDS_DONEINPROC_TOKEN:
+		if (avail < 3)
+			return SCAN_MORE;
+		if (TDS_GET_UA2LE(p + 1) & TDS_DONE_ERROR)
+			scan->error = true;
+		scan->skip = tds72 ? 10 : 6;
+		return 3;
+	}
+	tdsdump_log(TDS_DBG_ERROR, "unknown token 0x%02x in response\n", p[0]);
+	return SCAN_ERROR;
+}
+
+/**
+ * Scan data of a response from the member.
+ * @param data packet data, without header
+ */
+void
+pool_session_response(TDS_POOL_MEMBER *pmbr, const unsigned char *data, size_t len)
+{
+	TDS_POOL_SCAN *scan = &pmbr->scan;
+	size_t pos, n;
+	int used;
+
+	while (len && !pmbr->pinned) {
+		/* discard values */
+		if (scan->skip) {
+			n = (size_t) TDS_MIN(scan->skip, (TDS_UINT8) len);
+			scan->skip -= n;
+			data += n;
+			len -= n;
+			continue;
+		}
+
+		if (!scan_append(scan, data, len))
+			goto lost;
+		len = 0;
+
+		for (pos = 0; !pmbr->pinned; pos += used) {
+			if (scan->skip) {
+				n = (size_t) TDS_MIN(scan->skip, (TDS_UINT8) (scan->buf_len - pos));
+				scan->skip -= n;
+				pos += n;
+				if (scan->skip)
+					break;
+			}
+			used = scan_token(pmbr, scan->buf + pos, scan->buf_len - pos);
+			if (used == SCAN_MORE)
+				break;
+			if (used < 0)
+				goto lost;
+		}
+		scan->buf_len -= pos;
+		memmove(scan->buf, scan->buf + pos, scan->buf_len);
+	}
+	return;
+
+lost:
+	tdsdump_log(TDS_DBG_ERROR, "cannot follow member response, pinning\n");
+	pmbr->pinned = true;
+}
+
+static bool
+sql_word_char(char c)
+{
+	return isalnum((unsigned char) c) || c == '_' || c == '@' || c == '#' || c == '$';
+}
+
+/* SET followed by an option, not a variable or a column assignment */
+static bool
+sql_set_option(const char *p, const char *end)
+{
+	while (p < end && isspace((unsigned char) *p))
+		++p;
+	if (p >= end || *p == '@')
+		return false;
+
+	/* column name, possibly qualified */
+	while (p < end && (sql_word_char(*p) || *p == '.' || *p == '[' || *p == ']' || *p == '"'))
+		++p;
+	while (p < end && isspace((unsigned char) *p))
+		++p;
+	if (p < end && *p == '=')
+		return false;
+	/* compound assignment like += */
+	if (p + 1 < end && p[1] == '='
+	    && (*p == '+' || *p == '-' || *p == '*' || *p == '/' || *p == '%' || *p == '&' || *p == '|' || *p == '^'))
+		return false;
+	return true;
+}
+
+/*
+ * Check if SQL changes the session in ways not reported by the server.
+ * This is a conservative check, strings and comments are not skipped.
+ */
+static bool
+sql_changes_session(const char *sql, size_t sql_len)
+{
+	const char *p = sql, *end = sql + sql_len, *word;
+	bool prev_exec = false;
+	size_t len;
+
+#define WORD(s) (len == sizeof(s) - 1 && memcmp(word, s, len) == 0)
+#define PREFIX(s) (len >= sizeof(s) - 1 && memcmp(word, s, sizeof(s) - 1) == 0)
+
+	while (p < end) {
+		if (!sql_word_char(*p)) {
+			++p;
+			continue;
+		}
+		word = p;
+		while (p < end && sql_word_char(*p))
+			++p;
+		len = p - word;
+
+		/* temporary tables and procedures */
+		if (word[0] == '#')
+			return true;
+		if (WORD("SET") && sql_set_option(p, end))
+			return true;
+		if (WORD("CURSOR") || WORD("BULK") || WORD("REVERT") || WORD("SYMMETRIC") || WORD("SP_EXECUTE"))
+			return true;
+		/* EXECUTE AS */
+		if (prev_exec && WORD("AS"))
+			return true;
+		if (PREFIX("SP_PREP") || PREFIX("SP_CURSOR") || PREFIX("SP_UNPREPARE") || PREFIX("SP_SETAPPROLE")
+		    || PREFIX("SP_SET_SESSION_CONTEXT") || PREFIX("SP_GETAPPLOCK"))
+			return true;
+		prev_exec = WORD("EXEC") || WORD("EXECUTE");
+	}
+	return false;
+#undef WORD
+#undef PREFIX
+}
+
+/* append UCS-2 text to the SQL buffer as upper case ASCII */
+static bool
+sql_append(TDS_POOL_SCAN *scan, const unsigned char *p, size_t len)
+{
+	size_t n = len / 2u;
+
+	if (scan->sql_len + n > SCAN_MAX_SQL)
+		return false;
+	if (scan->sql_len + n > scan->sql_size) {
+		size_t size = TDS_MAX(scan->sql_len + n, 256u) * 2u;
+
+		if (!TDS_RESIZE(scan->sql, size))
+			return false;
+		scan->sql_size = size;
+	}
+	for (; n; --n, p += 2) {
+		char c = 'X';
+
+		if (p[1] == 0 && p[0] < 128)
+			c = (char) toupper(p[0]);
+		scan->sql[scan->sql_len++] = c;
+	}
+	return true;
+}
+
+/* size of a parameter value in a RPC request, -1 if not valid */
+static int
+rpc_value_size(const TDS_POOL_COLUMN *col, const unsigned char *p, size_t avail)
+{
+	size_t pos;
+	unsigned int n;
+
+	switch (col->kind) {
+	case POOL_COL_FIXED:
+		pos = col->size;
+		break;
+	case POOL_COL_LEN1:
+		if (avail < 1)
+			return -1;
+		pos = 1 + p[0];
+		break;
+	case POOL_COL_LEN2:
+		if (avail < 2)
+			return -1;
+		n = TDS_GET_UA2LE(p);
+		pos = 2 + (n == 0xffff ? 0 : n);
+		break;
+	case POOL_COL_LEN4:
+		if (avail < 4)
+			return -1;
+		n = TDS_GET_UA4LE(p);
+		if (n > avail - 4)
+			return -1;
+		pos = 4 + n;
+		break;
+	case POOL_COL_PLP:
+		if (avail < 8)
+			return -1;
+		pos = 8;
+		/* NULL */
+		if (TDS_GET_UA4LE(p) == 0xffffffffu && TDS_GET_UA4LE(p + 4) == 0xffffffffu)
+			break;
+		/* chunks, terminated by an empty one */
+		do {
+			if (avail - pos < 4)
+				return -1;
+			n = TDS_GET_UA4LE(p + pos);
+			pos += 4;
+			if (n > avail - pos)
+				return -1;
+			pos += n;
+		} while (n);
+		break;
+	default:
+		return -1;
+	}
+	if (pos > avail)
+		return -1;
+	return (int) pos;
+}
+
+/*
+ * Check all procedures called by a RPC request.
+ * Parameters are parsed only to find the following call, a request
+ * which cannot be parsed is considered as changing the session.
+ */
+static bool
+rpc_changes_session(TDS_POOL_MEMBER *pmbr, const unsigned char *p, size_t len)
+{
+	TDS_POOL_SCAN *scan = &pmbr->scan;
+	const unsigned char *const end = p + len;
+	const bool tds72 = IS_TDS72_PLUS(pmbr->sock.tds->conn);
+	TDS_POOL_COLUMN col;
+	unsigned int n;
+	size_t pos;
+	int used;
+
+	for (;;) {
+		/* procedure name and options */
+		if (end - p < 4)
+			return true;
+		n = TDS_GET_UA2LE(p);
+		p += 2;
+		if (n == 0xffff) {
+			/* well known procedure */
+			if (TDS_GET_UA2LE(p) != TDS_SP_EXECUTESQL)
+				return true;
+			p += 2;
+		} else {
+			scan->sql_len = 0;
+			if ((size_t) (end - p) < n * 2u || !sql_append(scan, p, n * 2u)
+			    || sql_changes_session(scan->sql, scan->sql_len))
+				return true;
+			p += n * 2u;
+		}
+		scan->sql_len = 0;
+		if (end - p < 2)
+			return true;
+		p += 2;
+
+		/* parameters, till end of request or next call */
+		while (p < end && *p != (tds72 ? 0xff : 0x80) && *p != 0xfe) {
+			/* name and status */
+			pos = 1 + 2u * p[0] + 1;
+			if ((size_t) (end - p) <= pos)
+				return true;
+			/* text and UDT types are encoded differently in requests */
+			switch (p[pos]) {
+			case SYBTEXT:
+			case SYBNTEXT:
+			case SYBIMAGE:
+			case SYBMSUDT:
+				return true;
+			}
+			used = scan_type_info(pmbr, p + pos, end - p - pos, &col);
+			if (used < 0)
+				return true;
+			pos += used;
+			used = rpc_value_size(&col, p + pos, end - p - pos);
+			if (used < 0)
+				return true;
+			p += pos + used;
+		}
+		if (p >= end)
+			return false;
+		/* skip batch separator */
+		if (++p >= end)
+			return false;
+	}
+}
+
+/**
+ * Inspect a request packet sent by the user before forwarding it.
+ * @param tds  user socket, packet is in in_buf
+ * @param first  first packet of the request
+ */
+void
+pool_session_request(TDS_POOL_MEMBER *pmbr, TDSSOCKET *tds, bool first)
+{
+	TDS_POOL_SCAN *scan = &pmbr->scan;
+	const unsigned char type = tds->in_buf[0];
+	const unsigned char *p = tds->in_buf + 8, *end = tds->in_buf + tds->in_len;
+
+	if (first && type != TDS_CANCEL) {
+		/* new response will start */
+		scan_reset_response(scan);
+		scan->sql_len = 0;
+	}
+	if (pmbr->pinned)
+		return;
+
+	/* skip ALL_HEADERS */
+	if (first && (type == TDS_QUERY || type == TDS_RPC) && IS_TDS72_PLUS(pmbr->sock.tds->conn)) {
+		if (end - p < 4 || (size_t) (end - p) < TDS_GET_UA4LE(p))
+			goto pin;
+		p += TDS_GET_UA4LE(p);
+	}
+
+	switch (type) {
+	case TDS_QUERY:
+		if (!sql_append(scan, p, end - p))
+			goto pin;
+		if ((tds->in_buf[1] & TDS_STATUS_EOM) == 0)
+			break;
+		if (sql_changes_session(scan->sql, scan->sql_len))
+			goto pin;
+		scan->sql_len = 0;
+		break;
+	case TDS_RPC:
+		/* request can contain more calls, check all when complete */
+		if (!scan_append(scan, p, end - p))
+			goto pin;
+		if ((tds->in_buf[1] & TDS_STATUS_EOM) == 0)
+			break;
+		if (rpc_changes_session(pmbr, scan->buf, scan->buf_len))
+			goto pin;
+		scan->buf_len = 0;
+		break;
+	}
+	return;
+
+pin:
+	tdsdump_log(TDS_DBG_INFO1, "request changes session, pinning\n");
+	pmbr->pinned = true;
+	scan->sql_len = 0;
+	scan->buf_len = 0;
+}
@@ -0,0 +1,172 @@
+/* TDSPool - Connection pooling for TDS based databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Purpose: test users are grouped in classes and waiting ones are
+ * served in proportion to class weights.
+ */
+
+/* allows to use some internal functions */
+#undef NDEBUG
+#include "../user.c"
+
+#include <freetds/utils/test_base.h>
+
+#define NUM_USERS 4
+
+static TDS_POOL pool;
+static TDS_POOL_USER users[NUM_USERS];
+
+static TDS_POOL_CLASS *
+get_class(const char *name)
+{
+	TDS_POOL_CLASS *pclass = pool_class_get(&pool, name);
+
+	assert(pclass);
+	return pclass;
+}
+
+/* clients log in with same login name, other fields differ */
+static void
+test_class_key(void)
+{
+	static const char *const apps[NUM_USERS] = { "app1", "APP1", "app2", "app2" };
+	static const char *const dbs[NUM_USERS] = { "db1", "db2", "db1", "db2" };
+	TDSLOGIN *logins[NUM_USERS];
+	TDS_POOL_CLASS *classes[NUM_USERS];
+	int i;
+
+	for (i = 0; i < NUM_USERS; ++i) {
+		logins[i] = tds_alloc_login(false);
+		assert(logins[i]);
+		assert(tds_dstr_copy(&logins[i]->user_name, "guest"));
+		assert(tds_dstr_copy(&logins[i]->app_name, apps[i]));
+		assert(tds_dstr_copy(&logins[i]->database, dbs[i]));
+		assert(tds_dstr_copy(&logins[i]->client_host_name, "host"));
+	}
+
+	/* application name is the default */
+	for (i = 0; i < NUM_USERS; ++i)
+		classes[i] = get_class(pool_user_class_key(&pool, logins[i]));
+	assert(classes[0] == classes[1] && classes[2] == classes[3] && classes[0] != classes[2]);
+	assert(strcmp(classes[0]->name, "app1") == 0);
+
+	pool.class_by = TDS_POOL_CLASS_DATABASE;
+	for (i = 0; i < NUM_USERS; ++i)
+		classes[i] = get_class(pool_user_class_key(&pool, logins[i]));
+	assert(classes[0] == classes[2] && classes[1] == classes[3] && classes[0] != classes[1]);
+	assert(strcmp(classes[1]->name, "db2") == 0);
+
+	pool.class_by = TDS_POOL_CLASS_HOST;
+	for (i = 0; i < NUM_USERS; ++i)
+		assert(get_class(pool_user_class_key(&pool, logins[i])) == get_class("host"));
+
+	pool.class_by = TDS_POOL_CLASS_APP;
+	for (i = 0; i < NUM_USERS; ++i)
+		tds_free_login(logins[i]);
+}
+
+/*
+ * Grant a member to the next waiter, the member is given back
+ * and the user waits again if "release" is set.
+ */
+static TDS_POOL_USER *
+grant(bool release)
+{
+	TDS_POOL_USER *puser = pool_next_waiter(&pool);
+
+	assert(puser);
+	dlist_user_remove(&pool.waiters, puser);
+	pool_user_granted(&pool, puser);
+	if (release) {
+		puser->pclass->num_members--;
+		dlist_user_append(&pool.waiters, puser);
+	}
+	return puser;
+}
+
+static void
+test_weights(void)
+{
+	TDS_POOL_CLASS *app1 = get_class("app1"), *app2 = get_class("app2");
+	TDS_POOL_USER *puser, *last_app1 = NULL;
+	int i, num_app1 = 0;
+
+	app1->weight = 3;
+	app2->weight = 1;
+	for (i = 0; i < NUM_USERS; ++i) {
+		users[i].pclass = i < NUM_USERS / 2 ? app1 : app2;
+		dlist_user_append(&pool.waiters, &users[i]);
+	}
+
+	/* members are shared in proportion to the weights */
+	for (i = 0; i < 400; ++i) {
+		puser = grant(true);
+		if (puser->pclass != app1)
+			continue;
+		/* users of the same class served in arrival order */
+		assert(puser != last_app1);
+		last_app1 = puser;
+		++num_app1;
+	}
+	assert(num_app1 >= 299 && num_app1 <= 301);
+	assert(app1->num_members == 0 && app2->num_members == 0);
+
+	/* a class with no waiters does not accumulate credit */
+	dlist_user_remove(&pool.waiters, &users[0]);
+	dlist_user_remove(&pool.waiters, &users[1]);
+	for (i = 0; i < 20; ++i)
+		assert(grant(true)->pclass == app2);
+	dlist_user_append(&pool.waiters, &users[0]);
+	dlist_user_append(&pool.waiters, &users[1]);
+	for (num_app1 = 0, i = 0; i < 8; ++i)
+		if (grant(true)->pclass == app1)
+			++num_app1;
+	assert(num_app1 >= 5 && num_app1 <= 7);
+
+	/* a class at "max user conn" is skipped */
+	pool.max_user_conn = 1;
+	puser = grant(false);
+	assert(puser->pclass->num_members == 1);
+	for (i = 0; i < 10; ++i)
+		assert(grant(true)->pclass != puser->pclass);
+	puser->pclass->num_members--;
+	dlist_user_append(&pool.waiters, puser);
+	pool.max_user_conn = 0;
+
+	while (dlist_user_first(&pool.waiters))
+		dlist_user_remove(&pool.waiters, dlist_user_first(&pool.waiters));
+}
+
+TEST_MAIN()
+{
+	TDS_POOL_CLASS *pclass;
+
+	dlist_user_init(&pool.waiters);
+
+	test_class_key();
+	test_weights();
+
+	while ((pclass = pool.classes) != NULL) {
+		pool.classes = pclass->next;
+		free(pclass->name);
+		free(pclass);
+	}
+	return 0;
+}
@@ -0,0 +1,450 @@
+/* TDSPool - Connection pooling for TDS based databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Purpose: test session tracking of transaction pooling.
+ */
+
+/* allows to use some internal functions */
+#undef NDEBUG
+#include "../session.c"
+
+#include <freetds/data.h>
+#include <freetds/utils/test_base.h>
+
+static TDSSOCKET *member_tds, *user_tds;
+static TDS_POOL_MEMBER mbr;
+
+static unsigned char buf[1024];
+static size_t buf_len;
+
+static void
+put(const void *data, size_t len)
+{
+	assert(buf_len + len <= sizeof(buf));
+	memcpy(buf + buf_len, data, len);
+	buf_len += len;
+}
+
+static void
+put_byte(unsigned char b)
+{
+	put(&b, 1);
+}
+
+static void
+put_smallint(unsigned int n)
+{
+	unsigned char p[2];
+
+	TDS_PUT_UA2LE(p, n);
+	put(p, 2);
+}
+
+static void
+put_int(TDS_UINT n)
+{
+	unsigned char p[4];
+
+	TDS_PUT_UA4LE(p, n);
+	put(p, 4);
+}
+
+static void
+put_ucs2(const char *s)
+{
+	for (; *s; ++s)
+		put_smallint((unsigned char) *s);
+}
+
+static void
+put_done(unsigned int status)
+{
+	put_byte(TDS_DONE_TOKEN);
+	put_smallint(status);
+	put_smallint(0);
+	put_int(0);
+	put_int(0);
+}
+
+static void
+put_envchange_tran(unsigned char type)
+{
+	static const unsigned char tran_id[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+	put_byte(TDS_ENVCHANGE_TOKEN);
+	put_smallint(11);
+	put_byte(type);
+	if (type == TDS_ENV_BEGINTRANS) {
+		put_byte(8);
+		put(tran_id, 8);
+		put_byte(0);
+	} else {
+		put_byte(0);
+		put_byte(8);
+		put(tran_id, 8);
+	}
+}
+
+static void
+reset_member(void)
+{
+	pool_session_reset(&mbr);
+	buf_len = 0;
+}
+
+/* feed response in buf to the scanner, split in chunks of given size */
+static void
+feed_response(size_t chunk)
+{
+	size_t pos, n;
+
+	for (pos = 0; pos < buf_len; pos += n) {
+		n = TDS_MIN(chunk, buf_len - pos);
+		pool_session_response(&mbr, buf + pos, n);
+	}
+}
+
+/* SQL must be upper case, as collected from requests */
+static void
+test_sql(void)
+{
+#define CHECK(sql, res) assert(sql_changes_session(sql, strlen(sql)) == res)
+	CHECK("SELECT * FROM T", false);
+	CHECK("SET NOCOUNT ON", true);
+	CHECK("SET   TRANSACTION ISOLATION LEVEL SERIALIZABLE", true);
+	CHECK("UPDATE T SET A = 1 WHERE B = 2", false);
+	CHECK("UPDATE T SET T.A=1, B = 2", false);
+	CHECK("UPDATE T SET [A] += 1", false);
+	CHECK("DECLARE @X INT SET @X = 1", false);
+	CHECK("CREATE TABLE #T (A INT)", true);
+	CHECK("SELECT * INTO #T FROM T", true);
+	CHECK("EXECUTE AS USER = 'GUEST'", true);
+	CHECK("EXEC AS LOGIN = 'SA'", true);
+	CHECK("EXEC SP_HELP", false);
+	CHECK("EXEC SP_PREPARE @H OUTPUT, NULL, N'SELECT 1'", true);
+	CHECK("DECLARE C CURSOR FOR SELECT 1", true);
+	CHECK("REVERT", true);
+#undef CHECK
+}
+
+/* build a request packet in user socket */
+static void
+set_packet(unsigned char type, bool eom, bool headers, const unsigned char *data, size_t len)
+{
+	unsigned char *p = user_tds->in_buf;
+	size_t pos = 8;
+
+	if (headers) {
+		TDS_PUT_UA4LE(p + pos, 4);
+		pos += 4;
+	}
+	assert(pos + len <= user_tds->recv_packet->capacity);
+	memcpy(p + pos, data, len);
+	pos += len;
+	p[0] = type;
+	p[1] = eom ? TDS_STATUS_EOM : 0;
+	TDS_PUT_UA2BE(p + 2, pos);
+	TDS_PUT_UA4LE(p + 4, 0);
+	user_tds->in_len = (unsigned int) pos;
+	user_tds->in_pos = 0;
+}
+
+/* send a SQL batch in the given number of packets */
+static bool
+query_pins(const char *sql, unsigned int packets)
+{
+	size_t len, part, pos = 0;
+	unsigned int i;
+
+	reset_member();
+	put_ucs2(sql);
+	len = buf_len;
+	for (i = 0; i < packets; ++i) {
+		part = i + 1 == packets ? len - pos : len / packets / 2u * 2u;
+		set_packet(TDS_QUERY, i + 1 == packets, i == 0, buf + pos, part);
+		pool_session_request(&mbr, user_tds, i == 0);
+		pos += part;
+	}
+	return mbr.pinned;
+}
+
+static void
+test_batch(void)
+{
+	assert(!query_pins("select 1", 1));
+	assert(query_pins("set nocount on", 1));
+	assert(!query_pins("update t set a = 1", 1));
+	assert(query_pins("create table #t(a int)", 1));
+	assert(query_pins("execute as user = 'guest'", 1));
+
+	/* statement split across packets */
+	assert(query_pins("select 1 set ansi_nulls off", 2));
+	assert(!query_pins("update t set a = 1 where b = 2", 3));
+	assert(query_pins("select a, b, c into #tmp from t", 3));
+}
+
+/* RPC call, parameters are an INT, a NVARCHAR and a NVARCHAR(MAX) */
+static void
+put_rpc(const char *name)
+{
+	static const unsigned char collation[5] = { 0x09, 0x04, 0xd0, 0x00, 0x34 };
+
+	if (name) {
+		put_smallint((unsigned int) strlen(name));
+		put_ucs2(name);
+	} else {
+		put_smallint(0xffff);
+		put_smallint(TDS_SP_EXECUTESQL);
+	}
+	put_smallint(0);
+
+	put_byte(2);
+	put_ucs2("@a");
+	put_byte(0);
+	put_byte(SYBINTN);
+	put_byte(4);
+	put_byte(4);
+	put_int(123);
+
+	put_byte(2);
+	put_ucs2("@b");
+	put_byte(0);
+	put_byte(XSYBNVARCHAR);
+	put_smallint(40);
+	put(collation, 5);
+	put_smallint(8);
+	put_ucs2("test");
+
+	put_byte(2);
+	put_ucs2("@c");
+	put_byte(0);
+	put_byte(XSYBNVARCHAR);
+	put_smallint(0xffff);
+	put(collation, 5);
+	put_int(10);
+	put_int(0);
+	put_int(4);
+	put_ucs2("ab");
+	put_int(6);
+	put_ucs2("cde");
+	put_int(0);
+}
+
+static bool
+rpc_pins(unsigned int packets)
+{
+	size_t len = buf_len, part, pos = 0;
+	unsigned int i;
+
+	for (i = 0; i < packets; ++i) {
+		part = i + 1 == packets ? len - pos : len / packets;
+		set_packet(TDS_RPC, i + 1 == packets, i == 0, buf + pos, part);
+		pool_session_request(&mbr, user_tds, i == 0);
+		pos += part;
+	}
+	/* request data must not be left for response */
+	assert(mbr.pinned || mbr.scan.buf_len == 0);
+	return mbr.pinned;
+}
+
+static void
+test_rpc(void)
+{
+	reset_member();
+	put_rpc(NULL);
+	assert(!rpc_pins(1));
+
+	reset_member();
+	put_rpc("my_proc");
+	assert(!rpc_pins(1));
+
+	reset_member();
+	put_rpc("sp_prepare");
+	assert(rpc_pins(1));
+
+	/* every call of the request is checked */
+	reset_member();
+	put_rpc("my_proc");
+	put_byte(0xff);
+	put_rpc("sp_prepare");
+	assert(rpc_pins(1));
+
+	reset_member();
+	put_rpc("my_proc");
+	put_byte(0xff);
+	put_rpc(NULL);
+	put_byte(0xff);
+	put_rpc("other_proc");
+	assert(!rpc_pins(1));
+
+	/* calls split across packets */
+	reset_member();
+	put_rpc("my_proc");
+	put_byte(0xff);
+	put_rpc("sp_cursoropen");
+	assert(rpc_pins(3));
+
+	reset_member();
+	put_rpc(NULL);
+	put_byte(0xff);
+	put_rpc("my_proc");
+	assert(!rpc_pins(4));
+
+	/* truncated request cannot be checked */
+	reset_member();
+	put_rpc("my_proc");
+	buf_len -= 3;
+	assert(rpc_pins(1));
+}
+
+/* result with INT, NVARCHAR(MAX) and INTN columns */
+static void
+put_result(void)
+{
+	static const unsigned char collation[5] = { 0x09, 0x04, 0xd0, 0x00, 0x34 };
+
+	put_byte(TDS7_RESULT_TOKEN);
+	put_smallint(3);
+
+	put_int(0);
+	put_smallint(0);
+	put_byte(SYBINT4);
+	put_byte(1);
+	put_ucs2("i");
+
+	put_int(0);
+	put_smallint(1);
+	put_byte(XSYBNVARCHAR);
+	put_smallint(0xffff);
+	put(collation, 5);
+	put_byte(1);
+	put_ucs2("s");
+
+	put_int(0);
+	put_smallint(1);
+	put_byte(SYBINTN);
+	put_byte(4);
+	put_byte(1);
+	put_ucs2("n");
+
+	/* row, text value in PLP chunks */
+	put_byte(TDS_ROW_TOKEN);
+	put_int(1);
+	put_int(0xfffffffeu);
+	put_int(0xfffffffeu);
+	put_int(4);
+	put_ucs2("ab");
+	/* data looking like tokens */
+	put_int(4);
+	put_byte(TDS_ENVCHANGE_TOKEN);
+	put_byte(TDS_ENV_DATABASE);
+	put_byte(TDS_ENVCHANGE_TOKEN);
+	put_byte(TDS_ENV_BEGINTRANS);
+	put_int(0);
+	put_byte(4);
+	put_int(2);
+
+	/* NBC row, NULL text */
+	put_byte(TDS_NBC_ROW_TOKEN);
+	put_byte(0x02);
+	put_int(TDS_ENVCHANGE_TOKEN);
+	put_byte(4);
+	put_int(TDS_ENV_DATABASE);
+
+	/* NBC row, all NULLs but first */
+	put_byte(TDS_NBC_ROW_TOKEN);
+	put_byte(0x06);
+	put_int(3);
+
+	/* row with NULL text */
+	put_byte(TDS_ROW_TOKEN);
+	put_int(4);
+	put_int(0xffffffffu);
+	put_int(0xffffffffu);
+	put_byte(0);
+
+	put_done(TDS_DONE_COUNT);
+}
+
+static void
+test_response(void)
+{
+	static const size_t chunks[] = { 1, 2, 3, 7, 64, sizeof(buf) };
+	size_t i;
+
+	for (i = 0; i < TDS_VECTOR_SIZE(chunks); ++i) {
+		/* transaction started */
+		reset_member();
+		put_result();
+		put_envchange_tran(TDS_ENV_BEGINTRANS);
+		put_done(TDS_DONE_FINAL);
+		feed_response(chunks[i]);
+		assert(!mbr.pinned);
+		assert(mbr.in_tran);
+
+		/* and committed */
+		buf_len = 0;
+		put_envchange_tran(TDS_ENV_COMMITTRANS);
+		put_result();
+		put_done(TDS_DONE_FINAL);
+		feed_response(chunks[i]);
+		assert(!mbr.pinned);
+		assert(!mbr.in_tran);
+
+		/* database changed */
+		reset_member();
+		put_result();
+		put_byte(TDS_ENVCHANGE_TOKEN);
+		put_smallint(1 + 1 + 2 * 3 + 1 + 2 * 6);
+		put_byte(TDS_ENV_DATABASE);
+		put_byte(3);
+		put_ucs2("db1");
+		put_byte(6);
+		put_ucs2("master");
+		put_done(TDS_DONE_FINAL);
+		feed_response(chunks[i]);
+		assert(mbr.pinned);
+	}
+}
+
+TEST_MAIN()
+{
+	TDSCONTEXT *ctx;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	member_tds = tds_alloc_socket(ctx, 512);
+	user_tds = tds_alloc_socket(ctx, 512);
+	assert(member_tds && user_tds);
+	member_tds->conn->tds_version = 0x704;
+	user_tds->conn->tds_version = 0x704;
+	mbr.sock.tds = member_tds;
+
+	test_sql();
+	test_batch();
+	test_rpc();
+	test_response();
+
+	pool_session_reset(&mbr);
+	tds_free_socket(user_tds);
+	tds_free_socket(member_tds);
+	tds_free_context(ctx);
+	return 0;
+}
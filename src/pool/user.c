@@ -49,29 +49,35 @@
 #include <freetds/utils/string.h>
 
 static TDS_POOL_USER *pool_user_find_new(TDS_POOL * pool);
-static bool pool_user_login(TDS_POOL * pool, TDS_POOL_USER * puser);
+static TDS_POOL *pool_user_login(TDS_POOL * pool, TDS_POOL_USER * puser);
 static bool pool_user_read(TDS_POOL * pool, TDS_POOL_USER * puser);
 static void login_execute(TDS_POOL_EVENT *base_event);
 static void end_login_execute(TDS_POOL_EVENT *base_event);
+static void pool_user_reject(TDS_POOL * pool, TDS_POOL_USER * puser, const char *msg);
+static const char *pool_user_class_key(TDS_POOL * pool, TDSLOGIN * login);
 
 void
 pool_user_init(TDS_POOL * pool)
 {
 	dlist_user_init(&pool->users);
 	dlist_user_init(&pool->waiters);
-	pool->ctx = tds_alloc_context(NULL);
 }
 
 void
 pool_user_destroy(TDS_POOL * pool)
 {
+	TDS_POOL_CLASS *pclass;
+
 	while (dlist_user_first(&pool->users))
 		pool_free_user(pool, dlist_user_first(&pool->users));
 	while (dlist_user_first(&pool->waiters))
 		pool_free_user(pool, dlist_user_first(&pool->waiters));
 
-	tds_free_context(pool->ctx);
-	pool->ctx = NULL;
+	while ((pclass = pool->classes) != NULL) {
+		pool->classes = pclass->next;
+		free(pclass->name);
+		free(pclass);
+	}
 }
 
 static TDS_POOL_USER *
@@ -91,8 +97,10 @@ pool_user_find_new(TDS_POOL * pool)
 		return NULL;
 	}
 
+	tds_mutex_lock(&pool->mtx);
 	dlist_user_append(&pool->users, puser);
 	pool->num_users++;
+	tds_mutex_unlock(&pool->mtx);
 
 	return puser;
 }
@@ -100,17 +108,19 @@ pool_user_find_new(TDS_POOL * pool)
 typedef struct {
 	TDS_POOL_EVENT common;
 	TDS_POOL *pool;
+	TDS_POOL_WORKER *worker;
 	TDS_POOL_USER *puser;
-	bool success;
+	/** pool serving the user, NULL if login failed */
+	TDS_POOL *login_pool;
 } LOGIN_EVENT;
 
 static TDS_THREAD_PROC_DECLARE(login_proc, arg)
 {
 	LOGIN_EVENT *ev = (LOGIN_EVENT *) arg;
 
-	ev->success = pool_user_login(ev->pool, ev->puser);
+	ev->login_pool = pool_user_login(ev->pool, ev->puser);
 
-	pool_event_add(ev->pool, &ev->common, login_execute);
+	pool_event_add(ev->worker, &ev->common, login_execute);
 	return TDS_THREAD_RESULT(0);
 }
 
@@ -121,17 +131,48 @@ login_execute(TDS_POOL_EVENT *base_event)
 	TDS_POOL_USER *puser = ev->puser;
 	TDS_POOL *pool = ev->pool;
 
-	if (!ev->success) {
+	if (!ev->login_pool) {
 		/* login failed...free socket */
 		pool_free_user(pool, puser);
 		return;
 	}
 
-	puser->sock.poll_recv = true;
+	/* user accepted on a port shared with other pools */
+	if (ev->login_pool != pool) {
+		tds_mutex_lock(&pool->mtx);
+		dlist_user_remove(&pool->users, puser);
+		pool->num_users--;
+		tds_mutex_unlock(&pool->mtx);
+
+		pool = ev->login_pool;
+		puser->sock.pool = pool;
+		tds_mutex_lock(&pool->mtx);
+		dlist_user_append(&pool->users, puser);
+		pool->num_users++;
+		tds_mutex_unlock(&pool->mtx);
+	}
+
+	if (!pool_socket_register(ev->worker, &puser->sock)) {
+		pool_free_user(pool, puser);
+		return;
+	}
+	pool_socket_poll(&puser->sock, true, false);
+
+	/* statistics requested, no member needed */
+	if (strcasecmp(tds_dstr_cstr(&puser->login->database), POOL_ADMIN_DATABASE) == 0) {
+		if (!pool_admin_login(pool, puser))
+			pool_free_user(pool, puser);
+		return;
+	}
+
+	tds_mutex_lock(&pool->mtx);
+	puser->pclass = pool_class_get(pool, pool_user_class_key(pool, puser->login));
+	tds_mutex_unlock(&pool->mtx);
 
 	/* try to assign a member, connection can have transactions
 	 * and so on so deassign only when disconnected */
-	pool_user_query(pool, puser);
+	if (!pool_user_query(pool, puser))
+		return;
 
 	tdsdump_log(TDS_DBG_INFO1, "user state %d\n", puser->user_state);
 
@@ -172,7 +213,7 @@ pool_user_create(TDS_POOL * pool, TDS_SYS_SOCKET s)
 		return NULL;
 	}
 
-	tds = tds_alloc_socket(pool->ctx, BLOCKSIZ);
+	tds = tds_alloc_socket(pool->set->ctx, BLOCKSIZ);
 	if (!tds) {
 		CLOSESOCKET(fd);
 		return NULL;
@@ -189,13 +230,15 @@ pool_user_create(TDS_POOL * pool, TDS_SYS_SOCKET s)
 	tds->out_flag = TDS_LOGIN;
 
 	puser->sock.tds = tds;
+	puser->sock.pool = pool;
 	puser->user_state = TDS_SRV_QUERY;
-	puser->sock.poll_recv = false;
-	puser->sock.poll_send = false;
+	pool_socket_poll(&puser->sock, false, false);
 
-	/* launch login asyncronously */
+	/* launch login asyncronously, user will be handled by next worker */
 	ev->puser = puser;
 	ev->pool = pool;
+	ev->worker = &pool->set->workers[pool->set->next_worker];
+	pool->set->next_worker = (pool->set->next_worker + 1) % pool->set->num_workers;
 
 	if (tds_thread_create_detached(login_proc, ev) != 0) {
 		pool_free_user(pool, puser);
@@ -216,59 +259,83 @@ pool_free_user(TDS_POOL *pool, TDS_POOL_USER * puser)
 	TDS_POOL_MEMBER *pmbr = puser->assigned_member;
 	if (pmbr) {
 		assert(pmbr->current_user == puser);
-		pool_deassign_member(pool, pmbr);
+		pool_unlink_member(pool, pmbr);
 		pool_reset_member(pool, pmbr);
 	}
 
+	pool_socket_unregister(&puser->sock);
 	tds_free_socket(puser->sock.tds);
 	tds_free_login(puser->login);
 
 	/* make sure to decrement the waiters list if he is waiting */
-	if (puser->user_state == TDS_SRV_WAIT)
+	tds_mutex_lock(&pool->mtx);
+	if (puser->user_state == TDS_SRV_WAIT) {
 		dlist_user_remove(&pool->waiters, puser);
-	else
+		pool->num_waiters--;
+	} else
 		dlist_user_remove(&pool->users, puser);
 	pool->num_users--;
+	tds_mutex_unlock(&pool->mtx);
+	pool_cache_user_free(pool, puser);
 	free(puser);
 }
 
 /* 
- * pool_process_users
- * check the fd_set for user input, allocate a pool member to it, and forward
- * the query to that member.
+ * pool_process_user
+ * handle user input, forward the query to the assigned member.
  */
 void
-pool_process_users(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds)
+pool_process_user(TDS_POOL * pool, TDS_POOL_USER * puser, short revents)
 {
-	TDS_POOL_USER *puser, *next;
-	short revents;
-
-	for (next = dlist_user_first(&pool->users); (puser = next) != NULL; ) {
-
-		next = dlist_user_next(&pool->users, puser);
-
-		if (!puser->sock.tds || puser->sock.poll_index >= num_fds)
-			continue;	/* dead connection */
-
-		revents = fds[puser->sock.poll_index].revents;
+	if (puser->sock.poll_recv && (revents & (POLLIN|POLLHUP)) != 0) {
+		assert(puser->user_state == TDS_SRV_QUERY);
+		if (!pool_user_read(pool, puser))
+			return;
+	}
+	if (puser->sock.poll_send && (revents & POLLOUT) != 0) {
+		if (puser->cache_reply)
+			pool_cache_reply(pool, puser);
+		else if (!pool_write_data(&puser->assigned_member->sock, &puser->sock))
+			pool_free_member(pool, puser->assigned_member);
+		else
+			pool_release_member(pool, puser->assigned_member);
+	}
+}
 
-		if (puser->sock.poll_recv && (revents & (POLLIN|POLLHUP)) != 0) {
-			assert(puser->user_state == TDS_SRV_QUERY);
-			if (!pool_user_read(pool, puser))
-				continue;
-		}
-		if (puser->sock.poll_send && (revents & POLLOUT) != 0) {
-			if (!pool_write_data(&puser->assigned_member->sock, &puser->sock))
-				pool_free_member(pool, puser->assigned_member);
-		}
-	}			/* for */
+/*
+ * pool_user_route
+ * choose the pool serving a login among the ones sharing the port
+ * of the pool that accepted the user: first the pool whose name or
+ * database is the login database, then the pool named as the login
+ * application. Defaults to the accepting pool.
+ */
+static TDS_POOL *
+pool_user_route(TDS_POOL * pool, TDSLOGIN * login)
+{
+	const char *database = tds_dstr_cstr(&login->database);
+	const char *app_name = tds_dstr_cstr(&login->app_name);
+	TDS_POOL *p;
+
+	for (p = pool->set->pools; p; p = p->next) {
+		if (p->port != pool->port || !database[0])
+			continue;
+		if (strcasecmp(p->name, database) == 0
+		    || (p->database && strcasecmp(p->database, database) == 0))
+			return p;
+	}
+	for (p = pool->set->pools; p; p = p->next) {
+		if (p->port == pool->port && app_name[0] && strcasecmp(p->name, app_name) == 0)
+			return p;
+	}
+	return pool;
 }
 
 /*
  * pool_user_login
  * Reads clients login packet and forges a login acknowledgement sequence 
+ * Returns pool serving the user, NULL on failure.
  */
-static bool
+static TDS_POOL *
 pool_user_login(TDS_POOL * pool, TDS_POOL_USER * puser)
 {
 	TDSSOCKET *tds;
@@ -277,7 +344,7 @@ pool_user_login(TDS_POOL * pool, TDS_POOL_USER * puser)
 	tds = puser->sock.tds;
 	while (tds->in_len <= tds->in_pos)
 		if (tds_read_packet(tds) < 0)
-			return false;
+			return NULL;
 
 	tdsdump_log(TDS_DBG_NETWORK, "got packet type %d\n", tds->in_flag);
 	if (tds->in_flag == TDS71_PRELOGIN) {
@@ -303,13 +370,13 @@ pool_user_login(TDS_POOL * pool, TDS_POOL_USER * puser)
 		tds->in_pos = tds->in_len;
 		while (tds->in_len <= tds->in_pos)
 			if (tds_read_packet(tds) < 0)
-				return false;
+				return NULL;
 	}
 
 	puser->login = login = tds_alloc_login(true);
 	if (!login) {
 		tdsdump_log(TDS_DBG_ERROR, "tds_alloc_login() failed.\n");
-		return false;
+		return NULL;
 	}
 	if (tds->in_flag == TDS_LOGIN) {
 		if (!tds->conn->tds_version)
@@ -319,25 +386,26 @@ pool_user_login(TDS_POOL * pool, TDS_POOL_USER * puser)
 		if (!tds->conn->tds_version)
 			tds->conn->tds_version = 0x700;
 		if (!tds7_read_login(tds, login))
-			return false;
+			return NULL;
 	} else {
-		return false;
+		return NULL;
 	}
 
 	/* check we support version required */
 	// TODO function to check it
 	if (!IS_TDS71_PLUS(login))
-		return false;
+		return NULL;
 
 	tds->in_len = tds->in_pos = 0;
 
 	dump_login(login);
+	pool = pool_user_route(pool, login);
 	if (strcmp(tds_dstr_cstr(&login->user_name), pool->user) != 0
 	    || strcmp(tds_dstr_cstr(&login->password), pool->password) != 0)
 		/* TODO send nack before exiting */
-		return false;
+		return NULL;
 
-	return true;
+	return pool;
 }
 
 bool
@@ -351,7 +419,9 @@ pool_user_send_login_ack(TDS_POOL * pool, TDS_POOL_USER * puser)
 	const char *server = mtds->conn->server ? mtds->conn->server : "JDBC";
 	bool dbname_mismatch, odbc_mismatch;
 
+	tds_mutex_lock(&pool->mtx);
 	pool->user_logins++;
+	tds_mutex_unlock(&pool->mtx);
 
 	/* copy a bit of information, resize socket with block */
 	tds->conn->tds_version = mtds->conn->tds_version;
@@ -385,10 +455,24 @@ pool_user_send_login_ack(TDS_POOL * pool, TDS_POOL_USER * puser)
 			strcat(str, "USE ");
 			tds_quote_id(mtds, strchr(str, 0), tds_dstr_cstr(&login->database), -1);
 		}
-		ret = tds_submit_query(mtds, str);
+		if (puser->assigned_member->reset_pending) {
+			/* reset session of previous user with this query */
+			ret = TDS_FAIL;
+			if (tds_set_state(mtds, TDS_WRITING) == TDS_WRITING) {
+				tds_start_query(mtds, TDS_QUERY);
+				tds_put_string(mtds, str, -1);
+				ret = tds_write_packet(mtds, TDS_STATUS_EOM | TDS_STATUS_RESETCONNECTION);
+				tds_set_state(mtds, TDS_PENDING);
+				puser->assigned_member->reset_pending = false;
+			}
+		} else {
+			ret = tds_submit_query(mtds, str);
+		}
 		free(str);
 		if (TDS_FAILED(ret) || TDS_FAILED(tds_process_simple_query(mtds)))
 			return false;
+		/* session differs from other ones */
+		puser->assigned_member->pinned = true;
 		if (dbname_mismatch)
 			database = tds_dstr_cstr(&login->database);
 		else
@@ -459,6 +543,26 @@ pool_user_read(TDS_POOL * pool, TDS_POOL_USER * puser)
 	TDSSOCKET *tds = puser->sock.tds;
 	TDS_POOL_MEMBER *pmbr = NULL;
 
+	if (puser->admin)
+		return pool_admin_read(pool, puser);
+
+	/* member released after last batch, get another one */
+	if (!puser->assigned_member) {
+		/* request could be answered by the result cache */
+		if (pool->num_cache_queries) {
+			if (pool_packet_read(tds))
+				return true;
+			if (tds->in_len == 0) {
+				tdsdump_log(TDS_DBG_INFO1, "user disconnected\n");
+				pool_free_user(pool, puser);
+				return false;
+			}
+			if (pool_cache_request(pool, puser))
+				return pool_cache_reply(pool, puser);
+		}
+		return pool_user_query(pool, puser);
+	}
+
 	for (;;) {
 		TDS_UCHAR in_flag;
 
@@ -480,11 +584,24 @@ pool_user_read(TDS_POOL * pool, TDS_POOL_USER * puser)
 		case TDS_BULK:
 		case TDS_CANCEL:
 		case TDS7_TRANS:
-			if (!pool_write_data(&puser->sock, &puser->assigned_member->sock)) {
-				pool_reset_member(pool, puser->assigned_member);
+			pmbr = puser->assigned_member;
+			/* reset session of previous user with first request */
+			if (pmbr->reset_pending && !pmbr->busy && tds->in_pos == 0
+			    && (in_flag == TDS_QUERY || in_flag == TDS_RPC || in_flag == TDS7_TRANS)) {
+				tds->in_buf[1] |= TDS_STATUS_RESETCONNECTION;
+				pmbr->reset_pending = false;
+			}
+			if (pool->mode == TDS_POOL_TRANSACTION && tds->in_pos == 0) {
+				pool_session_request(pmbr, tds, !pmbr->busy);
+				pool_cache_forward(puser, tds);
+			}
+			if (in_flag == TDS_CANCEL)
+				pmbr->cancelling = true;
+			pmbr->busy = true;
+			if (!pool_write_data(&puser->sock, &pmbr->sock)) {
+				pool_reset_member(pool, pmbr);
 				return false;
 			}
-			pmbr = puser->assigned_member;
 			break;
 
 		default:
@@ -501,35 +618,251 @@ pool_user_read(TDS_POOL * pool, TDS_POOL_USER * puser)
 	return true;
 }
 
+/**
+ * Login field used to group users in classes.
+ */
+static const char *
+pool_user_class_key(TDS_POOL * pool, TDSLOGIN * login)
+{
+	switch (pool->class_by) {
+	case TDS_POOL_CLASS_DATABASE:
+		return tds_dstr_cstr(&login->database);
+	case TDS_POOL_CLASS_HOST:
+		return tds_dstr_cstr(&login->client_host_name);
+	case TDS_POOL_CLASS_APP:
+		break;
+	}
+	return tds_dstr_cstr(&login->app_name);
+}
+
+/**
+ * Find or create the class with a given name.
+ * Pool lock must be held.
+ * @return NULL on memory error
+ */
+TDS_POOL_CLASS *
+pool_class_get(TDS_POOL * pool, const char *name)
+{
+	TDS_POOL_CLASS *pclass;
+
+	for (pclass = pool->classes; pclass; pclass = pclass->next)
+		if (strcasecmp(pclass->name, name) == 0)
+			return pclass;
+
+	pclass = tds_new0(TDS_POOL_CLASS, 1);
+	if (!pclass)
+		return NULL;
+	pclass->name = strdup(name);
+	if (!pclass->name) {
+		free(pclass);
+		return NULL;
+	}
+	pclass->weight = 1;
+	pclass->next = pool->classes;
+	pool->classes = pclass;
+	return pclass;
+}
+
+/**
+ * Account a member given to a user.
+ * Pool lock must be held.
+ */
 void
+pool_user_granted(TDS_POOL * pool, TDS_POOL_USER * puser)
+{
+	TDS_POOL_CLASS *pclass = puser->pclass;
+
+	pool_admin_wait_time(pool, puser->wait_tm ? tds_gettime_ms() - puser->wait_ms : 0);
+	puser->wait_tm = 0;
+	pool->grants++;
+	if (!pclass)
+		return;
+
+	pclass->num_members++;
+	/* classes not asking for members do not accumulate credit */
+	if (pclass->pass < pool->pass)
+		pclass->pass = pool->pass;
+	pool->pass = pclass->pass;
+	pclass->pass += POOL_STRIDE / pclass->weight;
+}
+
+/**
+ * Send an error to a user and disconnect it.
+ */
+static void
+pool_user_reject(TDS_POOL * pool, TDS_POOL_USER * puser, const char *msg)
+{
+	TDSSOCKET *tds = puser->sock.tds;
+
+	tdsdump_log(TDS_DBG_INFO1, "rejecting user: %s\n", msg);
+	fprintf(stderr, "%s\n", msg);
+
+	tds->out_flag = TDS_REPLY;
+	tds_send_err(tds, 17809, 1, 20, msg, pool->name, NULL, 1);
+	tds_send_done_token(tds, TDS_DONE_ERROR, 0);
+	tds_flush_packet(tds);
+
+	pool_free_user(pool, puser);
+}
+
+/**
+ * Get a member for the user or place it in wait state.
+ * @return false if user was disconnected
+ */
+bool
 pool_user_query(TDS_POOL * pool, TDS_POOL_USER * puser)
 {
-	TDS_POOL_MEMBER *pmbr;
+	TDS_POOL_MEMBER *pmbr = NULL;
+	bool queued;
 
 	tdsdump_log(TDS_DBG_FUNC, "pool_user_query\n");
 
 	assert(puser->assigned_member == NULL);
-	assert(puser->login);
 
 	puser->user_state = TDS_SRV_QUERY;
-	pmbr = pool_assign_idle_member(pool, puser);
+
+	/* do not overtake users already waiting */
+	tds_mutex_lock(&pool->mtx);
+	queued = !puser->wait_tm && dlist_user_first(&pool->waiters) != NULL;
+	tds_mutex_unlock(&pool->mtx);
+
+	if (!queued)
+		pmbr = pool_assign_idle_member(pool, puser);
 	if (!pmbr) {
 		/*
 		 * put into wait state
 		 * check when member is deallocated
 		 */
+		pool_socket_poll(&puser->sock, false, false);
+		tds_mutex_lock(&pool->mtx);
+		if (pool->max_waiters && pool->num_waiters >= pool->max_waiters) {
+			tds_mutex_unlock(&pool->mtx);
+			pool_user_reject(pool, puser, "Too many users waiting for a connection, increase \"max waiters\"");
+			return false;
+		}
 		tdsdump_log(TDS_DBG_INFO1, "Not enough free members...placing user in WAIT\n");
 		puser->user_state = TDS_SRV_WAIT;
-		puser->sock.poll_recv = false;
-		puser->sock.poll_send = false;
+		if (!puser->wait_tm) {
+			puser->wait_tm = time(NULL);
+			puser->wait_ms = tds_gettime_ms();
+		}
 		dlist_user_remove(&pool->users, puser);
 		dlist_user_append(&pool->waiters, puser);
+		pool->num_waiters++;
+		tds_mutex_unlock(&pool->mtx);
+		return true;
+	}
+
+	/* logged in user needs the member for a new request, forward it */
+	if (!puser->login && !pmbr->doing_async) {
+		pool_socket_poll(&pmbr->sock, true, false);
+		puser->sock.revents |= POLLIN;
+		pool_socket_poll(&puser->sock, true, false);
+	}
+	return true;
+}
+
+/**
+ * Choose next waiting user to serve, the one whose class has
+ * the lower virtual time, in arrival order for equal times.
+ * Pool lock must be held.
+ */
+static TDS_POOL_USER *
+pool_next_waiter(TDS_POOL * pool)
+{
+	TDS_POOL_USER *puser, *best = NULL;
+	TDS_UINT8 pass, best_pass = 0;
+
+	DLIST_FOREACH(dlist_user, &pool->waiters, puser) {
+		TDS_POOL_CLASS *pclass = puser->pclass;
+
+		pass = pool->pass;
+		if (pclass) {
+			if (pool->max_user_conn && pclass->num_members >= pool->max_user_conn)
+				continue;
+			pass = TDS_MAX(pclass->pass, pool->pass);
+		}
+		if (!best || pass < best_pass) {
+			best = puser;
+			best_pass = pass;
+		}
+	}
+	return best;
+}
+
+/**
+ * Assign free members to users of the worker waiting for them.
+ * The worker of the next user to serve is woken up if different.
+ * Users waiting more than "wait timeout" are disconnected.
+ * @return seconds till next wait timeout, -1 for infinite
+ */
+int
+pool_schedule_waiters(TDS_POOL * pool, TDS_POOL_WORKER * worker)
+{
+	TDS_POOL_USER *puser;
+	int left, min_left;
+	time_t now;
+
+	for (;;) {
+		min_left = -1;
+		now = time(NULL);
+		tds_mutex_lock(&pool->mtx);
+
+		/* users of this worker waiting too much */
+		puser = NULL;
+		if (pool->wait_timeout) {
+			DLIST_FOREACH(dlist_user, &pool->waiters, puser) {
+				if (puser->sock.worker != worker)
+					continue;
+				left = (int) (puser->wait_tm + pool->wait_timeout - now);
+				if (left <= 0)
+					break;
+				if (min_left < 0 || left < min_left)
+					min_left = left;
+			}
+		}
+		if (puser) {
+			puser->user_state = TDS_SRV_QUERY;
+			dlist_user_remove(&pool->waiters, puser);
+			dlist_user_append(&pool->users, puser);
+			pool->num_waiters--;
+			tds_mutex_unlock(&pool->mtx);
+			pool_user_reject(pool, puser, "Timeout waiting for a connection, increase \"wait timeout\"");
+			continue;
+		}
+
+		/* first see if there are members to do the request */
+		if (!dlist_member_first(&pool->idle_members) && pool->num_active_members >= pool->max_open_conn) {
+			tds_mutex_unlock(&pool->mtx);
+			return min_left;
+		}
+
+		puser = pool_next_waiter(pool);
+		if (!puser || puser->sock.worker != worker) {
+			if (puser)
+				pool_worker_wakeup(puser->sock.worker);
+			tds_mutex_unlock(&pool->mtx);
+			return min_left;
+		}
+
+		/* place back in query state */
+		assert(puser->user_state == TDS_SRV_WAIT);
+		puser->user_state = TDS_SRV_QUERY;
+		dlist_user_remove(&pool->waiters, puser);
+		dlist_user_append(&pool->users, puser);
+		pool->num_waiters--;
+		tds_mutex_unlock(&pool->mtx);
+
+		/* now try again */
+		if (pool_user_query(pool, puser) && puser->user_state == TDS_SRV_WAIT)
+			return min_left;
 	}
 }
 
 typedef struct {
 	TDS_POOL_EVENT common;
 	TDS_POOL *pool;
+	TDS_POOL_WORKER *worker;
 	TDS_POOL_USER *puser;
 	bool success;
 } END_LOGIN_EVENT;
@@ -541,7 +874,7 @@ static TDS_THREAD_PROC_DECLARE(end_login_proc, arg)
 
 	ev->success = pool_user_send_login_ack(pool, ev->puser);
 
-	pool_event_add(pool, &ev->common, end_login_execute);
+	pool_event_add(ev->worker, &ev->common, end_login_execute);
 	return TDS_THREAD_RESULT(0);
 }
 
@@ -558,10 +891,9 @@ end_login_execute(TDS_POOL_EVENT *base_event)
 		return;
 	}
 
-	puser->sock.poll_recv = true;
-	puser->sock.poll_send = false;
-	pmbr->sock.poll_recv = true;
-	pmbr->sock.poll_send = false;
+	pool_socket_poll(&puser->sock, true, false);
+	pool_socket_poll(&pmbr->sock, true, false);
+	pool_release_member(pool, pmbr);
 }
 
 /**
@@ -577,6 +909,7 @@ pool_user_finish_login(TDS_POOL * pool, TDS_POOL_USER * puser)
 	}
 
 	ev->pool  = pool;
+	ev->worker = puser->sock.worker;
 	ev->puser = puser;
 
 	if (tds_thread_create_detached(end_login_proc, ev) != 0) {
@@ -161,15 +161,60 @@ pool_write(TDS_SYS_SOCKET sock, const void *buf, size_t len)
 	return p - (const unsigned char *) buf;
 }
 
+/**
+ * Post an event to be executed by a worker thread.
+ * Can be called from any thread.
+ */
 void
-pool_event_add(TDS_POOL *pool, TDS_POOL_EVENT *ev, TDS_POOL_EXECUTE execute)
+pool_event_add(TDS_POOL_WORKER *worker, TDS_POOL_EVENT *ev, TDS_POOL_EXECUTE execute)
 {
-	tds_mutex_lock(&pool->events_mtx);
+	tds_mutex_lock(&worker->events_mtx);
 	ev->execute = execute;
-	ev->next = pool->events;
-	pool->events = ev;
-	tds_mutex_unlock(&pool->events_mtx);
-	WRITESOCKET(pool->event_fd, "x", 1);
+	ev->next = worker->events;
+	worker->events = ev;
+	tds_mutex_unlock(&worker->events_mtx);
+	pool_worker_wakeup(worker);
+}
+
+#if POOL_SPLICE
+/**
+ * Write data spliced from a member, left in the member pipe.
+ * @return bytes written or -1 on error
+ */
+static int
+pool_splice_write(TDS_POOL_MEMBER *pmbr, TDS_SYS_SOCKET sock)
+{
+	ssize_t ret;
+	unsigned int written = 0;
+
+	while (written < pmbr->splice_pending) {
+		ret = splice(pmbr->splice_pipe[0], NULL, sock, NULL, pmbr->splice_pending - written,
+			     SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (ret <= 0) {
+			int err = errno;
+			if (ret < 0 && (TDSSOCK_WOULDBLOCK(err) || err == EINTR))
+				break;
+			return -1;
+		}
+		written += ret;
+	}
+	pmbr->splice_pending -= written;
+	return written;
+}
+#endif
+
+/* account data forwarded in worker statistics */
+static void
+pool_count_data(TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to, int len)
+{
+	TDS_POOL_WORKER *worker = to->worker ? to->worker : from->worker;
+
+	if (!worker)
+		return;
+	if (to->is_member)
+		worker->bytes_to_members += len;
+	else
+		worker->bytes_to_users += len;
 }
 
 bool
@@ -177,26 +222,49 @@ pool_write_data(TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to)
 {
 	int ret;
 	TDSSOCKET *tds;
+	bool partial;
 
 	tdsdump_log(TDS_DBG_INFO1, "trying to send\n");
 
 	tds = from->tds;
-	tdsdump_log(TDS_DBG_INFO1, "sending %d bytes\n", tds->in_len);
 	tds_connection_coalesce(to->tds);
-	/* cf. net.c for better technique.  */
-	ret = pool_write(tds_get_s(to->tds), tds->in_buf + tds->in_pos, tds->in_len - tds->in_pos);
-	/* write failed, cleanup member */
-	if (ret < 0)
-		return false;
+#if POOL_SPLICE
+	if (from->is_member && ((TDS_POOL_MEMBER *) from)->splice_pending) {
+		TDS_POOL_MEMBER *pmbr = (TDS_POOL_MEMBER *) from;
+
+		tdsdump_log(TDS_DBG_INFO1, "splicing %u bytes\n", pmbr->splice_pending);
+		ret = pool_splice_write(pmbr, tds_get_s(to->tds));
+		if (ret < 0)
+			return false;
+		partial = pmbr->splice_pending != 0;
+	} else
+#endif
+	{
+		tdsdump_log(TDS_DBG_INFO1, "sending %d bytes\n", tds->in_len);
+		/* cf. net.c for better technique.  */
+		ret = pool_write(tds_get_s(to->tds), tds->in_buf + tds->in_pos, tds->in_len - tds->in_pos);
+		/* write failed, cleanup member */
+		if (ret < 0)
+			return false;
+
+		if (from->is_member)
+			pool_cache_data((TDS_POOL_USER *) to, tds->in_buf + tds->in_pos, ret);
+		tds->in_pos += ret;
+		partial = tds->in_pos < tds->in_len;
+	}
+
+	pool_count_data(from, to, ret);
 
-	tds->in_pos += ret;
-	if (tds->in_pos < tds->in_len) {
+	if (partial) {
 		/* partial write, schedule a future write */
-		to->poll_send = true;
-		from->poll_recv = false;
+		to->revents &= ~POLLOUT;
+		pool_socket_poll(to, to->poll_recv, true);
+		/* we stop reading, data could be left in the socket */
+		from->revents |= POLLIN;
+		pool_socket_poll(from, false, from->poll_send);
 	} else {
-		to->poll_send = false;
-		from->poll_recv = true;
+		pool_socket_poll(to, to->poll_recv, false);
+		pool_socket_poll(from, true, from->poll_send);
 	}
 	return true;
 }
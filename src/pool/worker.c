@@ -0,0 +1,430 @@
+/* TDSPool - Connection pooling for TDS based databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Each worker polls its own set of sockets.
+ * Sockets are registered once; with epoll they are registered edge
+ * triggered so a wakeup costs only the sockets having events.
+ * Readiness received is stored in the socket and consumed when the
+ * socket flags (poll_recv/poll_send) allow it, pool_socket_poll()
+ * queues the socket again if it becomes interested in readiness
+ * already received.
+ */
+
+#include <config.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif /* HAVE_SYS_EPOLL_H */
+
+#include "pool.h"
+
+#define POOL_MAX_EVENTS 64
+
+bool
+pool_worker_init(TDS_POOL_WORKER * worker, TDS_POOL_SET * set, unsigned int index)
+{
+	TDS_SYS_SOCKET event_pair[2];
+
+	worker->set = set;
+	worker->index = index;
+	worker->events = NULL;
+	dlist_ready_init(&worker->ready);
+	worker->wakeup_fd = INVALID_SOCKET;
+	worker->event_fd = INVALID_SOCKET;
+	if (tds_mutex_init(&worker->events_mtx))
+		return false;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, event_pair) < 0)
+		return false;
+	tds_socket_set_nonblocking(event_pair[0]);
+	tds_socket_set_nonblocking(event_pair[1]);
+	worker->event_fd = event_pair[1];
+	worker->wakeup_fd = event_pair[0];
+
+#if HAVE_SYS_EPOLL_H
+	{
+		struct epoll_event ev;
+		TDS_POOL *pool;
+		int i;
+
+		worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (worker->epoll_fd < 0)
+			return false;
+
+		/* internal sockets are level triggered, we read them partially */
+		ev.events = EPOLLIN;
+		ev.data.ptr = &worker->wakeup_fd;
+		if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup_fd, &ev) < 0)
+			return false;
+
+		/* first worker accepts and hands off users to others */
+		for (pool = set->pools; index == 0 && pool; pool = pool->next) {
+			for (i = 0; i < POOL_NUM_LISTEN; ++i) {
+				if (TDS_IS_SOCKET_INVALID(pool->listen_fds[i]))
+					continue;
+				ev.events = EPOLLIN;
+				ev.data.ptr = &pool->listen_fds[i];
+				if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, pool->listen_fds[i], &ev) < 0)
+					return false;
+			}
+		}
+	}
+#else
+	worker->socks = NULL;
+	worker->num_socks = worker->alloc_socks = 0;
+	worker->fds = NULL;
+#endif
+	return true;
+}
+
+void
+pool_worker_destroy(TDS_POOL_WORKER * worker)
+{
+	TDS_POOL_EVENT *ev;
+
+#if HAVE_SYS_EPOLL_H
+	if (worker->epoll_fd >= 0)
+		close(worker->epoll_fd);
+#else
+	free(worker->socks);
+	free(worker->fds);
+#endif
+	if (!TDS_IS_SOCKET_INVALID(worker->wakeup_fd))
+		CLOSESOCKET(worker->wakeup_fd);
+	if (!TDS_IS_SOCKET_INVALID(worker->event_fd))
+		CLOSESOCKET(worker->event_fd);
+	while ((ev = worker->events) != NULL) {
+		worker->events = ev->next;
+		free(ev);
+	}
+	tds_mutex_free(&worker->events_mtx);
+}
+
+/**
+ * Wake up a worker waiting for events.
+ * Can be called from any thread.
+ */
+void
+pool_worker_wakeup(TDS_POOL_WORKER * worker)
+{
+	WRITESOCKET(worker->event_fd, "x", 1);
+}
+
+static short
+pool_socket_wanted(const TDS_POOL_SOCKET * sock)
+{
+	short events = 0;
+
+	if (sock->poll_recv)
+		events |= POLLIN|POLLHUP;
+	if (sock->poll_send)
+		events |= POLLOUT;
+	return events;
+}
+
+static void
+pool_socket_ready(TDS_POOL_SOCKET * sock, short revents)
+{
+	sock->revents |= revents;
+	if ((sock->revents & pool_socket_wanted(sock)) != 0
+	    && !dlist_ready_in_list(&sock->worker->ready, sock))
+		dlist_ready_append(&sock->worker->ready, sock);
+}
+
+/**
+ * Add a socket to the sockets polled by a worker.
+ * Socket must not be registered.
+ * @return false on error, socket is left unregistered
+ */
+bool
+pool_socket_register(TDS_POOL_WORKER * worker, TDS_POOL_SOCKET * sock)
+{
+	assert(sock->worker == NULL);
+	assert(sock->tds);
+
+#if HAVE_SYS_EPOLL_H
+	{
+		struct epoll_event ev;
+
+		ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+		ev.data.ptr = sock;
+		if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, tds_get_s(sock->tds), &ev) < 0) {
+			fprintf(stderr, "Error registering socket\n");
+			return false;
+		}
+	}
+#else
+	if (worker->num_socks >= worker->alloc_socks) {
+		uint32_t alloc = worker->alloc_socks ? worker->alloc_socks * 2 : 16;
+
+		if (!TDS_RESIZE(worker->socks, alloc) || !TDS_RESIZE(worker->fds, alloc + 1 + worker->set->num_listeners)) {
+			fprintf(stderr, "Out of memory allocating fds\n");
+			return false;
+		}
+		worker->alloc_socks = alloc;
+	}
+	sock->poll_index = worker->num_socks;
+	worker->socks[worker->num_socks++] = sock;
+#endif
+	sock->worker = worker;
+	sock->revents = 0;
+	return true;
+}
+
+/**
+ * Remove a socket from the sockets polled by its worker.
+ * Does nothing if socket is not registered.
+ */
+void
+pool_socket_unregister(TDS_POOL_SOCKET * sock)
+{
+	TDS_POOL_WORKER *worker = sock->worker;
+
+	if (!worker)
+		return;
+
+	if (dlist_ready_in_list(&worker->ready, sock))
+		dlist_ready_remove(&worker->ready, sock);
+#if HAVE_SYS_EPOLL_H
+	if (sock->tds && !TDS_IS_SOCKET_INVALID(tds_get_s(sock->tds)))
+		epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, tds_get_s(sock->tds), NULL);
+#else
+	assert(sock->poll_index < worker->num_socks && worker->socks[sock->poll_index] == sock);
+	worker->socks[sock->poll_index] = worker->socks[--worker->num_socks];
+	worker->socks[sock->poll_index]->poll_index = sock->poll_index;
+#endif
+	sock->worker = NULL;
+	sock->revents = 0;
+}
+
+/**
+ * Change events we are interested in for a socket.
+ * If readiness was already received the socket is processed again.
+ */
+void
+pool_socket_poll(TDS_POOL_SOCKET * sock, bool recv, bool send)
+{
+	sock->poll_recv = recv;
+	sock->poll_send = send;
+	if (sock->worker)
+		pool_socket_ready(sock, 0);
+}
+
+/**
+ * Wait for events.
+ * Sockets with events are queued in the ready list.
+ * @param timeout timeout in milliseconds, -1 for infinite
+ * @param accept set to true if listening sockets have connections to accept,
+ *        pools to serve are marked with listen_ready
+ * @return -1 on error, 0 otherwise
+ */
+int
+pool_worker_wait(TDS_POOL_WORKER * worker, int timeout, bool *accept)
+{
+	bool wakeup = false;
+	int rc, i;
+	TDS_POOL *pool;
+
+	*accept = false;
+
+	/* do not wait if something is still to process */
+	if (dlist_ready_first(&worker->ready))
+		timeout = 0;
+
+#if HAVE_SYS_EPOLL_H
+	{
+		struct epoll_event evs[POOL_MAX_EVENTS];
+
+		rc = epoll_wait(worker->epoll_fd, evs, POOL_MAX_EVENTS, timeout);
+		if (rc < 0)
+			return errno == EINTR ? 0 : -1;
+
+		for (i = 0; i < rc; ++i) {
+			void *ptr = evs[i].data.ptr;
+			uint32_t events = evs[i].events;
+			short revents = 0;
+
+			if (ptr == &worker->wakeup_fd) {
+				wakeup = true;
+				continue;
+			}
+			for (pool = worker->set->pools; pool; pool = pool->next)
+				if (ptr >= (void *) &pool->listen_fds[0] && ptr < (void *) &pool->listen_fds[POOL_NUM_LISTEN])
+					break;
+			if (pool) {
+				pool->listen_ready[(TDS_SYS_SOCKET *) ptr - pool->listen_fds] = true;
+				*accept = true;
+				continue;
+			}
+			if (events & (EPOLLIN|EPOLLERR))
+				revents |= POLLIN;
+			if (events & (EPOLLHUP|EPOLLRDHUP))
+				revents |= POLLHUP;
+			if (events & EPOLLOUT)
+				revents |= POLLOUT;
+			pool_socket_ready((TDS_POOL_SOCKET *) ptr, revents);
+		}
+	}
+#else
+	{
+		struct pollfd *fds;
+		uint32_t num_fds = 0, first_sock, n;
+
+		if (!worker->fds && !TDS_RESIZE(worker->fds, 1 + worker->set->num_listeners)) {
+			fprintf(stderr, "Out of memory allocating fds\n");
+			exit(EXIT_FAILURE);
+		}
+		fds = worker->fds;
+		fds[num_fds].fd = worker->wakeup_fd;
+		fds[num_fds++].events = POLLIN;
+		for (pool = worker->set->pools; worker->index == 0 && pool; pool = pool->next) {
+			for (i = 0; i < POOL_NUM_LISTEN; ++i) {
+				if (TDS_IS_SOCKET_INVALID(pool->listen_fds[i]))
+					continue;
+				fds[num_fds].fd = pool->listen_fds[i];
+				fds[num_fds++].events = POLLIN;
+			}
+		}
+		first_sock = num_fds;
+		for (i = 0; i < (int) worker->num_socks; ++i) {
+			TDS_POOL_SOCKET *sock = worker->socks[i];
+
+			fds[num_fds].fd = tds_get_s(sock->tds);
+			/* skip dead connections */
+			fds[num_fds].events = IS_TDSDEAD(sock->tds) ? 0 : pool_socket_wanted(sock) & (POLLIN|POLLOUT);
+			++num_fds;
+		}
+		for (i = 0; i < (int) num_fds; ++i)
+			fds[i].revents = 0;
+
+		rc = poll(fds, num_fds, timeout);
+		if (rc < 0)
+			return sock_errno == TDSSOCK_EINTR ? 0 : -1;
+
+		wakeup = (fds[0].revents & POLLIN) != 0;
+		n = 1;
+		for (pool = worker->set->pools; worker->index == 0 && pool; pool = pool->next) {
+			for (i = 0; i < POOL_NUM_LISTEN; ++i) {
+				if (TDS_IS_SOCKET_INVALID(pool->listen_fds[i]))
+					continue;
+				if ((fds[n++].revents & POLLIN) != 0) {
+					pool->listen_ready[i] = true;
+					*accept = true;
+				}
+			}
+		}
+
+		/* sockets array cannot change while we are queuing */
+		for (i = first_sock; i < (int) num_fds; ++i) {
+			short revents = fds[i].revents;
+
+			if (revents & POLLERR)
+				revents |= POLLIN;
+			revents &= POLLIN|POLLOUT|POLLHUP;
+			if (revents)
+				pool_socket_ready(worker->socks[i - first_sock], revents);
+		}
+	}
+#endif
+
+	if (wakeup) {
+		char buf[32];
+
+		READSOCKET(worker->wakeup_fd, buf, sizeof(buf));
+	}
+	return 0;
+}
+
+/**
+ * Process events posted to the worker from other threads.
+ */
+void
+pool_worker_process_events(TDS_POOL_WORKER * worker)
+{
+	TDS_POOL_EVENT *events, *next;
+
+	/* detach events from worker */
+	tds_mutex_lock(&worker->events_mtx);
+	events = worker->events;
+	worker->events = NULL;
+	tds_mutex_unlock(&worker->events_mtx);
+
+	/* process them */
+	while (events) {
+		next = events->next;
+		events->next = NULL;
+
+		events->execute(events);
+		free(events);
+		events = next;
+	}
+}
+
+/**
+ * Process all sockets with readiness to consume.
+ * Processing a socket can free other sockets, they are removed
+ * from the ready list when unregistered.
+ */
+void
+pool_worker_process_ready(TDS_POOL_WORKER * worker)
+{
+	TDS_POOL_SOCKET *sock;
+
+	while ((sock = dlist_ready_first(&worker->ready)) != NULL) {
+		short revents;
+
+		dlist_ready_remove(&worker->ready, sock);
+
+		/* skip dead connections */
+		if (!sock->tds || IS_TDSDEAD(sock->tds))
+			continue;
+
+		/*
+		 * readiness is consumed, handlers read or write till they
+		 * would block or record it again if they stop before
+		 */
+		revents = sock->revents & pool_socket_wanted(sock);
+		sock->revents &= ~revents;
+		if (!revents)
+			continue;
+
+		if (sock->is_member)
+			pool_process_member(sock->pool, (TDS_POOL_MEMBER *) sock, revents);
+		else
+			pool_process_user(sock->pool, (TDS_POOL_USER *) sock, revents);
+	}
+}
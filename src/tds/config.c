@@ -646,7 +646,12 @@ tds_parse_conf_section(const char *option, const char *value, void *param)
 		char tmp[128];
 		struct addrinfo *addrs;
 
-		if (TDS_FAILED(tds_lookup_host_set(value, &login->ip_addrs))) {
+		/* Unix domain socket, no name to resolve */
+		if (tds_unix_socket_path(value)) {
+			if (login->ip_addrs != NULL)
+				freeaddrinfo(login->ip_addrs);
+			login->ip_addrs = NULL;
+		} else if (TDS_FAILED(tds_lookup_host_set(value, &login->ip_addrs))) {
 			tdsdump_log(TDS_DBG_WARN, "Found host entry %s however name resolution failed. \n", value);
 			return false;
 		}
@@ -913,7 +918,11 @@ tds_config_env_tdshost(TDSLOGIN * login)
 	if (!(tdshost = getenv("TDSHOST")))
 		return true;
 
-	if (TDS_FAILED(tds_lookup_host_set(tdshost, &login->ip_addrs))) {
+	if (tds_unix_socket_path(tdshost)) {
+		if (login->ip_addrs != NULL)
+			freeaddrinfo(login->ip_addrs);
+		login->ip_addrs = NULL;
+	} else if (TDS_FAILED(tds_lookup_host_set(tdshost, &login->ip_addrs))) {
 		tdsdump_log(TDS_DBG_WARN, "Name resolution failed for '%s' from $TDSHOST.\n", tdshost);
 		return false;
 	}
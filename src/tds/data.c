@@ -511,6 +511,26 @@ tds_varmax_stream_read(TDSINSTREAM *stream, void *ptr, size_t len)
 	return -1;
 }
 
+/**
+ * Read text pointer and length of a text/image value.
+ * \return length of data, -1 if NULL
+ */
+static int
+tds_get_textptr(TDSSOCKET *tds, TDSBLOB *blob)
+{
+	if (tds_get_byte(tds) != 16)
+		return -1;
+
+	/*  Jeff's hack */
+	tds_get_n(tds, blob->textptr, 16);
+	tds_get_n(tds, blob->timestamp, 8);
+	blob->valid_ptr = true;
+	if (IS_TDS72_PLUS(tds->conn) &&
+	    memcmp(blob->textptr, "dummy textptr\0\0",16) == 0)
+		blob->valid_ptr = false;
+	return tds_get_int(tds);
+}
+
 static TDSRET
 tds72_get_varmax(TDSSOCKET * tds, TDSCOLUMN * curcol)
 {
@@ -544,6 +564,256 @@ tds72_get_varmax(TDSSOCKET * tds, TDSCOLUMN * curcol)
 	return tds_get_char_dynamic(tds, curcol, pp, allocated, &r.stream);
 }
 
+/**
+ * Check if data of a column can be left on the wire and read on demand
+ * using tds_stream_column_read. Only large values (text, image and
+ * (n)varchar(max)/varbinary(max)) not needing conversion are handled.
+ */
+bool
+tds_column_streamable(TDSSOCKET *tds, const TDSCOLUMN *col)
+{
+	if (col->funcs->get_data != tds_generic_get)
+		return false;
+	if (USE_ICONV_IN && col->char_conv && (col->char_conv->flags & TDS_ENCODING_MEMCPY) == 0)
+		return false;
+	return col->column_varint_size == 4 || col->column_varint_size == 5 || col->column_varint_size == 8;
+}
+
+/**
+ * Forget about columns left on the wire.
+ * Called when the row was consumed or the connection can't be used anymore.
+ */
+void
+tds_stream_reset(TDSSOCKET *tds)
+{
+	TDSRESULTINFO *info = tds->stream_info;
+	unsigned int i;
+
+	tds->stream_col = NULL;
+	if (!info)
+		return;
+
+	tds->stream_info = NULL;
+	for (i = 0; i < info->num_cols; ++i)
+		info->columns[i]->column_stream_pending = 0;
+	tds_free_results(info);
+}
+
+/**
+ * Check if all data of the column being streamed was read.
+ * For PLP read the length of the next chunk if needed.
+ */
+static bool
+tds_stream_column_end(TDSSOCKET *tds)
+{
+	if (tds->stream_plp && tds->stream_left == 0) {
+		TDS_INT l = tds_get_int(tds);
+
+		tds->stream_left = l <= 0 ? -1 : l;
+	}
+	if (tds->stream_left > 0 && !IS_TDSDEAD(tds))
+		return false;
+
+	tds->stream_col->column_stream_pending = 0;
+	tds->stream_col = NULL;
+	return true;
+}
+
+/**
+ * Read the length of the next column left on the wire.
+ */
+static TDSRET
+tds_stream_column_header(TDSSOCKET *tds, TDSCOLUMN *col)
+{
+	TDS_INT8 size;
+
+	tds->stream_plp = false;
+	switch (col->column_varint_size) {
+	case 8:
+		tds->stream_plp = true;
+		size = tds_get_int8(tds);
+		break;
+	case 5:
+		size = tds_get_textptr(tds, (TDSBLOB *) col->column_data);
+		break;
+	default:
+		size = tds_get_int(tds);
+		if (size == 0)
+			size = -1;
+		break;
+	}
+	if (IS_TDSDEAD(tds))
+		return TDS_FAIL;
+
+	tds->stream_size = size;
+	col->column_cur_size = size == -1 ? -1 : (TDS_INT) TDS_MIN(TDS_MAX(size, 0), 0x7fffffff);
+	if (size == -1) {
+		col->column_stream_pending = 0;
+		return TDS_SUCCESS;
+	}
+
+	tds->stream_col = col;
+	tds->stream_left = tds->stream_plp ? 0 : size;
+	tds_stream_column_end(tds);
+	return TDS_SUCCESS;
+}
+
+/**
+ * Discard data of a column left on the wire.
+ */
+static TDSRET
+tds_stream_column_skip(TDSSOCKET *tds, TDSCOLUMN *col)
+{
+	if (!col->column_stream_pending)
+		return TDS_SUCCESS;
+	if (col != tds->stream_col)
+		TDS_PROPAGATE(tds_stream_column_header(tds, col));
+
+	while (tds->stream_col == col && !tds_stream_column_end(tds)) {
+		tds_get_n(tds, NULL, (size_t) tds->stream_left);
+		tds->stream_left = 0;
+	}
+	return IS_TDSDEAD(tds) ? TDS_FAIL : TDS_SUCCESS;
+}
+
+/**
+ * Start reading a column left on the wire.
+ * Data of previous streamed columns not read yet is discarded.
+ * \tds
+ * \param col  column to read, should be in current row
+ * \param size set to length of data, -1 if NULL, -2 if not known
+ * \return TDS_FAIL if column data was already consumed or on error
+ */
+TDSRET
+tds_stream_column_open(TDSSOCKET *tds, TDSCOLUMN *col, TDS_INT8 *size)
+{
+	TDSRESULTINFO *info = tds->stream_info;
+	unsigned int i;
+
+	if (col == tds->stream_col) {
+		*size = tds->stream_size;
+		return TDS_SUCCESS;
+	}
+	if (!info || !col->column_stream_pending)
+		return TDS_FAIL;
+
+	for (i = 0; i < info->num_cols && info->columns[i] != col; ++i) {
+		if (TDS_FAILED(tds_stream_column_skip(tds, info->columns[i]))) {
+			tds_stream_reset(tds);
+			return TDS_FAIL;
+		}
+	}
+	if (TDS_FAILED(tds_stream_column_header(tds, col))) {
+		tds_stream_reset(tds);
+		return TDS_FAIL;
+	}
+	*size = tds->stream_size;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Read data of a column left on the wire.
+ * Data are returned as sent by the server, without any conversion.
+ * \tds
+ * \param col column to read
+ * \param buf buffer to fill
+ * \param len size of buffer
+ * \return bytes read, 0 at end of data, -1 on error
+ */
+int
+tds_stream_column_read(TDSSOCKET *tds, TDSCOLUMN *col, void *buf, size_t len)
+{
+	size_t done = 0;
+	TDS_INT8 size;
+
+	if (col != tds->stream_col) {
+		if (!col->column_stream_pending)
+			return 0;
+		if (TDS_FAILED(tds_stream_column_open(tds, col, &size)))
+			return -1;
+	}
+
+	len = TDS_MIN(len, 0x7fffffff);
+	while (done < len && tds->stream_col == col) {
+		size_t n = (size_t) TDS_MIN((TDS_INT8) (len - done), tds->stream_left);
+
+		if (!tds_get_n(tds, (char *) buf + done, n)) {
+			tds_stream_reset(tds);
+			return -1;
+		}
+		done += n;
+		tds->stream_left -= n;
+		tds_stream_column_end(tds);
+	}
+	return (int) done;
+}
+
+/**
+ * Discard data of current row still on the wire.
+ * Called before reading next tokens.
+ */
+TDSRET
+tds_stream_skip_row(TDSSOCKET *tds)
+{
+	TDSRESULTINFO *info = tds->stream_info;
+	TDSRET rc = TDS_SUCCESS;
+	unsigned int i;
+
+	if (!info)
+		return TDS_SUCCESS;
+
+	for (i = 0; i < info->num_cols && TDS_SUCCEED(rc); ++i)
+		rc = tds_stream_column_skip(tds, info->columns[i]);
+	tds_stream_reset(tds);
+	return rc;
+}
+
+typedef struct tds_column_instream
+{
+	TDSINSTREAM stream;
+	TDSSOCKET *tds;
+	TDSCOLUMN *col;
+} TDSCOLUMNINSTREAM;
+
+static int
+tds_column_instream_read(TDSINSTREAM *stream, void *ptr, size_t len)
+{
+	TDSCOLUMNINSTREAM *s = (TDSCOLUMNINSTREAM *) stream;
+
+	return tds_stream_column_read(s->tds, s->col, ptr, len);
+}
+
+/**
+ * Copy data of a column left on the wire to an output stream.
+ * Data are read from network packets directly into the stream buffer,
+ * so a large value can be saved to a file or a socket without
+ * loading it into memory.
+ * \tds
+ * \param col        column to copy, should be in current row
+ * \param char_conv  conversion to apply, NULL to copy data as sent by the server
+ * \param ostream    stream to write to
+ * \return TDS_FAIL if column data was already consumed or on error
+ */
+TDSRET
+tds_stream_column_copy(TDSSOCKET *tds, TDSCOLUMN *col, TDSICONV *char_conv, TDSOUTSTREAM *ostream)
+{
+	TDSCOLUMNINSTREAM r;
+	TDS_INT8 size;
+
+	if (col != tds->stream_col) {
+		if (!col->column_stream_pending)
+			return TDS_FAIL;
+		TDS_PROPAGATE(tds_stream_column_open(tds, col, &size));
+	}
+
+	r.stream.read = tds_column_instream_read;
+	r.tds = tds;
+	r.col = col;
+	if (char_conv && (char_conv->flags & TDS_ENCODING_MEMCPY) == 0)
+		return tds_convert_stream(tds, char_conv, to_client, &r.stream, ostream);
+	return tds_copy_stream(&r.stream, ostream);
+}
+
 TDS_COMPILE_CHECK(tds_variant_size,  sizeof(((TDSVARIANT*)0)->data) == sizeof(((TDSBLOB*)0)->textvalue));
 TDS_COMPILE_CHECK(tds_variant_offset,TDS_OFFSET(TDSVARIANT, data) == TDS_OFFSET(TDSBLOB, textvalue));
 
@@ -703,7 +973,7 @@ TDSRET
 tds_generic_get(TDSSOCKET * tds, TDSCOLUMN * curcol)
 {
 	unsigned char *dest;
-	int len, colsize;
+	int colsize;
 	int fillchar;
 	TDSBLOB *blob = NULL;
 
@@ -714,19 +984,7 @@ tds_generic_get(TDSSOCKET * tds, TDSCOLUMN * curcol)
 	switch (curcol->column_varint_size) {
 	case 5:
 		/* It's a BLOB... */
-		len = tds_get_byte(tds);
-		blob = (TDSBLOB *) curcol->column_data;
-		if (len == 16) {	/*  Jeff's hack */
-			tds_get_n(tds, blob->textptr, 16);
-			tds_get_n(tds, blob->timestamp, 8);
-			blob->valid_ptr = true;
-			if (IS_TDS72_PLUS(tds->conn) &&
-			    memcmp(blob->textptr, "dummy textptr\0\0",16) == 0)
-				blob->valid_ptr = false;
-			colsize = tds_get_int(tds);
-		} else {
-			colsize = -1;
-		}
+		colsize = tds_get_textptr(tds, (TDSBLOB *) curcol->column_data);
 		break;
 	case 4:
 		colsize = tds_get_int(tds);
@@ -506,6 +506,7 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 	bool db_selected = false;
 	struct addrinfo *addrs;
 	int orig_port;
+	const char *unix_path;
 	bool rerouted = false;
 	/* save to restore during redirected connection */
 	unsigned int orig_mars = login->mars;
@@ -593,7 +594,8 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 	/* end */
 
 	/* verify that ip_addr is not empty */
-	if (login->ip_addrs == NULL) {
+	unix_path = tds_unix_socket_path(tds_dstr_cstr(&login->server_host_name));
+	if (login->ip_addrs == NULL && !unix_path) {
 		tdserror(tds_get_ctx(tds), tds, TDSEUHST, 0 );
 		tdsdump_log(TDS_DBG_ERROR, "IP address pointer is empty\n");
 		if (!tds_dstr_isempty(&login->server_name)) {
@@ -610,6 +612,9 @@ reroute:
 	tds_ssl_deinit(tds->conn);
 	erc = TDSEINTF;
 	orig_port = login->port;
+	/* local server on a Unix domain socket, see tds_parse_conf_section */
+	if (login->ip_addrs == NULL)
+		erc = tds_open_unix_socket(tds, unix_path, p_oserr);
 	for (addrs = login->ip_addrs; addrs != NULL; addrs = addrs->ai_next) {
 
 		/*
@@ -186,9 +186,12 @@ tds_alloc_dynamic(TDSCONNECTION * conn, const char *id)
 
 	/* insert into list */
 	dyn->next = conn->dyns;
+	if (conn->dyns)
+		conn->dyns->prev = dyn;
 	conn->dyns = dyn;
 
 	strlcpy(dyn->id, id, TDS_MAX_DYNID_LEN);
+	tds_hash_insert(&conn->dyns_by_id, &dyn->id_entry, tds_hash_bytes(dyn->id, strlen(dyn->id)));
 
 	return dyn;
 
@@ -221,22 +224,23 @@ tds_free_input_params(TDSDYNAMIC * dyn)
 void
 tds_dynamic_deallocated(TDSCONNECTION *conn, TDSDYNAMIC *dyn)
 {
-	TDSDYNAMIC **victim;
-
 	tdsdump_log(TDS_DBG_FUNC, "tds_dynamic_deallocated() : freeing dynamic_id %s\n", dyn->id);
 
-	victim = &conn->dyns;
-	while (*victim != dyn) {
-		if (*victim == NULL) {
-			tdsdump_log(TDS_DBG_FUNC, "tds_dynamic_deallocated() : cannot find id %s\n", dyn->id);
-			return;
-		}
-		victim = &(*victim)->next;
+	/* dynamics in the list are always indexed */
+	if (!tds_hash_linked(&dyn->id_entry)) {
+		tdsdump_log(TDS_DBG_FUNC, "tds_dynamic_deallocated() : cannot find id %s\n", dyn->id);
+		return;
 	}
 
 	/* remove from list */
-	*victim = dyn->next;
-	dyn->next = NULL;
+	if (dyn->prev)
+		dyn->prev->next = dyn->next;
+	else
+		conn->dyns = dyn->next;
+	if (dyn->next)
+		dyn->next->prev = dyn->prev;
+	dyn->next = dyn->prev = NULL;
+	tds_hash_remove(&conn->dyns_by_id, &dyn->id_entry);
 
 	/* assure there is no id left */
 	dyn->num_id = 0;
@@ -244,6 +248,106 @@ tds_dynamic_deallocated(TDSCONNECTION *conn, TDSDYNAMIC *dyn)
 	tds_release_dynamic(&dyn);
 }
 
+/** Maximum number of queries remembered as not preparable for a connection */
+#define TDS_MAX_EMULATED_QUERIES 64
+
+/** Query the server refused to prepare */
+struct tds_emulated_query
+{
+	TDS_HASH_ENTRY entry;
+	struct tds_emulated_query *next;
+	char query[1];
+};
+
+static void
+tds_free_emulated_queries(TDSCONNECTION *conn)
+{
+	struct tds_emulated_query *eq;
+
+	while ((eq = conn->emulated_first) != NULL) {
+		conn->emulated_first = eq->next;
+		tds_hash_remove(&conn->emulated_queries, &eq->entry);
+		free(eq);
+	}
+	conn->emulated_last = NULL;
+	conn->num_emulated = 0;
+}
+
+static void
+tds_emulated_query_add(TDSCONNECTION *conn, const char *query)
+{
+	struct tds_emulated_query *eq;
+	size_t len;
+
+	/* remove oldest query */
+	if (conn->num_emulated >= TDS_MAX_EMULATED_QUERIES) {
+		eq = conn->emulated_first;
+		conn->emulated_first = eq->next;
+		if (!conn->emulated_first)
+			conn->emulated_last = NULL;
+		tds_hash_remove(&conn->emulated_queries, &eq->entry);
+		free(eq);
+		--conn->num_emulated;
+	}
+
+	len = strlen(query);
+	eq = (struct tds_emulated_query *) malloc(TDS_OFFSET(struct tds_emulated_query, query) + len + 1);
+	if (!eq)
+		return;
+	memcpy(eq->query, query, len + 1);
+	eq->next = NULL;
+	tds_hash_insert(&conn->emulated_queries, &eq->entry, tds_hash_bytes(eq->query, len));
+	if (conn->emulated_last)
+		conn->emulated_last->next = eq;
+	else
+		conn->emulated_first = eq;
+	conn->emulated_last = eq;
+	++conn->num_emulated;
+}
+
+/**
+ * Mark a dynamic as emulated as the server cannot prepare it (for instance
+ * Sybase with BLOB parameters). The query is remembered so next prepare
+ * requests for the same query are emulated without asking the server.
+ * \param conn connection owning the dynamic
+ * \param dyn  dynamic to mark
+ */
+void
+tds_dynamic_set_emulated(TDSCONNECTION *conn, TDSDYNAMIC *dyn)
+{
+	dyn->emulated = true;
+
+	/* remember the query before releasing our reference on dyn */
+	if (dyn->query && !tds_dynamic_must_emulate(conn, dyn->query))
+		tds_emulated_query_add(conn, dyn->query);
+
+	tds_dynamic_deallocated(conn, dyn);
+}
+
+/**
+ * Check if a query was already refused by the server during prepare.
+ * \param conn  connection to check
+ * \param query query to prepare
+ * \return true if the prepare should be emulated
+ */
+bool
+tds_dynamic_must_emulate(TDSCONNECTION *conn, const char *query)
+{
+	TDS_HASH_ENTRY *entry;
+	size_t len;
+
+	if (!conn->num_emulated)
+		return false;
+
+	len = strlen(query);
+	TDS_HASH_FOREACH(&conn->emulated_queries, tds_hash_bytes(query, len), entry) {
+		struct tds_emulated_query *eq = TDS_HASH_ITEM(entry, struct tds_emulated_query, entry);
+
+		if (strcmp(eq->query, query) == 0)
+			return true;
+	}
+	return false;
+}
 
 /**
  * \fn void tds_release_dynamic(TDSDYNAMIC **pdyn)
@@ -304,6 +408,7 @@ tds_alloc_param_result(TDSPARAMINFO * old_param)
 	if (!TDS_RESIZE(param_info->columns, param_info->num_cols + 1u))
 		goto Cleanup;
 
+	tds_reset_column_index(param_info);
 	param_info->columns[param_info->num_cols++] = colinfo;
 	return param_info;
 
@@ -325,6 +430,7 @@ tds_free_param_result(TDSPARAMINFO * param_info)
 	if (!param_info || param_info->num_cols <= 0)
 		return;
 
+	tds_reset_column_index(param_info);
 	col = param_info->columns[--param_info->num_cols];
 	if (col->column_data && col->column_data_free)
 		col->column_data_free(col);
@@ -656,10 +762,113 @@ tds_free_results(TDSRESULTINFO * res_info)
 	}
 
 	free(res_info->bycolumns);
+	tds_reset_column_index(res_info);
 
 	free(res_info);
 }
 
+struct tds_column_index
+{
+	TDS_HASH hash;
+	TDS_HASH_ENTRY entries[1];
+};
+
+static bool
+tds_column_name_equal(const DSTR *column_name, const char *name, size_t len)
+{
+	const char *s = tds_dstr_cstr(column_name);
+
+	if (tds_dstr_len(column_name) != len)
+		return false;
+	for (; len; --len) {
+		unsigned char c1 = *s++, c2 = *name++;
+
+		if (c1 >= 'A' && c1 <= 'Z')
+			c1 += 'a' - 'A';
+		if (c2 >= 'A' && c2 <= 'Z')
+			c2 += 'a' - 'A';
+		if (c1 != c2)
+			return false;
+	}
+	return true;
+}
+
+static struct tds_column_index *
+tds_build_column_index(TDSRESULTINFO * res_info)
+{
+	struct tds_column_index *index;
+	TDS_USMALLINT i;
+
+	index = (struct tds_column_index *)
+		calloc(1, TDS_OFFSET(struct tds_column_index, entries) + sizeof(TDS_HASH_ENTRY) * res_info->num_cols);
+	if (!index)
+		return NULL;
+
+	tds_hash_init(&index->hash);
+	for (i = 0; i < res_info->num_cols; ++i) {
+		const DSTR *name = &res_info->columns[i]->column_name;
+
+		tds_hash_insert(&index->hash, &index->entries[i],
+				tds_hash_bytes_ci(tds_dstr_cstr(name), tds_dstr_len(name)));
+	}
+	return index;
+}
+
+/**
+ * Find a column given its name.
+ * Names are compared ignoring ASCII letter case.
+ * First call builds an index so next searches do not scan all columns.
+ * \param res_info results to search into
+ * \param name     name of the column, not necessarily NUL terminated
+ * \param len      length of name in bytes
+ * \return index of the first column with the given name, -1 if not found
+ */
+int
+tds_find_column(TDSRESULTINFO * res_info, const char *name, size_t len)
+{
+	struct tds_column_index *index;
+	TDS_HASH_ENTRY *entry;
+	int found = -1;
+
+	if (!res_info->name_index) {
+		res_info->name_index = tds_build_column_index(res_info);
+
+		/* no memory for index, just scan columns */
+		if (!res_info->name_index) {
+			int i;
+
+			for (i = 0; i < res_info->num_cols; ++i)
+				if (tds_column_name_equal(&res_info->columns[i]->column_name, name, len))
+					return i;
+			return -1;
+		}
+	}
+
+	/* columns with same name are possible, return the first one */
+	index = res_info->name_index;
+	TDS_HASH_FOREACH(&index->hash, tds_hash_bytes_ci(name, len), entry) {
+		int i = (int) (entry - index->entries);
+
+		if ((found < 0 || i < found)
+		    && tds_column_name_equal(&res_info->columns[i]->column_name, name, len))
+			found = i;
+	}
+	return found;
+}
+
+/**
+ * Discard index of columns by name.
+ * Must be called if columns are added, removed or renamed.
+ */
+void
+tds_reset_column_index(TDSRESULTINFO * res_info)
+{
+	if (res_info->name_index) {
+		tds_hash_free(&res_info->name_index->hash);
+		TDS_ZERO_FREE(res_info->name_index);
+	}
+}
+
 void
 tds_free_all_results(TDSSOCKET * tds)
 {
@@ -888,7 +1097,6 @@ TDSCURSOR *
 tds_alloc_cursor(TDSSOCKET *tds, const char *name, size_t namelen, const char *query, size_t querylen)
 {
 	TDSCURSOR *cursor;
-	TDSCURSOR *pcursor;
 
 	TEST_MALLOC(cursor, TDSCURSOR);
 	cursor->ref_count = 1;
@@ -902,13 +1110,13 @@ tds_alloc_cursor(TDSSOCKET *tds, const char *name, size_t namelen, const char *q
 	TEST_CALLOC(cursor->query, char, querylen + 1);
 	memcpy(cursor->query, query, querylen);
 
-	if (tds->conn->cursors == NULL) {
+	/* append to list */
+	cursor->prev = tds->conn->cursors_last;
+	if (tds->conn->cursors_last)
+		tds->conn->cursors_last->next = cursor;
+	else
 		tds->conn->cursors = cursor;
-	} else {
-		for (pcursor = tds->conn->cursors; pcursor->next; pcursor = pcursor->next)
-			continue;
-		pcursor->next = cursor;
-	}
+	tds->conn->cursors_last = cursor;
 	/* take into account reference in connection list */
 	++cursor->ref_count;
 
@@ -925,22 +1133,23 @@ tds_alloc_cursor(TDSSOCKET *tds, const char *name, size_t namelen, const char *q
 void
 tds_cursor_deallocated(TDSCONNECTION *conn, TDSCURSOR *cursor)
 {
-	TDSCURSOR **victim;
-
 	tdsdump_log(TDS_DBG_FUNC, "tds_cursor_deallocated() : freeing cursor_id %d\n", cursor->cursor_id);
 
-	victim = &conn->cursors;
-	while (*victim != cursor) {
-		if (*victim == NULL) {
-			tdsdump_log(TDS_DBG_FUNC, "tds_cursor_deallocated() : cannot find cursor_id %d\n", cursor->cursor_id);
-			return;
-		}
-		victim = &(*victim)->next;
+	if (!cursor->prev && conn->cursors != cursor) {
+		tdsdump_log(TDS_DBG_FUNC, "tds_cursor_deallocated() : cannot find cursor_id %d\n", cursor->cursor_id);
+		return;
 	}
 
 	/* remove from list */
-	*victim = cursor->next;
-	cursor->next = NULL;
+	if (cursor->prev)
+		cursor->prev->next = cursor->next;
+	else
+		conn->cursors = cursor->next;
+	if (cursor->next)
+		cursor->next->prev = cursor->prev;
+	else
+		conn->cursors_last = cursor->prev;
+	cursor->next = cursor->prev = NULL;
 
 	tds_release_cursor(&cursor);
 }
@@ -1125,6 +1334,9 @@ tds_deinit_connection(TDSCONNECTION *conn)
 		tds_dynamic_deallocated(conn, conn->dyns);
 	while (conn->cursors)
 		tds_cursor_deallocated(conn, conn->cursors);
+	tds_hash_free(&conn->dyns_by_id);
+	tds_free_emulated_queries(conn);
+	tds_hash_free(&conn->emulated_queries);
 	tds_ssl_deinit(conn);
 	/* close connection and free inactive sockets */
 	tds_connection_close(conn);
@@ -1152,6 +1364,8 @@ tds_init_connection(TDSCONNECTION *conn, TDSCONTEXT *context, unsigned int bufsi
 	conn->tds_ctx = context;
 	conn->ncharsize = 1;
 	conn->unicharsize = 1;
+	tds_hash_init(&conn->dyns_by_id);
+	tds_hash_init(&conn->emulated_queries);
 
 	if (tds_wakeup_init(&conn->wakeup))
 		goto Cleanup;
@@ -1180,6 +1394,7 @@ tds_init_socket(TDSSOCKET * tds_socket, unsigned int bufsize)
 	TDSPACKET *pkt;
 
 	tds_socket->parent = NULL;
+	tds_hash_init(&tds_socket->parsed_queries);
 
 	tds_socket->recv_packet = tds_alloc_packet(NULL, bufsize);
 	if (!tds_socket->recv_packet)
@@ -1429,6 +1644,8 @@ tds_free_socket(TDSSOCKET * tds)
 		return;
 
 	/* detach this socket */
+	tds_stream_reset(tds);
+	tds_free_param_results(tds->stream_params);
 	tds_release_cur_dyn(tds);
 	tds_release_cursor(&tds->cur_cursor);
 	tds_detach_results(tds->current_results);
@@ -1445,6 +1662,7 @@ tds_free_socket(TDSSOCKET * tds)
 	}
 #endif
 	tds_free_all_results(tds);
+	tds_free_parsed_queries(tds);
 #if ENABLE_ODBC_MARS
 	tds_cond_destroy(&tds->packet_cond);
 #endif
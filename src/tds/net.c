@@ -57,6 +57,10 @@
 #include <netinet/tcp.h>
 #endif /* HAVE_NETINET_TCP_H */
 
+#if HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif /* HAVE_SYS_UN_H */
+
 #if HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif /* HAVE_ARPA_INET_H */
@@ -516,6 +520,88 @@ exit:
 	return tds_error;
 }
 
+/**
+ * Check if a host name selects a Unix domain socket.
+ * \param host host name, like "unix:/path/to/socket"
+ * \return path of the socket or NULL if not a socket
+ */
+const char *
+tds_unix_socket_path(const char *host)
+{
+	if (strncmp(host, TDS_UNIX_HOST_PREFIX, strlen(TDS_UNIX_HOST_PREFIX)) != 0)
+		return NULL;
+	return host + strlen(TDS_UNIX_HOST_PREFIX);
+}
+
+/**
+ * Connect to a server listening on a Unix domain socket.
+ * Connecting to a local socket does not wait for the peer so no
+ * timeout is used; TCP options do not apply.
+ */
+TDSERRNO
+tds_open_unix_socket(TDSSOCKET *tds, const char *path, int *p_oserr)
+{
+#if HAVE_SYS_UN_H
+	struct sockaddr_un addr;
+	TDS_SYS_SOCKET sock;
+	char *errstr;
+
+	*p_oserr = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		tdsdump_log(TDS_DBG_ERROR, "Unix socket path %s too long\n", path);
+		return TDSECONN;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	tdsdump_log(TDS_DBG_INFO1, "Connecting to Unix socket %s\n", path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (TDS_IS_SOCKET_INVALID(sock)) {
+		errstr = sock_strerror(*p_oserr = sock_errno);
+		tdsdump_log(TDS_DBG_ERROR, "socket creation error: %s\n", errstr);
+		sock_strerror_free(errstr);
+		return TDSESOCK;
+	}
+
+#if defined(SO_NOSIGPIPE)
+	{
+		int on = 1;
+
+		if (setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (const void *) &on, sizeof(on))) {
+			*p_oserr = sock_errno;
+			CLOSESOCKET(sock);
+			return TDSESOCK;
+		}
+	}
+#endif
+
+	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		errstr = sock_strerror(*p_oserr = sock_errno);
+		tdsdump_log(TDS_DBG_ERROR, "tds_open_unix_socket: connect(2) returned \"%s\"\n", errstr);
+		sock_strerror_free(errstr);
+		CLOSESOCKET(sock);
+		return TDSECONN;
+	}
+
+	if ((*p_oserr = tds_socket_set_nonblocking(sock)) != 0) {
+		CLOSESOCKET(sock);
+		return TDSEUSCT;
+	}
+
+	tdsdump_log(TDS_DBG_INFO2, "tds_open_unix_socket() succeeded\n");
+	tds->conn->s = sock;
+	tds->state = TDS_IDLE;
+	return TDSEOK;
+#else
+	*p_oserr = 0;
+	tdsdump_log(TDS_DBG_ERROR, "Unix domain sockets not supported\n");
+	return TDSECONN;
+#endif
+}
+
 /**
  * Close current socket.
  * For last socket close entire connection.
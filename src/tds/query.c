@@ -45,12 +45,48 @@
 
 #include <assert.h>
 
+/** Maximum number of parsed queries kept by a socket */
+#define TDS_MAX_PARSED_QUERIES 32
+/** Longer queries are parsed again at every use */
+#define TDS_MAX_PARSED_QUERY_LEN 16384
+/** Number of values describing the type of a parameter */
+#define TDS_PARAM_SIG_LEN 7
+
+/**
+ * Query converted for RPC calls (sp_executesql, sp_prepare and so on).
+ * Kept by the socket so executing the same query again only needs to
+ * encode parameters.
+ */
+struct tds_parsed_query
+{
+	TDS_HASH_ENTRY entry;
+	struct tds_parsed_query *prev, *next;
+	/** query converted to UCS-2 */
+	char *converted;
+	size_t converted_len;
+	/** converted query with placeholders replaced by @Pn */
+	char *replaced;
+	size_t replaced_len;
+	int num_placeholders;
+	/** last parameters declaration, in UCS-2 */
+	char *decl;
+	size_t decl_len;
+	/** types used to build decl, TDS_PARAM_SIG_LEN values for each placeholder */
+	TDS_INT *decl_sig;
+	size_t query_len;
+	char query[1];
+};
+
 static TDSRET tds5_put_params(TDSSOCKET * tds, TDSPARAMINFO * info, int flags) TDS_WUR;
-static void tds7_put_query_params(TDSSOCKET * tds, const char *query, size_t query_len);
+static struct tds_parsed_query *tds7_get_parsed_query(TDSSOCKET *tds, const char *query, size_t query_len);
+static struct tds_parsed_query *tds7_find_parsed_query(TDSSOCKET *tds, const char *query, size_t query_len, uint32_t hash);
+static void tds7_release_parsed_query(struct tds_parsed_query *pq);
+static void tds7_put_query_params(TDSSOCKET * tds, const struct tds_parsed_query *pq);
 static TDSRET tds_put_data_info(TDSSOCKET * tds, TDSCOLUMN * curcol, int flags);
 static inline TDSRET tds_put_data(TDSSOCKET * tds, TDSCOLUMN * curcol);
-static TDSRET tds7_write_param_def_from_query(TDSSOCKET * tds, const char* converted_query,
-					      size_t converted_query_len, TDSPARAMINFO * params) TDS_WUR;
+static TDSRET tds7_put_params(TDSSOCKET * tds, TDSPARAMINFO * params, int first, int flags);
+static TDSRET tds7_write_param_def_from_query(TDSSOCKET * tds, struct tds_parsed_query *pq,
+					      TDSPARAMINFO * params) TDS_WUR;
 static TDSRET tds7_write_param_def_from_params(TDSSOCKET * tds, const char* query, size_t query_len,
 					       TDSPARAMINFO * params) TDS_WUR;
 
@@ -180,6 +216,19 @@ tds_query_flush_packet(TDSSOCKET *tds)
 	return ret;
 }
 
+/**
+ * Flush query packet unless a parameter is being streamed.
+ * In this case the packet is completed by tds_stream_param_end.
+ * \tds
+ */
+static TDSRET
+tds_query_flush_params(TDSSOCKET *tds)
+{
+	if (tds->stream_params)
+		return TDS_SUCCESS;
+	return tds_query_flush_packet(tds);
+}
+
 /**
  * Set current dynamic.
  * \tds
@@ -347,7 +396,6 @@ TDSRET
 tds_submit_query_params(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params, TDSHEADERS * head)
 {
 	size_t query_len;
-	int num_params = params ? params->num_cols : 0;
  
 	CHECK_TDS_EXTRA(tds);
 	if (params)
@@ -385,29 +433,30 @@ tds_submit_query_params(TDSSOCKET * tds, const char *query, TDSPARAMINFO * param
 		}
 		free(new_query);
 	} else if (!IS_TDS7_PLUS(tds->conn) || !params || !params->num_cols) {
+		struct tds_parsed_query *pq = NULL;
+
 		if (tds_start_query_head(tds, TDS_QUERY, head) != TDS_SUCCESS)
 			return TDS_FAIL;
-		tds_put_string(tds, query, (int)query_len);
+		/* use query already converted if available */
+		if (IS_TDS7_PLUS(tds->conn) && tds->num_parsed)
+			pq = tds7_find_parsed_query(tds, query, query_len, tds_hash_bytes(query, query_len));
+		if (pq)
+			tds_put_n(tds, pq->converted, pq->converted_len);
+		else
+			tds_put_string(tds, query, (int)query_len);
 	} else {
-		TDSCOLUMN *param;
-		int count, i;
-		size_t converted_query_len;
-		const char *converted_query;
+		struct tds_parsed_query *pq;
 		TDSFREEZE outer;
 		TDSRET rc;
 
-		converted_query =
-			tds_convert_string(tds, tds->conn->char_convs[client2ucs2],
-					   query, query_len, &converted_query_len);
-		if (!converted_query) {
+		pq = tds7_get_parsed_query(tds, query, query_len);
+		if (!pq) {
 			tds_set_state(tds, TDS_IDLE);
 			return TDS_FAIL;
 		}
 
-		count = tds_count_placeholders_ucs2le(converted_query, converted_query + converted_query_len);
-
 		if (tds_start_query_head(tds, TDS_RPC, head) != TDS_SUCCESS) {
-			tds_convert_string_free(query, converted_query);
+			tds7_release_parsed_query(pq);
 			return TDS_FAIL;
 		}
 
@@ -423,37 +472,22 @@ tds_submit_query_params(TDSSOCKET * tds, const char *query, TDSPARAMINFO * param
 		tds_put_smallint(tds, 0);
  
 		/* string with sql statement */
-		if (!count) {
-			tds_put_byte(tds, 0);
-			tds_put_byte(tds, 0);
-			tds_put_byte(tds, SYBNTEXT);	/* must be Ntype */
-			TDS_PUT_INT(tds, converted_query_len);
-			if (IS_TDS71_PLUS(tds->conn))
-				tds_put_n(tds, tds->conn->collation, 5);
-			TDS_PUT_INT(tds, converted_query_len);
-			tds_put_n(tds, converted_query, converted_query_len);
-
-			rc = tds7_write_param_def_from_params(tds, converted_query, converted_query_len, params);
-		} else {
-			tds7_put_query_params(tds, converted_query, converted_query_len);
-
-			rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
-		}
-		tds_convert_string_free(query, converted_query);
+		tds7_put_query_params(tds, pq);
+		if (!pq->num_placeholders)
+			rc = tds7_write_param_def_from_params(tds, pq->converted, pq->converted_len, params);
+		else
+			rc = tds7_write_param_def_from_query(tds, pq, params);
+		tds7_release_parsed_query(pq);
 		if (TDS_FAILED(rc)) {
 			tds_freeze_abort(&outer);
 			return rc;
 		}
 		tds_freeze_close(&outer);
 
-		for (i = 0; i < num_params; i++) {
-			param = params->columns[i];
-			TDS_PROPAGATE(tds_put_data_info(tds, param, 0));
-			TDS_PROPAGATE(tds_put_data(tds, param));
-		}
+		TDS_PROPAGATE(tds7_put_params(tds, params, 0, 0));
 		tds->current_op = TDS_OP_EXECUTESQL;
 	}
-	return tds_query_flush_packet(tds);
+	return tds_query_flush_params(tds);
 }
 
 /**
@@ -957,23 +991,342 @@ tds_get_column_declaration(TDSSOCKET * tds, TDSCOLUMN * curcol, char *out)
 	return TDS_FAIL;
 }
 
+static void
+tds_free_parsed_query(struct tds_parsed_query *pq)
+{
+	free(pq->converted);
+	free(pq->replaced);
+	free(pq->decl);
+	free(pq->decl_sig);
+	free(pq);
+}
+
+static void
+tds_unlink_parsed_query(TDSSOCKET *tds, struct tds_parsed_query *pq)
+{
+	if (pq->prev)
+		pq->prev->next = pq->next;
+	else
+		tds->parsed_first = pq->next;
+	if (pq->next)
+		pq->next->prev = pq->prev;
+	else
+		tds->parsed_last = pq->prev;
+	pq->prev = pq->next = NULL;
+	tds_hash_remove(&tds->parsed_queries, &pq->entry);
+	--tds->num_parsed;
+}
+
+/**
+ * Free all parsed queries kept by a socket
+ * \tds
+ */
+void
+tds_free_parsed_queries(TDSSOCKET *tds)
+{
+	while (tds->parsed_first) {
+		struct tds_parsed_query *pq = tds->parsed_first;
+
+		tds_unlink_parsed_query(tds, pq);
+		tds_free_parsed_query(pq);
+	}
+	tds_hash_free(&tds->parsed_queries);
+}
+
+/**
+ * Build query with all "@PX" for parameters
+ * \param pq  parsed query to fill
+ * \return false on memory error
+ */
+static bool
+tds7_replace_placeholders(struct tds_parsed_query *pq)
+{
+	const char *const query_end = pq->converted + pq->converted_len;
+	const char *s, *e;
+	char buf[24], *out;
+	size_t len;
+	int i;
+
+	len = pq->num_placeholders * 2;
+	/* adjust for the length of X */
+	for (i = 10; i <= pq->num_placeholders; i *= 10)
+		len += pq->num_placeholders - i + 1;
+	len = 2u * len + pq->converted_len;
+
+	out = pq->replaced = tds_new(char, len);
+	if (!out)
+		return false;
+	pq->replaced_len = len;
+
+	s = pq->converted;
+	/* TODO do a test with "...?" and "...?)" */
+	for (i = 1;; ++i) {
+		e = tds_next_placeholder_ucs2le(s, query_end, 0);
+		assert(e && pq->converted <= e && e <= query_end);
+		memcpy(out, s, e - s);
+		out += e - s;
+		if (e == query_end)
+			break;
+		sprintf(buf, "@P%d", i);
+		out += tds_ascii_to_ucs2(out, buf);
+		s = e + 2;
+	}
+	assert(out == pq->replaced + len);
+	return true;
+}
+
+static void
+tds7_link_parsed_query(TDSSOCKET *tds, struct tds_parsed_query *pq, uint32_t hash)
+{
+	pq->prev = tds->parsed_last;
+	if (tds->parsed_last)
+		tds->parsed_last->next = pq;
+	else
+		tds->parsed_first = pq;
+	tds->parsed_last = pq;
+	tds_hash_insert(&tds->parsed_queries, &pq->entry, hash);
+	++tds->num_parsed;
+}
+
+/**
+ * Search a query kept by the socket, marking it as recently used.
+ * \return query found or NULL
+ */
+static struct tds_parsed_query *
+tds7_find_parsed_query(TDSSOCKET *tds, const char *query, size_t query_len, uint32_t hash)
+{
+	TDS_HASH_ENTRY *entry;
+
+	TDS_HASH_FOREACH(&tds->parsed_queries, hash, entry) {
+		struct tds_parsed_query *pq = TDS_HASH_ITEM(entry, struct tds_parsed_query, entry);
+
+		if (pq->query_len != query_len || memcmp(pq->query, query, query_len) != 0)
+			continue;
+
+		/* move to the end of the list */
+		if (pq != tds->parsed_last) {
+			tds_unlink_parsed_query(tds, pq);
+			tds7_link_parsed_query(tds, pq, hash);
+		}
+		return pq;
+	}
+	return NULL;
+}
+
+/**
+ * Parse a new query and keep it in the socket.
+ * \param converted     query already converted to UCS-2, NULL to convert it
+ * \param converted_len length of converted in bytes
+ * \return parsed query or NULL on error
+ */
+static struct tds_parsed_query *
+tds7_new_parsed_query(TDSSOCKET *tds, const char *query, size_t query_len, uint32_t hash,
+		      const char *converted, size_t converted_len)
+{
+	struct tds_parsed_query *pq;
+
+	pq = (struct tds_parsed_query *) calloc(1, TDS_OFFSET(struct tds_parsed_query, query) + query_len + 1);
+	if (!pq)
+		return NULL;
+	memcpy(pq->query, query, query_len);
+	pq->query_len = query_len;
+
+	if (!converted) {
+		converted = tds_convert_string(tds, tds->conn->char_convs[client2ucs2], query, query_len, &converted_len);
+		if (!converted)
+			goto error;
+		if (converted != query)
+			pq->converted = (char *) converted;
+	}
+	pq->converted_len = converted_len;
+	if (!pq->converted) {
+		pq->converted = tds_new(char, converted_len + 1);
+		if (!pq->converted)
+			goto error;
+		memcpy(pq->converted, converted, converted_len);
+	}
+
+	pq->num_placeholders = tds_count_placeholders_ucs2le(pq->converted, pq->converted + pq->converted_len);
+	if (pq->num_placeholders && !tds7_replace_placeholders(pq))
+		goto error;
+
+	/* do not keep huge queries */
+	if (query_len > TDS_MAX_PARSED_QUERY_LEN)
+		return pq;
+
+	/* remove oldest query */
+	if (tds->num_parsed >= TDS_MAX_PARSED_QUERIES) {
+		struct tds_parsed_query *old = tds->parsed_first;
+
+		tds_unlink_parsed_query(tds, old);
+		tds_free_parsed_query(old);
+	}
+
+	tds7_link_parsed_query(tds, pq, hash);
+	return pq;
+
+error:
+	tds_free_parsed_query(pq);
+	return NULL;
+}
+
+/**
+ * Get a query converted for RPC calls.
+ * Recently used queries are kept by the socket to avoid converting
+ * and scanning them again.
+ * Result must be released with tds7_release_parsed_query.
+ * \tds
+ * \param query     query to convert
+ * \param query_len query length in bytes
+ * \return parsed query or NULL on error
+ */
+static struct tds_parsed_query *
+tds7_get_parsed_query(TDSSOCKET *tds, const char *query, size_t query_len)
+{
+	uint32_t hash = tds_hash_bytes(query, query_len);
+	struct tds_parsed_query *pq = tds7_find_parsed_query(tds, query, query_len, hash);
+
+	if (pq)
+		return pq;
+	return tds7_new_parsed_query(tds, query, query_len, hash, NULL, 0);
+}
+
+/**
+ * Provide the UCS-2 encoding of a query.
+ * Useful if the caller has the query in both client and server encoding
+ * (like ODBC wide functions) to avoid converting it again when sent.
+ * \tds
+ * \param query         query in client encoding
+ * \param query_len     query length in bytes
+ * \param converted     query encoded in UCS-2 little endian
+ * \param converted_len length of converted in bytes
+ */
+void
+tds_set_query_ucs2(TDSSOCKET *tds, const char *query, size_t query_len, const char *converted, size_t converted_len)
+{
+	uint32_t hash;
+	struct tds_parsed_query *pq;
+
+	if (!IS_TDS7_PLUS(tds->conn) || query_len > TDS_MAX_PARSED_QUERY_LEN || (converted_len % 2) != 0)
+		return;
+
+	hash = tds_hash_bytes(query, query_len);
+	if (tds7_find_parsed_query(tds, query, query_len, hash))
+		return;
+	pq = tds7_new_parsed_query(tds, query, query_len, hash, converted, converted_len);
+	if (pq)
+		tds7_release_parsed_query(pq);
+}
+
+/**
+ * Release a query returned by tds7_get_parsed_query
+ * \param pq  query to release
+ */
+static void
+tds7_release_parsed_query(struct tds_parsed_query *pq)
+{
+	/* not kept by the socket */
+	if (!tds_hash_linked(&pq->entry))
+		tds_free_parsed_query(pq);
+}
+
+/**
+ * Compute values on which declaration of a parameter depends.
+ * \param params parameters, NULL if not available
+ * \param i      parameter index
+ * \param sig    output values
+ */
+static void
+tds7_param_signature(const TDSPARAMINFO *params, int i, TDS_INT sig[TDS_PARAM_SIG_LEN])
+{
+	const TDSCOLUMN *col;
+
+	if (!params || i >= params->num_cols) {
+		memset(sig, 0xff, sizeof(TDS_INT) * TDS_PARAM_SIG_LEN);
+		return;
+	}
+	col = params->columns[i];
+	sig[0] = col->on_server.column_type;
+	sig[1] = col->on_server.column_size;
+	sig[2] = col->on_server.column_size ? 0 : col->column_size;
+	sig[3] = col->column_varint_size;
+	sig[4] = col->column_prec;
+	sig[5] = col->column_scale;
+	sig[6] = col->column_usertype;
+}
+
+/**
+ * Build declaration of parameters for a query.
+ * Declaration is kept with parameters types so next executions with same
+ * types do not need to compute it again.
+ * \tds
+ * \param pq      parsed query
+ * \param params  parameters to build declaration
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+static TDSRET
+tds7_build_param_def(TDSSOCKET * tds, struct tds_parsed_query *pq, TDSPARAMINFO * params)
+{
+	char declaration[128], *p, *decl = NULL;
+	TDS_INT *sig;
+	size_t decl_len = 0;
+	int i;
+
+	sig = tds_new(TDS_INT, TDS_PARAM_SIG_LEN * pq->num_placeholders + 1);
+	if (!sig)
+		return TDS_FAIL;
+
+	for (i = 0; i < pq->num_placeholders; ++i) {
+		char *new_decl;
+
+		tds7_param_signature(params, i, sig + i * TDS_PARAM_SIG_LEN);
+
+		p = declaration;
+		if (i)
+			*p++ = ',';
+
+		/* get this parameter declaration */
+		p += sprintf(p, "@P%d ", i+1);
+		if (!params || i >= params->num_cols) {
+			strcpy(p, "varchar(4000)");
+		} else if (TDS_FAILED(tds_get_column_declaration(tds, params->columns[i], p))) {
+			goto error;
+		}
+
+		/* declaration is always ASCII */
+		new_decl = (char *) realloc(decl, decl_len + strlen(declaration) * 2u);
+		if (!new_decl)
+			goto error;
+		decl = new_decl;
+		decl_len += tds_ascii_to_ucs2(decl + decl_len, declaration);
+	}
+
+	free(pq->decl);
+	free(pq->decl_sig);
+	pq->decl = decl;
+	pq->decl_len = decl_len;
+	pq->decl_sig = sig;
+	return TDS_SUCCESS;
+
+error:
+	free(decl);
+	free(sig);
+	return TDS_FAIL;
+}
+
 /**
  * Write string with parameters definition, useful for TDS7+.
  * Looks like "@P1 INT, @P2 VARCHAR(100)"
  * \param tds     state information for the socket and the TDS protocol
- * \param converted_query     query to send to server in ucs2le encoding
- * \param converted_query_len query length in bytes
+ * \param pq      parsed query
  * \param params  parameters to build declaration
  * \return result of write
  */
 /* TODO find a better name for this function */
 static TDSRET
-tds7_write_param_def_from_query(TDSSOCKET * tds, const char* converted_query, size_t converted_query_len, TDSPARAMINFO * params)
+tds7_write_param_def_from_query(TDSSOCKET * tds, struct tds_parsed_query *pq, TDSPARAMINFO * params)
 {
-	char declaration[128], *p;
-	int i, count;
-	unsigned int written;
-	TDSFREEZE outer, inner;
+	int i;
 
 	assert(IS_TDS7_PLUS(tds->conn));
 
@@ -981,7 +1334,16 @@ tds7_write_param_def_from_query(TDSSOCKET * tds, const char* converted_query, si
 	if (params)
 		CHECK_PARAMINFO_EXTRA(params);
 
-	count = tds_count_placeholders_ucs2le(converted_query, converted_query + converted_query_len);
+	/* check if types changed since last declaration */
+	for (i = 0; pq->decl_sig && i < pq->num_placeholders; ++i) {
+		TDS_INT sig[TDS_PARAM_SIG_LEN];
+
+		tds7_param_signature(params, i, sig);
+		if (memcmp(sig, pq->decl_sig + i * TDS_PARAM_SIG_LEN, sizeof(sig)) != 0)
+			break;
+	}
+	if (!pq->decl_sig || i < pq->num_placeholders)
+		TDS_PROPAGATE(tds7_build_param_def(tds, pq, params));
 
 	/* string with parameters types */
 	tds_put_byte(tds, 0);
@@ -989,32 +1351,12 @@ tds7_write_param_def_from_query(TDSSOCKET * tds, const char* converted_query, si
 	tds_put_byte(tds, SYBNTEXT);	/* must be Ntype */
 
 	/* put parameters definitions */
-	tds_freeze(tds, &outer, 4);
+	TDS_PUT_INT(tds, pq->decl_len);
 	if (IS_TDS71_PLUS(tds->conn))
 		tds_put_n(tds, tds->conn->collation, 5);
-	tds_freeze(tds, &inner, 4);
-
-	for (i = 0; i < count; ++i) {
-		p = declaration;
-		if (i)
-			*p++ = ',';
-
-		/* get this parameter declaration */
-		p += sprintf(p, "@P%d ", i+1);
-		if (!params || i >= params->num_cols) {
-			strcpy(p, "varchar(4000)");
-		} else if (TDS_FAILED(tds_get_column_declaration(tds, params->columns[i], p))) {
-			tds_freeze_abort(&inner);
-			tds_freeze_abort(&outer);
-			return TDS_FAIL;
-		}
-
-		tds_put_string(tds, declaration, -1);
-	}
-
-	written = tds_freeze_written(&inner) - 4;
-	tds_freeze_close_len(&inner, written ? written : -1);
-	tds_freeze_close_len(&outer, written);
+	TDS_PUT_INT(tds, pq->decl_len ? (TDS_INT) pq->decl_len : -1);
+	if (pq->decl_len)
+		tds_put_n(tds, pq->decl, pq->decl_len);
 	return TDS_SUCCESS;
 }
 
@@ -1124,53 +1466,29 @@ tds7_write_param_def_from_params(TDSSOCKET * tds, const char* query, size_t quer
 
 /**
  * Output params types and query (required by sp_prepare/sp_executesql/sp_prepexec)
- * \param tds       state information for the socket and the TDS protocol
- * \param query     query (encoded in ucs2le)
- * \param query_len query length in bytes
+ * \param tds  state information for the socket and the TDS protocol
+ * \param pq   parsed query
  */
 static void
-tds7_put_query_params(TDSSOCKET * tds, const char *query, size_t query_len)
+tds7_put_query_params(TDSSOCKET * tds, const struct tds_parsed_query *pq)
 {
-	size_t len;
-	int i, num_placeholders;
-	const char *s, *e;
-	char buf[24];
-	const char *const query_end = query + query_len;
+	/* we use all "@PX" for parameters */
+	const char *query = pq->replaced ? pq->replaced : pq->converted;
+	size_t len = pq->replaced ? pq->replaced_len : pq->converted_len;
 
 	CHECK_TDS_EXTRA(tds);
 
 	assert(IS_TDS7_PLUS(tds->conn));
 
-	/* we use all "@PX" for parameters */
-	num_placeholders = tds_count_placeholders_ucs2le(query, query_end);
-	len = num_placeholders * 2;
-	/* adjust for the length of X */
-	for (i = 10; i <= num_placeholders; i *= 10) {
-		len += num_placeholders - i + 1;
-	}
-
 	/* string with sql statement */
-	/* replace placeholders with dummy parametes */
 	tds_put_byte(tds, 0);
 	tds_put_byte(tds, 0);
 	tds_put_byte(tds, SYBNTEXT);	/* must be Ntype */
-	len = 2u * len + query_len;
 	TDS_PUT_INT(tds, len);
 	if (IS_TDS71_PLUS(tds->conn))
 		tds_put_n(tds, tds->conn->collation, 5);
 	TDS_PUT_INT(tds, len);
-	s = query;
-	/* TODO do a test with "...?" and "...?)" */
-	for (i = 1;; ++i) {
-		e = tds_next_placeholder_ucs2le(s, query_end, 0);
-		assert(e && query <= e && e <= query_end);
-		tds_put_n(tds, s, e - s);
-		if (e == query_end)
-			break;
-		sprintf(buf, "@P%d", i);
-		tds_put_string(tds, buf, -1);
-		s = e + 2;
-	}
+	tds_put_n(tds, query, len);
 }
 
 /**
@@ -1220,7 +1538,10 @@ tds_submit_prepare(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMI
 			goto failure;
 	}
 
-	if (!IS_TDS50(tds->conn) && !IS_TDS7_PLUS(tds->conn)) {
+	/* TDS 4.2 or query already refused by server */
+	if ((!IS_TDS50(tds->conn) && !IS_TDS7_PLUS(tds->conn))
+	    || (IS_TDS50(tds->conn) && tds_dynamic_must_emulate(tds->conn, query))) {
+		tdsdump_log(TDS_DBG_INFO1, "tds_submit_prepare() emulating prepare\n");
 		dyn->emulated = true;
 		tds_dynamic_deallocated(tds->conn, dyn);
 		tds_set_state(tds, TDS_IDLE);
@@ -1232,13 +1553,12 @@ tds_submit_prepare(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMI
 	tds_set_cur_dyn(tds, dyn);
 
 	if (IS_TDS7_PLUS(tds->conn)) {
-		size_t converted_query_len;
-		const char *converted_query;
+		struct tds_parsed_query *pq;
 		TDSFREEZE outer;
 		TDSRET rc;
 
-		converted_query = tds_convert_string(tds, tds->conn->char_convs[client2ucs2], query, query_len, &converted_query_len);
-		if (!converted_query)
+		pq = tds7_get_parsed_query(tds, query, query_len);
+		if (!pq)
 			goto failure;
 
 		tds_freeze(tds, &outer, 0);
@@ -1259,9 +1579,9 @@ tds_submit_prepare(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMI
 		tds_put_byte(tds, 4);
 		tds_put_byte(tds, 0);
 
-		rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
-		tds7_put_query_params(tds, converted_query, converted_query_len);
-		tds_convert_string_free(query, converted_query);
+		rc = tds7_write_param_def_from_query(tds, pq, params);
+		tds7_put_query_params(tds, pq);
+		tds7_release_parsed_query(pq);
 		if (TDS_FAILED(rc)) {
 			tds_freeze_abort(&outer);
 			return rc;
@@ -1324,7 +1644,6 @@ TDSRET
 tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params, TDSHEADERS * head)
 {
 	size_t query_len;
-	TDSCOLUMN *param;
 	TDSDYNAMIC *dyn;
 	unsigned int id_len;
 	TDSFREEZE outer;
@@ -1337,22 +1656,20 @@ tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params,
 	query_len = strlen(query);
 
 	if (IS_TDS7_PLUS(tds->conn)) {
-		int i;
-		size_t converted_query_len;
-		const char *converted_query;
+		struct tds_parsed_query *pq;
 		TDSRET rc;
 
 		if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
 			return TDS_FAIL;
 
-		converted_query = tds_convert_string(tds, tds->conn->char_convs[client2ucs2], query, (int)query_len, &converted_query_len);
-		if (!converted_query) {
+		pq = tds7_get_parsed_query(tds, query, query_len);
+		if (!pq) {
 			tds_set_state(tds, TDS_IDLE);
 			return TDS_FAIL;
 		}
 
 		if (tds_start_query_head(tds, TDS_RPC, head) != TDS_SUCCESS) {
-			tds_convert_string_free(query, converted_query);
+			tds7_release_parsed_query(pq);
 			return TDS_FAIL;
 		}
 		tds_freeze(tds, &outer, 0);
@@ -1365,23 +1682,19 @@ tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params,
 		}
 		tds_put_smallint(tds, 0);
 
-		tds7_put_query_params(tds, converted_query, converted_query_len);
-		rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
-		tds_convert_string_free(query, converted_query);
+		tds7_put_query_params(tds, pq);
+		rc = tds7_write_param_def_from_query(tds, pq, params);
+		tds7_release_parsed_query(pq);
 		if (TDS_FAILED(rc)) {
 			tds_freeze_abort(&outer);
 			return rc;
 		}
 		tds_freeze_close(&outer);
 
-		for (i = 0; i < params->num_cols; i++) {
-			param = params->columns[i];
-			TDS_PROPAGATE(tds_put_data_info(tds, param, 0));
-			TDS_PROPAGATE(tds_put_data(tds, param));
-		}
+		TDS_PROPAGATE(tds7_put_params(tds, params, 0, 0));
 
 		tds->current_op = TDS_OP_EXECUTESQL;
-		return tds_query_flush_packet(tds);
+		return tds_query_flush_params(tds);
 	}
 
 	/* allocate a structure for this thing */
@@ -1471,8 +1784,7 @@ tds71_submit_prepexec(TDSSOCKET * tds, const char *query, const char *id, TDSDYN
 	int query_len;
 	TDSRET rc = TDS_FAIL;
 	TDSDYNAMIC *dyn;
-	size_t converted_query_len;
-	const char *converted_query;
+	struct tds_parsed_query *pq;
 	TDSFREEZE outer;
 
 	CHECK_TDS_EXTRA(tds);
@@ -1496,8 +1808,8 @@ tds71_submit_prepexec(TDSSOCKET * tds, const char *query, const char *id, TDSDYN
 
 	query_len = (int)strlen(query);
 
-	converted_query = tds_convert_string(tds, tds->conn->char_convs[client2ucs2], query, query_len, &converted_query_len);
-	if (!converted_query)
+	pq = tds7_get_parsed_query(tds, query, query_len);
+	if (!pq)
 		goto failure;
 
 	tds_freeze(tds, &outer, 0);
@@ -1518,28 +1830,21 @@ tds71_submit_prepexec(TDSSOCKET * tds, const char *query, const char *id, TDSDYN
 	tds_put_byte(tds, 4);
 	tds_put_byte(tds, 0);
 
-	rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
-	tds7_put_query_params(tds, converted_query, converted_query_len);
-	tds_convert_string_free(query, converted_query);
+	rc = tds7_write_param_def_from_query(tds, pq, params);
+	tds7_put_query_params(tds, pq);
+	tds7_release_parsed_query(pq);
 	if (TDS_FAILED(rc)) {
 		tds_freeze_abort(&outer);
 		return rc;
 	}
 	tds_freeze_close(&outer);
 
-	if (params) {
-		int i;
-
-		for (i = 0; i < params->num_cols; i++) {
-			TDSCOLUMN *param = params->columns[i];
-			TDS_PROPAGATE(tds_put_data_info(tds, param, 0));
-			TDS_PROPAGATE(tds_put_data(tds, param));
-		}
-	}
+	if (params)
+		TDS_PROPAGATE(tds7_put_params(tds, params, 0, 0));
 
 	tds->current_op = TDS_OP_PREPEXEC;
 
-	rc = tds_query_flush_packet(tds);
+	rc = tds_query_flush_params(tds);
 	if (TDS_SUCCEED(rc))
 		return rc;
 
@@ -1648,6 +1953,142 @@ tds_put_data_info(TDSSOCKET * tds, TDSCOLUMN * curcol, int flags)
 	return TDS_SUCCESS;
 }
 
+/**
+ * Check if a parameter can be sent using tds_stream_param_write.
+ * Only varchar(max)/varbinary(max) types can be sent in chunks of
+ * unknown total length and data must not require conversion.
+ * \tds
+ * \param col  parameter to check
+ */
+bool
+tds_param_streamable(TDSSOCKET * tds, const TDSCOLUMN * col)
+{
+	if (!IS_TDS72_PLUS(tds->conn) || col->column_varint_size != 8)
+		return false;
+	if (col->on_server.column_type != XSYBVARBINARY && col->on_server.column_type != XSYBVARCHAR
+	    && col->on_server.column_type != XSYBNVARCHAR)
+		return false;
+	return !col->use_iconv_out || !col->char_conv || col->char_conv->flags == TDS_ENCODING_MEMCPY;
+}
+
+/**
+ * Write RPC parameters to wire.
+ * Writing stops after the header of a parameter marked with column_stream,
+ * its data is then sent with tds_stream_param_write and remaining
+ * parameters by tds_stream_param_end.
+ * \tds
+ * \param params  parameters to write
+ * \param first   index of first parameter to write
+ * \param flags   flags for tds_put_data_info
+ */
+static TDSRET
+tds7_put_params(TDSSOCKET * tds, TDSPARAMINFO * params, int first, int flags)
+{
+	int i;
+
+	for (i = first; i < params->num_cols; i++) {
+		TDSCOLUMN *param = params->columns[i];
+
+		TDS_PROPAGATE(tds_put_data_info(tds, param, flags));
+		if (param->column_stream && tds_param_streamable(tds, param)) {
+			/* length is not known, data follows in chunks */
+			tds_put_int8(tds, (TDS_INT8) -2);
+			++params->ref_count;
+			tds->stream_params = params;
+			tds->stream_param_next = i + 1;
+			tds->stream_param_flags = flags;
+			return TDS_SUCCESS;
+		}
+		TDS_PROPAGATE(tds_put_data(tds, param));
+	}
+	return TDS_SUCCESS;
+}
+
+/**
+ * Write a piece of the parameter being streamed.
+ * Data is sent as is so must be already in server encoding.
+ * \tds
+ * \param data  data to write
+ * \param len   length of data, in bytes
+ * \return TDS_FAIL if no parameter is streamed or on error
+ */
+TDSRET
+tds_stream_param_write(TDSSOCKET * tds, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+
+	if (!tds->stream_params || tds->state != TDS_WRITING)
+		return TDS_FAIL;
+
+	while (len) {
+		TDS_INT chunk = (TDS_INT) TDS_MIN(len, 0x40000000u);
+
+		tds_put_int(tds, chunk);
+		tds_put_n(tds, p, chunk);
+		p += chunk;
+		len -= chunk;
+	}
+	return IS_TDSDEAD(tds) ? TDS_FAIL : TDS_SUCCESS;
+}
+
+/**
+ * Terminate the parameter being streamed.
+ * Remaining parameters are written and the request is sent to the server,
+ * unless another parameter has to be streamed.
+ * \tds
+ */
+TDSRET
+tds_stream_param_end(TDSSOCKET * tds)
+{
+	TDSPARAMINFO *params = tds->stream_params;
+	TDSRET rc;
+
+	if (!params)
+		return TDS_FAIL;
+
+	tds->stream_params = NULL;
+	if (tds->state != TDS_WRITING) {
+		tds_free_param_results(params);
+		return TDS_FAIL;
+	}
+
+	/* PLP terminator */
+	tds_put_int(tds, 0);
+	rc = tds7_put_params(tds, params, tds->stream_param_next, tds->stream_param_flags);
+	tds_free_param_results(params);
+	TDS_PROPAGATE(rc);
+	return tds_query_flush_params(tds);
+}
+
+/**
+ * Abort the request whose parameter is being streamed.
+ * Last packet is sent with the ignore flag so the server discards the
+ * request; caller should then send a cancel to synchronize with the server.
+ * \tds
+ */
+TDSRET
+tds_stream_param_abort(TDSSOCKET * tds)
+{
+	TDSPARAMINFO *params = tds->stream_params;
+	TDSRET rc;
+
+	if (!params)
+		return TDS_FAIL;
+
+	tds->stream_params = NULL;
+	tds_free_param_results(params);
+	if (tds->state != TDS_WRITING)
+		return TDS_FAIL;
+
+	if (tds->out_pos > tds->out_buf_max)
+		TDS_PROPAGATE(tds_write_packet(tds, 0x00));
+	/* end of message and ignore this event */
+	rc = tds_write_packet(tds, 0x03);
+	if (TDS_SUCCEED(rc))
+		tds_set_state(tds, TDS_PENDING);
+	return rc;
+}
+
 /**
  * Send dynamic request on TDS 7+ to be executed
  * \tds
@@ -1656,10 +2097,6 @@ tds_put_data_info(TDSSOCKET * tds, TDSCOLUMN * curcol, int flags)
 static TDSRET
 tds7_send_execute(TDSSOCKET * tds, TDSDYNAMIC * dyn)
 {
-	TDSCOLUMN *param;
-	TDSPARAMINFO *info;
-	int i;
-
 	/* procedure name */
 	/* NOTE do not call this procedure using integer name (TDS_SP_EXECUTE) on mssql2k, it doesn't work! */
 	TDS_PUT_N_AS_UCS2(tds, "sp_execute");
@@ -1673,13 +2110,8 @@ tds7_send_execute(TDSSOCKET * tds, TDSDYNAMIC * dyn)
 	tds_put_byte(tds, 4);
 	tds_put_int(tds, dyn->num_id);
 
-	info = dyn->params;
-	if (info)
-		for (i = 0; i < info->num_cols; i++) {
-			param = info->columns[i];
-			TDS_PROPAGATE(tds_put_data_info(tds, param, 0));
-			TDS_PROPAGATE(tds_put_data(tds, param));
-		}
+	if (dyn->params)
+		TDS_PROPAGATE(tds7_put_params(tds, dyn->params, 0, 0));
 
 	tds->current_op = TDS_OP_EXECUTE;
 	return TDS_SUCCESS;
@@ -1714,9 +2146,9 @@ tds_submit_execute(TDSSOCKET * tds, TDSDYNAMIC * dyn)
 		/* RPC on sp_execute */
 		tds_start_query(tds, TDS_RPC);
 
-		tds7_send_execute(tds, dyn);
+		TDS_PROPAGATE(tds7_send_execute(tds, dyn));
 
-		return tds_query_flush_packet(tds);
+		return tds_query_flush_params(tds);
 	}
 
 	if (dyn->emulated) {
@@ -1992,8 +2424,6 @@ tds4_send_emulated_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * par
 TDSRET
 tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params, TDSHEADERS * head)
 {
-	TDSCOLUMN *param;
-	int i;
 	int num_params = params ? params->num_cols : 0;
 
 	CHECK_TDS_EXTRA(tds);
@@ -2026,13 +2456,10 @@ tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params, TDS
 		 */
 		tds_put_smallint(tds, 0);
 
-		for (i = 0; i < num_params; i++) {
-			param = params->columns[i];
-			TDS_PROPAGATE(tds_put_data_info(tds, param, TDS_PUT_DATA_USE_NAME));
-			TDS_PROPAGATE(tds_put_data(tds, param));
-		}
+		if (num_params)
+			TDS_PROPAGATE(tds7_put_params(tds, params, 0, TDS_PUT_DATA_USE_NAME));
 
-		return tds_query_flush_packet(tds);
+		return tds_query_flush_params(tds);
 	}
 
 	if (IS_TDS50(tds->conn)) {
@@ -2395,17 +2822,14 @@ tds_cursor_open(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, bool
 		*something_to_send = true;
 	}
 	if (IS_TDS7_PLUS(tds->conn)) {
-		const char *converted_query;
-		size_t converted_query_len;
+		struct tds_parsed_query *pq;
 		int num_params = params ? params->num_cols : 0;
 		TDSFREEZE outer;
 		TDSRET rc = TDS_SUCCESS;
 
 		/* cursor statement */
-		converted_query =
-			tds_convert_string(tds, tds->conn->char_convs[client2ucs2], cursor->query,
-					   strlen(cursor->query), &converted_query_len);
-		if (!converted_query) {
+		pq = tds7_get_parsed_query(tds, cursor->query, strlen(cursor->query));
+		if (!pq) {
 			if (!*something_to_send)
 				tds_set_state(tds, TDS_IDLE);
 			return TDS_FAIL;
@@ -2436,16 +2860,16 @@ tds_cursor_open(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, bool
 		tds_put_byte(tds, 0);
 
 		if (num_params) {
-			tds7_put_query_params(tds, converted_query, converted_query_len);
+			tds7_put_query_params(tds, pq);
 		} else {
 			tds_put_byte(tds, 0);
 			tds_put_byte(tds, 0);
 			tds_put_byte(tds, SYBNTEXT);	/* must be Ntype */
-			TDS_PUT_INT(tds, converted_query_len);
+			TDS_PUT_INT(tds, pq->converted_len);
 			if (IS_TDS71_PLUS(tds->conn))
 				tds_put_n(tds, tds->conn->collation, 5);
-			TDS_PUT_INT(tds, converted_query_len);
-			tds_put_n(tds, converted_query, (int)converted_query_len);
+			TDS_PUT_INT(tds, pq->converted_len);
+			tds_put_n(tds, pq->converted, pq->converted_len);
 		}
 
 		/* type */
@@ -2475,7 +2899,7 @@ tds_cursor_open(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, bool
 		if (num_params) {
 			int i;
 
-			rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
+			rc = tds7_write_param_def_from_query(tds, pq, params);
 
 			for (i = 0; i < num_params; i++) {
 				TDSCOLUMN *param = params->columns[i];
@@ -2485,7 +2909,7 @@ tds_cursor_open(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, bool
 				tds_put_data(tds, param);
 			}
 		}
-		tds_convert_string_free(cursor->query, converted_query);
+		tds7_release_parsed_query(pq);
 		if (TDS_FAILED(rc)) {
 			tds_freeze_abort(&outer);
 			if (!*something_to_send)
@@ -40,6 +40,10 @@
 #include <unistd.h>
 #endif /* HAVE_UNISTD_H */
 
+#ifdef _WIN32
+#include <io.h>
+#endif
+
 #include <assert.h>
 
 #include <freetds/tds.h>
@@ -374,4 +378,45 @@ tds_dynamic_stream_init(TDSDYNAMICSTREAM * stream, void **ptr, size_t allocated)
 	return TDS_SUCCESS;
 }
 
+/**
+ * Writes data to a file descriptor
+ */
+static int
+tds_fdout_stream_write(TDSOUTSTREAM *stream, size_t len)
+{
+	TDSFDOUTSTREAM *s = (TDSFDOUTSTREAM *) stream;
+	const char *p = s->buf;
+	size_t left = len;
+
+	assert(len <= sizeof(s->buf));
+	while (left) {
+		int n = (int) write(s->fd, p, (unsigned int) left);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		left -= n;
+	}
+	s->written += len;
+	return (int) len;
+}
 
+/**
+ * Initialize an output stream for write into a file descriptor.
+ * Data are written to the file descriptor as soon as they are
+ * available, no flush is needed.
+ * \param stream stream to initialize
+ * \param fd file descriptor to write to, can be a file, a pipe or a socket
+ */
+void
+tds_fdout_stream_init(TDSFDOUTSTREAM * stream, int fd)
+{
+	stream->stream.write = tds_fdout_stream_write;
+	stream->stream.buffer = stream->buf;
+	stream->stream.buf_len = sizeof(stream->buf);
+	stream->fd = fd;
+	stream->written = 0;
+}
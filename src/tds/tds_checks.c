@@ -134,12 +134,18 @@ tds_check_tds_extra(const TDSSOCKET * tds)
 		tds_check_resultinfo_extra(tds->param_info);
 
 	/* test cursors */
-	for (cur_cursor = tds->conn->cursors; cur_cursor != NULL; cur_cursor = cur_cursor->next)
+	for (cur_cursor = tds->conn->cursors; cur_cursor != NULL; cur_cursor = cur_cursor->next) {
 		tds_check_cursor_extra(cur_cursor);
+		assert(cur_cursor->prev ? cur_cursor->prev->next == cur_cursor : tds->conn->cursors == cur_cursor);
+		assert(cur_cursor->next || tds->conn->cursors_last == cur_cursor);
+	}
 
 	/* test dynamics */
-	for (cur_dyn = tds->conn->dyns; cur_dyn != NULL; cur_dyn = cur_dyn->next)
+	for (cur_dyn = tds->conn->dyns; cur_dyn != NULL; cur_dyn = cur_dyn->next) {
 		tds_check_dynamic_extra(cur_dyn);
+		assert(tds_lookup_dynamic(tds->conn, cur_dyn->id) == cur_dyn);
+		assert(cur_dyn->prev ? cur_dyn->prev->next == cur_dyn : tds->conn->dyns == cur_dyn);
+	}
 
 	/* test tds_ctx */
 	tds_check_context_extra(tds_get_ctx(tds));
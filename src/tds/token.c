@@ -566,6 +566,10 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 	if (tds_set_state(tds, TDS_READING) != TDS_READING)
 		return TDS_FAIL;
 
+	/* discard columns of previous row left on the wire */
+	if (TDS_FAILED(tds_stream_skip_row(tds)))
+		return TDS_FAIL;
+
 	rc = TDS_SUCCESS;
 	for (;;) {
 
@@ -1937,6 +1941,44 @@ tds_process_compute(TDSSOCKET * tds)
 	return TDS_SUCCESS;
 }
 
+/**
+ * Leave remaining columns of current row on the wire if client asked to.
+ * All columns from \a first should be streamable, data will be read in order
+ * using tds_stream_column_read.
+ * \tds
+ * \param info  results of current row
+ * \param first first column not read
+ * \param nbc   bitmap of NULL columns, NULL if not a NBC row
+ * \return true if columns are left on the wire
+ */
+static bool
+tds_stream_columns(TDSSOCKET *tds, TDSRESULTINFO *info, unsigned int first, const char *nbc)
+{
+	unsigned int i;
+
+	for (i = first; i < info->num_cols; i++) {
+		TDSCOLUMN *curcol = info->columns[i];
+
+		if (!curcol->column_stream || !tds_column_streamable(tds, curcol))
+			return false;
+	}
+
+	for (i = first; i < info->num_cols; i++) {
+		TDSCOLUMN *curcol = info->columns[i];
+
+		curcol->column_cur_size = 0;
+		curcol->column_stream_pending = 1;
+		if (nbc && (nbc[i / 8] & (1 << (i % 8)))) {
+			curcol->column_cur_size = -1;
+			curcol->column_stream_pending = 0;
+		}
+	}
+	++info->ref_count;
+	tds->stream_info = info;
+	tdsdump_log(TDS_DBG_INFO1, "streaming columns from %u\n", first);
+	return true;
+}
+
 /**
  * tds_process_row() processes rows and places them in the row buffer.
  * \tds
@@ -1957,6 +1999,8 @@ tds_process_row(TDSSOCKET * tds)
 	for (i = 0; i < info->num_cols; i++) {
 		tdsdump_log(TDS_DBG_INFO1, "tds_process_row(): reading column %d \n", i);
 		curcol = info->columns[i];
+		if (curcol->column_stream && tds_stream_columns(tds, info, i, NULL))
+			break;
 		TDS_PROPAGATE(curcol->funcs->get_data(tds, curcol));
 	}
 	return TDS_SUCCESS;
@@ -1984,6 +2028,8 @@ tds_process_nbcrow(TDSSOCKET * tds)
 	for (i = 0; i < info->num_cols; i++) {
 		curcol = info->columns[i];
 		tdsdump_log(TDS_DBG_INFO1, "tds_process_nbcrow(): reading column %d \n", i);
+		if (curcol->column_stream && tds_stream_columns(tds, info, i, nbcbuf))
+			break;
 		if (nbcbuf[i / 8] & (1 << (i % 8))) {
 			curcol->column_cur_size = -1;
 		} else {
@@ -2489,8 +2535,7 @@ tds_process_info(TDSSOCKET * tds, int marker)
 	/* special case, */
 	if (marker == TDS_EED_TOKEN && tds->cur_dyn && !TDS_IS_MSSQL(tds) && msg.msgno == 2782) {
 		/* we must emulate prepare */
-		tds->cur_dyn->emulated = true;
-		tds_dynamic_deallocated(tds->conn, tds->cur_dyn);
+		tds_dynamic_set_emulated(tds->conn, tds->cur_dyn);
 	} else if (marker == TDS_INFO_TOKEN && msg.msgno == 16954 && TDS_IS_MSSQL(tds)
 		   && tds->current_op == TDS_OP_CURSOROPEN && tds->cur_cursor) {
 		/* here mssql say "Executing SQL directly; no cursor." opening cursor */
@@ -2589,11 +2634,13 @@ tds_process_cancel(TDSSOCKET * tds)
 TDSDYNAMIC *
 tds_lookup_dynamic(TDSCONNECTION * conn, const char *id)
 {
-	TDSDYNAMIC *curr;
+	TDS_HASH_ENTRY *entry;
 
 	CHECK_CONN_EXTRA(conn);
-	
-	for (curr = conn->dyns; curr != NULL; curr = curr->next) {
+
+	TDS_HASH_FOREACH(&conn->dyns_by_id, tds_hash_bytes(id, strlen(id)), entry) {
+		TDSDYNAMIC *curr = TDS_HASH_ITEM(entry, TDSDYNAMIC, id_entry);
+
 		if (!strcmp(curr->id, id))
 			return curr;
 	}
@@ -0,0 +1,79 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test searching columns by name.
+ */
+#include "common.h"
+#include <assert.h>
+
+#define NUM_COLS 1200
+
+static int
+find(TDSRESULTINFO *info, const char *name)
+{
+	return tds_find_column(info, name, strlen(name));
+}
+
+TEST_MAIN()
+{
+	TDSRESULTINFO *info;
+	TDSPARAMINFO *params;
+	char name[32];
+	int i;
+
+	info = tds_alloc_results(NUM_COLS);
+	assert(info);
+
+	for (i = 0; i < NUM_COLS; ++i) {
+		sprintf(name, "Col%d", i);
+		assert(tds_dstr_copy(&info->columns[i]->column_name, name));
+	}
+	/* duplicate name, first should be returned */
+	assert(tds_dstr_copy(&info->columns[NUM_COLS - 1]->column_name, "COL10"));
+
+	assert(find(info, "col0") == 0);
+	assert(find(info, "COL999") == 999);
+	assert(find(info, "col10") == 10);
+	assert(find(info, "Col1199") == -1);
+	assert(find(info, "col") == -1);
+	assert(find(info, "") == -1);
+	assert(tds_find_column(info, "col12xyz", 5) == 12);
+
+	/* rename, index must be reset */
+	assert(tds_dstr_copy(&info->columns[5]->column_name, "renamed"));
+	tds_reset_column_index(info);
+	assert(find(info, "RENAMED") == 5);
+	assert(find(info, "col5") == -1);
+
+	tds_free_results(info);
+
+	/* adding parameters must update index */
+	params = tds_alloc_param_result(NULL);
+	assert(params);
+	assert(tds_dstr_copy(&params->columns[0]->column_name, "@p1"));
+	assert(find(params, "@P1") == 0);
+	assert(find(params, "@p2") == -1);
+	assert(tds_alloc_param_result(params) == params);
+	assert(tds_dstr_copy(&params->columns[1]->column_name, "@p2"));
+	assert(find(params, "@p2") == 1);
+	tds_free_param_results(params);
+
+	return 0;
+}
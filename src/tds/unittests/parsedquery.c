@@ -0,0 +1,178 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test cache of queries converted for RPC calls.
+ */
+
+/* allows to use some internal functions */
+#undef NDEBUG
+#include "../query.c"
+
+#include "common.h"
+
+static TDSSOCKET *tds;
+
+static struct tds_parsed_query *
+get_query(const char *query)
+{
+	struct tds_parsed_query *pq = tds7_get_parsed_query(tds, query, strlen(query));
+
+	assert(pq);
+	return pq;
+}
+
+static bool
+is_cached(const char *query)
+{
+	size_t len = strlen(query);
+
+	return tds7_find_parsed_query(tds, query, len, tds_hash_bytes(query, len)) != NULL;
+}
+
+/* compare an UCS-2 string with an ASCII one */
+static bool
+ucs2_equal(const char *ucs2, size_t ucs2_len, const char *s)
+{
+	char buf[256];
+
+	assert(strlen(s) * 2 < sizeof(buf));
+	return tds_ascii_to_ucs2(buf, s) == ucs2_len && memcmp(buf, ucs2, ucs2_len) == 0;
+}
+
+/* a query used again is found in the cache */
+static void
+test_hit(void)
+{
+	struct tds_parsed_query *pq, *pq2;
+
+	pq = get_query("SELECT * FROM t WHERE a = ? AND b = '?'");
+	assert(tds->num_parsed == 1);
+	assert(pq->num_placeholders == 1);
+	assert(ucs2_equal(pq->converted, pq->converted_len, "SELECT * FROM t WHERE a = ? AND b = '?'"));
+	assert(ucs2_equal(pq->replaced, pq->replaced_len, "SELECT * FROM t WHERE a = @P1 AND b = '?'"));
+	tds7_release_parsed_query(pq);
+
+	pq2 = get_query("SELECT * FROM t WHERE a = ? AND b = '?'");
+	assert(pq2 == pq);
+	assert(tds->num_parsed == 1);
+	tds7_release_parsed_query(pq2);
+}
+
+/* a different text is a different entry, declaration is rebuilt if types change */
+static void
+test_invalidation(void)
+{
+	struct tds_parsed_query *pq, *pq2;
+	TDSPARAMINFO *params;
+	const char *decl;
+
+	tds_free_parsed_queries(tds);
+	pq = get_query("SELECT ?");
+	pq2 = get_query("SELECT ? ");
+	assert(pq != pq2);
+	assert(tds->num_parsed == 2);
+
+	params = tds_alloc_param_result(NULL);
+	assert(params);
+	tds_set_param_type(tds->conn, params->columns[0], SYBINT4);
+
+	/* first use builds declaration */
+	tds_init_write_buf(tds);
+	assert(TDS_SUCCEED(tds7_write_param_def_from_query(tds, pq, params)));
+	assert(ucs2_equal(pq->decl, pq->decl_len, "@P1 INT"));
+	decl = pq->decl;
+
+	/* same types, declaration kept */
+	tds_init_write_buf(tds);
+	assert(TDS_SUCCEED(tds7_write_param_def_from_query(tds, pq, params)));
+	assert(pq->decl == decl);
+
+	/* type changed, declaration built again */
+	tds_set_param_type(tds->conn, params->columns[0], SYBFLT8);
+	tds_init_write_buf(tds);
+	assert(TDS_SUCCEED(tds7_write_param_def_from_query(tds, pq, params)));
+	assert(pq->decl != decl);
+	assert(ucs2_equal(pq->decl, pq->decl_len, "@P1 FLOAT"));
+
+	tds_free_param_results(params);
+	tds7_release_parsed_query(pq);
+	tds7_release_parsed_query(pq2);
+	tds_init_write_buf(tds);
+}
+
+/* oldest query is removed when cache is full, huge queries are not kept */
+static void
+test_eviction(void)
+{
+	struct tds_parsed_query *pq;
+	char query[64], *huge;
+	int i;
+
+	tds_free_parsed_queries(tds);
+	assert(tds->num_parsed == 0);
+
+	tds7_release_parsed_query(get_query("SELECT 1"));
+	tds7_release_parsed_query(get_query("SELECT 2"));
+	/* use first query again so second one is the oldest */
+	assert(is_cached("SELECT 1"));
+
+	for (i = 0; i < TDS_MAX_PARSED_QUERIES - 1; ++i) {
+		sprintf(query, "SELECT %d + ?", i);
+		tds7_release_parsed_query(get_query(query));
+	}
+	assert(tds->num_parsed == TDS_MAX_PARSED_QUERIES);
+	assert(!is_cached("SELECT 2"));
+	assert(is_cached("SELECT 1"));
+
+	huge = tds_new(char, TDS_MAX_PARSED_QUERY_LEN + 2);
+	assert(huge);
+	memset(huge, ' ', TDS_MAX_PARSED_QUERY_LEN + 1);
+	memcpy(huge, "SELECT ?", 8);
+	huge[TDS_MAX_PARSED_QUERY_LEN + 1] = 0;
+	pq = get_query(huge);
+	assert(pq->num_placeholders == 1);
+	assert(!tds_hash_linked(&pq->entry));
+	assert(tds->num_parsed == TDS_MAX_PARSED_QUERIES);
+	tds7_release_parsed_query(pq);
+	free(huge);
+
+	tds_free_parsed_queries(tds);
+	assert(tds->num_parsed == 0 && !tds->parsed_first && !tds->parsed_last);
+}
+
+TEST_MAIN()
+{
+	TDSCONTEXT *ctx;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	tds->conn->tds_version = 0x704;
+	assert(TDS_SUCCEED(tds_iconv_open(tds->conn, "ISO-8859-1", 0)));
+
+	test_hit();
+	test_invalidation();
+	test_eviction();
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
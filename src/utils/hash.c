@@ -0,0 +1,175 @@
+/* Hash - intrusive hash table
+ * Copyright (C) 2026 Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#include <freetds/utils/hash.h>
+
+/** initialize an empty table */
+void
+tds_hash_init(TDS_HASH *hash)
+{
+	unsigned int i;
+
+	hash->buckets = NULL;
+	hash->mask = TDS_HASH_SMALL_BUCKETS - 1;
+	hash->count = 0;
+	for (i = 0; i < TDS_HASH_SMALL_BUCKETS; ++i)
+		hash->small_buckets[i] = NULL;
+}
+
+/**
+ * Free resources allocated by the table.
+ * Entries are not touched.
+ */
+void
+tds_hash_free(TDS_HASH *hash)
+{
+	free(hash->buckets);
+	tds_hash_init(hash);
+}
+
+static inline TDS_HASH_ENTRY **
+tds_hash_buckets(TDS_HASH *hash)
+{
+	return hash->buckets ? hash->buckets : hash->small_buckets;
+}
+
+static void
+tds_hash_link(TDS_HASH_ENTRY **bucket, TDS_HASH_ENTRY *entry)
+{
+	entry->next = *bucket;
+	if (entry->next)
+		entry->next->pprev = &entry->next;
+	entry->pprev = bucket;
+	*bucket = entry;
+}
+
+/* double number of buckets, on memory error just keep current ones */
+static void
+tds_hash_grow(TDS_HASH *hash)
+{
+	TDS_HASH_ENTRY **old_buckets = tds_hash_buckets(hash), **new_buckets;
+	uint32_t old_size = hash->mask + 1, new_mask = hash->mask * 2 + 1, i;
+
+	new_buckets = (TDS_HASH_ENTRY **) calloc((size_t) new_mask + 1, sizeof(TDS_HASH_ENTRY *));
+	if (!new_buckets)
+		return;
+
+	for (i = 0; i < old_size; ++i) {
+		TDS_HASH_ENTRY *entry, *next;
+
+		for (entry = old_buckets[i]; entry; entry = next) {
+			next = entry->next;
+			tds_hash_link(&new_buckets[entry->value & new_mask], entry);
+		}
+	}
+	free(hash->buckets);
+	hash->buckets = new_buckets;
+	hash->mask = new_mask;
+}
+
+/**
+ * Insert an entry in the table.
+ * The entry must not be already in a table.
+ * @param hash   table
+ * @param entry  entry to insert
+ * @param value  hash value of the key
+ */
+void
+tds_hash_insert(TDS_HASH *hash, TDS_HASH_ENTRY *entry, uint32_t value)
+{
+	assert(!tds_hash_linked(entry));
+
+	if (hash->count > hash->mask)
+		tds_hash_grow(hash);
+
+	entry->value = value;
+	tds_hash_link(&tds_hash_buckets(hash)[value & hash->mask], entry);
+	++hash->count;
+}
+
+/**
+ * Remove an entry from a table.
+ * Does nothing if entry is not in a table.
+ */
+void
+tds_hash_remove(TDS_HASH *hash, TDS_HASH_ENTRY *entry)
+{
+	if (!tds_hash_linked(entry))
+		return;
+
+	*entry->pprev = entry->next;
+	if (entry->next)
+		entry->next->pprev = entry->pprev;
+	entry->next = NULL;
+	entry->pprev = NULL;
+	--hash->count;
+}
+
+/** compute hash value of a buffer (FNV-1a) */
+uint32_t
+tds_hash_bytes(const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	uint32_t h = 2166136261u;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return tds_hash_uint(h);
+}
+
+/** compute hash value of a buffer ignoring ASCII letter case */
+uint32_t
+tds_hash_bytes_ci(const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	uint32_t h = 2166136261u;
+
+	while (len--) {
+		unsigned char c = *p++;
+
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h ^= c;
+		h *= 16777619u;
+	}
+	return tds_hash_uint(h);
+}
+
+/** compute hash value of an integer */
+uint32_t
+tds_hash_uint(uint32_t n)
+{
+	/* finalizer from MurmurHash3, spread all bits into the lower ones */
+	n ^= n >> 16;
+	n *= 0x85ebca6bu;
+	n ^= n >> 13;
+	n *= 0xc2b2ae35u;
+	n ^= n >> 16;
+	return n;
+}
@@ -41,10 +41,6 @@
  * (you don't have NULL pointer, only empty strings)
  */
 
-/* This is in a separate module because we use the pointer to discriminate allocated and not allocated */
-const struct tds_dstr tds_str_empty = { 0, "" };
-#define EMPTY ((struct tds_dstr*) &tds_str_empty)
-
 /**
  * \addtogroup dstring
  * @{ 
@@ -54,16 +50,15 @@ const struct tds_dstr tds_str_empty = { 0, "" };
 void
 tds_dstr_zero(DSTR * s)
 {
-	memset((*s)->dstr_s, 0, (*s)->dstr_size);
+	memset(tds_dstr_buf(s), 0, s->dstr_size);
 }
 
 /** free string */
 void
 tds_dstr_free(DSTR * s)
 {
-	if (*s != EMPTY)
-		free(*s);
-	*s = EMPTY;
+	free(s->dstr_heap);
+	tds_dstr_init(s);
 }
 
 /**
@@ -76,22 +71,22 @@ tds_dstr_free(DSTR * s)
 DSTR*
 tds_dstr_copyn(DSTR * s, const char *src, size_t length)
 {
-	if (!length) {
-		if (*s != EMPTY) {
-			free(*s);
-			*s = EMPTY;
-		}
+	if (length < TDS_DSTR_INLINE_SIZE) {
+		/* source could be our own buffer */
+		memmove(s->dstr_inline, src, length);
+		s->dstr_inline[length] = 0;
+		free(s->dstr_heap);
+		s->dstr_heap = NULL;
 	} else {
-		struct tds_dstr *p = (struct tds_dstr *) malloc(length + TDS_OFFSET(struct tds_dstr, dstr_s) + 1);
+		char *p = (char *) malloc(length + 1);
 		if (TDS_UNLIKELY(!p))
 			return NULL;
-		memcpy(p->dstr_s, src, length);
-		p->dstr_s[length] = 0;
-		p->dstr_size = length;
-		if (*s != EMPTY)
-			free(*s);
-		*s = p;
+		memcpy(p, src, length);
+		p[length] = 0;
+		free(s->dstr_heap);
+		s->dstr_heap = p;
 	}
+	s->dstr_size = length;
 	return s;
 }
 
@@ -106,7 +101,17 @@ tds_dstr_copyn(DSTR * s, const char *src, size_t length)
 DSTR*
 tds_dstr_set(DSTR * s, char *src)
 {
-	DSTR *res = tds_dstr_copy(s, src);
+	DSTR *res;
+	size_t length = strlen(src);
+
+	if (length >= TDS_DSTR_INLINE_SIZE) {
+		free(s->dstr_heap);
+		s->dstr_heap = src;
+		s->dstr_size = length;
+		return s;
+	}
+
+	res = tds_dstr_copyn(s, src, length);
 	if (TDS_LIKELY(res != NULL))
 		free(src);
 	return res;
@@ -133,7 +138,7 @@ tds_dstr_copy(DSTR * s, const char *src)
 DSTR*
 tds_dstr_dup(DSTR * s, const DSTR * src)
 {
-	return tds_dstr_copyn(s, (*src)->dstr_s, (*src)->dstr_size);
+	return tds_dstr_copyn(s, tds_dstr_cstr(src), src->dstr_size);
 }
 
 /**
@@ -145,12 +150,11 @@ DSTR*
 tds_dstr_setlen(DSTR *s, size_t length)
 {
 #if ENABLE_EXTRA_CHECKS
-	assert((*s)->dstr_size >= length);
+	assert(s->dstr_size >= length);
 #endif
-	/* test required for empty strings */
-	if ((*s)->dstr_size >= length && *s != EMPTY) {
-		(*s)->dstr_size = length;
-		(*s)->dstr_s[length] = 0;
+	if (s->dstr_size >= length) {
+		s->dstr_size = length;
+		tds_dstr_buf(s)[length] = 0;
 	}
 	return s;
 }
@@ -164,15 +168,19 @@ tds_dstr_setlen(DSTR *s, size_t length)
 DSTR*
 tds_dstr_alloc(DSTR *s, size_t length)
 {
-	struct tds_dstr *p = (struct tds_dstr *) malloc(length + TDS_OFFSET(struct tds_dstr, dstr_s) + 1);
-	if (TDS_UNLIKELY(!p))
-		return NULL;
-
-	if (*s != EMPTY)
-		free(*s);
-	p->dstr_s[0] = 0;
-	p->dstr_size = length;
-	*s = p;
+	char *p = NULL;
+
+	if (length >= TDS_DSTR_INLINE_SIZE) {
+		p = (char *) malloc(length + 1);
+		if (TDS_UNLIKELY(!p))
+			return NULL;
+		p[0] = 0;
+	}
+
+	free(s->dstr_heap);
+	s->dstr_heap = p;
+	s->dstr_inline[0] = 0;
+	s->dstr_size = length;
 	return s;
 }
 
@@ -0,0 +1,125 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test dynamic strings, both short (inline) and long ones.
+ */
+
+#include <freetds/utils/test_base.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <freetds/utils/string.h>
+
+static const char long_str[] = "a string long enough to not fit in the embedded buffer";
+
+#define CHECK(s, expected) do { \
+	assert(tds_dstr_len(s) == strlen(expected)); \
+	assert(strcmp(tds_dstr_cstr(s), expected) == 0); \
+} while(0)
+
+TEST_MAIN()
+{
+	DSTR s = DSTR_INITIALIZER, s2;
+	DSTR *res;
+	char *p;
+
+	assert(sizeof(long_str) > TDS_DSTR_INLINE_SIZE);
+
+	assert(tds_dstr_isempty(&s));
+	CHECK(&s, "");
+
+	/* short string, stored inline */
+	res = tds_dstr_copy(&s, "column");
+	assert(res);
+	CHECK(&s, "column");
+
+	/* long string */
+	res = tds_dstr_copy(&s, long_str);
+	assert(res);
+	CHECK(&s, long_str);
+
+	/* copy part of itself, back to a short string */
+	res = tds_dstr_copyn(&s, tds_dstr_cstr(&s) + 2, 6);
+	assert(res);
+	CHECK(&s, "string");
+
+	/* copy part of itself, inline */
+	res = tds_dstr_copyn(&s, tds_dstr_cstr(&s) + 3, 3);
+	assert(res);
+	CHECK(&s, "ing");
+
+	/* duplicate */
+	tds_dstr_init(&s2);
+	res = tds_dstr_dup(&s2, &s);
+	assert(res);
+	CHECK(&s2, "ing");
+	res = tds_dstr_copy(&s, long_str);
+	assert(res);
+	res = tds_dstr_dup(&s2, &s);
+	assert(res);
+	CHECK(&s2, long_str);
+	assert(tds_dstr_cstr(&s) != tds_dstr_cstr(&s2));
+	tds_dstr_free(&s2);
+	assert(tds_dstr_isempty(&s2));
+
+	/* allocate and fill buffer */
+	res = tds_dstr_alloc(&s, 10);
+	assert(res);
+	strcpy(tds_dstr_buf(&s), "test");
+	tds_dstr_setlen(&s, 4);
+	CHECK(&s, "test");
+
+	res = tds_dstr_alloc(&s, 100);
+	assert(res);
+	strcpy(tds_dstr_buf(&s), long_str);
+	tds_dstr_setlen(&s, strlen(long_str));
+	CHECK(&s, long_str);
+	tds_dstr_setlen(&s, 3);
+	CHECK(&s, "a s");
+
+	/* set from allocated buffers */
+	p = strdup("short");
+	assert(p);
+	res = tds_dstr_set(&s, p);
+	assert(res);
+	CHECK(&s, "short");
+	p = strdup(long_str);
+	assert(p);
+	res = tds_dstr_set(&s, p);
+	assert(res);
+	CHECK(&s, long_str);
+
+	/* empty string */
+	res = tds_dstr_copy(&s, "");
+	assert(res);
+	assert(tds_dstr_isempty(&s));
+	CHECK(&s, "");
+
+	tds_dstr_zero(&s);
+	tds_dstr_free(&s);
+	assert(tds_dstr_isempty(&s));
+	return 0;
+}
@@ -0,0 +1,112 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test hash code.
+ */
+
+#include <freetds/utils/test_base.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <freetds/utils/hash.h>
+
+typedef struct
+{
+	int n;
+	TDS_HASH_ENTRY entry;
+} test_item;
+
+#define NUM_ITEMS 1000
+
+static test_item items[NUM_ITEMS];
+
+static test_item *
+lookup(TDS_HASH *hash, int n)
+{
+	TDS_HASH_ENTRY *entry;
+
+	TDS_HASH_FOREACH(hash, tds_hash_uint(n), entry) {
+		test_item *item = TDS_HASH_ITEM(entry, test_item, entry);
+
+		if (item->n == n)
+			return item;
+	}
+	return NULL;
+}
+
+TEST_MAIN()
+{
+	TDS_HASH hash[1];
+	int i;
+
+	tds_hash_init(hash);
+	memset(items, 0, sizeof(items));
+
+	assert(lookup(hash, 0) == NULL);
+
+	/* insert all items, table must grow */
+	for (i = 0; i < NUM_ITEMS; ++i) {
+		items[i].n = i * 7;
+		assert(!tds_hash_linked(&items[i].entry));
+		tds_hash_insert(hash, &items[i].entry, tds_hash_uint(items[i].n));
+		assert(tds_hash_linked(&items[i].entry));
+	}
+	assert(hash->count == NUM_ITEMS);
+	assert(hash->buckets != NULL);
+
+	for (i = 0; i < NUM_ITEMS; ++i) {
+		assert(lookup(hash, i * 7) == &items[i]);
+		assert(i % 7 == 0 || lookup(hash, i) == NULL);
+	}
+
+	/* remove odd items */
+	for (i = 1; i < NUM_ITEMS; i += 2) {
+		tds_hash_remove(hash, &items[i].entry);
+		assert(!tds_hash_linked(&items[i].entry));
+		/* removing twice is harmless */
+		tds_hash_remove(hash, &items[i].entry);
+	}
+	assert(hash->count == NUM_ITEMS / 2);
+
+	for (i = 0; i < NUM_ITEMS; ++i)
+		assert(lookup(hash, i * 7) == ((i & 1) ? NULL : &items[i]));
+
+	/* items with same hash value */
+	tds_hash_insert(hash, &items[1].entry, items[2].entry.value);
+	assert(tds_hash_first(hash, items[2].entry.value) != NULL);
+	assert(lookup(hash, items[2].n) == &items[2]);
+
+	for (i = 0; i < NUM_ITEMS; ++i)
+		tds_hash_remove(hash, &items[i].entry);
+	assert(hash->count == 0);
+	tds_hash_free(hash);
+
+	/* string hashes */
+	assert(tds_hash_bytes("test", 4) == tds_hash_bytes("test", 4));
+	assert(tds_hash_bytes("test", 4) != tds_hash_bytes("tesT", 4));
+	assert(tds_hash_bytes_ci("test", 4) == tds_hash_bytes_ci("tesT", 4));
+	assert(tds_hash_bytes_ci("test", 4) == tds_hash_bytes("test", 4));
+	return 0;
+}